@@ -0,0 +1,676 @@
+/**
+ * compression ratio, speed and memory of every codec and level over a set
+ * of files, for picking the codec per file type and catching regressions.
+ * every measurement runs in a forked child so one codec's peak memory
+ * can't hide the next one's
+ */
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sys/wait.h>
+
+#include "audio_files.hpp"
+#include "file_types.hpp"
+#include "bytecrush.h"
+#include "comms/link_codec.h"
+#include "comms/packet.h"
+
+
+/* @brief one input file and what its content was detected as */
+typedef struct {
+  std::string path;
+  std::vector<uint8_t> data;
+  file_info_t info;
+} bench_file_t;
+
+/* @brief result of one codec at one level on one file */
+typedef struct {
+  int ok;                 // round trip matched the input
+  uint64_t packed;        // compressed size in bytes
+  double compress_mbps;   // fastest compression run
+  double decompress_mbps; // fastest decompression run
+  long peak_kib;          // memory the codec used, -1 if unknown
+} bench_result_t;
+
+/* @brief a codec under test */
+typedef struct {
+  const char *name;
+  int has_levels; // takes BYTECRUSH_LEVEL_MIN to BYTECRUSH_LEVEL_MAX
+  int (*supports)(const bench_file_t *file);
+  size_t (*bound)(size_t size);
+  int (*compress)(const bench_file_t *file,
+                  int level,
+                  int threads,
+                  uint8_t *out,
+                  size_t *out_size);
+  int (*decompress)(const uint8_t *in,
+                    size_t in_size,
+                    uint8_t *out,
+                    size_t out_size,
+                    int threads);
+} bench_codec_t;
+
+typedef enum {
+  BENCH_FORMAT_TABLE = 0,
+  BENCH_FORMAT_CSV,
+  BENCH_FORMAT_JSON,
+} bench_format_e;
+
+typedef struct {
+  bench_format_e format;
+  int threads;
+  double min_time; // seconds each direction is repeated for
+  std::vector<int> levels;
+  FILE *out;
+} bench_options_t;
+
+/******************************** codecs **************************************/
+static int bench_any(const bench_file_t *) {
+  return 1;
+}
+
+static int bench_lz_compress(const bench_file_t *file,
+                             int level,
+                             int threads,
+                             uint8_t *out,
+                             size_t *out_size) {
+  return bytecrush_compress_parallel(file->data.data(),
+                                     file->data.size(),
+                                     NULL,
+                                     out,
+                                     out_size,
+                                     level,
+                                     threads);
+}
+
+static int bench_bytecrush_decompress(const uint8_t *in,
+                                      size_t in_size,
+                                      uint8_t *out,
+                                      size_t out_size,
+                                      int threads) {
+  size_t size = out_size;
+  if (bytecrush_decompress_parallel(in, in_size, out, &size, threads) != 0) {
+    return -1;
+  }
+  return (size == out_size) ? 0 : -1;
+}
+
+/** @brief the sample layouts the audio coder takes, same as the upload path */
+static int bench_audio_supports(const bench_file_t *file) {
+  const wav_format_t &wav = file->info.wav;
+  return file->info.type == DIST_FS_TYPE_WAV &&
+         wav.audio_format == DIST_FS_WAV_PCM && wav.num_channels >= 1 &&
+         wav.num_channels <= 8 &&
+         (wav.bits_per_sample == 8 || wav.bits_per_sample == 16 ||
+          wav.bits_per_sample == 24);
+}
+
+static int bench_audio_compress(const bench_file_t *file,
+                                int level,
+                                int threads,
+                                uint8_t *out,
+                                size_t *out_size) {
+  bytecrush_audio_format_t audio = {};
+  audio.channels                 = file->info.wav.num_channels;
+  audio.bits_per_sample          = file->info.wav.bits_per_sample;
+  audio.data_offset              = file->info.wav.data_offset;
+  audio.data_size                = file->info.wav.data_size;
+  return bytecrush_compress_parallel(file->data.data(),
+                                     file->data.size(),
+                                     &audio,
+                                     out,
+                                     out_size,
+                                     level,
+                                     threads);
+}
+
+/*
+ * the link codec compresses one transfer chunk at a time. each chunk is
+ * written as a 16 bit payload size, standing in for the frame header, then
+ * the payload the transport would send: the codec id and compressed bytes,
+ * or the raw chunk when compressing didn't make it smaller
+ */
+static size_t bench_link_bound(size_t size) {
+  size_t chunks = (size + DIST_FS_CHUNK_SIZE - 1) / DIST_FS_CHUNK_SIZE;
+  return size + chunks * 2;
+}
+
+static int bench_link_compress(const bench_file_t *file,
+                               int,
+                               int,
+                               uint8_t *out,
+                               size_t *out_size) {
+  const link_codec_t *codec = link_codec_find(LINK_CODEC_LZ);
+  const uint8_t *src        = file->data.data();
+  size_t size               = file->data.size();
+  size_t op                 = 0;
+  for (size_t in = 0; in < size; in += DIST_FS_CHUNK_SIZE) {
+    uint32_t n = (uint32_t)std::min<size_t>(size - in, DIST_FS_CHUNK_SIZE);
+    uint8_t *payload = out + op + 2;
+    uint32_t packed  = 0;
+    if (n >= LINK_CODEC_MIN_SIZE) {
+      packed = codec->compress(src + in, n, payload + 1, n - 2);
+    }
+    if (packed > 0) {
+      payload[0] = LINK_CODEC_LZ;
+      packed++;
+    } else {
+      memcpy(payload, src + in, n);
+      packed = n;
+    }
+    out[op]     = (uint8_t)packed;
+    out[op + 1] = (uint8_t)(packed >> 8);
+    op += 2 + packed;
+  }
+  *out_size = op;
+  return 0;
+}
+
+static int bench_link_decompress(const uint8_t *in,
+                                 size_t in_size,
+                                 uint8_t *out,
+                                 size_t out_size,
+                                 int) {
+  const link_codec_t *codec = link_codec_find(LINK_CODEC_LZ);
+  size_t ip                 = 0;
+  for (size_t op = 0; op < out_size; op += DIST_FS_CHUNK_SIZE) {
+    uint32_t n = (uint32_t)std::min<size_t>(out_size - op, DIST_FS_CHUNK_SIZE);
+    if (in_size - ip < 2) {
+      return -1;
+    }
+    uint32_t packed = in[ip] | ((uint32_t)in[ip + 1] << 8);
+    ip += 2;
+    if (packed > in_size - ip) {
+      return -1;
+    }
+    if (packed == n) {
+      memcpy(out + op, in + ip, n);
+    } else if (packed < 1 || in[ip] != LINK_CODEC_LZ ||
+               codec->decompress(in + ip + 1, packed - 1, out + op, n) !=
+                 (int)n) {
+      return -1;
+    }
+    ip += packed;
+  }
+  return (ip == in_size) ? 0 : -1;
+}
+
+static const bench_codec_t bench_codecs[] = {
+  {"lz",
+   1,
+   bench_any,
+   bytecrush_compress_bound,
+   bench_lz_compress,
+   bench_bytecrush_decompress},
+  {"audio",
+   1,
+   bench_audio_supports,
+   bytecrush_compress_bound,
+   bench_audio_compress,
+   bench_bytecrush_decompress},
+  {"link-lz",
+   0,
+   bench_any,
+   bench_link_bound,
+   bench_link_compress,
+   bench_link_decompress},
+};
+
+/****************************** measurement ***********************************/
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/** @brief a size field of /proc/self/status in KiB, -1 if it can't be read */
+static long proc_status_kib(const char *field) {
+  FILE *status = fopen("/proc/self/status", "r");
+  if (!status) {
+    return -1;
+  }
+  char line[256];
+  long kib      = -1;
+  size_t length = strlen(field);
+  while (fgets(line, sizeof(line), status)) {
+    if (strncmp(line, field, length) == 0) {
+      kib = strtol(line + length, NULL, 10);
+      break;
+    }
+  }
+  fclose(status);
+  return kib;
+}
+
+/** @brief reset the peak resident size (VmHWM) to the current one */
+static int reset_peak_rss(void) {
+  FILE *refs = fopen("/proc/self/clear_refs", "w");
+  if (!refs) {
+    return -1;
+  }
+  int rc = (fputs("5", refs) < 0) ? -1 : 0;
+  if (fclose(refs) != 0) {
+    rc = -1;
+  }
+  return rc;
+}
+
+/**
+ * @brief run one codec at one level, in the child. each direction is
+ * repeated until it has run for min_time and the fastest run is kept
+ */
+static void bench_child(const bench_file_t *file,
+                        const bench_codec_t *codec,
+                        int level,
+                        const bench_options_t *opt,
+                        bench_result_t *res) {
+  size_t size = file->data.size();
+  std::vector<uint8_t> packed(codec->bound(size));
+  std::vector<uint8_t> decoded(size);
+
+  // the buffers are touched up front so only the codec's own allocations
+  // show up in the peak
+  memset(packed.data(), 0, packed.size());
+  memset(decoded.data(), 0, decoded.size());
+  long base = (reset_peak_rss() == 0) ? proc_status_kib("VmRSS:") : -1;
+
+  double best  = 0.0;
+  double spent = 0.0;
+  size_t out   = 0;
+  do {
+    out          = packed.size();
+    double start = now_seconds();
+    if (codec->compress(file, level, opt->threads, packed.data(), &out) !=
+        0) {
+      return;
+    }
+    double t = now_seconds() - start;
+    best     = (best == 0.0 || t < best) ? t : best;
+    spent += t;
+  } while (spent < opt->min_time);
+  res->packed        = out;
+  res->compress_mbps = (double)size / best / 1e6;
+
+  best  = 0.0;
+  spent = 0.0;
+  do {
+    double start = now_seconds();
+    if (codec->decompress(
+          packed.data(), out, decoded.data(), size, opt->threads) != 0) {
+      return;
+    }
+    double t = now_seconds() - start;
+    best     = (best == 0.0 || t < best) ? t : best;
+    spent += t;
+  } while (spent < opt->min_time);
+  res->decompress_mbps = (double)size / best / 1e6;
+
+  long peak     = proc_status_kib("VmHWM:");
+  res->peak_kib = (base >= 0 && peak >= base) ? peak - base : -1;
+  res->ok       = (decoded == file->data);
+}
+
+/** @brief run one codec at one level in a forked child */
+static int bench_measure(const bench_file_t *file,
+                         const bench_codec_t *codec,
+                         int level,
+                         const bench_options_t *opt,
+                         bench_result_t *res) {
+  *res = {};
+  int fds[2];
+  if (pipe(fds) != 0) {
+    fprintf(stderr, "pipe failed: %s\n", strerror(errno));
+    return -1;
+  }
+
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "fork failed: %s\n", strerror(errno));
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    bench_result_t child = {};
+    bench_child(file, codec, level, opt, &child);
+    ssize_t written = write(fds[1], &child, sizeof(child));
+    _exit(written == (ssize_t)sizeof(child) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  size_t got = 0;
+  while (got < sizeof(*res)) {
+    ssize_t n = read(fds[0], (char *)res + got, sizeof(*res) - got);
+    if (n <= 0) {
+      break;
+    }
+    got += (size_t)n;
+  }
+  close(fds[0]);
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (got != sizeof(*res) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    *res = {};
+    return -1;
+  }
+  return 0;
+}
+
+/******************************** output **************************************/
+static void bench_header(const bench_options_t *opt) {
+  switch (opt->format) {
+    case BENCH_FORMAT_TABLE:
+      fprintf(opt->out,
+              "%-44s %-5s %10s %-8s %5s %10s %7s %10s %10s %9s\n",
+              "file",
+              "type",
+              "size",
+              "codec",
+              "level",
+              "packed",
+              "ratio",
+              "comp MB/s",
+              "dec MB/s",
+              "peak KiB");
+      break;
+
+    case BENCH_FORMAT_CSV:
+      fprintf(opt->out,
+              "file,type,size,codec,level,threads,packed,ratio,"
+              "compress_mbps,decompress_mbps,peak_kib,ok\n");
+      break;
+
+    case BENCH_FORMAT_JSON:
+      break;
+  }
+}
+
+static void bench_row(const bench_options_t *opt,
+                      const bench_file_t *file,
+                      const bench_codec_t *codec,
+                      int level,
+                      const bench_result_t *res) {
+  const char *type = file_type_name(file->info.type);
+  size_t size      = file->data.size();
+  double ratio     = res->packed ? (double)size / (double)res->packed : 0.0;
+
+  switch (opt->format) {
+    case BENCH_FORMAT_TABLE:
+      if (!res->ok) {
+        fprintf(opt->out,
+                "%-44s %-5s %10zu %-8s %5d %10s\n",
+                file->path.c_str(),
+                type,
+                size,
+                codec->name,
+                level,
+                "FAILED");
+        break;
+      }
+      fprintf(opt->out,
+              "%-44s %-5s %10zu %-8s %5d %10lu %7.3f %10.1f %10.1f %9ld\n",
+              file->path.c_str(),
+              type,
+              size,
+              codec->name,
+              level,
+              (unsigned long)res->packed,
+              ratio,
+              res->compress_mbps,
+              res->decompress_mbps,
+              res->peak_kib);
+      break;
+
+    case BENCH_FORMAT_CSV:
+      fprintf(opt->out,
+              "%s,%s,%zu,%s,%d,%d,%lu,%.4f,%.2f,%.2f,%ld,%d\n",
+              file->path.c_str(),
+              type,
+              size,
+              codec->name,
+              level,
+              opt->threads,
+              (unsigned long)res->packed,
+              ratio,
+              res->compress_mbps,
+              res->decompress_mbps,
+              res->peak_kib,
+              res->ok);
+      break;
+
+    case BENCH_FORMAT_JSON:
+      // one object per line, paths in the corpus need no escaping
+      fprintf(opt->out,
+              "{\"file\":\"%s\",\"type\":\"%s\",\"size\":%zu,"
+              "\"codec\":\"%s\",\"level\":%d,\"threads\":%d,"
+              "\"packed\":%lu,\"ratio\":%.4f,\"compress_mbps\":%.2f,"
+              "\"decompress_mbps\":%.2f,\"peak_kib\":%ld,\"ok\":%s}\n",
+              file->path.c_str(),
+              type,
+              size,
+              codec->name,
+              level,
+              opt->threads,
+              (unsigned long)res->packed,
+              ratio,
+              res->compress_mbps,
+              res->decompress_mbps,
+              res->peak_kib,
+              res->ok ? "true" : "false");
+      break;
+  }
+  fflush(opt->out);
+}
+
+/********************************* input **************************************/
+/** @brief read a file and detect its type, returns -1 if it can't be read */
+static int bench_load(const std::string &path, bench_file_t *file) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) {
+    fprintf(stderr, "can't open %s: %s\n", path.c_str(), strerror(errno));
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  file->path = path;
+  file->data.resize(size > 0 ? (size_t)size : 0);
+  size_t got = fread(file->data.data(), 1, file->data.size(), fp);
+  fclose(fp);
+  if (got != file->data.size()) {
+    fprintf(stderr, "short read on %s\n", path.c_str());
+    return -1;
+  }
+
+  // get_file_info() takes the basename of a writable copy of the path.
+  // anything it can't identify is benchmarked as plain data
+  std::string name = path;
+  file->info       = {};
+  if (get_file_info(file->info, name.data()) == DIST_FS_TYPE_FAILURE) {
+    file->info.type = DIST_FS_TYPE_DATA;
+  }
+  file->info.name = NULL;
+  return 0;
+}
+
+/** @brief expand the arguments into a sorted list of regular files */
+static std::vector<std::string> bench_paths(int argc, char *argv[]) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < argc; i++) {
+    std::error_code ec;
+    if (std::filesystem::is_directory(argv[i], ec)) {
+      for (const auto &entry :
+           std::filesystem::recursive_directory_iterator(argv[i], ec)) {
+        if (entry.is_regular_file()) {
+          paths.push_back(entry.path().string());
+        }
+      }
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+/** @brief parse a comma separated list of levels */
+static int parse_levels(const char *arg, std::vector<int> &levels) {
+  levels.clear();
+  const char *p = arg;
+  while (*p) {
+    char *end;
+    long level = strtol(p, &end, 10);
+    if (end == p || level < BYTECRUSH_LEVEL_MIN ||
+        level > BYTECRUSH_LEVEL_MAX) {
+      return -1;
+    }
+    levels.push_back((int)level);
+    p = (*end == ',') ? end + 1 : end;
+    if (*end && *end != ',') {
+      return -1;
+    }
+  }
+  return levels.empty() ? -1 : 0;
+}
+
+static void print_usage(const char *program_name) {
+  printf("Usage: %s [OPTIONS] <file or directory>...\n", program_name);
+  printf("Options:\n");
+  printf("  -f <table|csv|json>  Output format, default table\n");
+  printf("  -o <file>            Write the results to a file instead of "
+         "stdout\n");
+  printf("  -l <levels>          Comma separated levels to run, default all\n");
+  printf("  -t <threads>         Threads for the bytecrush codecs, 0 for one "
+         "per core. default 1\n");
+  printf("  -m <ms>              Repeat each run for at least this long, "
+         "default 200\n");
+  printf("  -h                   Print usage of %s\n", program_name);
+  printf("\nExamples:\n");
+  printf("  %s ../test_files\n", program_name);
+  printf("  %s -f json -o bench.json -l 1,6,9 ../test_files/wavs\n",
+         program_name);
+}
+
+int main(int argc, char *argv[]) {
+  bench_options_t opt = {};
+  opt.format          = BENCH_FORMAT_TABLE;
+  opt.threads         = 1;
+  opt.min_time        = 0.2;
+  opt.out             = stdout;
+  // a fixed threshold keeps large buffers in their own mappings, so memory
+  // freed by an earlier file can't soak up the next codec's peak
+  mallopt(M_MMAP_THRESHOLD, 64 * 1024);
+  mallopt(M_TRIM_THRESHOLD, 64 * 1024);
+  for (int level = BYTECRUSH_LEVEL_MIN; level <= BYTECRUSH_LEVEL_MAX;
+       level++) {
+    opt.levels.push_back(level);
+  }
+
+  const char *out_path = NULL;
+  int option;
+  while ((option = getopt(argc, argv, "f:o:l:t:m:h")) != -1) {
+    switch (option) {
+      case 'f':
+        if (strcmp(optarg, "table") == 0) {
+          opt.format = BENCH_FORMAT_TABLE;
+        } else if (strcmp(optarg, "csv") == 0) {
+          opt.format = BENCH_FORMAT_CSV;
+        } else if (strcmp(optarg, "json") == 0) {
+          opt.format = BENCH_FORMAT_JSON;
+        } else {
+          fprintf(stderr, "Unknown format: %s\n", optarg);
+          return -1;
+        }
+        break;
+
+      case 'o':
+        out_path = optarg;
+        break;
+
+      case 'l':
+        if (parse_levels(optarg, opt.levels) != 0) {
+          fprintf(stderr, "Invalid levels: %s\n", optarg);
+          return -1;
+        }
+        break;
+
+      case 't':
+        opt.threads = atoi(optarg);
+        break;
+
+      case 'm':
+        opt.min_time = atof(optarg) / 1000.0;
+        break;
+
+      case 'h':
+        print_usage(argv[0]);
+        return 0;
+
+      default:
+        print_usage(argv[0]);
+        return -1;
+    }
+  }
+
+  std::vector<std::string> paths = bench_paths(argc - optind, argv + optind);
+  if (paths.empty()) {
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  if (out_path) {
+    opt.out = fopen(out_path, "w");
+    if (!opt.out) {
+      fprintf(stderr, "can't open %s: %s\n", out_path, strerror(errno));
+      return -1;
+    }
+  }
+
+  int rc = 0;
+  bench_header(&opt);
+  for (const std::string &path : paths) {
+    bench_file_t file;
+    if (bench_load(path, &file) != 0) {
+      rc = -1;
+      continue;
+    }
+    if (file.data.empty()) {
+      continue;
+    }
+
+    for (const bench_codec_t &codec : bench_codecs) {
+      if (!codec.supports(&file)) {
+        continue;
+      }
+      std::vector<int> levels = codec.has_levels ? opt.levels
+                                                 : std::vector<int>{0};
+      for (int level : levels) {
+        bench_result_t res;
+        if (bench_measure(&file, &codec, level, &opt, &res) != 0 ||
+            !res.ok) {
+          rc = -1;
+        }
+        bench_row(&opt, &file, &codec, level, &res);
+      }
+    }
+  }
+
+  if (opt.out != stdout) {
+    fclose(opt.out);
+  }
+  return rc;
+}
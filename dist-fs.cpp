@@ -19,6 +19,7 @@
 #include "dist-fs/config.hpp"
 #include "dist-fs/audio_files.hpp"
 #include "dist-fs/storage.hpp"
+#include "dist-fs/metrics.hpp"
 
 
 static void print_usage(const char *program_name) {
@@ -30,14 +31,19 @@ static void print_usage(const char *program_name) {
     "  -d, --download <file>    Download the specified file from the SSD\n");
   printf("  -D, --delete <file>      Delete the specified file from the SSD\n");
   printf("  -l, --list               List all files on the SSD\n");
+  printf("  -s, --search <text>      List the files whose name contains the "
+         "text\n");
   printf("  -S, --ssd_echo <pattern> Perform an echo test on the SSD with a "
          "specified hex pattern (up to 16 bytes)\n");
   printf("  -r, --reset <offset> <size> Reset a section of the SSD starting at "
          "the specified offset with the given size\n");
+  printf("  -m, --metrics            Print the latencies and counters of the "
+         "other options once they ran\n");
   printf("\nExamples:\n");
   printf("  %s --upload example.wav\n", program_name);
   printf("  %s --ssd_echo ABABABAB\n", program_name);
   printf("  %s --reset 1024 512\n", program_name);
+  printf("  %s --upload example.wav --metrics\n", program_name);
   printf("\nNote: <file> must be specified for upload, download, and delete "
          "operations.\n");
 }
@@ -71,6 +77,7 @@ int main(int argc, char *argv[]) {
   uint8_t ssd_pattern[DIST_FS_SSD_PATTERN_SZ] = {0};
   off_t reset_offset                          = 0;
   size_t reset_size                           = 0;
+  bool print_metrics                          = false;
 
   // set a default name for config
   const char *config_file     = "../client.conf";
@@ -88,7 +95,7 @@ int main(int argc, char *argv[]) {
   }
 
   // parse command line options
-  while ((option = getopt(argc, argv, "u:d:D:lS:r:h")) != -1) {
+  while ((option = getopt(argc, argv, "u:d:D:ls:S:r:mh")) != -1) {
     switch (option) {
       case 'u': // --upload
         if (optarg == NULL) {
@@ -127,6 +134,10 @@ int main(int argc, char *argv[]) {
         list_files(config_ctx);
         break;
 
+      case 's': // --search
+        rc = search_files(config_ctx, optarg);
+        break;
+
       case 'S': // --ssd_echo
         if (optarg == NULL) {
           LOG(ERR, "Option -S requires a hex pattern argument.");
@@ -170,6 +181,10 @@ int main(int argc, char *argv[]) {
         ssd_reset(reset_offset, reset_size);
         break;
 
+      case 'm': // --metrics
+        print_metrics = true;
+        break;
+
       case 'h': // --help
         print_usage(argv[0]);
         break;
@@ -188,6 +203,13 @@ int main(int argc, char *argv[]) {
     goto cleanup;
   }
 
+  // after every other option, so the metrics cover what they did
+  if (print_metrics) {
+    std::string text;
+    metrics_expose(text);
+    fputs(text.c_str(), stdout);
+  }
+
 cleanup:
   config_cleanup(&config_ctx);
   return rc;
@@ -1,31 +1,27 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 #include <ctime>
+#include <sys/stat.h>
 
 /** some definitions related to the wav file format */
 #define DIST_FS_TYPE_SZ   4
 #define DIST_FS_ID_HEADER 16
 
+/* bytes read from the head of a file to identify it when it isn't already
+ * in memory, enough for the chunk headers in front of a WAV file's data */
+#define DIST_FS_SNIFF_SIZE 65536
 
-/* defines for WAV files */
-#define DIST_FS_RIFF 0x52494646 // ASCII: (RIFF)
-#define DIST_FS_WAVE 0x57415645 // ASCII: (WAVE)
-#define DIST_FS_FMT  0x666d7420 // ASCII: (fmt )
 
-/* defines for FLAC files */
-#define DIST_FS_FLAC 0x664C6143 // ASCII: (fLaC)
-
-/* defines for MP3 files */
-#define DIST_FS_MP3 0x49443304 // ASCII: (ID3 )
-
-/* defines for AIFF files */
-#define DIST_FS_AIFF 0x464f524d // ASCII: (FORM)
-
-/* defines for M4A files */
-#define DIST_FS_M4A_HEADER 0x0000001c
-#define DIST_FS_M4A        0x4d344120 // ASCII: (M4A )
+/* defines for WAV files, the signatures of every type are in
+ * file_types.cpp */
+/* "RIFF", size (4), "WAVE" */
+#define DIST_FS_RIFF_HEADER 12
 
+/* format tags of the WAV fmt chunk */
+#define DIST_FS_WAV_PCM        0x0001
+#define DIST_FS_WAV_EXTENSIBLE 0xFFFE
 
 /** @brief enumeration of error codes */
 typedef enum {
@@ -41,8 +37,29 @@ typedef enum {
   DIST_FS_TYPE_AIFF = 2,
   DIST_FS_TYPE_M4A  = 3,
   DIST_FS_TYPE_MP3  = 4,
-  // DIST_FS_TYPE_FOLDER = 5,
-  /*add more files here*/
+  DIST_FS_TYPE_DATA = 5, // not a recognized format, stored as a blob
+  // DIST_FS_TYPE_FOLDER = 6,
+  DIST_FS_TYPE_OGG   = 7,
+  DIST_FS_TYPE_AAC   = 8,
+  DIST_FS_TYPE_MIDI  = 9,
+  DIST_FS_TYPE_MP4   = 10, // ISO media that isn't M4A audio
+  DIST_FS_TYPE_PNG   = 11,
+  DIST_FS_TYPE_JPEG  = 12,
+  DIST_FS_TYPE_GIF   = 13,
+  DIST_FS_TYPE_BMP   = 14,
+  DIST_FS_TYPE_TIFF  = 15,
+  DIST_FS_TYPE_WEBP  = 16,
+  DIST_FS_TYPE_ZIP   = 17,
+  DIST_FS_TYPE_GZIP  = 18,
+  DIST_FS_TYPE_BZIP2 = 19,
+  DIST_FS_TYPE_XZ    = 20,
+  DIST_FS_TYPE_ZSTD  = 21,
+  DIST_FS_TYPE_7Z    = 22,
+  DIST_FS_TYPE_TAR   = 23,
+  DIST_FS_TYPE_PDF   = 24,
+  DIST_FS_TYPE_JSON  = 25,
+  DIST_FS_TYPE_TEXT  = 26,
+  /*add more files here, values are stored on the SSD so only append*/
   DIST_FS_END,
   DIST_FS_NUM_TYPES = DIST_FS_END - 1,
 } dist_fs_file_types_e;
@@ -65,6 +82,18 @@ typedef struct {
 } dist_fs_wav_t;
 
 
+/** @brief PCM layout read from a WAV file's fmt and data chunks */
+typedef struct {
+  uint16_t audio_format;    /* format tag, subformat for extensible */
+  uint16_t num_channels;    /* number of channels                   */
+  uint32_t sample_rate;     /* sample rate in hz                    */
+  uint16_t block_align;     /* bytes per sample frame               */
+  uint16_t bits_per_sample; /* number of bits in a sample           */
+  uint64_t data_offset;     /* file offset of the sample data       */
+  uint64_t data_size;       /* bytes of sample data                 */
+} wav_format_t;
+
+
 /** @brief Structure for file timestamps */
 typedef struct {
   std::time_t last_modified; /**< File last modified*/
@@ -80,6 +109,44 @@ typedef struct {
   dist_fs_file_types_e type; // file type
   off_t offset;              // file offset in the drive
   std::time_t timestamp;     // file timestamp
+  wav_format_t wav;          // sample layout, WAV files only
 } file_info_t;
 
+/**
+ * @brief Identifies a file by reading the head of it
+ * @param file_info Filled in with the file's name, size, time and type
+ * @param filename Path of the file
+ * @return Returns 0 for a known format, DIST_FS_TYPE_UNKNOWN for data, or
+ * DIST_FS_TYPE_FAILURE if the file couldn't be read
+ */
 int get_file_info(file_info_t &file_info, const char *filename);
+
+/**
+ * @brief Identifies a file from bytes already read, so callers that read
+ * the file anyway don't open or seek it again
+ * @param file_info Filled in with the file's name, size, time and type
+ * @param filename Path of the file
+ * @param file_stat fstat() of the file, for its size and time
+ * @param data Head of the file, or all of it
+ * @param size Bytes in data
+ * @return Same as get_file_info()
+ */
+int get_buffer_info(file_info_t &file_info,
+                    const char *filename,
+                    const struct stat &file_stat,
+                    const uint8_t *data,
+                    size_t size);
+
+/**
+ * @brief Reads the PCM layout out of a WAV header in memory. chunks past the
+ * end of the buffer are not looked at
+ * @param data Head of the file
+ * @param size Bytes in data
+ * @param file_size Size of the whole file, the data chunk is clipped to it
+ * @param fmt Layout found
+ * @return Returns 0 on success, -1 if this isn't a WAV file
+ */
+int get_wav_format(const uint8_t *data,
+                   size_t size,
+                   uint64_t file_size,
+                   wav_format_t &fmt);
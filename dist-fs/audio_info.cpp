@@ -0,0 +1,589 @@
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
+#include <string>
+
+#include "audio_info.hpp"
+#include "utils.hpp"
+
+
+/********************************* helpers ************************************/
+static uint16_t be16(const uint8_t *p) {
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t be24(const uint8_t *p) {
+  return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static uint32_t be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t be64(const uint8_t *p) {
+  return ((uint64_t)be32(p) << 32) | be32(p + 4);
+}
+
+static uint16_t le16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** @brief ID3 sizes keep the top bit of every byte clear */
+static uint32_t syncsafe32(const uint8_t *p) {
+  return (p[0] << 21) | (p[1] << 14) | (p[2] << 7) | p[3];
+}
+
+static uint32_t to_ms(uint64_t units, uint64_t per_second) {
+  if (per_second == 0) {
+    return 0;
+  }
+  return (uint32_t)std::min<uint64_t>(units * 1000 / per_second, UINT32_MAX);
+}
+
+/** @brief bits per second of a number of bytes that play for ms */
+static uint32_t to_bitrate(uint64_t bytes, uint32_t ms) {
+  return to_ms(bytes * 8, ms);
+}
+
+/** @brief appends a code point as UTF-8 if it fits whole */
+static void utf8_put(char *dst, size_t cap, size_t &len, uint32_t cp) {
+  uint8_t out[4];
+  size_t n = 0;
+  if (cp < 0x80) {
+    out[n++] = (uint8_t)cp;
+  } else if (cp < 0x800) {
+    out[n++] = (uint8_t)(0xc0 | (cp >> 6));
+    out[n++] = (uint8_t)(0x80 | (cp & 0x3f));
+  } else if (cp < 0x10000) {
+    out[n++] = (uint8_t)(0xe0 | (cp >> 12));
+    out[n++] = (uint8_t)(0x80 | ((cp >> 6) & 0x3f));
+    out[n++] = (uint8_t)(0x80 | (cp & 0x3f));
+  } else {
+    out[n++] = (uint8_t)(0xf0 | (cp >> 18));
+    out[n++] = (uint8_t)(0x80 | ((cp >> 12) & 0x3f));
+    out[n++] = (uint8_t)(0x80 | ((cp >> 6) & 0x3f));
+    out[n++] = (uint8_t)(0x80 | (cp & 0x3f));
+  }
+  if (len + n < cap) {
+    memcpy(dst + len, out, n);
+    len += n;
+    dst[len] = '\0';
+  }
+}
+
+/**
+ * @brief copies a UTF-8 or ASCII tag, cut short on a character boundary and
+ * without trailing NULs or spaces
+ */
+static void tag_copy(char *dst, const uint8_t *src, size_t len) {
+  len = std::min(len, strnlen(reinterpret_cast<const char *>(src), len));
+  if (len >= AUDIO_INFO_TAG_LEN) {
+    len = AUDIO_INFO_TAG_LEN - 1;
+    while (len > 0 && (src[len] & 0xc0) == 0x80) {
+      len--;
+    }
+  }
+  while (len > 0 && src[len - 1] == ' ') {
+    len--;
+  }
+  memcpy(dst, src, len);
+  dst[len] = '\0';
+}
+
+static uint16_t bpm_round(double bpm) {
+  return (bpm > 0 && bpm < 65536) ? (uint16_t)lround(bpm) : 0;
+}
+
+static uint16_t tag_bpm(const char *text) {
+  return bpm_round(strtod(text, NULL));
+}
+
+/*********************************** WAV **************************************/
+/** @brief INAM, IART and IPRD out of a LIST INFO chunk */
+static void wav_list_info(const uint8_t *body, size_t len, audio_info_t *info) {
+  size_t pos = 4;
+  while (pos + 8 <= len) {
+    const uint8_t *id = body + pos;
+    uint32_t size     = le32(body + pos + 4);
+    size_t text       = std::min<size_t>(size, len - pos - 8);
+
+    if (memcmp(id, "INAM", 4) == 0) {
+      tag_copy(info->title, body + pos + 8, text);
+    } else if (memcmp(id, "IART", 4) == 0) {
+      tag_copy(info->artist, body + pos + 8, text);
+    } else if (memcmp(id, "IPRD", 4) == 0) {
+      tag_copy(info->album, body + pos + 8, text);
+    }
+    pos += 8 + (uint64_t)size + (size & 1);
+  }
+}
+
+static int parse_wav(const uint8_t *data,
+                     size_t size,
+                     uint64_t file_size,
+                     audio_info_t *info) {
+  wav_format_t fmt;
+  if (get_wav_format(data, size, file_size, fmt) || fmt.sample_rate == 0) {
+    return -1;
+  }
+  info->sample_rate     = fmt.sample_rate;
+  info->channels        = fmt.num_channels;
+  info->bits_per_sample = fmt.bits_per_sample;
+  info->bitrate         = fmt.sample_rate * fmt.block_align * 8;
+  info->duration_ms =
+    to_ms(fmt.data_size, (uint64_t)fmt.sample_rate * fmt.block_align);
+
+  // the tags and the loop tempo sit in chunks of their own
+  uint64_t pos = DIST_FS_RIFF_HEADER;
+  while (pos + 8 <= size) {
+    const uint8_t *id = data + pos;
+    uint32_t len      = le32(data + pos + 4);
+    size_t body       = std::min<uint64_t>(len, size - pos - 8);
+
+    if (memcmp(id, "LIST", 4) == 0 && body >= 4 &&
+        memcmp(data + pos + 8, "INFO", 4) == 0) {
+      wav_list_info(data + pos + 8, body, info);
+    } else if (memcmp(id, "acid", 4) == 0 && body >= 24) {
+      float tempo;
+      memcpy(&tempo, data + pos + 8 + 20, sizeof(tempo));
+      info->bpm = bpm_round(tempo);
+    }
+    pos += 8 + (uint64_t)len + (len & 1);
+  }
+  return 0;
+}
+
+/*********************************** FLAC *************************************/
+/** @brief TITLE, ARTIST, ALBUM and BPM out of a VORBIS_COMMENT block */
+static void flac_vorbis_comment(const uint8_t *body,
+                                size_t len,
+                                audio_info_t *info) {
+  if (len < 8) {
+    return;
+  }
+  uint64_t pos = 4 + (uint64_t)le32(body);
+  if (pos + 4 > len) {
+    return;
+  }
+  uint32_t count = le32(body + pos);
+  pos += 4;
+
+  for (uint32_t i = 0; i < count && pos + 4 <= len; i++) {
+    uint32_t size = le32(body + pos);
+    pos += 4;
+    if (pos + size > len) {
+      break;
+    }
+
+    // comments are KEY=value, keys are case insensitive
+    const char *comment = reinterpret_cast<const char *>(body + pos);
+    const void *eq      = memchr(comment, '=', size);
+    pos += size;
+    if (!eq) {
+      continue;
+    }
+    std::string key(comment, static_cast<const char *>(eq) - comment);
+    const uint8_t *value = static_cast<const uint8_t *>(eq) + 1;
+    size_t value_len     = size - key.size() - 1;
+
+    if (strcasecmp(key.c_str(), "TITLE") == 0) {
+      tag_copy(info->title, value, value_len);
+    } else if (strcasecmp(key.c_str(), "ARTIST") == 0) {
+      tag_copy(info->artist, value, value_len);
+    } else if (strcasecmp(key.c_str(), "ALBUM") == 0) {
+      tag_copy(info->album, value, value_len);
+    } else if (strcasecmp(key.c_str(), "BPM") == 0) {
+      char text[AUDIO_INFO_TAG_LEN];
+      tag_copy(text, value, value_len);
+      info->bpm = tag_bpm(text);
+    }
+  }
+}
+
+static int parse_flac(const uint8_t *data,
+                      size_t size,
+                      uint64_t file_size,
+                      audio_info_t *info) {
+  uint64_t pos = 4;
+  bool last    = false;
+  while (!last && pos + 4 <= size) {
+    last                 = data[pos] & 0x80;
+    uint8_t type         = data[pos] & 0x7f;
+    uint32_t len         = be24(data + pos + 1);
+    const uint8_t *block = data + pos + 4;
+    size_t avail         = std::min<uint64_t>(len, size - pos - 4);
+
+    if (type == 0 && avail >= 18) {
+      // STREAMINFO packs rate, channels, sample size and the sample count
+      // into bit fields after the block and frame size limits
+      info->sample_rate     = be24(block + 10) >> 4;
+      info->channels        = ((block[12] >> 1) & 7) + 1;
+      info->bits_per_sample =
+        (uint16_t)((((block[12] & 1) << 4) | (block[13] >> 4)) + 1);
+      uint64_t samples =
+        ((uint64_t)(block[13] & 0x0f) << 32) | be32(block + 14);
+      info->duration_ms = to_ms(samples, info->sample_rate);
+    } else if (type == 4) {
+      flac_vorbis_comment(block, avail, info);
+    }
+    pos += 4 + (uint64_t)len;
+  }
+
+  if (info->sample_rate == 0) {
+    return -1;
+  }
+  if (info->duration_ms) {
+    info->bitrate = to_bitrate(file_size, info->duration_ms);
+  }
+  return 0;
+}
+
+/*********************************** AIFF *************************************/
+/** @brief the 80 bit extended float AIFF keeps its sample rate in */
+static uint32_t aiff_rate(const uint8_t *p) {
+  int exponent      = (be16(p) & 0x7fff) - 16383;
+  uint64_t mantissa = be64(p + 2);
+  if (exponent < 0 || exponent > 31) {
+    return 0;
+  }
+  return (uint32_t)(mantissa >> (63 - exponent));
+}
+
+static int parse_aiff(const uint8_t *data,
+                      size_t size,
+                      uint64_t file_size,
+                      audio_info_t *info) {
+  uint32_t frames = 0;
+  uint64_t pos    = 12;
+  while (pos + 8 <= size) {
+    const uint8_t *id    = data + pos;
+    uint32_t len         = be32(data + pos + 4);
+    const uint8_t *chunk = data + pos + 8;
+    size_t avail         = std::min<uint64_t>(len, size - pos - 8);
+
+    if (memcmp(id, "COMM", 4) == 0 && avail >= 18) {
+      info->channels        = be16(chunk);
+      frames                = be32(chunk + 2);
+      info->bits_per_sample = be16(chunk + 6);
+      info->sample_rate     = aiff_rate(chunk + 8);
+    } else if (memcmp(id, "NAME", 4) == 0) {
+      tag_copy(info->title, chunk, avail);
+    } else if (memcmp(id, "AUTH", 4) == 0) {
+      tag_copy(info->artist, chunk, avail);
+    }
+    pos += 8 + (uint64_t)len + (len & 1);
+  }
+
+  if (info->sample_rate == 0) {
+    return -1;
+  }
+  info->duration_ms = to_ms(frames, info->sample_rate);
+  if (info->duration_ms) {
+    info->bitrate = to_bitrate(file_size, info->duration_ms);
+  }
+  return 0;
+}
+
+/*********************************** MP3 **************************************/
+/** @brief an ID3 text frame, converted from its encoding to UTF-8 */
+static void id3_text(char *dst, const uint8_t *frame, size_t len) {
+  dst[0]  = '\0';
+  size_t n = 0;
+  if (len < 1) {
+    return;
+  }
+  uint8_t encoding = frame[0];
+  frame++;
+  len--;
+
+  if (encoding == 0) { // ISO-8859-1
+    for (size_t i = 0; i < len && frame[i]; i++) {
+      utf8_put(dst, AUDIO_INFO_TAG_LEN, n, frame[i]);
+    }
+  } else if (encoding == 3) { // UTF-8
+    tag_copy(dst, frame, len);
+  } else { // UTF-16, with a byte order mark unless it's 2
+    bool big_endian = encoding == 2;
+    size_t i        = 0;
+    if (encoding == 1 && len >= 2) {
+      big_endian = frame[0] == 0xfe && frame[1] == 0xff;
+      i          = 2;
+    }
+    for (; i + 1 < len; i += 2) {
+      uint16_t unit = big_endian ? be16(frame + i) : le16(frame + i);
+      if (unit == 0) {
+        break;
+      }
+      // surrogate pairs are rare in tags, they come out as '?'
+      bool surrogate = unit >= 0xd800 && unit <= 0xdfff;
+      utf8_put(dst, AUDIO_INFO_TAG_LEN, n, surrogate ? '?' : unit);
+    }
+  }
+}
+
+/**
+ * @brief reads the text frames of an ID3v2 tag
+ * @return Returns the size of the whole tag
+ */
+static uint64_t mp3_id3v2(const uint8_t *data,
+                          size_t size,
+                          audio_info_t *info,
+                          uint32_t *tlen_ms) {
+  uint8_t version  = data[3];
+  uint8_t flags    = data[5];
+  uint64_t tag_end = 10 + (uint64_t)syncsafe32(data + 6);
+  uint64_t tag     = tag_end + ((flags & 0x10) ? 10 : 0);
+  uint64_t end     = std::min<uint64_t>(tag_end, size);
+
+  uint64_t pos = 10;
+  if ((flags & 0x40) && pos + 4 <= end) {
+    // v2.4 counts the extended header itself in its size, v2.3 doesn't
+    pos += version >= 4 ? syncsafe32(data + pos) : be32(data + pos) + 4;
+  }
+
+  size_t id_len = version == 2 ? 3 : 4;
+  size_t header = version == 2 ? 6 : 10;
+  while (pos + header <= end && data[pos] != 0) {
+    const uint8_t *id = data + pos;
+    uint32_t len      = version == 2   ? be24(id + 3)
+                        : version >= 4 ? syncsafe32(id + 4)
+                                       : be32(id + 4);
+    const uint8_t *body = id + header;
+    size_t avail        = std::min<uint64_t>(len, end - pos - header);
+
+    auto id_is = [&](const char *v2, const char *v3) {
+      return memcmp(id, id_len == 3 ? v2 : v3, id_len) == 0;
+    };
+    if (id_is("TT2", "TIT2")) {
+      id3_text(info->title, body, avail);
+    } else if (id_is("TP1", "TPE1")) {
+      id3_text(info->artist, body, avail);
+    } else if (id_is("TAL", "TALB")) {
+      id3_text(info->album, body, avail);
+    } else if (id_is("TBP", "TBPM")) {
+      char text[AUDIO_INFO_TAG_LEN];
+      id3_text(text, body, avail);
+      info->bpm = tag_bpm(text);
+    } else if (id_is("TLE", "TLEN")) {
+      char text[AUDIO_INFO_TAG_LEN];
+      id3_text(text, body, avail);
+      *tlen_ms = (uint32_t)std::min<unsigned long>(strtoul(text, NULL, 10),
+                                                   UINT32_MAX);
+    }
+    pos += header + (uint64_t)len;
+  }
+  return tag;
+}
+
+/** @brief kbit/s of MPEG-1 and MPEG-2 layer III frames, by bitrate index */
+static const uint16_t mp3_bitrates[2][15] = {
+  {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+  {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+};
+
+static const uint32_t mp3_rates[3] = {44100, 48000, 32000};
+
+static int parse_mp3(const uint8_t *data,
+                     size_t size,
+                     uint64_t file_size,
+                     audio_info_t *info) {
+  uint32_t tlen_ms = 0;
+  uint64_t pos     = 0;
+  if (size >= 10 && memcmp(data, "ID3", 3) == 0) {
+    pos = mp3_id3v2(data, size, info, &tlen_ms);
+  }
+
+  // the first layer III frame header after the tag
+  uint64_t scan_end = std::min<uint64_t>(size, pos + 65536);
+  for (; pos + 4 <= scan_end; pos++) {
+    const uint8_t *h = data + pos;
+    if (h[0] != 0xff || (h[1] & 0xe6) != 0xe2 || ((h[1] >> 3) & 3) == 1 ||
+        (h[2] >> 4) == 0 || (h[2] >> 4) == 15 || ((h[2] >> 2) & 3) == 3) {
+      continue;
+    }
+
+    int version        = (h[1] >> 3) & 3; // 3 MPEG-1, 2 MPEG-2, 0 MPEG-2.5
+    bool mpeg1         = version == 3;
+    bool mono          = (h[3] >> 6) == 3;
+    uint32_t kbps      = mp3_bitrates[mpeg1 ? 0 : 1][h[2] >> 4];
+    uint32_t frame_len = mpeg1 ? 1152 : 576;
+
+    // MPEG-2 halves the MPEG-1 rates, MPEG-2.5 quarters them
+    info->sample_rate = mp3_rates[(h[2] >> 2) & 3] >> (3 - version + 1) / 2;
+    info->channels    = mono ? 1 : 2;
+    info->bitrate     = kbps * 1000;
+
+    // VBR encoders leave a Xing or Info header with the frame count in the
+    // first frame, after the side info
+    size_t side          = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+    const uint8_t *xing  = h + 4 + side;
+    uint64_t audio_bytes = file_size > pos ? file_size - pos : 0;
+    if (pos + 4 + side + 12 <= size &&
+        (memcmp(xing, "Xing", 4) == 0 || memcmp(xing, "Info", 4) == 0) &&
+        (be32(xing + 4) & 1)) {
+      uint64_t frames   = be32(xing + 8);
+      info->duration_ms = to_ms(frames * frame_len, info->sample_rate);
+    } else if (pos + 4 + 32 + 18 <= size &&
+               memcmp(h + 4 + 32, "VBRI", 4) == 0) {
+      uint64_t frames   = be32(h + 4 + 32 + 14);
+      info->duration_ms = to_ms(frames * frame_len, info->sample_rate);
+    } else if (tlen_ms) {
+      info->duration_ms = tlen_ms;
+    } else {
+      info->duration_ms = to_ms(audio_bytes * 8, info->bitrate);
+    }
+    if (info->duration_ms) {
+      info->bitrate = to_bitrate(audio_bytes, info->duration_ms);
+    }
+    return 0;
+  }
+
+  return -1;
+}
+
+/*********************************** M4A **************************************/
+/** @brief the payload of the data atom inside an ilst item */
+static void m4a_item(const uint8_t *item,
+                     size_t len,
+                     char *text,
+                     uint16_t *number) {
+  if (len < 16 || memcmp(item + 4, "data", 4) != 0) {
+    return;
+  }
+  size_t data_len = std::min<size_t>(be32(item), len);
+  if (data_len < 16) {
+    return;
+  }
+  if (text) {
+    tag_copy(text, item + 16, data_len - 16);
+  } else if (data_len >= 18) {
+    *number = be16(item + 16);
+  }
+}
+
+static void m4a_walk(const uint8_t *data,
+                     size_t size,
+                     int depth,
+                     audio_info_t *info) {
+  uint64_t pos = 0;
+  while (pos + 8 <= size && depth < 8) {
+    uint64_t len  = be32(data + pos);
+    size_t header = 8;
+    if (len == 1 && pos + 16 <= size) {
+      len    = be64(data + pos + 8);
+      header = 16;
+    } else if (len == 0) {
+      len = size - pos;
+    }
+    if (len < header) {
+      return;
+    }
+    const uint8_t *type = data + pos + 4;
+    const uint8_t *body = data + pos + header;
+    size_t avail        = std::min<uint64_t>(len, size - pos) - header;
+
+    auto type_is = [&](const char *name) { return memcmp(type, name, 4) == 0; };
+    if (type_is("moov") || type_is("trak") || type_is("mdia") ||
+        type_is("minf") || type_is("stbl") || type_is("udta") ||
+        type_is("ilst")) {
+      m4a_walk(body, avail, depth + 1, info);
+    } else if (type_is("meta") && avail >= 4) {
+      // a full box, version and flags come before the children
+      m4a_walk(body + 4, avail - 4, depth + 1, info);
+    } else if (type_is("stsd") && avail >= 8) {
+      m4a_walk(body + 8, avail - 8, depth + 1, info);
+    } else if ((type_is("mp4a") || type_is("alac")) && avail >= 28 &&
+               info->sample_rate == 0) {
+      // audio sample entry, the first audio track wins
+      info->channels        = be16(body + 16);
+      info->bits_per_sample = type_is("alac") ? be16(body + 18) : 0;
+      info->sample_rate     = be32(body + 24) >> 16;
+    } else if (type_is("mvhd") && avail >= 20) {
+      bool v1            = body[0] == 1;
+      uint32_t timescale = be32(body + (v1 ? 20 : 12));
+      uint64_t duration  = v1 ? (avail >= 32 ? be64(body + 24) : 0)
+                              : be32(body + 16);
+      info->duration_ms  = to_ms(duration, timescale);
+    } else if (type_is("\xa9nam")) {
+      m4a_item(body, avail, info->title, NULL);
+    } else if (type_is("\xa9" "ART")) {
+      m4a_item(body, avail, info->artist, NULL);
+    } else if (type_is("\xa9" "alb")) {
+      m4a_item(body, avail, info->album, NULL);
+    } else if (type_is("tmpo")) {
+      m4a_item(body, avail, NULL, &info->bpm);
+    }
+
+    // a box reaching past the buffer is the last one in it, and a 64 bit
+    // size that large would wrap pos back to a box already walked
+    if (len >= size - pos) {
+      return;
+    }
+    pos += len;
+  }
+}
+
+static int parse_m4a(const uint8_t *data,
+                     size_t size,
+                     uint64_t file_size,
+                     audio_info_t *info) {
+  m4a_walk(data, size, 0, info);
+  if (info->duration_ms == 0 && info->sample_rate == 0) {
+    return -1;
+  }
+  if (info->duration_ms) {
+    info->bitrate = to_bitrate(file_size, info->duration_ms);
+  }
+  return 0;
+}
+
+int audio_info_parse(dist_fs_file_types_e type,
+                     const uint8_t *data,
+                     size_t size,
+                     uint64_t file_size,
+                     audio_info_t *info) {
+  memset(info, 0, sizeof(*info));
+
+  int rc = -1;
+  switch (type) {
+    case DIST_FS_TYPE_WAV:
+      rc = parse_wav(data, size, file_size, info);
+      break;
+    case DIST_FS_TYPE_FLAC:
+      rc = parse_flac(data, size, file_size, info);
+      break;
+    case DIST_FS_TYPE_AIFF:
+      rc = parse_aiff(data, size, file_size, info);
+      break;
+    case DIST_FS_TYPE_MP3:
+      rc = parse_mp3(data, size, file_size, info);
+      break;
+    case DIST_FS_TYPE_M4A:
+      rc = parse_m4a(data, size, file_size, info);
+      break;
+    default:
+      return -1;
+  }
+
+  if (rc != 0) {
+    LOG(WARN, "Couldn't read the audio headers of a %d file", type);
+    memset(info, 0, sizeof(*info));
+    return -1;
+  }
+  LOG(INFO,
+      "Audio: %u ms, %u Hz, %u channels, %u bits, %u bit/s, %u bpm",
+      info->duration_ms,
+      info->sample_rate,
+      info->channels,
+      info->bits_per_sample,
+      info->bitrate,
+      info->bpm);
+  return 0;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file audio_info.hpp
+ * @brief Reads play time, sample format and tags out of audio file headers
+ * at upload, so listings can show and sort by them without opening the
+ * file's data on the SSD
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "audio_files.hpp"
+
+/** @brief Bytes kept of each text tag, including the terminating NUL */
+#define AUDIO_INFO_TAG_LEN 48
+
+/**
+ * @struct audio_info_t
+ * @brief What is known about an audio file's contents, all zero for other
+ * files. kept in the file's metadata entry
+ */
+typedef struct {
+  uint32_t duration_ms;            /**< Play time, 0 if unknown */
+  uint32_t sample_rate;            /**< Samples per second per channel */
+  uint32_t bitrate;                /**< Average bits per second */
+  uint16_t channels;               /**< Number of channels */
+  uint16_t bits_per_sample;        /**< Sample size, 0 for lossy formats */
+  uint16_t bpm;                    /**< Tempo from the tags, 0 if untagged */
+  char title[AUDIO_INFO_TAG_LEN];  /**< UTF-8 title tag */
+  char artist[AUDIO_INFO_TAG_LEN]; /**< UTF-8 artist tag */
+  char album[AUDIO_INFO_TAG_LEN];  /**< UTF-8 album tag */
+} audio_info_t;
+
+/**
+ * @brief Fills in an audio info record from a file's bytes. parses WAV fmt,
+ * LIST INFO and acid chunks, FLAC STREAMINFO and VORBIS_COMMENT blocks, AIFF
+ * COMM, NAME and AUTH chunks, MP3 ID3v2 tags and frame headers, and M4A
+ * mvhd, stsd and ilst atoms
+ * @param type Type of the file
+ * @param data Head of the file, or all of it. headers past the end of the
+ * buffer are not read
+ * @param size Bytes in data
+ * @param file_size Size of the whole file
+ * @param info Filled in with what the headers hold, zeroed first
+ * @return Returns 0 if the file's format was read, or -1 if it isn't audio
+ * or the headers are broken
+ */
+int audio_info_parse(dist_fs_file_types_e type,
+                     const uint8_t *data,
+                     size_t size,
+                     uint64_t file_size,
+                     audio_info_t *info);
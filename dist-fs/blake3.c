@@ -0,0 +1,455 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "blake3.h"
+
+
+/* domain separation flags */
+#define B3_CHUNK_START 1
+#define B3_CHUNK_END   2
+#define B3_PARENT      4
+#define B3_ROOT        8
+
+static const uint32_t b3_iv[8] = {0x6A09E667,
+                                  0xBB67AE85,
+                                  0x3C6EF372,
+                                  0xA54FF53A,
+                                  0x510E527F,
+                                  0x9B05688C,
+                                  0x1F83D9AB,
+                                  0x5BE0CD19};
+
+static const uint8_t b3_msg_permutation[16] =
+  {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+
+/******************************* byte helpers *********************************/
+static inline uint32_t load_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static inline void store_le32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t rotr32(uint32_t w, uint32_t c) {
+  return (w >> c) | (w << (32 - c));
+}
+
+/****************************** compression ***********************************/
+static inline void b3_g(uint32_t *s,
+                        int a,
+                        int b,
+                        int c,
+                        int d,
+                        uint32_t mx,
+                        uint32_t my) {
+  s[a] = s[a] + s[b] + mx;
+  s[d] = rotr32(s[d] ^ s[a], 16);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 12);
+  s[a] = s[a] + s[b] + my;
+  s[d] = rotr32(s[d] ^ s[a], 8);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 7);
+}
+
+static inline void b3_round(uint32_t *s, const uint32_t *m) {
+  // columns
+  b3_g(s, 0, 4, 8, 12, m[0], m[1]);
+  b3_g(s, 1, 5, 9, 13, m[2], m[3]);
+  b3_g(s, 2, 6, 10, 14, m[4], m[5]);
+  b3_g(s, 3, 7, 11, 15, m[6], m[7]);
+  // diagonals
+  b3_g(s, 0, 5, 10, 15, m[8], m[9]);
+  b3_g(s, 1, 6, 11, 12, m[10], m[11]);
+  b3_g(s, 2, 7, 8, 13, m[12], m[13]);
+  b3_g(s, 3, 4, 9, 14, m[14], m[15]);
+}
+
+/** @brief the full 16 word compression output for one block */
+static void b3_compress(const uint32_t cv[8],
+                        const uint8_t block[BLAKE3_BLOCK_LEN],
+                        uint8_t block_len,
+                        uint64_t counter,
+                        uint8_t flags,
+                        uint32_t out[16]) {
+  uint32_t m[16];
+  for (int i = 0; i < 16; i++) {
+    m[i] = load_le32(block + 4 * i);
+  }
+
+  uint32_t s[16] = {cv[0],
+                    cv[1],
+                    cv[2],
+                    cv[3],
+                    cv[4],
+                    cv[5],
+                    cv[6],
+                    cv[7],
+                    b3_iv[0],
+                    b3_iv[1],
+                    b3_iv[2],
+                    b3_iv[3],
+                    (uint32_t)counter,
+                    (uint32_t)(counter >> 32),
+                    block_len,
+                    flags};
+
+  for (int r = 0; r < 7; r++) {
+    b3_round(s, m);
+    if (r == 6) {
+      break;
+    }
+    uint32_t permuted[16];
+    for (int i = 0; i < 16; i++) {
+      permuted[i] = m[b3_msg_permutation[i]];
+    }
+    memcpy(m, permuted, sizeof(m));
+  }
+
+  for (int i = 0; i < 8; i++) {
+    out[i]     = s[i] ^ s[i + 8];
+    out[i + 8] = s[i + 8] ^ cv[i];
+  }
+}
+
+/** @brief compress a block and keep the new chaining value in place */
+static void b3_compress_in_place(uint32_t cv[8],
+                                 const uint8_t block[BLAKE3_BLOCK_LEN],
+                                 uint8_t block_len,
+                                 uint64_t counter,
+                                 uint8_t flags) {
+  uint32_t out[16];
+  b3_compress(cv, block, block_len, counter, flags, out);
+  memcpy(cv, out, 8 * sizeof(uint32_t));
+}
+
+/*
+ * the last block of a node isn't compressed until it's known whether the
+ * node is the root, so chunks and parents both end up as one of these
+ */
+typedef struct {
+  uint32_t cv[8];
+  uint8_t block[BLAKE3_BLOCK_LEN];
+  uint8_t block_len;
+  uint64_t counter;
+  uint8_t flags;
+} b3_output_t;
+
+static void b3_output_cv(const b3_output_t *o, uint8_t out[BLAKE3_OUT_LEN]) {
+  uint32_t cv[8];
+  memcpy(cv, o->cv, sizeof(cv));
+  b3_compress_in_place(cv, o->block, o->block_len, o->counter, o->flags);
+  for (int i = 0; i < 8; i++) {
+    store_le32(out + 4 * i, cv[i]);
+  }
+}
+
+static void b3_output_root(const b3_output_t *o, uint8_t out[BLAKE3_OUT_LEN]) {
+  // a 32 byte digest only ever needs the first output block
+  uint32_t words[16];
+  b3_compress(o->cv, o->block, o->block_len, 0, o->flags | B3_ROOT, words);
+  for (int i = 0; i < 8; i++) {
+    store_le32(out + 4 * i, words[i]);
+  }
+}
+
+static void b3_parent_output(const uint8_t left[BLAKE3_OUT_LEN],
+                             const uint8_t right[BLAKE3_OUT_LEN],
+                             const uint32_t key[8],
+                             b3_output_t *o) {
+  memcpy(o->cv, key, sizeof(o->cv));
+  memcpy(o->block, left, BLAKE3_OUT_LEN);
+  memcpy(o->block + BLAKE3_OUT_LEN, right, BLAKE3_OUT_LEN);
+  o->block_len = BLAKE3_BLOCK_LEN;
+  o->counter   = 0;
+  o->flags     = B3_PARENT;
+}
+
+/******************************** chunk state *********************************/
+static void b3_chunk_init(blake3_chunk_state_t *c,
+                          const uint32_t key[8],
+                          uint64_t chunk_counter) {
+  memcpy(c->cv, key, sizeof(c->cv));
+  c->chunk_counter     = chunk_counter;
+  c->buf_len           = 0;
+  c->blocks_compressed = 0;
+  c->flags             = 0;
+  memset(c->buf, 0, sizeof(c->buf));
+}
+
+static inline size_t b3_chunk_len(const blake3_chunk_state_t *c) {
+  return (size_t)c->blocks_compressed * BLAKE3_BLOCK_LEN + c->buf_len;
+}
+
+static inline uint8_t b3_chunk_start_flag(const blake3_chunk_state_t *c) {
+  return c->blocks_compressed == 0 ? B3_CHUNK_START : 0;
+}
+
+static void b3_chunk_update(blake3_chunk_state_t *c,
+                            const uint8_t *input,
+                            size_t input_len) {
+  while (input_len > 0) {
+    // a full buffer is only compressed once more input shows it isn't the
+    // chunk's last block
+    if (c->buf_len == BLAKE3_BLOCK_LEN) {
+      b3_compress_in_place(c->cv,
+                           c->buf,
+                           BLAKE3_BLOCK_LEN,
+                           c->chunk_counter,
+                           c->flags | b3_chunk_start_flag(c));
+      c->blocks_compressed++;
+      c->buf_len = 0;
+      memset(c->buf, 0, sizeof(c->buf));
+    }
+
+    size_t take = BLAKE3_BLOCK_LEN - c->buf_len;
+    if (take > input_len) {
+      take = input_len;
+    }
+    memcpy(c->buf + c->buf_len, input, take);
+    c->buf_len += (uint8_t)take;
+    input += take;
+    input_len -= take;
+  }
+}
+
+static void b3_chunk_output(const blake3_chunk_state_t *c, b3_output_t *o) {
+  memcpy(o->cv, c->cv, sizeof(o->cv));
+  memcpy(o->block, c->buf, sizeof(o->block));
+  o->block_len = c->buf_len;
+  o->counter   = c->chunk_counter;
+  o->flags     = c->flags | b3_chunk_start_flag(c) | B3_CHUNK_END;
+}
+
+/********************************** hasher ************************************/
+static void b3_push_cv(blake3_hasher_t *self, const uint8_t *cv) {
+  memcpy(self->cv_stack + (size_t)self->cv_stack_len * BLAKE3_OUT_LEN,
+         cv,
+         BLAKE3_OUT_LEN);
+  self->cv_stack_len++;
+}
+
+/*
+ * a finished chunk merges with the subtrees on the stack that are complete.
+ * total_chunks has one trailing zero bit for every such subtree
+ */
+static void b3_add_chunk_cv(blake3_hasher_t *self,
+                            uint8_t new_cv[BLAKE3_OUT_LEN],
+                            uint64_t total_chunks) {
+  while ((total_chunks & 1) == 0) {
+    self->cv_stack_len--;
+    b3_output_t parent;
+    b3_parent_output(self->cv_stack +
+                       (size_t)self->cv_stack_len * BLAKE3_OUT_LEN,
+                     new_cv,
+                     self->key,
+                     &parent);
+    b3_output_cv(&parent, new_cv);
+    total_chunks >>= 1;
+  }
+  b3_push_cv(self, new_cv);
+}
+
+void blake3_hasher_init(blake3_hasher_t *self) {
+  memcpy(self->key, b3_iv, sizeof(self->key));
+  b3_chunk_init(&self->chunk, self->key, 0);
+  self->cv_stack_len = 0;
+}
+
+void blake3_hasher_update(blake3_hasher_t *self,
+                          const void *input,
+                          size_t input_len) {
+  const uint8_t *in = (const uint8_t *)input;
+  while (input_len > 0) {
+    // same as blocks, a full chunk only goes into the tree once more input
+    // shows it isn't the root
+    if (b3_chunk_len(&self->chunk) == BLAKE3_CHUNK_LEN) {
+      b3_output_t chunk_out;
+      uint8_t chunk_cv[BLAKE3_OUT_LEN];
+      b3_chunk_output(&self->chunk, &chunk_out);
+      b3_output_cv(&chunk_out, chunk_cv);
+      uint64_t total_chunks = self->chunk.chunk_counter + 1;
+      b3_add_chunk_cv(self, chunk_cv, total_chunks);
+      b3_chunk_init(&self->chunk, self->key, total_chunks);
+    }
+
+    size_t take = BLAKE3_CHUNK_LEN - b3_chunk_len(&self->chunk);
+    if (take > input_len) {
+      take = input_len;
+    }
+    b3_chunk_update(&self->chunk, in, take);
+    in += take;
+    input_len -= take;
+  }
+}
+
+/** @brief fold the stack into the current chunk from the right */
+static void b3_hasher_output(const blake3_hasher_t *self, b3_output_t *output) {
+  b3_chunk_output(&self->chunk, output);
+
+  size_t remaining = self->cv_stack_len;
+  while (remaining > 0) {
+    remaining--;
+    uint8_t right_cv[BLAKE3_OUT_LEN];
+    b3_output_cv(output, right_cv);
+    b3_parent_output(self->cv_stack + remaining * BLAKE3_OUT_LEN,
+                     right_cv,
+                     self->key,
+                     output);
+  }
+}
+
+void blake3_hasher_finalize(const blake3_hasher_t *self, uint8_t *out) {
+  // the last merge is the root
+  b3_output_t output;
+  b3_hasher_output(self, &output);
+  b3_output_root(&output, out);
+}
+
+void blake3_hash(const void *input, size_t input_len, uint8_t *out) {
+  blake3_hasher_t hasher;
+  blake3_hasher_init(&hasher);
+  blake3_hasher_update(&hasher, input, input_len);
+  blake3_hasher_finalize(&hasher, out);
+}
+
+/*************************** multithreaded hashing ****************************/
+/*
+ * the input is cut into pieces of a power of two chunks, aligned to the
+ * piece size. each piece is a complete subtree, so its chaining value only
+ * depends on its own bytes and position and the pieces can be hashed on
+ * different threads. the caller then pushes them onto the stack in order
+ * and hashes the last piece itself, since that one holds the root
+ */
+#define B3_MIN_PIECE_CHUNKS 64
+
+typedef struct {
+  const uint8_t *input;
+  size_t piece_len; // bytes per piece
+  size_t pieces;    // pieces hashed on the pool
+  size_t threads;   // workers, including the caller
+  size_t first;     // piece this worker starts at, then every threads'th
+  uint8_t *cvs;     // BLAKE3_OUT_LEN per piece
+} b3_job_t;
+
+/** @brief chaining value of a complete subtree that isn't the root */
+static void b3_subtree_cv(const uint8_t *input,
+                          size_t input_len,
+                          uint64_t chunk_counter,
+                          uint8_t out[BLAKE3_OUT_LEN]) {
+  blake3_hasher_t hasher;
+  blake3_hasher_init(&hasher);
+  b3_chunk_init(&hasher.chunk, hasher.key, chunk_counter);
+  blake3_hasher_update(&hasher, input, input_len);
+
+  b3_output_t output;
+  b3_hasher_output(&hasher, &output);
+  b3_output_cv(&output, out);
+}
+
+static void *b3_hash_worker(void *arg) {
+  const b3_job_t *job = (const b3_job_t *)arg;
+  uint64_t piece_chunks = job->piece_len / BLAKE3_CHUNK_LEN;
+  for (size_t i = job->first; i < job->pieces; i += job->threads) {
+    b3_subtree_cv(job->input + i * job->piece_len,
+                  job->piece_len,
+                  i * piece_chunks,
+                  job->cvs + i * BLAKE3_OUT_LEN);
+  }
+  return NULL;
+}
+
+void blake3_hash_parallel(const void *input,
+                          size_t input_len,
+                          uint8_t *out,
+                          int threads) {
+  const uint8_t *in = (const uint8_t *)input;
+  size_t nthreads   = threads;
+  if (threads == BLAKE3_THREADS_AUTO) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads    = online > 0 ? (size_t)online : 1;
+  }
+  if (nthreads > BLAKE3_MAX_THREADS) {
+    nthreads = BLAKE3_MAX_THREADS;
+  }
+
+  // a few pieces per thread so an uneven split doesn't leave threads idle
+  size_t chunks       = input_len / BLAKE3_CHUNK_LEN;
+  size_t piece_chunks = B3_MIN_PIECE_CHUNKS;
+  while (chunks / (piece_chunks * 2) >= nthreads * 4) {
+    piece_chunks *= 2;
+  }
+  size_t piece_len = piece_chunks * BLAKE3_CHUNK_LEN;
+
+  // only pieces with input after them, the last one stays with the caller
+  size_t pieces = input_len ? (input_len - 1) / piece_len : 0;
+  if (nthreads > pieces) {
+    nthreads = pieces;
+  }
+  if (nthreads < 2) {
+    blake3_hash(input, input_len, out);
+    return;
+  }
+
+  uint8_t cv_buf[BLAKE3_OUT_LEN * 256];
+  uint8_t *cvs = cv_buf;
+  if (pieces > sizeof(cv_buf) / BLAKE3_OUT_LEN) {
+    cvs = (uint8_t *)malloc(pieces * BLAKE3_OUT_LEN);
+    if (!cvs) {
+      blake3_hash(input, input_len, out);
+      return;
+    }
+  }
+
+  b3_job_t jobs[BLAKE3_MAX_THREADS];
+  pthread_t workers[BLAKE3_MAX_THREADS];
+  int started[BLAKE3_MAX_THREADS] = {0};
+  for (size_t t = 0; t < nthreads; t++) {
+    jobs[t].input     = in;
+    jobs[t].piece_len = piece_len;
+    jobs[t].pieces    = pieces;
+    jobs[t].threads   = nthreads;
+    jobs[t].first     = t;
+    jobs[t].cvs       = cvs;
+  }
+  // the caller takes the first share, and any share a thread couldn't be
+  // started for
+  for (size_t t = 1; t < nthreads; t++) {
+    started[t] =
+      pthread_create(&workers[t], NULL, b3_hash_worker, &jobs[t]) == 0;
+  }
+  b3_hash_worker(&jobs[0]);
+  for (size_t t = 1; t < nthreads; t++) {
+    if (started[t]) {
+      pthread_join(workers[t], NULL);
+    } else {
+      b3_hash_worker(&jobs[t]);
+    }
+  }
+
+  // every entry on the stack covers at least a piece, so pieces merge the
+  // same way single chunks do
+  blake3_hasher_t hasher;
+  blake3_hasher_init(&hasher);
+  for (size_t i = 0; i < pieces; i++) {
+    uint8_t cv[BLAKE3_OUT_LEN];
+    memcpy(cv, cvs + i * BLAKE3_OUT_LEN, BLAKE3_OUT_LEN);
+    b3_add_chunk_cv(&hasher, cv, i + 1);
+  }
+  b3_chunk_init(&hasher.chunk, hasher.key, (uint64_t)pieces * piece_chunks);
+  blake3_hasher_update(&hasher,
+                       in + pieces * piece_len,
+                       input_len - pieces * piece_len);
+  blake3_hasher_finalize(&hasher, out);
+
+  if (cvs != cv_buf) {
+    free(cvs);
+  }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*
+ * BLAKE3 hashing, the portable reference construction. inputs are split
+ * into 1 KiB chunks that are compressed on their own and merged pairwise
+ * into a binary tree, so the incremental hasher only keeps one chaining
+ * value per tree level
+ */
+#define BLAKE3_OUT_LEN   32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_MAX_DEPTH 54
+
+/* worker threads for blake3_hash_parallel(), AUTO uses one per online core */
+#define BLAKE3_THREADS_AUTO 0
+#define BLAKE3_MAX_THREADS  64
+
+/* @brief state for the 1 KiB chunk being hashed */
+typedef struct {
+  uint32_t cv[8];                // chaining value
+  uint64_t chunk_counter;        // index of the chunk in the input
+  uint8_t buf[BLAKE3_BLOCK_LEN]; // partial block
+  uint8_t buf_len;               // bytes in buf
+  uint8_t blocks_compressed;     // full blocks already compressed
+  uint8_t flags;                 // domain flags for every block
+} blake3_chunk_state_t;
+
+/* @brief incremental hasher, see blake3_hasher_init() */
+typedef struct {
+  uint32_t key[8];
+  blake3_chunk_state_t chunk;
+  uint8_t cv_stack_len;
+  uint8_t cv_stack[(BLAKE3_MAX_DEPTH + 1) * BLAKE3_OUT_LEN];
+} blake3_hasher_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief start a new hash
+ *
+ * @param[out] self  hasher to initialize
+ */
+void blake3_hasher_init(blake3_hasher_t *self);
+
+/**
+ * @brief hash more input, can be called any number of times
+ *
+ * @param[in/out] self       hasher
+ * @param[in]     input      data to hash
+ * @param[in]     input_len  size of the input in bytes
+ */
+void blake3_hasher_update(blake3_hasher_t *self,
+                          const void *input,
+                          size_t input_len);
+
+/**
+ * @brief write the hash of everything fed so far. the hasher is left as it
+ * was, so more input can still follow
+ *
+ * @param[in]  self  hasher
+ * @param[out] out   BLAKE3_OUT_LEN bytes
+ */
+void blake3_hasher_finalize(const blake3_hasher_t *self, uint8_t *out);
+
+/**
+ * @brief hash a buffer in one call
+ *
+ * @param[in]  input      data to hash
+ * @param[in]  input_len  size of the input in bytes
+ * @param[out] out        BLAKE3_OUT_LEN bytes
+ */
+void blake3_hash(const void *input, size_t input_len, uint8_t *out);
+
+/**
+ * @brief blake3_hash() with the subtrees of a large input hashed on a pool
+ * of threads. the hash is the same for any number of threads, inputs too
+ * small to split are hashed on the calling thread
+ *
+ * @param[in]  input      data to hash
+ * @param[in]  input_len  size of the input in bytes
+ * @param[out] out        BLAKE3_OUT_LEN bytes
+ * @param[in]  threads    threads to use, BLAKE3_THREADS_AUTO for one per core
+ */
+void blake3_hash_parallel(const void *input,
+                          size_t input_len,
+                          uint8_t *out,
+                          int threads);
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,76 +2,2455 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "bytecrush.h"
+#include "bytecrush_simd.h"
 
 
-int compress_text_lz77(const char *file_path);
-int compress_audio_flaclike(const char *file_path);
+/******************************************************************************/
+long get_file_size(const char *filename) {
+  struct stat st;
+  if (stat(filename, &st) == 0)
+    return st.st_size;
+  return -1;
+}
+
+/******************************* byte helpers *********************************/
+static inline uint32_t read_le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static inline void write_le32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint64_t read_le64(const uint8_t *p) {
+  return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+static inline void write_le64(uint8_t *p, uint64_t v) {
+  write_le32(p, (uint32_t)v);
+  write_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+/******************************** LZ77 codec **********************************/
+/*
+ * a block is a run of sequences. each sequence is a token byte (literal
+ * count in the high nibble, match length - BC_MIN_MATCH in the low nibble,
+ * 15 meaning 255 terminated extension bytes follow), the literals, and the
+ * match offset as a LEB128 varint. the final sequence has no match
+ */
+#define BC_MIN_MATCH 4
+#define BC_HASH_BITS 15
+#define BC_HASH_SIZE (1 << BC_HASH_BITS)
+
+/* @brief match finder effort for one compression level */
+typedef struct {
+  uint32_t chain_depth; // candidates visited per position
+  uint32_t nice_len;    // stop searching once a match is this long
+  int lazy;             // check whether the next position matches longer
+  int entropy;          // huffman code the sequences when it pays off
+} bc_level_t;
+
+static const bc_level_t bc_levels[BYTECRUSH_LEVEL_MAX + 1] = {
+  {0, 0, 0, 0}, // unused
+  {1, 16, 0, 0},
+  {4, 32, 0, 1},
+  {8, 64, 0, 1},
+  {16, 64, 1, 1},
+  {32, 128, 1, 1},
+  {64, 128, 1, 1},
+  {256, 258, 1, 1},
+  {1024, 1024, 1, 1},
+  {4096, 65535, 1, 1},
+};
+
+/* @brief hash chain match finder. head holds the most recent position for
+ * each hash and prev links every position to the previous one with the same
+ * hash, so older candidates are visited newest first */
+typedef struct {
+  int32_t head[BC_HASH_SIZE];
+  int32_t *prev;
+  uint32_t next_insert; // first position not yet in the chains
+} bc_matcher_t;
+
+static inline uint32_t bc_hash(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return (v * 2654435761u) >> (32 - BC_HASH_BITS);
+}
+
+/** @brief add every position before end to the hash chains */
+static void bc_insert_upto(bc_matcher_t *m,
+                           const uint8_t *base,
+                           uint32_t end,
+                           uint32_t size) {
+  // the last few bytes can't start a match
+  uint32_t limit = (size >= BC_MIN_MATCH) ? size - BC_MIN_MATCH + 1 : 0;
+  if (end > limit) {
+    end = limit;
+  }
+  for (uint32_t pos = m->next_insert; pos < end; pos++) {
+    uint32_t h   = bc_hash(base + pos);
+    m->prev[pos] = m->head[h];
+    m->head[h]   = (int32_t)pos;
+  }
+  if (end > m->next_insert) {
+    m->next_insert = end;
+  }
+}
+
+/** @brief longest earlier match for pos, returns its length or 0 */
+static uint32_t bc_find_match(const bc_matcher_t *m,
+                              const bc_level_t *lvl,
+                              const uint8_t *base,
+                              uint32_t pos,
+                              uint32_t size,
+                              uint32_t *offset) {
+  if (pos + BC_MIN_MATCH > size) {
+    return 0;
+  }
+
+  const uint8_t *cur = base + pos;
+  uint32_t max_len   = size - pos;
+  uint32_t best      = BC_MIN_MATCH - 1;
+  uint32_t depth     = lvl->chain_depth;
+  int32_t cand       = m->head[bc_hash(cur)];
+
+  while (cand >= 0 && depth-- > 0) {
+    const uint8_t *ref = base + cand;
+    // a longer match has to differ from the best one at its last byte
+    if (ref[best] == cur[best] && memcmp(ref, cur, BC_MIN_MATCH) == 0) {
+      uint32_t len = BC_MIN_MATCH;
+      while (len < max_len && ref[len] == cur[len]) {
+        len++;
+      }
+      if (len > best) {
+        best    = len;
+        *offset = pos - (uint32_t)cand;
+        if (len >= lvl->nice_len || len == max_len) {
+          break;
+        }
+      }
+    }
+    cand = m->prev[cand];
+  }
+
+  return (best >= BC_MIN_MATCH) ? best : 0;
+}
+
+/** @brief write a 255 terminated length extension */
+static uint8_t *bc_put_length(uint8_t *op, uint32_t len) {
+  for (; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+/** @brief append a sequence, returns the new output position or NULL */
+static uint8_t *bc_emit(uint8_t *op,
+                        uint8_t *oend,
+                        const uint8_t *literals,
+                        uint32_t lit_len,
+                        uint32_t offset,
+                        uint32_t match_len) {
+  // token, both length extensions, literals and a 5 byte varint at worst
+  size_t worst = 1 + lit_len / 255 + 1 + lit_len + 5 + match_len / 255 + 1;
+  if (worst > (size_t)(oend - op)) {
+    return NULL;
+  }
+
+  uint8_t *token = op++;
+  *token         = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+  if (lit_len >= 15) {
+    op = bc_put_length(op, lit_len - 15);
+  }
+  memcpy(op, literals, lit_len);
+  op += lit_len;
+
+  if (match_len == 0) {
+    return op;
+  }
+
+  for (; offset >= 0x80; offset >>= 7) {
+    *op++ = (uint8_t)(offset | 0x80);
+  }
+  *op++ = (uint8_t)offset;
+
+  uint32_t len = match_len - BC_MIN_MATCH;
+  *token |= (uint8_t)(len >= 15 ? 15 : len);
+  if (len >= 15) {
+    op = bc_put_length(op, len - 15);
+  }
+  return op;
+}
+
+/**
+ * @brief LZ77 compress one block
+ * @return compressed size, 0 if it didn't fit in dst_cap
+ */
+static size_t bc_lz77_compress_block(bc_matcher_t *m,
+                                     const bc_level_t *lvl,
+                                     const uint8_t *src,
+                                     uint32_t size,
+                                     uint8_t *dst,
+                                     size_t dst_cap) {
+  memset(m->head, 0xFF, sizeof(m->head));
+  m->next_insert = 0;
+
+  uint8_t *op     = dst;
+  uint8_t *oend   = dst + dst_cap;
+  uint32_t pos    = 0;
+  uint32_t anchor = 0;
+
+  while (pos + BC_MIN_MATCH <= size) {
+    uint32_t offset = 0;
+    uint32_t len    = bc_find_match(m, lvl, src, pos, size, &offset);
+    bc_insert_upto(m, src, pos + 1, size);
+    if (len == 0) {
+      pos++;
+      continue;
+    }
+
+    // lazy evaluation: if the next byte starts a longer match, emit this
+    // one as a literal instead
+    while (lvl->lazy && len < lvl->nice_len) {
+      uint32_t next_offset = 0;
+      uint32_t next_len =
+        bc_find_match(m, lvl, src, pos + 1, size, &next_offset);
+      if (next_len <= len) {
+        break;
+      }
+      pos++;
+      len    = next_len;
+      offset = next_offset;
+      bc_insert_upto(m, src, pos + 1, size);
+    }
+
+    op = bc_emit(op, oend, src + anchor, pos - anchor, offset, len);
+    if (!op) {
+      return 0;
+    }
+    pos += len;
+    anchor = pos;
+    bc_insert_upto(m, src, pos, size);
+  }
+
+  op = bc_emit(op, oend, src + anchor, size - anchor, 0, 0);
+  return op ? (size_t)(op - dst) : 0;
+}
+
+/** @brief read a 255 terminated length extension */
+static int bc_read_length(const uint8_t **ip,
+                          const uint8_t *iend,
+                          uint32_t *len) {
+  uint8_t b;
+  do {
+    if (*ip >= iend) {
+      return -1;
+    }
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return 0;
+}
+
+/**
+ * @brief decompress one LZ77 block into exactly raw_size bytes
+ * @return 0 on success, -1 on corrupt data
+ */
+static int bc_lz77_decompress_block(const uint8_t *src,
+                                    size_t src_size,
+                                    uint8_t *dst,
+                                    uint32_t raw_size) {
+  const uint8_t *ip   = src;
+  const uint8_t *iend = src + src_size;
+  uint8_t *op         = dst;
+  uint8_t *oend       = dst + raw_size;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    uint32_t lit_len = token >> 4;
+    if (lit_len == 15 && bc_read_length(&ip, iend, &lit_len) != 0) {
+      return -1;
+    }
+    if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op)) {
+      return -1;
+    }
+    memcpy(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+
+    if (ip == iend) {
+      break;
+    }
+
+    uint32_t offset = 0;
+    for (int shift = 0;; shift += 7) {
+      if (ip >= iend || shift > 28) {
+        return -1;
+      }
+      uint8_t b = *ip++;
+      offset |= (uint32_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        break;
+      }
+    }
+    if (offset == 0 || offset > (size_t)(op - dst)) {
+      return -1;
+    }
+
+    uint32_t match_len = token & 0x0F;
+    if (match_len == 15 && bc_read_length(&ip, iend, &match_len) != 0) {
+      return -1;
+    }
+    match_len += BC_MIN_MATCH;
+    if (match_len > (size_t)(oend - op)) {
+      return -1;
+    }
+
+    // matches may overlap their own output, copy forwards
+    const uint8_t *match = op - offset;
+    if (offset >= match_len) {
+      memcpy(op, match, match_len);
+    } else {
+      for (uint32_t i = 0; i < match_len; i++) {
+        op[i] = match[i];
+      }
+    }
+    op += match_len;
+  }
+
+  return (op == oend) ? 0 : -1;
+}
+
+/******************************** bit streams *********************************/
+/* @brief MSB first bit writer. running past the end of the buffer sets
+ * overflow instead of writing */
+typedef struct {
+  uint8_t *buf;
+  size_t cap;
+  size_t pos;
+  uint64_t acc;
+  uint32_t nbits;
+  int overflow;
+} bc_bitwriter_t;
+
+static inline void bw_put(bc_bitwriter_t *bw, uint32_t value, uint32_t n) {
+  bw->acc = (bw->acc << n) | (value & (((uint64_t)1 << n) - 1));
+  bw->nbits += n;
+  while (bw->nbits >= 8) {
+    bw->nbits -= 8;
+    if (bw->pos < bw->cap) {
+      bw->buf[bw->pos++] = (uint8_t)(bw->acc >> bw->nbits);
+    } else {
+      bw->overflow = 1;
+    }
+  }
+}
+
+/** @brief q zero bits, a one, then the k low bits of u */
+static inline void bw_put_rice(bc_bitwriter_t *bw, uint32_t u, uint32_t k) {
+  uint32_t q = u >> k;
+  // most codes fit in a single put
+  if (q + 1 + k <= 32) {
+    bw_put(bw, (1u << k) | (u & ((1u << k) - 1)), q + 1 + k);
+    return;
+  }
+  while (q >= 32) {
+    if (bw->overflow) {
+      return;
+    }
+    bw_put(bw, 0, 32);
+    q -= 32;
+  }
+  bw_put(bw, 1, q + 1);
+  bw_put(bw, u, k);
+}
+
+/** @brief pad to a byte boundary, returns bytes written */
+static size_t bw_flush(bc_bitwriter_t *bw) {
+  if (bw->nbits > 0) {
+    bw_put(bw, 0, 8 - bw->nbits);
+  }
+  return bw->pos;
+}
+
+/* @brief MSB first bit reader. reads past the end return zeros and are
+ * caught by bc_bitreader_ok() */
+typedef struct {
+  const uint8_t *buf;
+  size_t size;
+  size_t pos;
+  uint64_t acc; // next bits, left aligned
+  uint32_t nbits;
+  uint64_t consumed;
+} bc_bitreader_t;
+
+static inline void br_refill(bc_bitreader_t *br) {
+  while (br->nbits <= 56) {
+    uint64_t b = (br->pos < br->size) ? br->buf[br->pos] : 0;
+    br->pos++;
+    br->acc |= b << (56 - br->nbits);
+    br->nbits += 8;
+  }
+}
+
+static inline int bc_bitreader_ok(const bc_bitreader_t *br) {
+  return br->consumed <= (uint64_t)br->size * 8;
+}
+
+static inline uint32_t br_get(bc_bitreader_t *br, uint32_t n) {
+  if (n == 0) {
+    return 0;
+  }
+  br_refill(br);
+  uint32_t v = (uint32_t)(br->acc >> (64 - n));
+  br->acc <<= n;
+  br->nbits -= n;
+  br->consumed += n;
+  return v;
+}
+
+static inline int32_t br_get_signed(bc_bitreader_t *br, uint32_t n) {
+  uint32_t v = br_get(br, n);
+  // sign extend from n bits
+  return (int32_t)(v << (32 - n)) >> (32 - n);
+}
+
+/** @brief read a rice code, returns -1 past the end of the stream */
+static inline int br_get_rice(bc_bitreader_t *br, uint32_t k, uint32_t *u) {
+  uint32_t q = 0;
+  for (;;) {
+    br_refill(br);
+    if (br->acc != 0) {
+      break;
+    }
+    q += br->nbits;
+    br->consumed += br->nbits;
+    br->acc   = 0;
+    br->nbits = 0;
+    if (!bc_bitreader_ok(br) || q > (1u << 30)) {
+      return -1;
+    }
+  }
+  uint32_t zeros = (uint32_t)__builtin_clzll(br->acc);
+  q += zeros;
+  // two shifts, the stop bit can be the last bit of the accumulator
+  br->acc = (br->acc << zeros) << 1;
+  br->nbits -= zeros + 1;
+  br->consumed += zeros + 1;
+  if (q > (1u << 30) >> k) {
+    return -1;
+  }
+  *u = (q << k) | br_get(br, k);
+  return 0;
+}
+
+static inline int32_t unzigzag(uint32_t u) {
+  return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+/******************************* huffman coder ********************************/
+/*
+ * canonical huffman coding of a block's LZ77 sequences. text and JSON leave
+ * plenty of literals behind the match finder, and their skewed byte counts
+ * code well below 8 bits each. codes are at most BC_HUFF_MAX_BITS long, so
+ * one lookup on the next BC_HUFF_MAX_BITS bits of the stream decodes a
+ * symbol, or two when both codes fit.
+ *
+ * block payload: LZ77 size (4), the code length of every byte value (4 bits
+ * each, 0 if unused), then the codes MSB first
+ */
+#define BC_HUFF_SYMBOLS    256
+#define BC_HUFF_MAX_BITS   11
+#define BC_HUFF_TABLE_SIZE (1 << BC_HUFF_MAX_BITS)
+#define BC_HUFF_HEADER     (4 + BC_HUFF_SYMBOLS / 2)
+
+/* worst case LZ77 size of a block, one run of literals */
+#define BC_LZ77_BOUND(raw) ((size_t)(raw) + (raw) / 255 + 16)
+
+/* @brief decode table entry for one BC_HUFF_MAX_BITS bit prefix */
+typedef struct {
+  uint8_t sym[2]; // decoded symbols
+  uint8_t len0;   // length of the first code, 0 if the prefix is invalid
+  uint8_t bits;   // length of both codes, len0 if only the first fits
+} bc_huff_entry_t;
+
+static int bc_u64_cmp(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/** @brief length limited huffman code lengths for a histogram */
+static void bc_huff_lengths(const uint32_t *freq, uint8_t *len) {
+  // frequency in the high bits, ties broken by symbol so the code doesn't
+  // depend on the sort
+  uint64_t key[BC_HUFF_SYMBOLS];
+  uint32_t n = 0;
+  for (uint32_t s = 0; s < BC_HUFF_SYMBOLS; s++) {
+    len[s] = 0;
+    if (freq[s]) {
+      key[n++] = ((uint64_t)freq[s] << 8) | s;
+    }
+  }
+  if (n == 0) {
+    return;
+  }
+  if (n == 1) {
+    len[key[0] & 0xFF] = 1;
+    return;
+  }
+  qsort(key, n, sizeof(key[0]), bc_u64_cmp);
+
+  // two queue construction: the leaves sorted rarest first, and the
+  // internal nodes, which are created in order of weight
+  uint64_t weight[2 * BC_HUFF_SYMBOLS];
+  uint16_t parent[2 * BC_HUFF_SYMBOLS];
+  for (uint32_t i = 0; i < n; i++) {
+    weight[i] = key[i] >> 8;
+  }
+  uint32_t leaf = 0;
+  uint32_t node = n;
+  for (uint32_t next = n; next < 2 * n - 1; next++) {
+    uint32_t pick[2];
+    for (int k = 0; k < 2; k++) {
+      if (leaf < n && (node >= next || weight[leaf] <= weight[node])) {
+        pick[k] = leaf++;
+      } else {
+        pick[k] = node++;
+      }
+    }
+    weight[next]    = weight[pick[0]] + weight[pick[1]];
+    parent[pick[0]] = (uint16_t)next;
+    parent[pick[1]] = (uint16_t)next;
+  }
+
+  // parents come after their children, so depths fill in from the root
+  uint8_t depth[2 * BC_HUFF_SYMBOLS];
+  uint32_t count[BC_HUFF_MAX_BITS + 1] = {};
+  depth[2 * n - 2] = 0;
+  for (uint32_t i = 2 * n - 2; i-- > 0;) {
+    depth[i] = (uint8_t)(depth[parent[i]] + 1);
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    count[depth[i] > BC_HUFF_MAX_BITS ? BC_HUFF_MAX_BITS : depth[i]]++;
+  }
+
+  // clamping the deep codes overfills the code space. each pass drops a
+  // longest code and splits a shorter one in two to make room for it,
+  // which frees one slot of the longest length
+  uint32_t kraft = 0;
+  for (uint32_t l = 1; l <= BC_HUFF_MAX_BITS; l++) {
+    kraft += count[l] << (BC_HUFF_MAX_BITS - l);
+  }
+  while (kraft > BC_HUFF_TABLE_SIZE) {
+    count[BC_HUFF_MAX_BITS]--;
+    for (uint32_t l = BC_HUFF_MAX_BITS - 1; l > 0; l--) {
+      if (count[l]) {
+        count[l]--;
+        count[l + 1] += 2;
+        break;
+      }
+    }
+    kraft--;
+  }
+
+  // longest codes to the rarest symbols
+  uint32_t i = 0;
+  for (uint32_t l = BC_HUFF_MAX_BITS; l > 0; l--) {
+    for (uint32_t c = count[l]; c > 0; c--) {
+      len[key[i++] & 0xFF] = (uint8_t)l;
+    }
+  }
+}
+
+/** @brief canonical codes for a set of code lengths */
+static void bc_huff_codes(const uint8_t *len, uint16_t *code) {
+  uint32_t count[BC_HUFF_MAX_BITS + 1] = {};
+  for (uint32_t s = 0; s < BC_HUFF_SYMBOLS; s++) {
+    count[len[s]]++;
+  }
+  count[0] = 0;
+
+  uint32_t next[BC_HUFF_MAX_BITS + 1];
+  uint32_t c = 0;
+  for (uint32_t l = 1; l <= BC_HUFF_MAX_BITS; l++) {
+    c       = (c + count[l - 1]) << 1;
+    next[l] = c;
+  }
+  for (uint32_t s = 0; s < BC_HUFF_SYMBOLS; s++) {
+    code[s] = len[s] ? (uint16_t)next[len[s]]++ : 0;
+  }
+}
+
+/**
+ * @brief huffman code a byte stream
+ * @return coded size, 0 if it didn't fit in dst_cap
+ */
+static size_t bc_huff_compress(const uint8_t *src,
+                               uint32_t size,
+                               uint8_t *dst,
+                               size_t dst_cap) {
+  uint32_t freq[BC_HUFF_SYMBOLS] = {};
+  for (uint32_t i = 0; i < size; i++) {
+    freq[src[i]]++;
+  }
+  uint8_t len[BC_HUFF_SYMBOLS];
+  bc_huff_lengths(freq, len);
+
+  // the exact size is known up front, don't code what won't be kept
+  uint64_t bits = 0;
+  for (uint32_t s = 0; s < BC_HUFF_SYMBOLS; s++) {
+    bits += (uint64_t)freq[s] * len[s];
+  }
+  if (BC_HUFF_HEADER + (bits + 7) / 8 > dst_cap) {
+    return 0;
+  }
+
+  write_le32(dst, size);
+  for (uint32_t s = 0; s < BC_HUFF_SYMBOLS; s += 2) {
+    dst[4 + s / 2] = (uint8_t)((len[s] << 4) | len[s + 1]);
+  }
+
+  uint16_t code[BC_HUFF_SYMBOLS];
+  bc_huff_codes(len, code);
+  bc_bitwriter_t bw = {
+    dst + BC_HUFF_HEADER, dst_cap - BC_HUFF_HEADER, 0, 0, 0, 0};
+  for (uint32_t i = 0; i < size; i++) {
+    bw_put(&bw, code[src[i]], len[src[i]]);
+  }
+  size_t coded = bw_flush(&bw);
+  return bw.overflow ? 0 : BC_HUFF_HEADER + coded;
+}
+
+/**
+ * @brief build the two symbol decode table for a set of code lengths
+ * @return 0 on success, -1 if the lengths don't form a valid code
+ */
+static int bc_huff_table(const uint8_t *len, bc_huff_entry_t *table) {
+  uint32_t kraft = 0;
+  for (uint32_t s = 0; s < BC_HUFF_SYMBOLS; s++) {
+    if (len[s] > BC_HUFF_MAX_BITS) {
+      return -1;
+    }
+    if (len[s]) {
+      kraft += 1u << (BC_HUFF_MAX_BITS - len[s]);
+    }
+  }
+  if (kraft == 0 || kraft > BC_HUFF_TABLE_SIZE) {
+    return -1;
+  }
+
+  // first the symbol each prefix starts with. prefixes no code starts
+  // are left at length 0 and rejected while decoding
+  uint16_t code[BC_HUFF_SYMBOLS];
+  bc_huff_codes(len, code);
+  memset(table, 0, BC_HUFF_TABLE_SIZE * sizeof(*table));
+  for (uint32_t s = 0; s < BC_HUFF_SYMBOLS; s++) {
+    if (!len[s]) {
+      continue;
+    }
+    uint32_t shift = BC_HUFF_MAX_BITS - len[s];
+    uint32_t first = (uint32_t)code[s] << shift;
+    for (uint32_t i = 0; i < (1u << shift); i++) {
+      table[first + i].sym[0] = (uint8_t)s;
+      table[first + i].len0   = len[s];
+      table[first + i].bits   = len[s];
+    }
+  }
+
+  // then a second symbol wherever the next code fits in the leftover bits
+  for (uint32_t i = 0; i < BC_HUFF_TABLE_SIZE; i++) {
+    uint32_t l0 = table[i].len0;
+    if (!l0) {
+      continue;
+    }
+    const bc_huff_entry_t *rest =
+      &table[(i << l0) & (BC_HUFF_TABLE_SIZE - 1)];
+    if (rest->len0 && l0 + rest->len0 <= BC_HUFF_MAX_BITS) {
+      table[i].sym[1] = rest->sym[0];
+      table[i].bits   = (uint8_t)(l0 + rest->len0);
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief decode a huffman coded stream of exactly size bytes
+ * @return 0 on success, -1 on corrupt data
+ */
+static int bc_huff_decompress(const uint8_t *src,
+                              size_t src_size,
+                              uint8_t *dst,
+                              uint32_t size) {
+  if (src_size < BC_HUFF_HEADER || read_le32(src) != size) {
+    return -1;
+  }
+  uint8_t len[BC_HUFF_SYMBOLS];
+  for (uint32_t s = 0; s < BC_HUFF_SYMBOLS; s += 2) {
+    len[s]     = src[4 + s / 2] >> 4;
+    len[s + 1] = src[4 + s / 2] & 0x0F;
+  }
+  bc_huff_entry_t table[BC_HUFF_TABLE_SIZE];
+  if (bc_huff_table(len, table) != 0) {
+    return -1;
+  }
+
+  bc_bitreader_t br = {
+    src + BC_HUFF_HEADER, src_size - BC_HUFF_HEADER, 0, 0, 0, 0};
+  uint32_t out = 0;
+  while (out < size) {
+    // a refill leaves at least 57 bits, enough for four lookups
+    br_refill(&br);
+    for (int k = 0; k < 4 && out < size; k++) {
+      const bc_huff_entry_t *e =
+        &table[br.acc >> (64 - BC_HUFF_MAX_BITS)];
+      if (!e->len0) {
+        return -1;
+      }
+      uint32_t bits = e->bits;
+      dst[out++]    = e->sym[0];
+      if (bits != e->len0 && out < size) {
+        dst[out++] = e->sym[1];
+      } else {
+        bits = e->len0;
+      }
+      br.acc <<= bits;
+      br.nbits -= bits;
+      br.consumed += bits;
+    }
+  }
+  return bc_bitreader_ok(&br) ? 0 : -1;
+}
+
+/******************************** audio codec *********************************/
+/*
+ * lossless PCM codec in the style of FLAC. the samples of a block are
+ * de-interleaved and coded in frames of BC_AUDIO_FRAME samples per channel.
+ * for stereo each frame picks whichever of left/right, left/side,
+ * side/right and mid/side is cheapest. each channel is then coded as a
+ * subframe: a constant, verbatim samples, a fixed polynomial predictor
+ * (order 0-4) or a quantized LPC predictor, with the prediction residual
+ * rice coded in 2^n partitions that each pick their own rice parameter.
+ *
+ * block payload: channels (1), bits per sample (1), then a bitstream of
+ * frames, each an optional 2 bit stereo mode followed by one subframe per
+ * channel:
+ *
+ *  type (8)    0 constant, 1 verbatim, 2 + n fixed order n, 0x20 + n LPC
+ *  warmup      order samples, sample bits each
+ *  LPC only    precision - 1 (4), shift (5), order coefficients
+ *  residual    partition order (4), then per partition rice k (5) + codes
+ */
+#define BC_AUDIO_FRAME        4096
+#define BC_AUDIO_MAX_CHANNELS 8
+#define BC_AUDIO_MAX_FIXED    (BYTECRUSH_FIXED_ORDERS - 1)
+#define BC_AUDIO_MAX_LPC      32
+#define BC_AUDIO_MAX_PORDER   8
+#define BC_AUDIO_MAX_RICE     30
+
+#define BC_SUBFRAME_CONSTANT 0x00
+#define BC_SUBFRAME_VERBATIM 0x01
+#define BC_SUBFRAME_FIXED    0x02
+#define BC_SUBFRAME_LPC      0x20
+
+/* @brief stereo decorrelation modes */
+typedef enum {
+  BC_STEREO_INDEPENDENT = 0,
+  BC_STEREO_LEFT_SIDE,
+  BC_STEREO_SIDE_RIGHT,
+  BC_STEREO_MID_SIDE,
+} bc_stereo_mode_e;
+
+/* @brief predictor search effort for one compression level */
+typedef struct {
+  uint32_t max_lpc_order;  // 0 disables LPC
+  uint32_t lpc_precision;  // bits per quantized coefficient
+  uint32_t max_porder;     // largest rice partition order tried
+  int exhaustive;          // try every LPC order, not just a few
+} bc_audio_level_t;
+
+static const bc_audio_level_t bc_audio_levels[BYTECRUSH_LEVEL_MAX + 1] = {
+  {0, 0, 0, 0}, // unused
+  {0, 0, 3, 0},
+  {0, 0, 4, 0},
+  {0, 0, 6, 0},
+  {8, 12, 4, 0},
+  {8, 12, 6, 0},
+  {8, 12, 8, 0},
+  {12, 12, 8, 0},
+  {12, 15, 8, 1},
+  {32, 15, 8, 1},
+};
+
+/* @brief decoded samples of one channel of a frame */
+typedef int32_t bc_audio_chan_t[BC_AUDIO_FRAME];
+
+/* @brief encoder scratch space, allocated once per stream */
+typedef struct {
+  int32_t chan[BC_AUDIO_MAX_CHANNELS][BC_AUDIO_FRAME];
+  int32_t mid[BC_AUDIO_FRAME];
+  int32_t side[BC_AUDIO_FRAME];
+  int32_t residual[2][BC_AUDIO_FRAME]; // best so far and candidate
+  double window[BC_AUDIO_FRAME];
+  uint32_t rice_u[BC_AUDIO_FRAME]; // zigzag codes of a partition
+  const bytecrush_kernels_t *kern; // vector kernels for this CPU
+} bc_audio_work_t;
+
+/* @brief how a subframe will be coded */
+typedef struct {
+  uint8_t type;
+  uint32_t order;
+  uint32_t precision;
+  uint32_t shift;
+  int32_t coefs[BC_AUDIO_MAX_LPC];
+  uint32_t porder;
+  uint8_t rice[1 << BC_AUDIO_MAX_PORDER];
+  const int32_t *residual;
+  uint64_t bits;
+} bc_subframe_t;
+
+/** @brief bytes per sample for a supported PCM bit depth, 0 otherwise */
+static inline uint32_t bc_audio_sample_bytes(uint32_t bits) {
+  return (bits == 8 || bits == 16 || bits == 24) ? bits / 8 : 0;
+}
+
+/** @brief lowest SAD order, and a rough cost in bits for it */
+static uint32_t bc_fixed_best_order(const bytecrush_kernels_t *kern,
+                                    const int32_t *x,
+                                    uint32_t n,
+                                    uint64_t *est_bits) {
+  uint64_t sad[BYTECRUSH_FIXED_ORDERS];
+  kern->fixed_sad(x, n, sad);
+
+  uint32_t best = 0;
+  for (uint32_t o = 1; o <= BC_AUDIO_MAX_FIXED && o < n; o++) {
+    if (sad[o] < sad[best]) {
+      best = o;
+    }
+  }
+  if (est_bits) {
+    // rice coding costs about log2(mean |residual|) + 2 bits a sample
+    uint64_t samples = (n > BC_AUDIO_MAX_FIXED) ? n - BC_AUDIO_MAX_FIXED : 1;
+    uint64_t mean    = sad[best] / samples + 1;
+    *est_bits = samples * (uint64_t)(66 - __builtin_clzll(mean));
+  }
+  return best;
+}
+
+/**
+ * @brief pick the rice partition order and parameters for a residual. the
+ * first `order` samples are warmup and not part of the residual
+ *
+ * @return estimated size of the coded residual in bits
+ */
+static uint64_t bc_rice_partition(const bytecrush_kernels_t *kern,
+                                  const int32_t *res,
+                                  uint32_t n,
+                                  uint32_t order,
+                                  uint32_t max_porder,
+                                  uint32_t *porder_out,
+                                  uint8_t *rice_out) {
+  // finest partition order that splits n evenly and leaves room for the
+  // warmup samples in the first partition
+  uint32_t pmax = 0;
+  while (pmax < max_porder && (n % (2u << pmax)) == 0 &&
+         (n >> (pmax + 1)) > order) {
+    pmax++;
+  }
+
+  uint64_t sums[1 << BC_AUDIO_MAX_PORDER];
+  uint32_t parts = 1u << pmax;
+  uint32_t psize = n >> pmax;
+  for (uint32_t p = 0; p < parts; p++) {
+    uint32_t start = (p == 0) ? order : p * psize;
+    sums[p] = kern->rice_map(res + start, (p + 1) * psize - start, NULL);
+  }
+
+  uint64_t best_bits = UINT64_MAX;
+  for (int32_t po = (int32_t)pmax; po >= 0; po--) {
+    uint32_t cur_parts = 1u << po;
+    uint32_t cur_size  = n >> po;
+    uint64_t bits      = 4;
+    uint8_t rice[1 << BC_AUDIO_MAX_PORDER];
+
+    for (uint32_t p = 0; p < cur_parts; p++) {
+      uint64_t count = cur_size - ((p == 0) ? order : 0);
+      uint64_t sum   = sums[p];
+      // parameter nearest log2 of the mean, then the cheaper neighbour
+      uint32_t k = 0;
+      if (count > 0 && sum > count) {
+        k = 63 - (uint32_t)__builtin_clzll(sum / count);
+      }
+      if (k > BC_AUDIO_MAX_RICE) {
+        k = BC_AUDIO_MAX_RICE;
+      }
+      uint64_t cost = count * (k + 1) + (sum >> k);
+      if (k > 0) {
+        uint64_t lower = count * k + (sum >> (k - 1));
+        if (lower < cost) {
+          cost = lower;
+          k--;
+        }
+      }
+      rice[p] = (uint8_t)k;
+      bits += 5 + cost;
+    }
+
+    if (bits < best_bits) {
+      best_bits   = bits;
+      *porder_out = (uint32_t)po;
+      memcpy(rice_out, rice, cur_parts);
+    }
+
+    // merge pairs of partitions for the next coarser order
+    for (uint32_t p = 0; p < cur_parts / 2; p++) {
+      sums[p] = sums[2 * p] + sums[2 * p + 1];
+    }
+  }
+  return best_bits;
+}
+
+/** @brief windowed autocorrelation for lags 0 to max_lag */
+static void bc_autocorrelation(const int32_t *x,
+                               uint32_t n,
+                               uint32_t max_lag,
+                               const double *window,
+                               double *ac) {
+  double xw[BC_AUDIO_FRAME];
+  for (uint32_t i = 0; i < n; i++) {
+    xw[i] = x[i] * window[i];
+  }
+  for (uint32_t lag = 0; lag <= max_lag; lag++) {
+    double sum = 0.0;
+    for (uint32_t i = lag; i < n; i++) {
+      sum += xw[i] * xw[i - lag];
+    }
+    ac[lag] = sum;
+  }
+}
+
+/**
+ * @brief Levinson-Durbin recursion. lpc[o - 1] receives the predictor of
+ * order o for every order up to max_order
+ *
+ * @return highest order solved, less than max_order if the signal ran out
+ * of prediction error
+ */
+static uint32_t bc_levinson(const double *ac,
+                            uint32_t max_order,
+                            double lpc[][BC_AUDIO_MAX_LPC]) {
+  double a[BC_AUDIO_MAX_LPC];
+  double err = ac[0];
+
+  for (uint32_t i = 0; i < max_order; i++) {
+    if (err <= 0.0) {
+      return i;
+    }
+    double r = -ac[i + 1];
+    for (uint32_t j = 0; j < i; j++) {
+      r -= a[j] * ac[i - j];
+    }
+    r /= err;
+
+    a[i] = r;
+    uint32_t j;
+    for (j = 0; j < (i >> 1); j++) {
+      double tmp = a[j];
+      a[j] += r * a[i - 1 - j];
+      a[i - 1 - j] += r * tmp;
+    }
+    if (i & 1) {
+      a[j] += a[j] * r;
+    }
+    err *= (1.0 - r * r);
+
+    for (j = 0; j <= i; j++) {
+      lpc[i][j] = -a[j];
+    }
+  }
+  return max_order;
+}
+
+/** @brief quantize predictor coefficients, returns -1 if they're all 0 */
+static int bc_lpc_quantize(const double *lpc,
+                           uint32_t order,
+                           uint32_t precision,
+                           int32_t *coefs,
+                           uint32_t *shift) {
+  double cmax = 0.0;
+  for (uint32_t i = 0; i < order; i++) {
+    double c = lpc[i] < 0 ? -lpc[i] : lpc[i];
+    if (c > cmax) {
+      cmax = c;
+    }
+  }
+  if (cmax <= 0.0) {
+    return -1;
+  }
+
+  int32_t qmax = (1 << (precision - 1)) - 1;
+  int32_t qmin = -(1 << (precision - 1));
+  int log2cmax;
+  frexp(cmax, &log2cmax);
+  int s = (int)precision - 1 - log2cmax;
+  if (s < 0) {
+    s = 0;
+  } else if (s > 15) {
+    s = 15;
+  }
+
+  // carry the rounding error into the next coefficient
+  double error = 0.0;
+  for (uint32_t i = 0; i < order; i++) {
+    error += lpc[i] * (double)(1 << s);
+    long q = lround(error);
+    if (q > qmax) {
+      q = qmax;
+    } else if (q < qmin) {
+      q = qmin;
+    }
+    error -= (double)q;
+    coefs[i] = (int32_t)q;
+  }
+  *shift = (uint32_t)s;
+  return 0;
+}
+
+/** @brief LPC residual, returns -1 if it can't be rice coded */
+static int bc_lpc_residual(const int32_t *x,
+                           uint32_t n,
+                           const int32_t *coefs,
+                           uint32_t order,
+                           uint32_t shift,
+                           int32_t *res) {
+  for (uint32_t i = order; i < n; i++) {
+    int64_t sum = 0;
+    for (uint32_t j = 0; j < order; j++) {
+      sum += (int64_t)coefs[j] * x[i - 1 - j];
+    }
+    int64_t r = (int64_t)x[i] - (sum >> shift);
+    if (r >= (1 << 30) || r <= -(1 << 30)) {
+      return -1;
+    }
+    res[i] = (int32_t)r;
+  }
+  return 0;
+}
+
+/** @brief choose how to code one channel of a frame */
+static void bc_subframe_analyze(bc_audio_work_t *w,
+                                const bc_audio_level_t *alvl,
+                                const int32_t *x,
+                                uint32_t n,
+                                uint32_t sample_bits,
+                                bc_subframe_t *sf) {
+  uint32_t i;
+  for (i = 1; i < n && x[i] == x[0]; i++) {
+  }
+  if (i == n) {
+    sf->type  = BC_SUBFRAME_CONSTANT;
+    sf->order = 0;
+    sf->bits  = 8 + sample_bits;
+    return;
+  }
+
+  // verbatim is the fallback every predictor has to beat
+  sf->type  = BC_SUBFRAME_VERBATIM;
+  sf->order = 0;
+  sf->bits  = 8 + (uint64_t)n * sample_bits;
+
+  // fixed predictor, the order with the lowest absolute residual sum
+  int slot       = 0;
+  uint32_t order = bc_fixed_best_order(w->kern, x, n, NULL);
+  int32_t *res   = w->residual[slot];
+  w->kern->fixed_residual(x, n, order, res);
+
+  uint64_t bits = 8 + (uint64_t)order * sample_bits;
+  bits += bc_rice_partition(
+    w->kern, res, n, order, alvl->max_porder, &sf->porder, sf->rice);
+  if (bits < sf->bits) {
+    sf->type     = (uint8_t)(BC_SUBFRAME_FIXED + order);
+    sf->order    = order;
+    sf->residual = res;
+    sf->bits     = bits;
+    slot ^= 1;
+  }
+
+  uint32_t max_order = alvl->max_lpc_order;
+  if (max_order == 0 || n <= max_order * 2) {
+    return;
+  }
+
+  double ac[BC_AUDIO_MAX_LPC + 1];
+  double lpc[BC_AUDIO_MAX_LPC][BC_AUDIO_MAX_LPC];
+  bc_autocorrelation(x, n, max_order, w->window, ac);
+  max_order = bc_levinson(ac, max_order, lpc);
+
+  for (order = 1; order <= max_order; order++) {
+    // below the exhaustive levels only a few orders are worth coding
+    if (!alvl->exhaustive && order != max_order && order != max_order / 2) {
+      continue;
+    }
+
+    int32_t coefs[BC_AUDIO_MAX_LPC];
+    uint32_t shift;
+    if (bc_lpc_quantize(
+          lpc[order - 1], order, alvl->lpc_precision, coefs, &shift) != 0) {
+      continue;
+    }
+    res = w->residual[slot];
+    if (bc_lpc_residual(x, n, coefs, order, shift, res) != 0) {
+      continue;
+    }
+
+    uint32_t porder;
+    uint8_t rice[1 << BC_AUDIO_MAX_PORDER];
+    bits = 8 + (uint64_t)order * sample_bits + 4 + 5 +
+           (uint64_t)order * alvl->lpc_precision +
+           bc_rice_partition(
+             w->kern, res, n, order, alvl->max_porder, &porder, rice);
+    if (bits < sf->bits) {
+      sf->type      = (uint8_t)(BC_SUBFRAME_LPC + order);
+      sf->order     = order;
+      sf->precision = alvl->lpc_precision;
+      sf->shift     = shift;
+      sf->porder    = porder;
+      sf->residual  = res;
+      sf->bits      = bits;
+      memcpy(sf->coefs, coefs, order * sizeof(int32_t));
+      memcpy(sf->rice, rice, 1u << porder);
+      slot ^= 1;
+    }
+  }
+}
+
+static void bc_subframe_write(bc_bitwriter_t *bw,
+                              bc_audio_work_t *w,
+                              const bc_subframe_t *sf,
+                              const int32_t *x,
+                              uint32_t n,
+                              uint32_t sample_bits) {
+  bw_put(bw, sf->type, 8);
+
+  if (sf->type == BC_SUBFRAME_CONSTANT) {
+    bw_put(bw, (uint32_t)x[0], sample_bits);
+    return;
+  }
+  if (sf->type == BC_SUBFRAME_VERBATIM) {
+    for (uint32_t i = 0; i < n && !bw->overflow; i++) {
+      bw_put(bw, (uint32_t)x[i], sample_bits);
+    }
+    return;
+  }
+
+  for (uint32_t i = 0; i < sf->order; i++) {
+    bw_put(bw, (uint32_t)x[i], sample_bits);
+  }
+  if (sf->type >= BC_SUBFRAME_LPC) {
+    bw_put(bw, sf->precision - 1, 4);
+    bw_put(bw, sf->shift, 5);
+    for (uint32_t i = 0; i < sf->order; i++) {
+      bw_put(bw, (uint32_t)sf->coefs[i], sf->precision);
+    }
+  }
+
+  bw_put(bw, sf->porder, 4);
+  uint32_t parts = 1u << sf->porder;
+  uint32_t psize = n >> sf->porder;
+  for (uint32_t p = 0; p < parts && !bw->overflow; p++) {
+    uint32_t k = sf->rice[p];
+    bw_put(bw, k, 5);
+    uint32_t start = (p == 0) ? sf->order : p * psize;
+    uint32_t count = (p + 1) * psize - start;
+    w->kern->rice_map(sf->residual + start, count, w->rice_u);
+    for (uint32_t i = 0; i < count; i++) {
+      bw_put_rice(bw, w->rice_u[i], k);
+    }
+  }
+}
+
+static int bc_subframe_read(bc_bitreader_t *br,
+                            int32_t *x,
+                            uint32_t n,
+                            uint32_t sample_bits) {
+  uint32_t type = br_get(br, 8);
+
+  if (type == BC_SUBFRAME_CONSTANT) {
+    int32_t v = br_get_signed(br, sample_bits);
+    for (uint32_t i = 0; i < n; i++) {
+      x[i] = v;
+    }
+    return bc_bitreader_ok(br) ? 0 : -1;
+  }
+  if (type == BC_SUBFRAME_VERBATIM) {
+    for (uint32_t i = 0; i < n; i++) {
+      x[i] = br_get_signed(br, sample_bits);
+    }
+    return bc_bitreader_ok(br) ? 0 : -1;
+  }
+
+  uint32_t order;
+  int lpc = 0;
+  if (type >= BC_SUBFRAME_FIXED &&
+      type <= BC_SUBFRAME_FIXED + BC_AUDIO_MAX_FIXED) {
+    order = type - BC_SUBFRAME_FIXED;
+  } else if (type > BC_SUBFRAME_LPC &&
+             type <= BC_SUBFRAME_LPC + BC_AUDIO_MAX_LPC) {
+    order = type - BC_SUBFRAME_LPC;
+    lpc   = 1;
+  } else {
+    return -1;
+  }
+  if (order >= n) {
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < order; i++) {
+    x[i] = br_get_signed(br, sample_bits);
+  }
+
+  int32_t coefs[BC_AUDIO_MAX_LPC];
+  uint32_t shift = 0;
+  if (lpc) {
+    uint32_t precision = br_get(br, 4) + 1;
+    shift              = br_get(br, 5);
+    for (uint32_t i = 0; i < order; i++) {
+      coefs[i] = br_get_signed(br, precision);
+    }
+  }
+
+  // residuals first, prediction is added back in a second pass
+  uint32_t porder = br_get(br, 4);
+  if (porder > BC_AUDIO_MAX_PORDER || (n % (1u << porder)) != 0 ||
+      (n >> porder) < order) {
+    return -1;
+  }
+  uint32_t parts = 1u << porder;
+  uint32_t psize = n >> porder;
+  for (uint32_t p = 0; p < parts; p++) {
+    uint32_t k = br_get(br, 5);
+    if (k > BC_AUDIO_MAX_RICE) {
+      return -1;
+    }
+    uint32_t start = (p == 0) ? order : p * psize;
+    for (uint32_t i = start; i < (p + 1) * psize; i++) {
+      uint32_t u;
+      if (br_get_rice(br, k, &u) != 0) {
+        return -1;
+      }
+      x[i] = unzigzag(u);
+    }
+    if (!bc_bitreader_ok(br)) {
+      return -1;
+    }
+  }
 
+  if (lpc) {
+    for (uint32_t i = order; i < n; i++) {
+      int64_t sum = 0;
+      for (uint32_t j = 0; j < order; j++) {
+        sum += (int64_t)coefs[j] * x[i - 1 - j];
+      }
+      x[i] = (int32_t)(x[i] + (sum >> shift));
+    }
+    return 0;
+  }
+
+  // widened so a corrupt residual can't overflow
+  for (uint32_t i = order; i < n; i++) {
+    int64_t p = 0;
+    switch (order) {
+      case 0:
+        break;
+      case 1:
+        p = x[i - 1];
+        break;
+      case 2:
+        p = 2 * (int64_t)x[i - 1] - x[i - 2];
+        break;
+      case 3:
+        p = 3 * ((int64_t)x[i - 1] - x[i - 2]) + x[i - 3];
+        break;
+      default:
+        p = 4 * ((int64_t)x[i - 1] + x[i - 3]) - 6 * (int64_t)x[i - 2] -
+            x[i - 4];
+        break;
+    }
+    x[i] = (int32_t)(x[i] + p);
+  }
+  return 0;
+}
+
+/** @brief little endian PCM to de-interleaved signed samples */
+static void bc_pcm_load(const uint8_t *src,
+                        uint32_t frames,
+                        uint32_t channels,
+                        uint32_t bytes,
+                        bc_audio_work_t *w) {
+  for (uint32_t i = 0; i < frames; i++) {
+    for (uint32_t c = 0; c < channels; c++) {
+      const uint8_t *s = src + (i * channels + c) * bytes;
+      int32_t v;
+      if (bytes == 1) {
+        v = (int32_t)s[0] - 128;
+      } else if (bytes == 2) {
+        v = (int16_t)(s[0] | (s[1] << 8));
+      } else {
+        v = (int32_t)((uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 |
+                      (uint32_t)s[2] << 24) >>
+            8;
+      }
+      w->chan[c][i] = v;
+    }
+  }
+}
+
+static void bc_pcm_store(int32_t chan[][BC_AUDIO_FRAME],
+                         uint32_t frames,
+                         uint32_t channels,
+                         uint32_t bytes,
+                         uint8_t *dst) {
+  for (uint32_t i = 0; i < frames; i++) {
+    for (uint32_t c = 0; c < channels; c++) {
+      uint8_t *d = dst + (i * channels + c) * bytes;
+      int32_t v  = chan[c][i];
+      if (bytes == 1) {
+        d[0] = (uint8_t)(v + 128);
+      } else {
+        for (uint32_t b = 0; b < bytes; b++) {
+          d[b] = (uint8_t)((uint32_t)v >> (8 * b));
+        }
+      }
+    }
+  }
+}
 
-/***************************** pattern checkers *******************************/
-static int pattern_check_repeats(const uint8_t *buffer,
-                                 size_t size,
-                                 size_t *pattern_length) {
-  if (size < 2) {
+/**
+ * @brief audio compress one block of whole PCM sample frames
+ * @return compressed size, 0 if it didn't fit in dst_cap
+ */
+static size_t bc_audio_compress_block(bc_audio_work_t *w,
+                                      const bc_audio_level_t *alvl,
+                                      const uint8_t *src,
+                                      uint32_t size,
+                                      uint32_t channels,
+                                      uint32_t bits,
+                                      uint8_t *dst,
+                                      size_t dst_cap) {
+  uint32_t bytes  = bc_audio_sample_bytes(bits);
+  uint32_t frames = size / (channels * bytes);
+  if (dst_cap < 2) {
     return 0;
   }
+  dst[0] = (uint8_t)channels;
+  dst[1] = (uint8_t)bits;
+
+  bc_bitwriter_t bw = {dst + 2, dst_cap - 2, 0, 0, 0, 0};
+
+  for (uint32_t f = 0; f < frames && !bw.overflow; f += BC_AUDIO_FRAME) {
+    uint32_t n = (frames - f > BC_AUDIO_FRAME) ? BC_AUDIO_FRAME : frames - f;
+    bc_pcm_load(src + f * channels * bytes, n, channels, bytes, w);
+
+    // welch window for the LPC autocorrelation
+    for (uint32_t i = 0; i < n; i++) {
+      double t     = (i - (n - 1) / 2.0) / ((n + 1) / 2.0);
+      w->window[i] = 1.0 - t * t;
+    }
+
+    const int32_t *sig[BC_AUDIO_MAX_CHANNELS];
+    uint32_t sig_bits[BC_AUDIO_MAX_CHANNELS];
+    for (uint32_t c = 0; c < channels; c++) {
+      sig[c]      = w->chan[c];
+      sig_bits[c] = bits;
+    }
+
+    if (channels == 2) {
+      for (uint32_t i = 0; i < n; i++) {
+        w->mid[i]  = (w->chan[0][i] + w->chan[1][i]) >> 1;
+        w->side[i] = w->chan[0][i] - w->chan[1][i];
+      }
+      // cheap estimate of each signal from its best fixed predictor
+      uint64_t l, r, m, s;
+      bc_fixed_best_order(w->kern, w->chan[0], n, &l);
+      bc_fixed_best_order(w->kern, w->chan[1], n, &r);
+      bc_fixed_best_order(w->kern, w->mid, n, &m);
+      bc_fixed_best_order(w->kern, w->side, n, &s);
+
+      uint64_t cost[4] = {l + r, l + s, s + r, m + s};
+      uint32_t mode    = BC_STEREO_INDEPENDENT;
+      for (uint32_t i = 1; i < 4; i++) {
+        if (cost[i] < cost[mode]) {
+          mode = i;
+        }
+      }
+      bw_put(&bw, mode, 2);
+
+      if (mode == BC_STEREO_LEFT_SIDE) {
+        sig[1] = w->side;
+      } else if (mode == BC_STEREO_SIDE_RIGHT) {
+        sig[0] = w->side;
+      } else if (mode == BC_STEREO_MID_SIDE) {
+        sig[0] = w->mid;
+        sig[1] = w->side;
+      }
+      // the side channel needs one extra bit
+      if (mode == BC_STEREO_LEFT_SIDE || mode == BC_STEREO_MID_SIDE) {
+        sig_bits[1]++;
+      } else if (mode == BC_STEREO_SIDE_RIGHT) {
+        sig_bits[0]++;
+      }
+    }
+
+    for (uint32_t c = 0; c < channels && !bw.overflow; c++) {
+      bc_subframe_t sf;
+      bc_subframe_analyze(w, alvl, sig[c], n, sig_bits[c], &sf);
+      bc_subframe_write(&bw, w, &sf, sig[c], n, sig_bits[c]);
+    }
+  }
+
+  size_t len = bw_flush(&bw);
+  return bw.overflow ? 0 : len + 2;
+}
+
+/**
+ * @brief decompress one audio block into exactly raw_size bytes
+ * @return 0 on success, -1 on corrupt data
+ */
+static int bc_audio_decompress_block(const uint8_t *src,
+                                     size_t src_size,
+                                     uint8_t *dst,
+                                     uint32_t raw_size,
+                                     int32_t chan[][BC_AUDIO_FRAME]) {
+  if (src_size < 2) {
+    return -1;
+  }
+  uint32_t channels = src[0];
+  uint32_t bits     = src[1];
+  uint32_t bytes    = bc_audio_sample_bytes(bits);
+  if (channels == 0 || channels > BC_AUDIO_MAX_CHANNELS || bytes == 0 ||
+      raw_size % (channels * bytes) != 0) {
+    return -1;
+  }
+  uint32_t frames = raw_size / (channels * bytes);
+
+  bc_bitreader_t br = {src + 2, src_size - 2, 0, 0, 0, 0};
+
+  for (uint32_t f = 0; f < frames; f += BC_AUDIO_FRAME) {
+    uint32_t n = (frames - f > BC_AUDIO_FRAME) ? BC_AUDIO_FRAME : frames - f;
+
+    uint32_t mode = BC_STEREO_INDEPENDENT;
+    if (channels == 2) {
+      mode = br_get(&br, 2);
+    }
+
+    for (uint32_t c = 0; c < channels; c++) {
+      uint32_t sample_bits = bits;
+      if ((c == 1 &&
+           (mode == BC_STEREO_LEFT_SIDE || mode == BC_STEREO_MID_SIDE)) ||
+          (c == 0 && mode == BC_STEREO_SIDE_RIGHT)) {
+        sample_bits++;
+      }
+      if (bc_subframe_read(&br, chan[c], n, sample_bits) != 0) {
+        return -1;
+      }
+    }
+
+    int32_t *a = chan[0];
+    int32_t *b = chan[1];
+    for (uint32_t i = 0; i < n && mode != BC_STEREO_INDEPENDENT; i++) {
+      if (mode == BC_STEREO_LEFT_SIDE) {
+        b[i] = a[i] - b[i];
+      } else if (mode == BC_STEREO_SIDE_RIGHT) {
+        a[i] = a[i] + b[i];
+      } else {
+        int32_t side = b[i];
+        int32_t mid  = (int32_t)((uint32_t)a[i] << 1) | (side & 1);
+        a[i]         = (mid + side) >> 1;
+        b[i]         = (mid - side) >> 1;
+      }
+    }
+
+    bc_pcm_store(chan, n, channels, bytes, dst + f * channels * bytes);
+  }
+
+  return bc_bitreader_ok(&br) ? 0 : -1;
+}
+
+/******************************** stream API **********************************/
+/* @brief per stream encoder state, shared by every block */
+typedef struct {
+  const bc_level_t *lvl;
+  const bc_audio_level_t *alvl;
+  bc_matcher_t *matcher;
+  bc_audio_work_t *audio;
+  uint8_t *lz; // LZ77 sequences of the current block
+  unsigned char *output;
+  size_t capacity;
+  size_t out;
+} bc_encoder_t;
+
+/**
+ * @brief append a block, trying the audio coder when a format is given,
+ * then LZ77, then storing it
+ */
+static int bc_encode_block(bc_encoder_t *enc,
+                           const unsigned char *input,
+                           uint32_t raw,
+                           const bytecrush_audio_format_t *audio) {
+  if (enc->capacity - enc->out < BYTECRUSH_BLOCK_HEADER_SZ) {
+    return -1;
+  }
+  uint8_t *hdr  = enc->output + enc->out;
+  uint8_t *data = hdr + BYTECRUSH_BLOCK_HEADER_SZ;
+  size_t room   = enc->capacity - enc->out - BYTECRUSH_BLOCK_HEADER_SZ;
+
+  // anything kept has to beat storing the block
+  size_t limit   = (room < (size_t)raw - 1) ? room : (size_t)raw - 1;
+  size_t packed  = 0;
+  uint8_t method = BYTECRUSH_METHOD_STORED;
+
+  if (audio && raw > 1) {
+    packed = bc_audio_compress_block(enc->audio,
+                                     enc->alvl,
+                                     input,
+                                     raw,
+                                     audio->channels,
+                                     audio->bits_per_sample,
+                                     data,
+                                     limit);
+    method = BYTECRUSH_METHOD_AUDIO;
+  }
+  if (packed == 0 && raw > 1) {
+    size_t lz = bc_lz77_compress_block(
+      enc->matcher, enc->lvl, input, raw, enc->lz, BC_LZ77_BOUND(raw));
+    // the extra decode pass is only worth a few percent or more
+    if (enc->lvl->entropy) {
+      size_t cap = lz - lz / 32;
+      if (cap > limit) {
+        cap = limit;
+      }
+      packed = bc_huff_compress(enc->lz, (uint32_t)lz, data, cap);
+      method = BYTECRUSH_METHOD_LZ77_HUFF;
+    }
+    if (packed == 0 && lz > 0 && lz <= limit) {
+      memcpy(data, enc->lz, lz);
+      packed = lz;
+      method = BYTECRUSH_METHOD_LZ77;
+    }
+  }
+  if (packed == 0) {
+    if (room < raw) {
+      return -1;
+    }
+    memcpy(data, input, raw);
+    packed = raw;
+    method = BYTECRUSH_METHOD_STORED;
+  }
+
+  hdr[0] = method;
+  write_le32(hdr + 1, raw);
+  write_le32(hdr + 5, (uint32_t)packed);
+  enc->out += BYTECRUSH_BLOCK_HEADER_SZ + packed;
+  return 0;
+}
+
+/* @brief one block of the input and how to code it */
+typedef struct {
+  const unsigned char *src;
+  uint32_t raw;
+  const bytecrush_audio_format_t *audio; // NULL for LZ77
+} bc_job_t;
+
+/**
+ * @brief split a byte range into blocks
+ * @return number of jobs appended
+ */
+static size_t bc_plan_range(bc_job_t *jobs,
+                            const unsigned char *input,
+                            size_t size,
+                            const bytecrush_audio_format_t *audio) {
+  // audio blocks hold whole sample frames
+  uint32_t block_size = BYTECRUSH_BLOCK_SIZE;
+  if (audio) {
+    uint32_t frame_bytes =
+      audio->channels * bc_audio_sample_bytes(audio->bits_per_sample);
+    block_size -= block_size % frame_bytes;
+  }
+
+  size_t count = 0;
+  for (size_t in = 0; in < size;) {
+    uint32_t raw =
+      (size - in > block_size) ? block_size : (uint32_t)(size - in);
+    jobs[count].src   = input + in;
+    jobs[count].raw   = raw;
+    jobs[count].audio = audio;
+    count++;
+    in += raw;
+  }
+  return count;
+}
 
-  size_t i = 1;
-  while (i < size && buffer[i] == buffer[0]) {
-    i++;
+static void bc_encoder_free(bc_encoder_t *enc) {
+  if (enc->matcher) {
+    free(enc->matcher->prev);
   }
+  free(enc->matcher);
+  free(enc->audio);
+  free(enc->lz);
+  enc->matcher = NULL;
+  enc->audio   = NULL;
+  enc->lz      = NULL;
+}
 
-  if (i > 1) {
-    *pattern_length = i;
-    // repeat pattern found...
-    return 1;
+/**
+ * @brief allocate an encoder's scratch space. the matcher's tables are too
+ * big for the stack and are reused for every block
+ */
+static int bc_encoder_init(bc_encoder_t *enc, int level, int with_audio) {
+  memset(enc, 0, sizeof(*enc));
+  enc->lvl     = &bc_levels[level];
+  enc->alvl    = &bc_audio_levels[level];
+  enc->matcher = (bc_matcher_t *)malloc(sizeof(*enc->matcher));
+  if (enc->matcher) {
+    enc->matcher->prev =
+      (int32_t *)malloc(BYTECRUSH_BLOCK_SIZE * sizeof(int32_t));
+  }
+  enc->lz = (uint8_t *)malloc(BC_LZ77_BOUND(BYTECRUSH_BLOCK_SIZE));
+  if (with_audio) {
+    enc->audio = (bc_audio_work_t *)malloc(sizeof(*enc->audio));
+    if (enc->audio) {
+      enc->audio->kern = bytecrush_kernels();
+    }
+  }
+  if (!enc->matcher || !enc->matcher->prev || !enc->lz ||
+      (with_audio && !enc->audio)) {
+    bc_encoder_free(enc);
+    return -1;
   }
   return 0;
 }
 
-/******************************************************************************/
-long get_file_size(const char *filename) {
-  struct stat st;
-  if (stat(filename, &st) == 0)
-    return st.st_size;
-  return -1;
+/*
+ * block parallel compression. workers claim blocks in order and code each
+ * into a slot of a ring, and the calling thread copies finished slots to
+ * the output in block order. a worker can't run more than one ring's worth
+ * of blocks ahead of the copy, which bounds the memory in flight to
+ * slots * block size no matter how big the input is
+ */
+typedef struct {
+  size_t job;          // block the slot holds
+  int done;            // coded and waiting to be copied out
+  unsigned char *buf;  // block header and data
+  size_t size;         // bytes used in buf
+} bc_slot_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  const bc_job_t *jobs;
+  size_t count;
+  size_t next_job;  // next block to hand to a worker
+  size_t next_emit; // next block to copy to the output
+  bc_slot_t *slots;
+  size_t nslots;
+  size_t slot_cap;
+  int level;
+  int with_audio;
+  int failed;
+} bc_pool_t;
+
+static void *bc_compress_worker(void *arg) {
+  bc_pool_t *pool = (bc_pool_t *)arg;
+
+  bc_encoder_t enc;
+  int rc = bc_encoder_init(&enc, pool->level, pool->with_audio);
+
+  pthread_mutex_lock(&pool->lock);
+  if (rc != 0) {
+    pool->failed = 1;
+    pthread_cond_broadcast(&pool->cond);
+  }
+  for (;;) {
+    while (!pool->failed && pool->next_job < pool->count &&
+           pool->next_job >= pool->next_emit + pool->nslots) {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    if (pool->failed || pool->next_job >= pool->count) {
+      break;
+    }
+    size_t idx      = pool->next_job++;
+    bc_slot_t *slot = &pool->slots[idx % pool->nslots];
+    pthread_mutex_unlock(&pool->lock);
+
+    const bc_job_t *job = &pool->jobs[idx];
+    enc.output          = slot->buf;
+    enc.capacity        = pool->slot_cap;
+    enc.out             = 0;
+    rc = bc_encode_block(&enc, job->src, job->raw, job->audio);
+
+    pthread_mutex_lock(&pool->lock);
+    if (rc != 0) {
+      pool->failed = 1;
+    } else {
+      slot->job  = idx;
+      slot->size = enc.out;
+      slot->done = 1;
+    }
+    pthread_cond_broadcast(&pool->cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  bc_encoder_free(&enc);
+  return NULL;
 }
 
-size_t rle_compress(int16_t *data, size_t size, uint8_t *output) {
-  size_t out_index = 0;
-  size_t i         = 0;
+/** @brief code the jobs on a thread pool, appending blocks to out */
+static int bc_encode_parallel(const bc_job_t *jobs,
+                              size_t count,
+                              int level,
+                              int with_audio,
+                              int threads,
+                              unsigned char *output,
+                              size_t capacity,
+                              size_t *out) {
+  bc_pool_t pool = {};
+  pool.jobs       = jobs;
+  pool.count      = count;
+  pool.nslots     = (size_t)threads * 2;
+  pool.slot_cap   = BYTECRUSH_BLOCK_HEADER_SZ + BYTECRUSH_BLOCK_SIZE;
+  pool.level      = level;
+  pool.with_audio = with_audio;
+
+  pool.slots = (bc_slot_t *)calloc(pool.nslots, sizeof(bc_slot_t));
+  pthread_t *tids = (pthread_t *)calloc((size_t)threads, sizeof(pthread_t));
+  int rc          = (pool.slots && tids) ? 0 : -1;
+  for (size_t i = 0; rc == 0 && i < pool.nslots; i++) {
+    pool.slots[i].buf = (unsigned char *)malloc(pool.slot_cap);
+    if (!pool.slots[i].buf) {
+      rc = -1;
+    }
+  }
+  if (rc != 0) {
+    goto cleanup;
+  }
+
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+
+  int started;
+  for (started = 0; started < threads; started++) {
+    if (pthread_create(&tids[started], NULL, bc_compress_worker, &pool) != 0) {
+      break;
+    }
+  }
 
-  while (i < size) {
-    int16_t value      = data[i];
-    uint8_t run_length = 1;
+  // reorder buffer: copy blocks out strictly in order as they finish
+  pthread_mutex_lock(&pool.lock);
+  if (started == 0) {
+    pool.failed = 1;
+  }
+  while (!pool.failed && pool.next_emit < pool.count) {
+    bc_slot_t *slot = &pool.slots[pool.next_emit % pool.nslots];
+    if (!slot->done || slot->job != pool.next_emit) {
+      pthread_cond_wait(&pool.cond, &pool.lock);
+      continue;
+    }
+    // the slot can't be reused until next_emit moves past it, so the copy
+    // doesn't need the lock
+    pthread_mutex_unlock(&pool.lock);
+    int fits = (slot->size <= capacity - *out);
+    if (fits) {
+      memcpy(output + *out, slot->buf, slot->size);
+      *out += slot->size;
+    }
+    pthread_mutex_lock(&pool.lock);
 
-    while (i + run_length < size && data[i + run_length] == value &&
-           run_length < 255) {
-      run_length++;
+    slot->done = 0;
+    pool.next_emit++;
+    if (!fits) {
+      pool.failed = 1;
     }
+    pthread_cond_broadcast(&pool.cond);
+  }
+  rc = pool.failed ? -1 : 0;
+  pthread_mutex_unlock(&pool.lock);
 
-    output[out_index++] = (uint8_t)run_length;
-    memcpy(&output[out_index], &value, sizeof(int16_t));
-    out_index += sizeof(int16_t);
+  for (int i = 0; i < started; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  pthread_mutex_destroy(&pool.lock);
+  pthread_cond_destroy(&pool.cond);
 
-    i += run_length;
+cleanup:
+  for (size_t i = 0; pool.slots && i < pool.nslots; i++) {
+    free(pool.slots[i].buf);
   }
-  return out_index;
+  free(pool.slots);
+  free(tids);
+  return rc;
 }
 
-/******************************************************************************/
-int bytecrush_compress(const char *file_path) {
+/** @brief number of workers to use for a stream of count blocks */
+static int bc_thread_count(int threads, size_t count) {
+  if (threads <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threads    = (cores > 0) ? (int)cores : 1;
+  }
+  if (threads > BYTECRUSH_MAX_THREADS) {
+    threads = BYTECRUSH_MAX_THREADS;
+  }
+  if ((size_t)threads > count) {
+    threads = (int)count;
+  }
+  return threads;
+}
+
+/** @brief true if the audio coder can handle this PCM layout */
+static int bc_audio_format_ok(const bytecrush_audio_format_t *audio,
+                              size_t input_size) {
+  return audio && audio->channels > 0 &&
+         audio->channels <= BC_AUDIO_MAX_CHANNELS &&
+         bc_audio_sample_bytes(audio->bits_per_sample) != 0 &&
+         audio->data_offset <= input_size &&
+         audio->data_size <= input_size - audio->data_offset;
+}
+
+size_t bytecrush_compress_bound(size_t input_size) {
+  if (input_size == 0) {
+    return 0;
+  }
+  // audio blocks are trimmed to whole sample frames, and the ranges
+  // around the samples can add two partial blocks
+  size_t block_size = BYTECRUSH_BLOCK_SIZE - BC_AUDIO_MAX_CHANNELS * 3;
+  size_t blocks     = (input_size + block_size - 1) / block_size + 2;
+  return BYTECRUSH_STREAM_HEADER_SZ + blocks * BYTECRUSH_BLOCK_HEADER_SZ +
+         input_size;
+}
+
+int bytecrush_compress_parallel(const unsigned char *input,
+                                size_t input_size,
+                                const bytecrush_audio_format_t *audio,
+                                unsigned char *output,
+                                size_t *output_size,
+                                int level,
+                                int threads) {
+  size_t capacity = *output_size;
+  *output_size    = 0;
+  if (input_size == 0) {
+    return 0;
+  }
+  if (capacity < BYTECRUSH_STREAM_HEADER_SZ) {
+    return -1;
+  }
+
+  if (level < BYTECRUSH_LEVEL_MIN) {
+    level = BYTECRUSH_LEVEL_MIN;
+  } else if (level > BYTECRUSH_LEVEL_MAX) {
+    level = BYTECRUSH_LEVEL_MAX;
+  }
+  if (!bc_audio_format_ok(audio, input_size)) {
+    audio = NULL;
+  }
+
+  // the ranges around the samples can add two partial blocks
+  size_t max_jobs = input_size / (BYTECRUSH_BLOCK_SIZE / 2) + 3;
+  bc_job_t *jobs  = (bc_job_t *)malloc(max_jobs * sizeof(bc_job_t));
+  if (!jobs) {
+    return -1;
+  }
+  size_t count = 0;
+  if (audio) {
+    // container headers and trailing chunks go through LZ77, the samples
+    // through the audio coder
+    size_t data_end = audio->data_offset + audio->data_size;
+    count += bc_plan_range(jobs + count, input, audio->data_offset, NULL);
+    count += bc_plan_range(
+      jobs + count, input + audio->data_offset, audio->data_size, audio);
+    count += bc_plan_range(
+      jobs + count, input + data_end, input_size - data_end, NULL);
+  } else {
+    count += bc_plan_range(jobs, input, input_size, NULL);
+  }
+
+  memcpy(output, BYTECRUSH_MAGIC, 3);
+  output[3] = BYTECRUSH_VERSION;
+  write_le64(output + 4, input_size);
+  write_le32(output + 12, BYTECRUSH_BLOCK_SIZE);
+  size_t out = BYTECRUSH_STREAM_HEADER_SZ;
+
+  int rc  = -1;
+  threads = bc_thread_count(threads, count);
+  if (threads > 1) {
+    rc = bc_encode_parallel(
+      jobs, count, level, audio != NULL, threads, output, capacity, &out);
+  } else {
+    // a single thread codes straight into the output
+    bc_encoder_t enc;
+    if (bc_encoder_init(&enc, level, audio != NULL) == 0) {
+      enc.output   = output;
+      enc.capacity = capacity;
+      enc.out      = out;
+      rc           = 0;
+      for (size_t i = 0; rc == 0 && i < count; i++) {
+        rc = bc_encode_block(&enc, jobs[i].src, jobs[i].raw, jobs[i].audio);
+      }
+      out = enc.out;
+      bc_encoder_free(&enc);
+    }
+  }
+
+  free(jobs);
+  if (rc == 0) {
+    *output_size = out;
+  }
+  return rc;
+}
+
+int bytecrush_compress_audio(const unsigned char *input,
+                             size_t input_size,
+                             const bytecrush_audio_format_t *audio,
+                             unsigned char *output,
+                             size_t *output_size,
+                             int level) {
+  return bytecrush_compress_parallel(
+    input, input_size, audio, output, output_size, level, 1);
+}
+
+int bytecrush_compress_level(const unsigned char *input,
+                             size_t input_size,
+                             unsigned char *output,
+                             size_t *output_size,
+                             int level) {
+  return bytecrush_compress_audio(
+    input, input_size, NULL, output, output_size, level);
+}
+
+int bytecrush_compress(const unsigned char *input,
+                       size_t input_size,
+                       unsigned char *output,
+                       size_t *output_size) {
+  return bytecrush_compress_level(
+    input, input_size, output, output_size, BYTECRUSH_LEVEL_DEFAULT);
+}
+
+int bytecrush_decompressed_size(const unsigned char *input,
+                                size_t input_size,
+                                size_t *size) {
+  if (input_size < BYTECRUSH_STREAM_HEADER_SZ ||
+      memcmp(input, BYTECRUSH_MAGIC, 3) != 0 ||
+      input[3] != BYTECRUSH_VERSION) {
+    return -1;
+  }
+  *size = (size_t)read_le64(input + 4);
+  return 0;
+}
+
+/* @brief decoder scratch space, allocated the first time a block needs it */
+typedef struct {
+  bc_audio_chan_t *chan; // audio sample buffers
+  uint8_t *lz;           // huffman decoded LZ77 sequences
+  size_t lz_cap;
+} bc_scratch_t;
+
+static void bc_scratch_free(bc_scratch_t *scratch) {
+  free(scratch->chan);
+  free(scratch->lz);
+}
+
+/**
+ * @brief decode one block into exactly raw bytes
+ * @return 0 on success, -1 on corrupt data
+ */
+static int bc_decode_block(uint8_t method,
+                           const uint8_t *src,
+                           uint32_t packed,
+                           uint8_t *dst,
+                           uint32_t raw,
+                           bc_scratch_t *scratch) {
+  uint32_t lz;
+  switch (method) {
+    case BYTECRUSH_METHOD_STORED:
+      if (packed != raw) {
+        return -1;
+      }
+      memcpy(dst, src, raw);
+      return 0;
+
+    case BYTECRUSH_METHOD_LZ77:
+      return bc_lz77_decompress_block(src, packed, dst, raw);
+
+    case BYTECRUSH_METHOD_LZ77_HUFF:
+      if (packed < BC_HUFF_HEADER) {
+        return -1;
+      }
+      lz = read_le32(src);
+      if (lz > BC_LZ77_BOUND(raw)) {
+        return -1;
+      }
+      if (scratch->lz_cap < lz) {
+        free(scratch->lz);
+        scratch->lz_cap = 0;
+        scratch->lz     = (uint8_t *)malloc(lz);
+        if (!scratch->lz) {
+          return -1;
+        }
+        scratch->lz_cap = lz;
+      }
+      if (bc_huff_decompress(src, packed, scratch->lz, lz) != 0) {
+        return -1;
+      }
+      return bc_lz77_decompress_block(scratch->lz, lz, dst, raw);
+
+    case BYTECRUSH_METHOD_AUDIO:
+      if (!scratch->chan) {
+        scratch->chan = (bc_audio_chan_t *)malloc(BC_AUDIO_MAX_CHANNELS *
+                                                  sizeof(bc_audio_chan_t));
+        if (!scratch->chan) {
+          return -1;
+        }
+      }
+      return bc_audio_decompress_block(src, packed, dst, raw, scratch->chan);
+
+    default:
+      return -1;
+  }
+}
+
+/* @brief where one block sits in the stream and in the output */
+typedef struct {
+  size_t in;  // offset of the block data in the stream
+  size_t out; // offset of the decoded bytes in the output
+  uint32_t raw;
+  uint32_t packed;
+  uint8_t method;
+} bc_block_ref_t;
+
+/*
+ * block parallel decompression. every block's place in the output is known
+ * from the headers, so workers decode straight into the output and nothing
+ * needs reordering
+ */
+typedef struct {
+  const unsigned char *input;
+  unsigned char *output;
+  const bc_block_ref_t *blocks;
+  size_t count;
+  size_t next; // next block to claim, atomic
+  int failed;  // atomic
+} bc_unpack_t;
+
+static void *bc_decompress_worker(void *arg) {
+  bc_unpack_t *job     = (bc_unpack_t *)arg;
+  bc_scratch_t scratch = {};
+
+  for (;;) {
+    size_t idx = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+    if (idx >= job->count || __atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+      break;
+    }
+    const bc_block_ref_t *b = &job->blocks[idx];
+    if (bc_decode_block(b->method,
+                        job->input + b->in,
+                        b->packed,
+                        job->output + b->out,
+                        b->raw,
+                        &scratch) != 0) {
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+      break;
+    }
+  }
+  bc_scratch_free(&scratch);
+  return NULL;
+}
+
+int bytecrush_decompress_parallel(const unsigned char *input,
+                                  size_t input_size,
+                                  unsigned char *output,
+                                  size_t *output_size,
+                                  int threads) {
+  size_t capacity = *output_size;
+  *output_size    = 0;
+  if (input_size == 0) {
+    return 0;
+  }
+
+  size_t total;
+  if (bytecrush_decompressed_size(input, input_size, &total) != 0 ||
+      total > capacity) {
+    return -1;
+  }
+
+  // every block header is at least this far apart, which bounds the index
+  size_t max_blocks =
+    (input_size - BYTECRUSH_STREAM_HEADER_SZ) / BYTECRUSH_BLOCK_HEADER_SZ;
+  bc_block_ref_t *blocks =
+    (bc_block_ref_t *)malloc((max_blocks + 1) * sizeof(bc_block_ref_t));
+  if (!blocks) {
+    return -1;
+  }
+
+  // walk and check the block headers before decoding any of them
+  size_t count = 0;
+  size_t in    = BYTECRUSH_STREAM_HEADER_SZ;
+  size_t out   = 0;
+  int rc       = 0;
+  while (in < input_size) {
+    if (input_size - in < BYTECRUSH_BLOCK_HEADER_SZ) {
+      rc = -1;
+      break;
+    }
+    const uint8_t *hdr = input + in;
+    bc_block_ref_t *b  = &blocks[count++];
+    b->method          = hdr[0];
+    b->raw             = read_le32(hdr + 1);
+    b->packed          = read_le32(hdr + 5);
+    in += BYTECRUSH_BLOCK_HEADER_SZ;
+    if (b->raw > BYTECRUSH_MAX_BLOCK_SIZE || b->packed > input_size - in ||
+        b->raw > total - out) {
+      rc = -1;
+      break;
+    }
+    b->in  = in;
+    b->out = out;
+    in += b->packed;
+    out += b->raw;
+  }
+  if (rc != 0 || out != total) {
+    free(blocks);
+    return -1;
+  }
+
+  bc_unpack_t job = {};
+  job.input       = input;
+  job.output      = output;
+  job.blocks      = blocks;
+  job.count       = count;
+
+  threads = bc_thread_count(threads, count);
+  pthread_t tids[BYTECRUSH_MAX_THREADS];
+  int started = 0;
+  for (; started < threads - 1; started++) {
+    if (pthread_create(
+          &tids[started], NULL, bc_decompress_worker, &job) != 0) {
+      break;
+    }
+  }
+  // the calling thread decodes too, and on its own if no thread started
+  bc_decompress_worker(&job);
+  for (int i = 0; i < started; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  free(blocks);
+
+  if (job.failed) {
+    return -1;
+  }
+  *output_size = out;
+  return 0;
+}
+
+int bytecrush_decompress(const unsigned char *input,
+                         size_t input_size,
+                         unsigned char *output,
+                         size_t *output_size) {
+  return bytecrush_decompress_parallel(
+    input, input_size, output, output_size, 1);
+}
+
+/* @brief where the streaming decoder is in the stream */
+typedef enum {
+  BC_DECODER_STREAM_HEADER = 0, // collecting the stream header
+  BC_DECODER_BLOCK_HEADER,      // collecting a block header
+  BC_DECODER_BLOCK_DATA,        // collecting a block's data
+  BC_DECODER_ERROR,             // the stream was corrupt
+} bc_decoder_state_e;
+
+struct bytecrush_decoder {
+  bc_decoder_state_e state;
+  bytecrush_sink_t sink;
+  void *arg;
+  uint8_t header[BYTECRUSH_STREAM_HEADER_SZ]; // stream or block header
+  size_t have;                                // bytes of the current part
+  uint64_t total;                             // decompressed stream size
+  uint64_t out;                               // bytes handed to the sink
+  uint8_t method;                             // current block's method
+  uint32_t raw;                               // current block's raw size
+  uint32_t packed;                            // current block's data size
+  uint8_t *block;                             // compressed block data
+  size_t block_cap;
+  uint8_t *raw_buf;                           // decoded block
+  size_t raw_cap;
+  bc_scratch_t scratch;                       // block decode buffers
+};
+
+bytecrush_decoder_t *bytecrush_decoder_create(bytecrush_sink_t sink,
+                                              void *arg) {
+  bytecrush_decoder_t *dec =
+    (bytecrush_decoder_t *)calloc(1, sizeof(bytecrush_decoder_t));
+  if (dec) {
+    dec->sink = sink;
+    dec->arg  = arg;
+  }
+  return dec;
+}
+
+void bytecrush_decoder_free(bytecrush_decoder_t *dec) {
+  if (!dec) {
+    return;
+  }
+  free(dec->block);
+  free(dec->raw_buf);
+  bc_scratch_free(&dec->scratch);
+  free(dec);
+}
+
+/** @brief grow a decoder buffer to hold at least size bytes */
+static int bc_decoder_reserve(uint8_t **buf, size_t *cap, size_t size) {
+  if (*cap >= size) {
+    return 0;
+  }
+  uint8_t *grown = (uint8_t *)realloc(*buf, size);
+  if (!grown) {
+    return -1;
+  }
+  *buf = grown;
+  *cap = size;
+  return 0;
+}
+
+/** @brief a block header is complete, check it and get ready for the data */
+static int bc_decoder_block_header(bytecrush_decoder_t *dec) {
+  dec->method = dec->header[0];
+  dec->raw    = read_le32(dec->header + 1);
+  dec->packed = read_le32(dec->header + 5);
+  if (dec->method > BYTECRUSH_METHOD_LZ77_HUFF ||
+      dec->raw > BYTECRUSH_MAX_BLOCK_SIZE || dec->raw > dec->total - dec->out ||
+      (dec->method == BYTECRUSH_METHOD_STORED && dec->packed != dec->raw) ||
+      (dec->method != BYTECRUSH_METHOD_STORED &&
+       dec->packed > BYTECRUSH_MAX_BLOCK_SIZE)) {
+    return -1;
+  }
+  // stored blocks go straight to the sink, nothing to buffer
+  if (dec->method != BYTECRUSH_METHOD_STORED &&
+      (bc_decoder_reserve(&dec->block, &dec->block_cap, dec->packed) != 0 ||
+       bc_decoder_reserve(&dec->raw_buf, &dec->raw_cap, dec->raw) != 0)) {
+    return -1;
+  }
+  return 0;
+}
+
+int bytecrush_decoder_feed(bytecrush_decoder_t *dec,
+                           const unsigned char *data,
+                           size_t size) {
+  while (size > 0 && dec->state != BC_DECODER_ERROR) {
+    int rc = 0;
+    size_t n;
+
+    switch (dec->state) {
+      case BC_DECODER_STREAM_HEADER:
+        n = BYTECRUSH_STREAM_HEADER_SZ - dec->have;
+        n = (size < n) ? size : n;
+        memcpy(dec->header + dec->have, data, n);
+        dec->have += n;
+        if (dec->have == BYTECRUSH_STREAM_HEADER_SZ) {
+          size_t total;
+          rc = bytecrush_decompressed_size(
+            dec->header, BYTECRUSH_STREAM_HEADER_SZ, &total);
+          dec->total = total;
+          dec->have  = 0;
+          dec->state = BC_DECODER_BLOCK_HEADER;
+        }
+        break;
+
+      case BC_DECODER_BLOCK_HEADER:
+        n = BYTECRUSH_BLOCK_HEADER_SZ - dec->have;
+        n = (size < n) ? size : n;
+        memcpy(dec->header + dec->have, data, n);
+        dec->have += n;
+        if (dec->have == BYTECRUSH_BLOCK_HEADER_SZ) {
+          rc         = bc_decoder_block_header(dec);
+          dec->have  = 0;
+          dec->state = BC_DECODER_BLOCK_DATA;
+        }
+        break;
+
+      default:
+        n = dec->packed - dec->have;
+        n = (size < n) ? size : n;
+        if (dec->method == BYTECRUSH_METHOD_STORED) {
+          rc = (n > 0) ? dec->sink(data, n, dec->arg) : 0;
+        } else {
+          memcpy(dec->block + dec->have, data, n);
+        }
+        dec->have += n;
+        if (dec->have == dec->packed) {
+          if (dec->method != BYTECRUSH_METHOD_STORED) {
+            rc = bc_decode_block(dec->method,
+                                 dec->block,
+                                 dec->packed,
+                                 dec->raw_buf,
+                                 dec->raw,
+                                 &dec->scratch);
+            if (rc == 0) {
+              rc = dec->sink(dec->raw_buf, dec->raw, dec->arg);
+            }
+          }
+          dec->out += dec->raw;
+          dec->have  = 0;
+          dec->state = BC_DECODER_BLOCK_HEADER;
+        }
+        break;
+    }
+
+    if (rc != 0) {
+      dec->state = BC_DECODER_ERROR;
+    }
+    data += n;
+    size -= n;
+  }
+  return (dec->state == BC_DECODER_ERROR) ? -1 : 0;
+}
+
+int bytecrush_decoder_finish(bytecrush_decoder_t *dec) {
+  // an empty input compresses to an empty stream
+  if (dec->state == BC_DECODER_STREAM_HEADER && dec->have == 0) {
+    return 0;
+  }
+  return (dec->state == BC_DECODER_BLOCK_HEADER && dec->have == 0 &&
+          dec->out == dec->total)
+           ? 0
+           : -1;
+}
+
+/******************************* file helpers *********************************/
+/** @brief read a whole file into a malloc'd buffer */
+static unsigned char *read_file(const char *file_path, size_t *size) {
+  long file_size = get_file_size(file_path);
+  if (file_size < 0) {
+    return NULL;
+  }
+  FILE *file = fopen(file_path, "rb");
+  if (!file) {
+    return NULL;
+  }
+  unsigned char *buffer = (unsigned char *)malloc((size_t)file_size + 1);
+  if (buffer &&
+      fread(buffer, 1, (size_t)file_size, file) != (size_t)file_size) {
+    free(buffer);
+    buffer = NULL;
+  }
+  fclose(file);
+  *size = (size_t)file_size;
+  return buffer;
+}
+
+static int write_file(const char *file_path,
+                      const unsigned char *data,
+                      size_t size) {
+  FILE *file = fopen(file_path, "wb");
+  if (!file) {
+    return -1;
+  }
+  int rc = (fwrite(data, 1, size, file) == size) ? 0 : -1;
+  fclose(file);
+  return rc;
+}
+
+int bytecrush_compress_file(const char *file_path) {
   printf("bytecrushing file %s\n", file_path);
   char output_path[256];
   snprintf(output_path, sizeof(output_path), "%s.bcrush", file_path);
+
+  size_t input_size;
+  unsigned char *input = read_file(file_path, &input_size);
+  if (!input) {
+    printf("failed to read %s\n", file_path);
+    return -1;
+  }
+
+  size_t output_size    = bytecrush_compress_bound(input_size);
+  unsigned char *output = (unsigned char *)malloc(output_size + 1);
+  int rc                = -1;
+  if (output && bytecrush_compress_parallel(input,
+                                            input_size,
+                                            NULL,
+                                            output,
+                                            &output_size,
+                                            BYTECRUSH_LEVEL_DEFAULT,
+                                            BYTECRUSH_THREADS_AUTO) == 0) {
+    rc = write_file(output_path, output, output_size);
+    printf("%zu -> %zu bytes\n", input_size, output_size);
+  }
+
+  free(output);
+  free(input);
+  return rc;
 }
 
-int main(int argc, char *argv[]) {
+int bytecrush_decompress_file(const char *file_path) {
+  size_t path_len = strlen(file_path);
+  size_t ext_len  = strlen(".bcrush");
+  if (path_len <= ext_len ||
+      strcmp(file_path + path_len - ext_len, ".bcrush") != 0) {
+    printf("%s is not a .bcrush file\n", file_path);
+    return -1;
+  }
+  char output_path[256];
+  snprintf(output_path,
+           sizeof(output_path),
+           "%.*s",
+           (int)(path_len - ext_len),
+           file_path);
 
-  bytecrush_compress(argv[1]);
+  size_t input_size;
+  unsigned char *input = read_file(file_path, &input_size);
+  if (!input) {
+    printf("failed to read %s\n", file_path);
+    return -1;
+  }
 
-  return 0;
+  size_t output_size = 0;
+  int rc             = -1;
+  if (input_size == 0 ||
+      bytecrush_decompressed_size(input, input_size, &output_size) == 0) {
+    unsigned char *output = (unsigned char *)malloc(output_size + 1);
+    if (output && bytecrush_decompress_parallel(input,
+                                                input_size,
+                                                output,
+                                                &output_size,
+                                                BYTECRUSH_THREADS_AUTO) == 0) {
+      rc = write_file(output_path, output, output_size);
+    }
+    free(output);
+  }
+
+  free(input);
+  return rc;
+}
+
+#ifdef BYTECRUSH_MAIN
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s [-d] <file>\n", argv[0]);
+    return -1;
+  }
+
+  if (argc > 2 && strcmp(argv[1], "-d") == 0) {
+    return bytecrush_decompress_file(argv[2]);
+  }
+  return bytecrush_compress_file(argv[1]);
 }
+#endif
@@ -1,25 +1,211 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 
-#define MAX_TREE_NODES 512
-#define BYTE_RANGE     256
+/*
+ * bytecrush stream layout, all integers little endian:
+ *
+ *  stream header  "BCR", version (1), raw size (8), block size (4)
+ *  block header   method (1), raw size (4), compressed size (4)
+ *  block data     compressed size bytes
+ *
+ * blocks never reference each other, so a reader can walk the block headers
+ * and hand each block to a different thread. an empty input compresses to
+ * an empty stream
+ */
+#define BYTECRUSH_MAGIC             "BCR"
+#define BYTECRUSH_VERSION           1
+#define BYTECRUSH_STREAM_HEADER_SZ  16
+#define BYTECRUSH_BLOCK_HEADER_SZ   9
+#define BYTECRUSH_BLOCK_SIZE        (128 * 1024)
+#define BYTECRUSH_MAX_BLOCK_SIZE    (16 * 1024 * 1024)
 
+/* compression levels trade match search depth for ratio */
+#define BYTECRUSH_LEVEL_MIN     1
+#define BYTECRUSH_LEVEL_MAX     9
+#define BYTECRUSH_LEVEL_DEFAULT 6
 
+/* worker threads for the parallel coders, AUTO uses one per online core */
+#define BYTECRUSH_THREADS_AUTO 0
+#define BYTECRUSH_MAX_THREADS  64
+
+/* @brief how a block's data is encoded */
+typedef enum {
+  BYTECRUSH_METHOD_STORED = 0, // raw bytes
+  BYTECRUSH_METHOD_LZ77,       // LZ77 sequences
+  BYTECRUSH_METHOD_AUDIO,      // predicted, rice coded PCM samples
+  BYTECRUSH_METHOD_LZ77_HUFF,  // LZ77 sequences, huffman coded
+} bytecrush_method_e;
+
+/* @brief where the PCM samples are in an audio file and how they're laid
+ * out. 8 bit unsigned and 16/24 bit signed little endian samples with up to
+ * 8 interleaved channels are supported */
 typedef struct {
-  uint8_t byte;
-  char code[32];
-} huffman_code_t;
+  uint16_t channels;        // interleaved channels
+  uint16_t bits_per_sample; // 8, 16 or 24
+  uint64_t data_offset;     // offset of the first sample in the file
+  uint64_t data_size;       // bytes of sample data
+} bytecrush_audio_format_t;
+
+/* @brief consumer of decompressed data, returns non-zero to stop */
+typedef int (*bytecrush_sink_t)(const unsigned char *data,
+                                size_t size,
+                                void *arg);
+
+/* @brief incremental decoder, see bytecrush_decoder_create() */
+typedef struct bytecrush_decoder bytecrush_decoder_t;
 
 typedef struct {
   uint32_t original_size;
   uint32_t compressed_size;
 } wav_header_t;
 
-huffman_code_t huffman_table[BYTE_RANGE];
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief worst case compressed size for an input, for sizing output buffers
+ */
+size_t bytecrush_compress_bound(size_t input_size);
+
+/**
+ * @brief compress a buffer at the default level
+ *
+ * @param[in]     input        data to compress
+ * @param[in]     input_size   size of the input in bytes
+ * @param[out]    output       compressed stream
+ * @param[in/out] output_size  output capacity in, compressed size out
+ *
+ * @return 0 on success, -1 if the output buffer is too small
+ */
+int bytecrush_compress(const unsigned char *input,
+                       size_t input_size,
+                       unsigned char *output,
+                       size_t *output_size);
+
+/**
+ * @brief compress a buffer at the given level (BYTECRUSH_LEVEL_MIN to
+ * BYTECRUSH_LEVEL_MAX)
+ */
+int bytecrush_compress_level(const unsigned char *input,
+                             size_t input_size,
+                             unsigned char *output,
+                             size_t *output_size,
+                             int level);
+
+/**
+ * @brief compress an audio file. the sample data is run through the lossless
+ * audio coder and the rest of the file through LZ77. falls back to
+ * bytecrush_compress_level() if the format isn't supported
+ *
+ * @param[in]     input        whole audio file
+ * @param[in]     input_size   size of the file in bytes
+ * @param[in]     audio        sample layout, may be NULL
+ * @param[out]    output       compressed stream
+ * @param[in/out] output_size  output capacity in, compressed size out
+ * @param[in]     level        compression level
+ *
+ * @return 0 on success, -1 if the output buffer is too small
+ */
+int bytecrush_compress_audio(const unsigned char *input,
+                             size_t input_size,
+                             const bytecrush_audio_format_t *audio,
+                             unsigned char *output,
+                             size_t *output_size,
+                             int level);
+
+/**
+ * @brief bytecrush_compress_audio() with the blocks spread over a pool of
+ * threads. the stream is identical to the single threaded one. at most two
+ * blocks per thread are held in memory on top of the input and output
+ *
+ * @param[in]     threads      workers, BYTECRUSH_THREADS_AUTO for one per
+ *                             core. 1 compresses on the calling thread
+ *
+ * @return 0 on success, -1 if the output buffer is too small or a thread
+ * couldn't be set up
+ */
+int bytecrush_compress_parallel(const unsigned char *input,
+                                size_t input_size,
+                                const bytecrush_audio_format_t *audio,
+                                unsigned char *output,
+                                size_t *output_size,
+                                int level,
+                                int threads);
+
+/**
+ * @brief decompress a bytecrush stream
+ *
+ * @param[in]     input        compressed stream
+ * @param[in]     input_size   size of the stream in bytes
+ * @param[out]    output       decompressed data
+ * @param[in/out] output_size  output capacity in, decompressed size out
+ *
+ * @return 0 on success, -1 on a corrupt stream or a short output buffer
+ */
+int bytecrush_decompress(const unsigned char *input,
+                         size_t input_size,
+                         unsigned char *output,
+                         size_t *output_size);
+
+/**
+ * @brief bytecrush_decompress() with the blocks decoded on a pool of
+ * threads. the block headers are all checked before any block is decoded
+ *
+ * @param[in]     threads      workers, BYTECRUSH_THREADS_AUTO for one per
+ *                             core. 1 decompresses on the calling thread
+ */
+int bytecrush_decompress_parallel(const unsigned char *input,
+                                  size_t input_size,
+                                  unsigned char *output,
+                                  size_t *output_size,
+                                  int threads);
+
+/**
+ * @brief read the decompressed size from a stream header
+ *
+ * @return 0 on success, -1 if the header is invalid
+ */
+int bytecrush_decompressed_size(const unsigned char *input,
+                                size_t input_size,
+                                size_t *size);
+
+/**
+ * @brief create a decoder that takes a stream in chunks of any size and
+ * hands each decompressed block to the sink as soon as it's complete. only
+ * one block is held in memory at a time
+ *
+ * @return the decoder, NULL if out of memory
+ */
+bytecrush_decoder_t *bytecrush_decoder_create(bytecrush_sink_t sink,
+                                              void *arg);
+
+/**
+ * @brief feed the next chunk of a stream to a decoder
+ *
+ * @return 0 on success, -1 on a corrupt stream or if the sink failed
+ */
+int bytecrush_decoder_feed(bytecrush_decoder_t *dec,
+                           const unsigned char *data,
+                           size_t size);
+
+/**
+ * @brief check that the stream ended on a block boundary with every byte
+ * the header promised
+ *
+ * @return 0 if the stream was complete, -1 otherwise
+ */
+int bytecrush_decoder_finish(bytecrush_decoder_t *dec);
 
+void bytecrush_decoder_free(bytecrush_decoder_t *dec);
 
-int bytecrush_compress(const char *file_path);
+/* file helpers, write <file>.bcrush and read it back */
+int bytecrush_compress_file(const char *file_path);
+int bytecrush_decompress_file(const char *file_path);
 
-int bytecrush_decompress(const char *file_path);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,482 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bytecrush_simd.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define BC_SIMD_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BC_SIMD_NEON 1
+#endif
+
+
+/*********************************** scalar ***********************************/
+/* the vector kernels finish their tails here, starting at sample i */
+static void fixed_residual_tail(const int32_t *x,
+                                uint32_t i,
+                                uint32_t n,
+                                uint32_t order,
+                                int32_t *res) {
+  switch (order) {
+    case 0:
+      for (; i < n; i++) {
+        res[i] = x[i];
+      }
+      break;
+    case 1:
+      for (; i < n; i++) {
+        res[i] = x[i] - x[i - 1];
+      }
+      break;
+    case 2:
+      for (; i < n; i++) {
+        res[i] = x[i] - 2 * x[i - 1] + x[i - 2];
+      }
+      break;
+    case 3:
+      for (; i < n; i++) {
+        res[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+      }
+      break;
+    default:
+      for (; i < n; i++) {
+        res[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+      }
+      break;
+  }
+}
+
+static void fixed_sad_tail(const int32_t *x,
+                           uint32_t i,
+                           uint32_t n,
+                           uint64_t *sad) {
+  for (; i < n; i++) {
+    int32_t e0 = x[i];
+    int32_t e1 = e0 - x[i - 1];
+    int32_t e2 = e1 - (x[i - 1] - x[i - 2]);
+    int32_t e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]);
+    int32_t e4 = e3 - (x[i - 1] - 3 * x[i - 2] + 3 * x[i - 3] - x[i - 4]);
+    sad[0] += (uint64_t)(e0 < 0 ? -(int64_t)e0 : e0);
+    sad[1] += (uint64_t)(e1 < 0 ? -(int64_t)e1 : e1);
+    sad[2] += (uint64_t)(e2 < 0 ? -(int64_t)e2 : e2);
+    sad[3] += (uint64_t)(e3 < 0 ? -(int64_t)e3 : e3);
+    sad[4] += (uint64_t)(e4 < 0 ? -(int64_t)e4 : e4);
+  }
+}
+
+static uint64_t rice_map_tail(const int32_t *res,
+                              uint32_t i,
+                              uint32_t n,
+                              uint32_t *u) {
+  uint64_t sum = 0;
+  for (; i < n; i++) {
+    uint32_t z = ((uint32_t)res[i] << 1) ^ (uint32_t)(res[i] >> 31);
+    if (u) {
+      u[i] = z;
+    }
+    sum += z;
+  }
+  return sum;
+}
+
+static void fixed_residual_scalar(const int32_t *x,
+                                  uint32_t n,
+                                  uint32_t order,
+                                  int32_t *res) {
+  fixed_residual_tail(x, order, n, order, res);
+}
+
+static void fixed_sad_scalar(const int32_t *x,
+                             uint32_t n,
+                             uint64_t sad[BYTECRUSH_FIXED_ORDERS]) {
+  for (uint32_t o = 0; o < BYTECRUSH_FIXED_ORDERS; o++) {
+    sad[o] = 0;
+  }
+  fixed_sad_tail(x, BYTECRUSH_FIXED_ORDERS - 1, n, sad);
+}
+
+static uint64_t rice_map_scalar(const int32_t *res, uint32_t n, uint32_t *u) {
+  return rice_map_tail(res, 0, n, u);
+}
+
+static const bytecrush_kernels_t bc_kernels_scalar = {
+  "scalar",
+  fixed_residual_scalar,
+  fixed_sad_scalar,
+  rice_map_scalar,
+};
+
+/************************************ x86 *************************************/
+/*
+ * the kernels are compiled for their instruction set with target attributes
+ * so the rest of the build doesn't need -mavx2, and only run after
+ * __builtin_cpu_supports() says the CPU has it. every residual fits in 32
+ * bits for the sample depths the coder accepts, so the lanes never overflow.
+ * absolute values and zigzag codes are widened to 64 bit before summing
+ */
+#ifdef BC_SIMD_X86
+
+/* SSE4.1, 4 samples per step */
+#define BC_SSE __attribute__((target("sse4.1")))
+
+BC_SSE static inline __m128i sse_load(const int32_t *p) {
+  return _mm_loadu_si128((const __m128i *)p);
+}
+
+/* add the 4 unsigned 32 bit lanes of v into two 64 bit lanes of acc */
+BC_SSE static inline __m128i sse_widen_add(__m128i acc, __m128i v) {
+  __m128i zero = _mm_setzero_si128();
+  acc          = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+  return _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+}
+
+BC_SSE static inline uint64_t sse_hsum64(__m128i v) {
+  return (uint64_t)_mm_cvtsi128_si64(v) + (uint64_t)_mm_extract_epi64(v, 1);
+}
+
+BC_SSE static void fixed_residual_sse41(const int32_t *x,
+                                        uint32_t n,
+                                        uint32_t order,
+                                        int32_t *res) {
+  uint32_t i = order;
+  for (; i + 4 <= n; i += 4) {
+    __m128i a = sse_load(x + i);
+    __m128i r;
+    if (order == 0) {
+      r = a;
+    } else if (order == 1) {
+      r = _mm_sub_epi32(a, sse_load(x + i - 1));
+    } else if (order == 2) {
+      __m128i b2 = _mm_slli_epi32(sse_load(x + i - 1), 1);
+      r          = _mm_add_epi32(_mm_sub_epi32(a, b2), sse_load(x + i - 2));
+    } else if (order == 3) {
+      // x[i] - x[i - 3] - 3 * (x[i - 1] - x[i - 2])
+      __m128i d  = _mm_sub_epi32(sse_load(x + i - 1), sse_load(x + i - 2));
+      __m128i ad = _mm_sub_epi32(a, sse_load(x + i - 3));
+      r          = _mm_sub_epi32(ad, _mm_add_epi32(_mm_slli_epi32(d, 1), d));
+    } else {
+      // x[i] + x[i - 4] - 4 * (x[i - 1] + x[i - 3]) + 6 * x[i - 2]
+      __m128i c  = sse_load(x + i - 2);
+      __m128i bd = _mm_add_epi32(sse_load(x + i - 1), sse_load(x + i - 3));
+      __m128i c6 = _mm_add_epi32(_mm_slli_epi32(c, 2), _mm_slli_epi32(c, 1));
+      __m128i ae = _mm_add_epi32(a, sse_load(x + i - 4));
+      r          = _mm_add_epi32(ae, _mm_sub_epi32(c6, _mm_slli_epi32(bd, 2)));
+    }
+    _mm_storeu_si128((__m128i *)(res + i), r);
+  }
+  fixed_residual_tail(x, i, n, order, res);
+}
+
+BC_SSE static void fixed_sad_sse41(const int32_t *x,
+                                   uint32_t n,
+                                   uint64_t sad[BYTECRUSH_FIXED_ORDERS]) {
+  __m128i acc[BYTECRUSH_FIXED_ORDERS];
+  for (uint32_t o = 0; o < BYTECRUSH_FIXED_ORDERS; o++) {
+    acc[o] = _mm_setzero_si128();
+  }
+
+  uint32_t i = BYTECRUSH_FIXED_ORDERS - 1;
+  for (; i + 4 <= n; i += 4) {
+    // differences of neighbouring samples, then differences of those
+    __m128i a  = sse_load(x + i);
+    __m128i b  = sse_load(x + i - 1);
+    __m128i c  = sse_load(x + i - 2);
+    __m128i d  = sse_load(x + i - 3);
+    __m128i e  = sse_load(x + i - 4);
+    __m128i e1 = _mm_sub_epi32(a, b);
+    __m128i f1 = _mm_sub_epi32(b, c);
+    __m128i g1 = _mm_sub_epi32(c, d);
+    __m128i h1 = _mm_sub_epi32(d, e);
+    __m128i e2 = _mm_sub_epi32(e1, f1);
+    __m128i f2 = _mm_sub_epi32(f1, g1);
+    __m128i g2 = _mm_sub_epi32(g1, h1);
+    __m128i e3 = _mm_sub_epi32(e2, f2);
+    __m128i e4 = _mm_sub_epi32(e3, _mm_sub_epi32(f2, g2));
+
+    acc[0] = sse_widen_add(acc[0], _mm_abs_epi32(a));
+    acc[1] = sse_widen_add(acc[1], _mm_abs_epi32(e1));
+    acc[2] = sse_widen_add(acc[2], _mm_abs_epi32(e2));
+    acc[3] = sse_widen_add(acc[3], _mm_abs_epi32(e3));
+    acc[4] = sse_widen_add(acc[4], _mm_abs_epi32(e4));
+  }
+
+  for (uint32_t o = 0; o < BYTECRUSH_FIXED_ORDERS; o++) {
+    sad[o] = sse_hsum64(acc[o]);
+  }
+  fixed_sad_tail(x, i, n, sad);
+}
+
+BC_SSE static uint64_t rice_map_sse41(const int32_t *res,
+                                      uint32_t n,
+                                      uint32_t *u) {
+  __m128i acc = _mm_setzero_si128();
+  uint32_t i  = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = sse_load(res + i);
+    __m128i z = _mm_xor_si128(_mm_slli_epi32(v, 1), _mm_srai_epi32(v, 31));
+    if (u) {
+      _mm_storeu_si128((__m128i *)(u + i), z);
+    }
+    acc = sse_widen_add(acc, z);
+  }
+  return sse_hsum64(acc) + rice_map_tail(res, i, n, u);
+}
+
+static const bytecrush_kernels_t bc_kernels_sse41 = {
+  "sse4.1",
+  fixed_residual_sse41,
+  fixed_sad_sse41,
+  rice_map_sse41,
+};
+
+/* AVX2, 8 samples per step */
+#define BC_AVX2 __attribute__((target("avx2")))
+
+BC_AVX2 static inline __m256i avx2_load(const int32_t *p) {
+  return _mm256_loadu_si256((const __m256i *)p);
+}
+
+BC_AVX2 static inline __m256i avx2_widen_add(__m256i acc, __m256i v) {
+  __m256i zero = _mm256_setzero_si256();
+  acc          = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+  return _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+}
+
+BC_AVX2 static inline uint64_t avx2_hsum64(__m256i v) {
+  __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v),
+                            _mm256_extracti128_si256(v, 1));
+  return (uint64_t)_mm_cvtsi128_si64(s) + (uint64_t)_mm_extract_epi64(s, 1);
+}
+
+BC_AVX2 static void fixed_residual_avx2(const int32_t *x,
+                                        uint32_t n,
+                                        uint32_t order,
+                                        int32_t *res) {
+  uint32_t i = order;
+  for (; i + 8 <= n; i += 8) {
+    __m256i a = avx2_load(x + i);
+    __m256i r;
+    if (order == 0) {
+      r = a;
+    } else if (order == 1) {
+      r = _mm256_sub_epi32(a, avx2_load(x + i - 1));
+    } else if (order == 2) {
+      __m256i b2 = _mm256_slli_epi32(avx2_load(x + i - 1), 1);
+      __m256i ab = _mm256_sub_epi32(a, b2);
+      r          = _mm256_add_epi32(ab, avx2_load(x + i - 2));
+    } else if (order == 3) {
+      __m256i b  = avx2_load(x + i - 1);
+      __m256i d  = _mm256_sub_epi32(b, avx2_load(x + i - 2));
+      __m256i d3 = _mm256_add_epi32(_mm256_slli_epi32(d, 1), d);
+      __m256i ad = _mm256_sub_epi32(a, avx2_load(x + i - 3));
+      r          = _mm256_sub_epi32(ad, d3);
+    } else {
+      __m256i c  = avx2_load(x + i - 2);
+      __m256i bd = _mm256_add_epi32(avx2_load(x + i - 1), avx2_load(x + i - 3));
+      __m256i c2 = _mm256_slli_epi32(c, 1);
+      __m256i c6 = _mm256_add_epi32(_mm256_slli_epi32(c, 2), c2);
+      __m256i ae = _mm256_add_epi32(a, avx2_load(x + i - 4));
+      r = _mm256_add_epi32(ae, _mm256_sub_epi32(c6, _mm256_slli_epi32(bd, 2)));
+    }
+    _mm256_storeu_si256((__m256i *)(res + i), r);
+  }
+  fixed_residual_tail(x, i, n, order, res);
+}
+
+BC_AVX2 static void fixed_sad_avx2(const int32_t *x,
+                                   uint32_t n,
+                                   uint64_t sad[BYTECRUSH_FIXED_ORDERS]) {
+  __m256i acc[BYTECRUSH_FIXED_ORDERS];
+  for (uint32_t o = 0; o < BYTECRUSH_FIXED_ORDERS; o++) {
+    acc[o] = _mm256_setzero_si256();
+  }
+
+  uint32_t i = BYTECRUSH_FIXED_ORDERS - 1;
+  for (; i + 8 <= n; i += 8) {
+    __m256i a  = avx2_load(x + i);
+    __m256i b  = avx2_load(x + i - 1);
+    __m256i c  = avx2_load(x + i - 2);
+    __m256i d  = avx2_load(x + i - 3);
+    __m256i e  = avx2_load(x + i - 4);
+    __m256i e1 = _mm256_sub_epi32(a, b);
+    __m256i f1 = _mm256_sub_epi32(b, c);
+    __m256i g1 = _mm256_sub_epi32(c, d);
+    __m256i h1 = _mm256_sub_epi32(d, e);
+    __m256i e2 = _mm256_sub_epi32(e1, f1);
+    __m256i f2 = _mm256_sub_epi32(f1, g1);
+    __m256i g2 = _mm256_sub_epi32(g1, h1);
+    __m256i e3 = _mm256_sub_epi32(e2, f2);
+    __m256i e4 = _mm256_sub_epi32(e3, _mm256_sub_epi32(f2, g2));
+
+    acc[0] = avx2_widen_add(acc[0], _mm256_abs_epi32(a));
+    acc[1] = avx2_widen_add(acc[1], _mm256_abs_epi32(e1));
+    acc[2] = avx2_widen_add(acc[2], _mm256_abs_epi32(e2));
+    acc[3] = avx2_widen_add(acc[3], _mm256_abs_epi32(e3));
+    acc[4] = avx2_widen_add(acc[4], _mm256_abs_epi32(e4));
+  }
+
+  for (uint32_t o = 0; o < BYTECRUSH_FIXED_ORDERS; o++) {
+    sad[o] = avx2_hsum64(acc[o]);
+  }
+  fixed_sad_tail(x, i, n, sad);
+}
+
+BC_AVX2 static uint64_t rice_map_avx2(const int32_t *res,
+                                      uint32_t n,
+                                      uint32_t *u) {
+  __m256i acc = _mm256_setzero_si256();
+  uint32_t i  = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = avx2_load(res + i);
+    __m256i z =
+      _mm256_xor_si256(_mm256_slli_epi32(v, 1), _mm256_srai_epi32(v, 31));
+    if (u) {
+      _mm256_storeu_si256((__m256i *)(u + i), z);
+    }
+    acc = avx2_widen_add(acc, z);
+  }
+  return avx2_hsum64(acc) + rice_map_tail(res, i, n, u);
+}
+
+static const bytecrush_kernels_t bc_kernels_avx2 = {
+  "avx2",
+  fixed_residual_avx2,
+  fixed_sad_avx2,
+  rice_map_avx2,
+};
+
+#endif // BC_SIMD_X86
+
+/*********************************** NEON *************************************/
+/* NEON is part of the aarch64 baseline, so there's nothing to detect */
+#ifdef BC_SIMD_NEON
+
+static void fixed_residual_neon(const int32_t *x,
+                                uint32_t n,
+                                uint32_t order,
+                                int32_t *res) {
+  uint32_t i = order;
+  for (; i + 4 <= n; i += 4) {
+    int32x4_t a = vld1q_s32(x + i);
+    int32x4_t r;
+    if (order == 0) {
+      r = a;
+    } else if (order == 1) {
+      r = vsubq_s32(a, vld1q_s32(x + i - 1));
+    } else if (order == 2) {
+      int32x4_t b2 = vshlq_n_s32(vld1q_s32(x + i - 1), 1);
+      r            = vaddq_s32(vsubq_s32(a, b2), vld1q_s32(x + i - 2));
+    } else if (order == 3) {
+      int32x4_t d  = vsubq_s32(vld1q_s32(x + i - 1), vld1q_s32(x + i - 2));
+      int32x4_t ad = vsubq_s32(a, vld1q_s32(x + i - 3));
+      r            = vsubq_s32(ad, vmulq_n_s32(d, 3));
+    } else {
+      int32x4_t bd = vaddq_s32(vld1q_s32(x + i - 1), vld1q_s32(x + i - 3));
+      int32x4_t c6 = vmulq_n_s32(vld1q_s32(x + i - 2), 6);
+      int32x4_t ae = vaddq_s32(a, vld1q_s32(x + i - 4));
+      r            = vaddq_s32(ae, vsubq_s32(c6, vshlq_n_s32(bd, 2)));
+    }
+    vst1q_s32(res + i, r);
+  }
+  fixed_residual_tail(x, i, n, order, res);
+}
+
+static void fixed_sad_neon(const int32_t *x,
+                           uint32_t n,
+                           uint64_t sad[BYTECRUSH_FIXED_ORDERS]) {
+  uint64x2_t acc[BYTECRUSH_FIXED_ORDERS];
+  for (uint32_t o = 0; o < BYTECRUSH_FIXED_ORDERS; o++) {
+    acc[o] = vdupq_n_u64(0);
+  }
+
+  uint32_t i = BYTECRUSH_FIXED_ORDERS - 1;
+  for (; i + 4 <= n; i += 4) {
+    int32x4_t a  = vld1q_s32(x + i);
+    int32x4_t b  = vld1q_s32(x + i - 1);
+    int32x4_t c  = vld1q_s32(x + i - 2);
+    int32x4_t d  = vld1q_s32(x + i - 3);
+    int32x4_t e  = vld1q_s32(x + i - 4);
+    int32x4_t e1 = vsubq_s32(a, b);
+    int32x4_t f1 = vsubq_s32(b, c);
+    int32x4_t g1 = vsubq_s32(c, d);
+    int32x4_t h1 = vsubq_s32(d, e);
+    int32x4_t e2 = vsubq_s32(e1, f1);
+    int32x4_t f2 = vsubq_s32(f1, g1);
+    int32x4_t g2 = vsubq_s32(g1, h1);
+    int32x4_t e3 = vsubq_s32(e2, f2);
+    int32x4_t e4 = vsubq_s32(e3, vsubq_s32(f2, g2));
+
+    // pairwise widening adds keep the sums in 64 bit lanes
+    acc[0] = vpadalq_u32(acc[0], vreinterpretq_u32_s32(vabsq_s32(a)));
+    acc[1] = vpadalq_u32(acc[1], vreinterpretq_u32_s32(vabsq_s32(e1)));
+    acc[2] = vpadalq_u32(acc[2], vreinterpretq_u32_s32(vabsq_s32(e2)));
+    acc[3] = vpadalq_u32(acc[3], vreinterpretq_u32_s32(vabsq_s32(e3)));
+    acc[4] = vpadalq_u32(acc[4], vreinterpretq_u32_s32(vabsq_s32(e4)));
+  }
+
+  for (uint32_t o = 0; o < BYTECRUSH_FIXED_ORDERS; o++) {
+    sad[o] = vaddvq_u64(acc[o]);
+  }
+  fixed_sad_tail(x, i, n, sad);
+}
+
+static uint64_t rice_map_neon(const int32_t *res, uint32_t n, uint32_t *u) {
+  uint64x2_t acc = vdupq_n_u64(0);
+  uint32_t i     = 0;
+  for (; i + 4 <= n; i += 4) {
+    int32x4_t v  = vld1q_s32(res + i);
+    uint32x4_t z = vreinterpretq_u32_s32(
+      veorq_s32(vshlq_n_s32(v, 1), vshrq_n_s32(v, 31)));
+    if (u) {
+      vst1q_u32(u + i, z);
+    }
+    acc = vpadalq_u32(acc, z);
+  }
+  return vaddvq_u64(acc) + rice_map_tail(res, i, n, u);
+}
+
+static const bytecrush_kernels_t bc_kernels_neon = {
+  "neon",
+  fixed_residual_neon,
+  fixed_sad_neon,
+  rice_map_neon,
+};
+
+#endif // BC_SIMD_NEON
+
+/********************************** dispatch **********************************/
+size_t bytecrush_kernels_available(const bytecrush_kernels_t **list,
+                                   size_t max) {
+  size_t count = 0;
+  if (count < max) {
+    list[count++] = &bc_kernels_scalar;
+  }
+#ifdef BC_SIMD_X86
+  __builtin_cpu_init();
+  if (count < max && __builtin_cpu_supports("sse4.1")) {
+    list[count++] = &bc_kernels_sse41;
+  }
+  if (count < max && __builtin_cpu_supports("avx2")) {
+    list[count++] = &bc_kernels_avx2;
+  }
+#endif
+#ifdef BC_SIMD_NEON
+  if (count < max) {
+    list[count++] = &bc_kernels_neon;
+  }
+#endif
+  return count;
+}
+
+const bytecrush_kernels_t *bytecrush_kernels(void) {
+  // the list is ordered narrowest to widest
+  const bytecrush_kernels_t *list[4];
+  size_t count = bytecrush_kernels_available(list, 4);
+  return list[count - 1];
+}
+
+const bytecrush_kernels_t *bytecrush_kernels_scalar(void) {
+  return &bc_kernels_scalar;
+}
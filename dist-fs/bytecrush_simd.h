@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* fixed polynomial predictor orders 0 to 4 */
+#define BYTECRUSH_FIXED_ORDERS 5
+
+/*
+ * vectorized inner loops of the audio coder. every table computes exactly
+ * what the scalar one does, so streams don't depend on the CPU that wrote
+ * them. bytecrush_kernels() picks the widest one the CPU supports the first
+ * time it's called
+ */
+typedef struct {
+  const char *name;
+
+  /* residual of the fixed predictor of the given order for samples order to
+   * n - 1. res[0, order) is left alone */
+  void (*fixed_residual)(const int32_t *x,
+                         uint32_t n,
+                         uint32_t order,
+                         int32_t *res);
+
+  /* sum of absolute residuals of every fixed order over samples 4 to n - 1,
+   * so the orders are compared over the same samples */
+  void (*fixed_sad)(const int32_t *x,
+                    uint32_t n,
+                    uint64_t sad[BYTECRUSH_FIXED_ORDERS]);
+
+  /* zigzag map residuals to the unsigned values that get rice coded. returns
+   * their sum, which is what the rice parameter is picked from. u may be
+   * NULL if only the sum is wanted */
+  uint64_t (*rice_map)(const int32_t *res, uint32_t n, uint32_t *u);
+} bytecrush_kernels_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* @brief best kernels for this CPU */
+const bytecrush_kernels_t *bytecrush_kernels(void);
+
+/* @brief plain C kernels, the reference the others are tested against */
+const bytecrush_kernels_t *bytecrush_kernels_scalar(void);
+
+/**
+ * @brief every kernel table this CPU can run, scalar first
+ *
+ * @param[out] list  receives up to max tables
+ * @param[in]  max   capacity of list
+ *
+ * @return number of tables written
+ */
+size_t bytecrush_kernels_available(const bytecrush_kernels_t **list,
+                                   size_t max);
+
+#ifdef __cplusplus
+}
+#endif
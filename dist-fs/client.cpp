@@ -3,13 +3,128 @@
  */
 #include <iostream>
 #include <cstring>
+#include <vector>
+#include <unistd.h>
 
 #include "utils.hpp"
+#include "md_sync.hpp"
 #include "comms/comms.h"
 #include "comms/packet.h"
 
 
-int main() {
+static void print_usage(const char *program_name) {
+  printf("Usage: %s [OPTIONS]\n", program_name);
+  printf("Options:\n");
+  printf("  -h, --help               Print usage of %s\n", program_name);
+  printf("  -u, --upload <file>      Upload the specified file to the host\n");
+  printf(
+    "  -d, --download <file>    Download the specified file from the host\n");
+  printf("  -D, --delete <file>      Delete the specified file on the host\n");
+  printf("  -l, --list               List all files on the host\n");
+  printf("  -p, --page <sort>[:<offset>[:<limit>]]\n"
+         "                           List a page of files sorted by time, "
+         "size, name\n"
+         "                           or type, a leading - sorts descending\n");
+  printf("  -y, --sync <file>        Bring the copy of the listing kept in "
+         "<file>\n"
+         "                           up to date and list it\n");
+}
+
+/* sort keys of a list page, in the host's md_index_key_e order */
+static const char *list_keys[] = {"time", "size", "name", "type"};
+
+static int parse_page(const char *arg, dist_fs_list_query_t *query) {
+  memset(query, 0, sizeof(*query));
+  query->type = DIST_FS_LIST_ANY_TYPE;
+  if (*arg == '-') {
+    query->flags |= DIST_FS_LIST_DESCENDING;
+    arg++;
+  }
+
+  size_t key_len = strcspn(arg, ":");
+  size_t key     = 0;
+  while (key < sizeof(list_keys) / sizeof(list_keys[0]) &&
+         (strlen(list_keys[key]) != key_len ||
+          strncmp(arg, list_keys[key], key_len) != 0)) {
+    key++;
+  }
+  if (key == sizeof(list_keys) / sizeof(list_keys[0])) {
+    return -1;
+  }
+  query->key = (uint8_t)key;
+
+  if (arg[key_len] == ':' &&
+      sscanf(arg + key_len + 1, "%u:%u", &query->offset, &query->limit) < 1) {
+    return -1;
+  }
+  return 0;
+}
+
+/* reads the copy of the listing kept in path, fetches what changed since and
+ * writes the copy back */
+static int sync_files(comm_context_t *comm_ctx, const char *path) {
+  md_sync_header_t header = {};
+  std::vector<md_sync_entry_t> files;
+
+  FILE *copy = fopen(path, "rb");
+  if (copy) {
+    std::vector<uint8_t> bytes;
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), copy)) > 0) {
+      bytes.insert(bytes.end(), buf, buf + len);
+    }
+    fclose(copy);
+    // a copy that doesn't decode is replaced by a full listing
+    if (md_sync_apply(&header, files, bytes.data(), bytes.size()) != 0) {
+      LOG(WARN, "Ignoring unreadable listing copy {%s}", path);
+      header = {};
+      files.clear();
+    }
+  }
+
+  char *listing      = nullptr;
+  size_t listing_len = 0;
+  FILE *stream       = open_memstream(&listing, &listing_len);
+  if (!stream) {
+    LOG(ERR, "Failed to buffer the binary listing");
+    return -1;
+  }
+  int rc = sync_command(comm_ctx, header.epoch, header.generation, stream);
+  fclose(stream);
+  if (rc == 0) {
+    LOG(INFO, "Received %zu byte binary listing", listing_len);
+    rc = md_sync_apply(&header, files, (uint8_t *)listing, listing_len);
+  }
+  free(listing);
+  if (rc != 0) {
+    return rc;
+  }
+
+  std::vector<uint8_t> out;
+  md_sync_begin(out);
+  for (const auto &file : files) {
+    md_sync_append(out, file);
+  }
+  md_sync_end(out, &header);
+
+  copy = fopen(path, "wb");
+  if (!copy || fwrite(out.data(), 1, out.size(), copy) != out.size()) {
+    LOG(ERR, "Failed to write listing copy {%s}", path);
+    if (copy) {
+      fclose(copy);
+    }
+    return -1;
+  }
+  fclose(copy);
+
+  for (const auto &file : files) {
+    printf("%s\t%lu\n", file.name, file.size);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
   // comm_context_t *comm_ctx = comm_init(COMMS_UART, "/dev/serial0", 4000000);
 
   comm_context_t *comm_ctx = comm_init(COMMS_NETWORK, "192.168.86.56", 0);
@@ -24,19 +139,73 @@ int main() {
     return -1;
   }
 
-  /*
-    // send a test packet first
-    uint8_t buffer[4] = {0xDE, 0xAD, 0xBE, 0xEF};
-    const uint16_t buffer_size = sizeof(buffer) / sizeof(buffer[0]);
-    test_packet(comm_ctx, buffer, buffer_size);
-  */
+  // agree on a link codec first, an older host just leaves the link raw
+  if (hello_command(comm_ctx) != 0) {
+    LOG(WARN, "Link codec negotiation failed, sending raw frames");
+  }
 
-  int rc = list_files_command(comm_ctx);
-  LOG(INFO, "list_files_command() rc: %d", rc);
+  int option;
+  int rc = 0;
 
-  // rc = upload_files_command(comm_ctx,
-  // "../test_files/wavs/SPRING_ARC_VOL.3(120BPM)_v4.wav"); LOG(INFO,
-  // "upload_files_command() rc: %d", rc);
+  // with no arguments keep the old behaviour of listing the host's files
+  if (argc < 2) {
+    rc = list_files_command(comm_ctx);
+    LOG(INFO, "list_files_command() rc: %d", rc);
+    return rc;
+  }
 
-  return 0;
+  dist_fs_list_query_t query;
+  while ((option = getopt(argc, argv, "u:d:D:lp:y:h")) != -1) {
+    switch (option) {
+      case 'u': // --upload
+        rc = upload_files_command(comm_ctx, optarg);
+        LOG(INFO, "upload_files_command() rc: %d", rc);
+        break;
+
+      case 'd': // --download
+        rc = download_files_command(comm_ctx, optarg);
+        LOG(INFO, "download_files_command() rc: %d", rc);
+        break;
+
+      case 'D': // --delete
+        rc = delete_files_command(comm_ctx, optarg);
+        LOG(INFO, "delete_files_command() rc: %d", rc);
+        break;
+
+      case 'l': // --list
+        rc = list_files_command(comm_ctx);
+        LOG(INFO, "list_files_command() rc: %d", rc);
+        break;
+
+      case 'p': // --page
+        if (parse_page(optarg, &query) != 0) {
+          LOG(ERR, "Invalid page: %s", optarg);
+          print_usage(argv[0]);
+          return -1;
+        }
+        rc = list_page_command(comm_ctx, &query);
+        LOG(INFO, "list_page_command() rc: %d", rc);
+        break;
+
+      case 'y': // --sync
+        rc = sync_files(comm_ctx, optarg);
+        LOG(INFO, "sync_files() rc: %d", rc);
+        break;
+
+      case 'h': // --help
+        print_usage(argv[0]);
+        break;
+
+      default:
+        LOG(ERR, "Unknown option: -%c", option);
+        print_usage(argv[0]);
+        return -1;
+    }
+  }
+
+  LOG(INFO,
+      "Link tx %lu bytes on the wire for %lu raw",
+      comm_ctx->tx_wire_bytes,
+      comm_ctx->tx_raw_bytes);
+  return rc;
 }
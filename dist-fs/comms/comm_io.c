@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "../utils.hpp"
+#include "../metrics.hpp"
+#include "comm_io.h"
+
+/** @brief back off while waiting on the other side of a ring */
+static void comm_io_backoff(unsigned spins) {
+  if (spins < 64) {
+    sched_yield();
+  } else {
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 100 * 1000};
+    nanosleep(&ts, NULL);
+  }
+}
+
+/** @brief milliseconds on the monotonic clock */
+static uint64_t comm_io_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void *comm_io_thread(void *arg) {
+  comm_io_t *io       = (comm_io_t *)arg;
+  comm_context_t *ctx = io->ctx;
+  comm_driver_t *drv  = ctx->driver;
+
+  LOG(INFO, "I/O thread started for comm type {%d}", ctx->type);
+
+  while (__atomic_load_n(&io->running, __ATOMIC_ACQUIRE)) {
+    // drain pending transmit data first, in as few driver calls as the ring
+    // layout allows
+    const uint8_t *tx_ptr = NULL;
+    size_t tx_len         = ring_read_ptr(&io->tx, &tx_ptr);
+    if (tx_len > 0) {
+      struct iovec iov = {.iov_base = (void *)tx_ptr, .iov_len = tx_len};
+      uint64_t start   = metrics_now_ns();
+      int w            = drv->writev(ctx, &iov, 1, COMM_IO_POLL_MS);
+      if (w != -ETIMEDOUT) {
+        metrics_op(METRICS_LINK_WRITE, start, w > 0 ? (uint64_t)w : 0, w > 0);
+      }
+      if (w > 0) {
+        ring_consume(&io->tx, (size_t)w);
+        io->tx_bytes += (uint64_t)w;
+      } else if (w != -ETIMEDOUT) {
+        LOG(ERR, "I/O thread write failed: %d", w);
+      }
+    }
+
+    // then read straight into the rx ring. don't wait on the driver if there
+    // is more to transmit
+    uint8_t *rx_ptr = NULL;
+    size_t rx_len   = ring_write_ptr(&io->rx, &rx_ptr);
+    metrics_set(METRICS_LINK_RX_QUEUED, (int64_t)ring_count(&io->rx));
+    if (rx_len == 0) {
+      io->rx_stalls++;
+      metrics_add(METRICS_LINK_RX_STALLS, 1);
+      comm_io_backoff(UINT32_MAX);
+      continue;
+    }
+
+    uint16_t timeout_ms = ring_count(&io->tx) > 0 ? 0 : COMM_IO_POLL_MS;
+
+    int r = drv->read(ctx, rx_ptr, (uint32_t)rx_len, timeout_ms);
+    if (r > 0) {
+      ring_commit(&io->rx, (size_t)r);
+      io->rx_bytes += (uint64_t)r;
+      metrics_add(METRICS_LINK_RX_BYTES, (uint64_t)r);
+    }
+  }
+
+  LOG(INFO,
+      "I/O thread stopped, rx {%lu} bytes, tx {%lu} bytes, {%lu} rx stalls",
+      io->rx_bytes,
+      io->tx_bytes,
+      io->rx_stalls);
+  return NULL;
+}
+
+int comm_io_start(comm_io_t *io,
+                  comm_context_t *ctx,
+                  size_t rx_size,
+                  size_t tx_size) {
+  if (!io || !ctx || !ctx->driver || !ctx->driver->read ||
+      !ctx->driver->writev)
+    return -EINVAL;
+
+  memset(io, 0, sizeof(*io));
+  io->ctx = ctx;
+
+  int rc = ring_init(&io->rx, rx_size);
+  if (rc < 0) {
+    LOG(ERR, "Failed to allocate rx ring of {%zu} bytes", rx_size);
+    return rc;
+  }
+  rc = ring_init(&io->tx, tx_size);
+  if (rc < 0) {
+    LOG(ERR, "Failed to allocate tx ring of {%zu} bytes", tx_size);
+    ring_free(&io->rx);
+    return rc;
+  }
+
+  __atomic_store_n(&io->running, 1, __ATOMIC_RELEASE);
+  rc = pthread_create(&io->thread, NULL, comm_io_thread, io);
+  if (rc != 0) {
+    LOG(ERR, "Failed to start I/O thread: %d", rc);
+    ring_free(&io->rx);
+    ring_free(&io->tx);
+    return -rc;
+  }
+  return 0;
+}
+
+void comm_io_stop(comm_io_t *io) {
+  if (!io || !__atomic_load_n(&io->running, __ATOMIC_ACQUIRE))
+    return;
+
+  __atomic_store_n(&io->running, 0, __ATOMIC_RELEASE);
+  pthread_join(io->thread, NULL);
+  ring_free(&io->rx);
+  ring_free(&io->tx);
+}
+
+int comm_io_decode(comm_io_t *io,
+                   packet_parser_t *parser,
+                   uint16_t timeout_ms) {
+  uint64_t deadline = comm_io_now_ms() + timeout_ms;
+  unsigned spins    = 0;
+  int frames        = 0;
+
+  while (true) {
+    // parse in place, one contiguous region of the ring at a time
+    const uint8_t *ptr = NULL;
+    size_t len         = ring_read_ptr(&io->rx, &ptr);
+    if (len > 0) {
+      frames += (int)packet_parser_feed(parser, ptr, len);
+      ring_consume(&io->rx, len);
+      continue;
+    }
+
+    if (frames > 0 || comm_io_now_ms() >= deadline) {
+      break;
+    }
+    comm_io_backoff(spins++);
+  }
+
+  return frames > 0 ? frames : -ETIMEDOUT;
+}
+
+int comm_io_send(comm_io_t *io,
+                 const struct iovec *iov,
+                 int iovcnt,
+                 uint16_t timeout_ms) {
+  uint64_t deadline = comm_io_now_ms() + timeout_ms;
+  size_t total      = 0;
+  unsigned spins    = 0;
+
+  for (int i = 0; i < iovcnt; i++) {
+    total += iov[i].iov_len;
+  }
+  if (total > io->tx.capacity) {
+    return -EMSGSIZE;
+  }
+
+  // the frame goes in whole or not at all, part of one left in the ring
+  // would reach the peer and throw its parser out of step
+  while (ring_space(&io->tx) < total) {
+    if (comm_io_now_ms() >= deadline) {
+      return -ETIMEDOUT;
+    }
+    comm_io_backoff(spins++);
+  }
+  for (int i = 0; i < iovcnt; i++) {
+    ring_push(&io->tx, (const uint8_t *)iov[i].iov_base, iov[i].iov_len);
+  }
+
+  return (int)total;
+}
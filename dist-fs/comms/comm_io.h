@@ -0,0 +1,72 @@
+/**
+ * per transport I/O thread. the thread owns the driver and moves bytes
+ * between it and a pair of SPSC rings, so packet processing never blocks
+ * the link and a slow handler can't cause receive overruns
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "comms.h"
+#include "packet.h"
+#include "ring.h"
+
+/** @brief default ring sizes, big enough to ride out long handler stalls */
+#define COMM_IO_RX_RING_SIZE (1 << 20)
+#define COMM_IO_TX_RING_SIZE (1 << 20)
+/** @brief how long the I/O thread waits on the driver per iteration */
+#define COMM_IO_POLL_MS 5
+
+/** @brief I/O thread state for a single transport */
+typedef struct {
+  comm_context_t *ctx; // transport pumped by this thread
+  ring_t rx;           // driver -> processing thread
+  ring_t tx;           // processing thread -> driver
+  pthread_t thread;    // I/O thread handle
+  int running;         // cleared to stop the thread
+  uint64_t rx_bytes;   // bytes received from the driver
+  uint64_t tx_bytes;   // bytes handed to the driver
+  uint64_t rx_stalls;  // times the rx ring was full when data was pending
+} comm_io_t;
+
+/**
+ * @brief allocate the rings and start the I/O thread for a transport
+ *
+ * @param[in] io        I/O state to initialize
+ * @param[in] ctx       initialized comm context
+ * @param[in] rx_size   receive ring size in bytes
+ * @param[in] tx_size   transmit ring size in bytes
+ *
+ * @return 0 on success, < 0 on failure
+ */
+int comm_io_start(comm_io_t *io,
+                  comm_context_t *ctx,
+                  size_t rx_size,
+                  size_t tx_size);
+
+/** @brief stop the I/O thread and free the rings */
+void comm_io_stop(comm_io_t *io);
+
+/**
+ * @brief processing thread: feed everything received so far to the parser,
+ * waiting up to timeout_ms for data if none is pending
+ *
+ * @return frames decoded, < 0 on timeout
+ */
+int comm_io_decode(comm_io_t *io, packet_parser_t *parser, uint16_t timeout_ms);
+
+/**
+ * @brief processing thread: queue buffers for transmission. returns once
+ * everything is in the tx ring, not when it has been sent. the buffers are
+ * queued whole or, on a timeout, not at all
+ *
+ * @return bytes queued, -ETIMEDOUT if the ring didn't free up in time,
+ * -EMSGSIZE if the buffers are larger than the ring
+ */
+int comm_io_send(comm_io_t *io,
+                 const struct iovec *iov,
+                 int iovcnt,
+                 uint16_t timeout_ms);
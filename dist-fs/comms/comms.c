@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/uio.h>
 
 #include "../utils.hpp"
 #include "comms.h"
@@ -73,3 +77,59 @@ comm_init(comm_types_e type, const char *device, uint32_t baud) {
   }
   return &gl_comm_ctx;
 }
+
+/** @brief shared writev() loop for fd based drivers */
+int comm_fd_writev(int fd,
+                   const struct iovec *iov,
+                   int iovcnt,
+                   uint16_t timeout_ms) {
+  if (!iov || iovcnt <= 0 || iovcnt > COMMS_MAX_IOV)
+    return -EINVAL;
+
+  // work on a local copy of the vector so partial writes can advance it
+  struct iovec vec[COMMS_MAX_IOV];
+  memcpy(vec, iov, sizeof(struct iovec) * iovcnt);
+
+  struct iovec *cur     = vec;
+  int remaining         = iovcnt;
+  struct pollfd pfd     = {.fd = fd, .events = POLLOUT, .revents = 0};
+  ssize_t bytes_written = 0;
+
+  // skip over any leading empty buffers
+  while (remaining > 0 && cur->iov_len == 0) {
+    cur++;
+    remaining--;
+  }
+
+  while (remaining > 0) {
+    // on timeout or error, report what already went out so callers don't
+    // resend it
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret == 0) {
+      return bytes_written > 0 ? (int)bytes_written : -ETIMEDOUT;
+    } else if (ret < 0 || !(pfd.revents & POLLOUT)) {
+      return bytes_written > 0 ? (int)bytes_written : -errno;
+    }
+
+    ssize_t w = writev(fd, cur, remaining);
+    if (w < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      return bytes_written > 0 ? (int)bytes_written : -errno;
+    }
+    bytes_written += w;
+
+    // drop fully written buffers and advance into a partially written one
+    while (remaining > 0 && (size_t)w >= cur->iov_len) {
+      w -= cur->iov_len;
+      cur++;
+      remaining--;
+    }
+    if (remaining > 0) {
+      cur->iov_base = (uint8_t *)cur->iov_base + w;
+      cur->iov_len -= w;
+    }
+  }
+
+  return (int)bytes_written;
+}
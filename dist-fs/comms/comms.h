@@ -6,10 +6,14 @@
 #include <time.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 
 typedef struct comm_driver_t comm_driver_t;
 
+/** @brief max number of buffers accepted by a single writev() call */
+#define COMMS_MAX_IOV 8
+
 typedef enum {
   COMMS_SPI = 0,
   COMMS_NETWORK,
@@ -30,6 +34,9 @@ typedef struct {
   char device[128];
   comm_driver_t *driver;
   network_context_t network_ctx;
+  uint8_t codec;          // negotiated link codec (link_codec_e)
+  uint64_t tx_raw_bytes;  // payload bytes handed to the link
+  uint64_t tx_wire_bytes; // payload bytes sent after compression
 } comm_context_t;
 
 typedef struct comm_driver_t {
@@ -84,6 +91,22 @@ typedef struct comm_driver_t {
                uint8_t *tx,
                uint32_t tx_sz,
                uint16_t timeout_ms);
+  /**
+   * @brief write a scatter/gather list of buffers to the comms stream. this
+   * lets callers send a header and a payload that live in separate buffers
+   * without first copying them into one contiguous packet
+   *
+   * @param[in] ctx       comm context pointer
+   * @param[in] iov       buffers to send, in order
+   * @param[in] iovcnt    number of buffers in iov (<= COMMS_MAX_IOV)
+   * @param[in] timout_ms timeout after given time
+   *
+   * @return bytes written, < 0 on failure
+   */
+  int (*writev)(comm_context_t *ctx,
+                const struct iovec *iov,
+                int iovcnt,
+                uint16_t timeout_ms);
   /**
    * @brief some comms specific ioctl operation
    *
@@ -100,4 +123,20 @@ typedef struct comm_driver_t {
  */
 comm_context_t *comm_init(comm_types_e type, const char *device, uint32_t baud);
 
+/**
+ * @brief writev() helper for file descriptor backed drivers. handles partial
+ * writes and polls for POLLOUT between them
+ *
+ * @param[in] fd          file descriptor to write to
+ * @param[in] iov         buffers to send, in order
+ * @param[in] iovcnt      number of buffers in iov (<= COMMS_MAX_IOV)
+ * @param[in] timeout_ms  timeout while waiting for the fd to become writable
+ *
+ * @return bytes written, < 0 on failure
+ */
+int comm_fd_writev(int fd,
+                   const struct iovec *iov,
+                   int iovcnt,
+                   uint16_t timeout_ms);
+
 #endif
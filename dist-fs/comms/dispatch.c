@@ -0,0 +1,446 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <vector>
+
+#include "../utils.hpp"
+#include "../storage.hpp"
+#include "../md_index.hpp"
+#include "../md_sync.hpp"
+#include "../metrics.hpp"
+#include "dispatch.h"
+#include "link_codec.h"
+
+/** @brief how long to wait for room in the tx ring per response frame */
+#define DISPATCH_SEND_TIMEOUT_MS 1000
+
+/** @brief queue a single response frame on the I/O thread */
+static int send_response(dispatch_context_t *dctx,
+                         dist_fs_ops_e command,
+                         uint8_t flags,
+                         const uint8_t *payload,
+                         uint32_t payload_size) {
+  uint8_t header[DIST_FS_HEADER_SIZE];
+  uint8_t packed[DIST_FS_MAX_PAYLOAD_SIZE];
+
+  // comm_io_send() copies the frame into the tx ring, so a compressed
+  // payload can live on the stack
+  uint32_t packed_size =
+    packet_compress(dctx->io->ctx, &flags, payload, payload_size, packed);
+  if (packed_size > 0) {
+    payload      = packed;
+    payload_size = packed_size;
+  }
+  encode_packet(
+    command, flags | DIST_FS_FLAG_RESPONSE, nullptr, payload_size, header);
+
+  struct iovec iov[2] = {
+    {.iov_base = header, .iov_len = DIST_FS_HEADER_SIZE},
+    {.iov_base = (void *)payload, .iov_len = payload_size},
+  };
+  int ret = comm_io_send(
+    dctx->io, iov, payload_size > 0 ? 2 : 1, DISPATCH_SEND_TIMEOUT_MS);
+  return (ret == (int)(DIST_FS_HEADER_SIZE + payload_size)) ? 0 : -1;
+}
+
+/** @brief answer a request with an error code */
+static void send_error(dispatch_context_t *dctx,
+                       dist_fs_ops_e command,
+                       int32_t status) {
+  uint8_t payload[4] = {
+    (uint8_t)(status >> 24),
+    (uint8_t)(status >> 16),
+    (uint8_t)(status >> 8),
+    (uint8_t)status,
+  };
+  LOG(ERR, "Command {%d} failed with {%d}", command, status);
+  send_response(dctx,
+                command,
+                DIST_FS_FLAG_START | DIST_FS_FLAG_END | DIST_FS_FLAG_ERROR,
+                payload,
+                sizeof(payload));
+}
+
+/** @brief copy a file name payload into a NUL terminated buffer */
+static bool payload_to_name(const dist_fs_packet_t *packet,
+                            char *name,
+                            size_t name_sz) {
+  if (packet->payload_size == 0 || packet->payload_size >= name_sz) {
+    return false;
+  }
+  memcpy(name, packet->payload, packet->payload_size);
+  name[packet->payload_size] = '\0';
+  return true;
+}
+
+/* request handlers */
+
+/** @brief send "<name>\t<size>\n" lines, packing as many as fit per frame */
+static void send_list(dispatch_context_t *dctx,
+                      const std::vector<storage_metadata_t> &entries) {
+  std::vector<uint8_t> chunk;
+  chunk.reserve(DIST_FS_CHUNK_SIZE);
+  uint8_t flags = DIST_FS_FLAG_START;
+
+  for (const auto &entry : entries) {
+    char line[320];
+    int len = snprintf(
+      line, sizeof(line), "%s\t%zu\n", entry.filename, entry.size);
+    if (len <= 0) {
+      continue;
+    }
+    if (chunk.size() + (size_t)len > DIST_FS_CHUNK_SIZE) {
+      send_response(
+        dctx, DIST_FS_LIST, flags, chunk.data(), (uint32_t)chunk.size());
+      chunk.clear();
+      flags = 0;
+    }
+    chunk.insert(chunk.end(), line, line + len);
+  }
+
+  send_response(dctx,
+                DIST_FS_LIST,
+                flags | DIST_FS_FLAG_END,
+                chunk.data(),
+                (uint32_t)chunk.size());
+}
+
+/**
+ * @brief brings the index up to date with the metadata table first, the CLI
+ * may have changed the table next to the server
+ * @return Returns 0 if the index can be answered from, or -1 otherwise
+ */
+static int refresh_index(dispatch_context_t *dctx) {
+  int ssd_fd = open(dctx->cfg.drive_full_path, O_RDONLY);
+  if (ssd_fd == -1) {
+    return -1;
+  }
+  int rc = storage_refresh_index(ssd_fd);
+  close(ssd_fd);
+  return rc < 0 ? -1 : 0;
+}
+
+static void handle_list(dispatch_context_t *dctx,
+                        const dist_fs_packet_t *packet) {
+  // a query is answered from the index, the full listing straight from the
+  // table
+  if (packet->payload_size > 0 && dctx->index) {
+    dist_fs_list_query_t wire;
+    if (decode_list_query(packet->payload, packet->payload_size, &wire) ||
+        wire.key >= MD_INDEX_NUM_KEYS) {
+      send_error(dctx, DIST_FS_LIST, -EINVAL);
+      return;
+    }
+    if (refresh_index(dctx)) {
+      send_error(dctx, DIST_FS_LIST, -EIO);
+      return;
+    }
+
+    md_index_query_t query = {};
+
+    query.key        = (md_index_key_e)wire.key;
+    query.descending = wire.flags & DIST_FS_LIST_DESCENDING;
+    query.type       = wire.type == DIST_FS_LIST_ANY_TYPE ? -1 : wire.type;
+    query.prefix     = wire.prefix;
+    query.offset     = wire.offset;
+    query.limit      = wire.limit;
+
+    std::vector<storage_metadata_t> page;
+    uint64_t start = metrics_now_ns();
+    size_t total   = md_index_list(dctx->index, &query, page);
+    metrics_op(METRICS_MD_QUERY, start, 0, true);
+    LOG(INFO, "Listing %zu of %zu matching files", page.size(), total);
+    send_list(dctx, page);
+    return;
+  }
+
+  int ssd_fd = open(dctx->cfg.drive_full_path, O_RDONLY);
+  if (ssd_fd == -1) {
+    send_error(dctx, DIST_FS_LIST, -EIO);
+    return;
+  }
+  std::vector<storage_metadata_t> md_table = md_table_read(ssd_fd);
+  close(ssd_fd);
+  send_list(dctx, md_table);
+}
+
+static void handle_sync(dispatch_context_t *dctx,
+                        const dist_fs_packet_t *packet) {
+  // changes are only known to the index
+  if (!dctx->index) {
+    send_error(dctx, DIST_FS_SYNC, -ENOSYS);
+    return;
+  }
+  if (packet->payload_size != 0 &&
+      packet->payload_size != DIST_FS_SYNC_QUERY_SIZE) {
+    send_error(dctx, DIST_FS_SYNC, -EINVAL);
+    return;
+  }
+  if (refresh_index(dctx)) {
+    send_error(dctx, DIST_FS_SYNC, -EIO);
+    return;
+  }
+
+  uint32_t epoch      = 0;
+  uint64_t generation = 0;
+  for (uint32_t i = 0; i < packet->payload_size; i++) {
+    if (i < 4) {
+      epoch = (epoch << 8) | packet->payload[i];
+    } else {
+      generation = (generation << 8) | packet->payload[i];
+    }
+  }
+
+  std::vector<uint8_t> listing;
+  uint64_t start = metrics_now_ns();
+  size_t records = md_sync_encode(dctx->index, epoch, generation, listing);
+  metrics_op(METRICS_MD_QUERY, start, listing.size(), true);
+  LOG(INFO,
+      "Syncing %zu records in %zu bytes from generation %lu",
+      records,
+      listing.size(),
+      generation);
+
+  uint8_t flags = DIST_FS_FLAG_START;
+  for (size_t sent = 0; sent < listing.size();) {
+    uint32_t chunk = (listing.size() - sent > DIST_FS_CHUNK_SIZE)
+                       ? DIST_FS_CHUNK_SIZE
+                       : (uint32_t)(listing.size() - sent);
+    if (sent + chunk == listing.size()) {
+      flags |= DIST_FS_FLAG_END;
+    }
+    if (send_response(
+          dctx, DIST_FS_SYNC, flags, listing.data() + sent, chunk) != 0) {
+      LOG(ERR, "Failed to queue binary listing");
+      return;
+    }
+    sent += chunk;
+    flags = 0;
+  }
+}
+
+/** @brief download sink that queues each chunk as a data frame */
+static int download_sink(const uint8_t *data, size_t size, void *arg) {
+  dispatch_context_t *dctx = (dispatch_context_t *)arg;
+
+  while (size > 0) {
+    uint32_t chunk =
+      size > DIST_FS_CHUNK_SIZE ? DIST_FS_CHUNK_SIZE : (uint32_t)size;
+    if (send_response(dctx, DIST_FS_DOWNLOAD, 0, data, chunk) != 0) {
+      return -1;
+    }
+    data += chunk;
+    size -= chunk;
+  }
+  return 0;
+}
+
+static void handle_download(dispatch_context_t *dctx,
+                            const dist_fs_packet_t *packet) {
+  char name[256];
+  if (!payload_to_name(packet, name, sizeof(name))) {
+    send_error(dctx, DIST_FS_DOWNLOAD, -EINVAL);
+    return;
+  }
+
+  storage_metadata_t entry;
+  if (storage_find_file(dctx->cfg, name, &entry) != 0) {
+    send_error(dctx, DIST_FS_DOWNLOAD, -ENOENT);
+    return;
+  }
+
+  uint8_t size_be[8];
+  for (int i = 0; i < 8; i++) {
+    size_be[i] = (uint8_t)((uint64_t)entry.size >> (56 - 8 * i));
+  }
+  send_response(
+    dctx, DIST_FS_DOWNLOAD, DIST_FS_FLAG_START, size_be, sizeof(size_be));
+
+  // frames are only copied into the tx ring, so the I/O thread is sending
+  // one chunk while the next one is being read off the drive
+  if (download_file_stream(dctx->cfg, name, download_sink, dctx) != 0) {
+    send_error(dctx, DIST_FS_DOWNLOAD, -EIO);
+    return;
+  }
+  send_response(dctx, DIST_FS_DOWNLOAD, DIST_FS_FLAG_END, nullptr, 0);
+}
+
+static void handle_delete(dispatch_context_t *dctx,
+                          const dist_fs_packet_t *packet) {
+  char name[256];
+  if (!payload_to_name(packet, name, sizeof(name))) {
+    send_error(dctx, DIST_FS_DELETE, -EINVAL);
+    return;
+  }
+
+  if (delete_file(dctx->cfg, name) != 0) {
+    send_error(dctx, DIST_FS_DELETE, -ENOENT);
+    return;
+  }
+  send_response(
+    dctx, DIST_FS_DELETE, DIST_FS_FLAG_START | DIST_FS_FLAG_END, nullptr, 0);
+}
+
+static void handle_hello(dispatch_context_t *dctx,
+                         const dist_fs_packet_t *packet) {
+  uint8_t peer_mask = (packet->payload_size >= 1) ? packet->payload[0] : 0;
+  uint8_t codec     = dctx->cfg.link_compression
+                        ? link_codec_select(peer_mask)
+                        : (uint8_t)LINK_CODEC_NONE;
+
+  // the answer is a single byte, so it always goes out raw. the client
+  // starts compressing once it has it
+  send_response(
+    dctx, DIST_FS_HELLO, DIST_FS_FLAG_START | DIST_FS_FLAG_END, &codec, 1);
+  dctx->io->ctx->codec = codec;
+  LOG(INFO, "Link codec {%d} selected", codec);
+}
+
+/** @brief drop an upload in progress and its spool file */
+static void upload_abort(dispatch_context_t *dctx) {
+  if (dctx->upload_fd != -1) {
+    close(dctx->upload_fd);
+    unlink(dctx->upload_path);
+    dctx->upload_fd = -1;
+  }
+}
+
+/**
+ * @brief answer an upload with an error. the rest of its frames are dropped
+ * quietly, so the client sees one error rather than one per frame
+ */
+static void upload_fail(dispatch_context_t *dctx,
+                        const dist_fs_packet_t *packet,
+                        int32_t err) {
+  upload_abort(dctx);
+  send_error(dctx, DIST_FS_UPLOAD, err);
+  dctx->upload_failed = !(packet->flags & DIST_FS_FLAG_END);
+}
+
+static void handle_upload(dispatch_context_t *dctx,
+                          const dist_fs_packet_t *packet) {
+  if (packet->flags & DIST_FS_FLAG_START) {
+    // a new upload replaces one that never finished
+    if (dctx->upload_fd != -1) {
+      LOG(WARN, "Abandoning unfinished upload of {%s}", dctx->upload_name);
+      upload_abort(dctx);
+    }
+    dctx->upload_failed = false;
+    if (!payload_to_name(
+          packet, dctx->upload_name, sizeof(dctx->upload_name))) {
+      upload_fail(dctx, packet, -EINVAL);
+      return;
+    }
+
+    // upload_file() works on a local file, so the data is spooled until
+    // the END frame arrives
+    strcpy(dctx->upload_path, "/tmp/dist-fs-upload-XXXXXX");
+    dctx->upload_fd = mkstemp(dctx->upload_path);
+    if (dctx->upload_fd == -1) {
+      upload_fail(dctx, packet, -errno);
+      return;
+    }
+    dctx->upload_size = 0;
+    LOG(INFO, "Receiving upload of {%s}", dctx->upload_name);
+    return;
+  }
+
+  if (dctx->upload_fd == -1) {
+    if (dctx->upload_failed) {
+      dctx->upload_failed = !(packet->flags & DIST_FS_FLAG_END);
+      return;
+    }
+    LOG(WARN, "UPLOAD data frame with no upload in progress");
+    upload_fail(dctx, packet, -EPROTO);
+    return;
+  }
+
+  if (packet->payload_size > 0) {
+    ssize_t written =
+      write(dctx->upload_fd, packet->payload, packet->payload_size);
+    if (written != (ssize_t)packet->payload_size) {
+      upload_fail(dctx, packet, -EIO);
+      return;
+    }
+    dctx->upload_size += packet->payload_size;
+  }
+
+  if (!(packet->flags & DIST_FS_FLAG_END)) {
+    return;
+  }
+
+  LOG(INFO,
+      "Upload of {%s} complete, {%lu} bytes",
+      dctx->upload_name,
+      dctx->upload_size);
+  close(dctx->upload_fd);
+  dctx->upload_fd = -1;
+
+  int rc = upload_file_as(dctx->cfg, dctx->upload_path, dctx->upload_name);
+  unlink(dctx->upload_path);
+  if (rc != 0) {
+    send_error(dctx, DIST_FS_UPLOAD, -EIO);
+    return;
+  }
+  send_response(
+    dctx, DIST_FS_UPLOAD, DIST_FS_FLAG_START | DIST_FS_FLAG_END, nullptr, 0);
+}
+
+void dispatch_init(dispatch_context_t *dctx,
+                   comm_io_t *io,
+                   config_context_t cfg) {
+  memset(dctx, 0, sizeof(*dctx));
+  dctx->io        = io;
+  dctx->cfg       = cfg;
+  dctx->upload_fd = -1;
+  dctx->index     = nullptr;
+}
+
+void dispatch_packet(const dist_fs_packet_t *packet, void *arg) {
+  dispatch_context_t *dctx = (dispatch_context_t *)arg;
+
+  if (packet->flags & DIST_FS_FLAG_RESPONSE) {
+    LOG(WARN, "Ignoring response frame sent to the host");
+    return;
+  }
+
+  switch (packet->command) {
+    case DIST_FS_LIST:
+      LOG(INFO, "Handling DIST_FS_LIST");
+      handle_list(dctx, packet);
+      break;
+
+    case DIST_FS_UPLOAD:
+      handle_upload(dctx, packet);
+      break;
+
+    case DIST_FS_DOWNLOAD:
+      LOG(INFO, "Handling DIST_FS_DOWNLOAD");
+      handle_download(dctx, packet);
+      break;
+
+    case DIST_FS_DELETE:
+      LOG(INFO, "Handling DIST_FS_DELETE");
+      handle_delete(dctx, packet);
+      break;
+
+    case DIST_FS_HELLO:
+      LOG(INFO, "Handling DIST_FS_HELLO");
+      handle_hello(dctx, packet);
+      break;
+
+    case DIST_FS_SYNC:
+      LOG(INFO, "Handling DIST_FS_SYNC");
+      handle_sync(dctx, packet);
+      break;
+
+    default:
+      LOG(ERR, "Unknown command {%d}", packet->command);
+      break;
+  }
+}
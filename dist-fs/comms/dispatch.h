@@ -0,0 +1,47 @@
+/**
+ * host side request handling. frames decoded from a client are dispatched
+ * to the storage driver and responses are queued on the transport's I/O
+ * thread
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../config.hpp"
+#include "comm_io.h"
+#include "packet.h"
+
+struct md_index_t;
+
+/** @brief per connection state for the request dispatcher */
+typedef struct {
+  comm_io_t *io;           // transport responses are queued on
+  config_context_t cfg;    // storage configuration
+  int upload_fd;           // spool file of the upload in progress, or -1
+  char upload_path[64];    // path of the spool file
+  char upload_name[256];   // name the upload will be stored under
+  uint64_t upload_size;    // bytes received for the upload so far
+  bool upload_failed;      // upload was refused, drop frames until END
+  md_index_t *index;       // answers LIST queries and SYNC, or NULL
+} dispatch_context_t;
+
+/**
+ * @brief initialize dispatcher state for a connection
+ *
+ * @param[in] dctx  dispatcher state
+ * @param[in] io    running I/O thread for the connection's transport
+ * @param[in] cfg   storage configuration
+ */
+void dispatch_init(dispatch_context_t *dctx,
+                   comm_io_t *io,
+                   config_context_t cfg);
+
+/**
+ * @brief packet parser callback. handles one request frame and queues any
+ * response frames
+ *
+ * @param[in] packet  decoded frame
+ * @param[in] arg     dispatch_context_t pointer
+ */
+void dispatch_packet(const dist_fs_packet_t *packet, void *arg);
@@ -11,6 +11,10 @@ static int i2c_write(comm_context_t *ctx,
                      uint8_t *tx,
                      uint32_t tx_size,
                      uint16_t timeout_ms);
+static int i2c_writev(comm_context_t *ctx,
+                      const struct iovec *iov,
+                      int iovcnt,
+                      uint16_t timeout_ms);
 static int i2c_ioctl(comm_context_t *ctx, uint8_t opcode, void *data);
 
 
@@ -20,6 +24,7 @@ comm_driver_t i2c_ops = {
   .read      = i2c_read,
   .write_one = i2c_write_one,
   .write     = i2c_write,
+  .writev    = i2c_writev,
   .ioctl     = i2c_ioctl,
 };
 
@@ -74,6 +79,19 @@ static int i2c_write(comm_context_t *ctx,
   return bytes_written;
 }
 
+static int i2c_writev(comm_context_t *ctx,
+                      const struct iovec *iov,
+                      int iovcnt,
+                      uint16_t timeout_ms) {
+  (void)ctx;
+  (void)iov;
+  (void)iovcnt;
+  (void)timeout_ms;
+  int bytes_written = 0;
+
+  return bytes_written;
+}
+
 static int i2c_ioctl(comm_context_t *ctx, uint8_t opcode, void *data) {
   (void)ctx;
   (void)opcode;
@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "link_codec.h"
+
+/*
+ * LZ codec. the block layout follows LZ4: a run of sequences, each a token
+ * byte (literal length in the high nibble, match length - 4 in the low
+ * nibble, 15 meaning more length bytes follow), the literals, and a 16 bit
+ * little endian match offset. the last sequence is literals only. the
+ * compressor is a single probe hash table so it keeps up with the link on
+ * a small core
+ */
+#define LZ_MIN_MATCH     4
+#define LZ_HASH_BITS     12
+#define LZ_LAST_LITERALS 5  // input tail that is always sent as literals
+#define LZ_MFLIMIT       12 // no match may start in the last 12 bytes
+#define LZ_MAX_OFFSET    65535
+
+static inline uint32_t lz_read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/** @brief append a sequence, returns the new output position or NULL */
+static uint8_t *lz_emit(uint8_t *op,
+                        uint8_t *oend,
+                        const uint8_t *literals,
+                        uint32_t lit_len,
+                        uint32_t offset,
+                        uint32_t match_len) {
+  // token, length bytes, literals and offset in the worst case
+  size_t worst = 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1;
+  if (worst > (size_t)(oend - op)) {
+    return NULL;
+  }
+
+  uint8_t *token = op++;
+  *token         = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+  if (lit_len >= 15) {
+    uint32_t len = lit_len - 15;
+    for (; len >= 255; len -= 255) {
+      *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+  }
+  memcpy(op, literals, lit_len);
+  op += lit_len;
+
+  // the final sequence carries no match
+  if (match_len == 0) {
+    return op;
+  }
+
+  *op++ = (uint8_t)(offset & 0xFF);
+  *op++ = (uint8_t)(offset >> 8);
+
+  uint32_t len = match_len - LZ_MIN_MATCH;
+  *token |= (uint8_t)(len >= 15 ? 15 : len);
+  if (len >= 15) {
+    for (len -= 15; len >= 255; len -= 255) {
+      *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+  }
+  return op;
+}
+
+static uint32_t lz_compress(const uint8_t *src,
+                            uint32_t src_sz,
+                            uint8_t *dst,
+                            uint32_t dst_cap) {
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  const uint8_t *ip     = src;
+  const uint8_t *anchor = src;
+  const uint8_t *iend   = src + src_sz;
+  uint8_t *op           = dst;
+  uint8_t *oend         = dst + dst_cap;
+
+  if (src_sz > LZ_MFLIMIT) {
+    const uint8_t *mflimit    = iend - LZ_MFLIMIT;
+    const uint8_t *matchlimit = iend - LZ_LAST_LITERALS;
+
+    while (ip < mflimit) {
+      uint32_t seq       = lz_read32(ip);
+      uint32_t h         = lz_hash(seq);
+      const uint8_t *ref = src + table[h];
+      table[h]           = (uint32_t)(ip - src);
+
+      if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != seq) {
+        ip++;
+        continue;
+      }
+
+      // extend forwards, then backwards over literals that also match
+      const uint8_t *mend = ip + LZ_MIN_MATCH;
+      const uint8_t *rend = ref + LZ_MIN_MATCH;
+      while (mend < matchlimit && *mend == *rend) {
+        mend++;
+        rend++;
+      }
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+
+      op = lz_emit(op,
+                   oend,
+                   anchor,
+                   (uint32_t)(ip - anchor),
+                   (uint32_t)(ip - ref),
+                   (uint32_t)(mend - ip));
+      if (!op) {
+        return 0;
+      }
+      ip     = mend;
+      anchor = ip;
+    }
+  }
+
+  op = lz_emit(op, oend, anchor, (uint32_t)(iend - anchor), 0, 0);
+  return op ? (uint32_t)(op - dst) : 0;
+}
+
+/** @brief read an extended length, returns false on truncated input */
+static bool lz_read_length(const uint8_t **ip,
+                           const uint8_t *iend,
+                           uint32_t *len) {
+  uint8_t b;
+  do {
+    if (*ip >= iend) {
+      return false;
+    }
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+static int lz_decompress(const uint8_t *src,
+                         uint32_t src_sz,
+                         uint8_t *dst,
+                         uint32_t dst_cap) {
+  const uint8_t *ip   = src;
+  const uint8_t *iend = src + src_sz;
+  uint8_t *op         = dst;
+  uint8_t *oend       = dst + dst_cap;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    uint32_t lit_len = token >> 4;
+    if (lit_len == 15 && !lz_read_length(&ip, iend, &lit_len)) {
+      return -1;
+    }
+    if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op)) {
+      return -1;
+    }
+    memcpy(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+
+    if (ip == iend) {
+      break;
+    }
+
+    if (iend - ip < 2) {
+      return -1;
+    }
+    uint32_t offset = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst)) {
+      return -1;
+    }
+
+    uint32_t match_len = token & 0x0F;
+    if (match_len == 15 && !lz_read_length(&ip, iend, &match_len)) {
+      return -1;
+    }
+    match_len += LZ_MIN_MATCH;
+    if (match_len > (size_t)(oend - op)) {
+      return -1;
+    }
+
+    // matches may overlap their own output, copy forwards a byte at a time
+    const uint8_t *match = op - offset;
+    if (offset >= match_len) {
+      memcpy(op, match, match_len);
+    } else {
+      for (uint32_t i = 0; i < match_len; i++) {
+        op[i] = match[i];
+      }
+    }
+    op += match_len;
+  }
+
+  return (int)(op - dst);
+}
+
+/** @brief codec registry, in order of preference */
+static const link_codec_t link_codec_registry[] = {
+  {LINK_CODEC_LZ, "lz", lz_compress, lz_decompress},
+  {LINK_CODEC_END, NULL, NULL, NULL}, // termination
+};
+
+const link_codec_t *link_codec_find(uint8_t id) {
+  for (int i = 0; link_codec_registry[i].id != LINK_CODEC_END; ++i) {
+    if (link_codec_registry[i].id == id) {
+      return &link_codec_registry[i];
+    }
+  }
+  return NULL;
+}
+
+uint8_t link_codec_mask(void) {
+  uint8_t mask = 0;
+  for (int i = 0; link_codec_registry[i].id != LINK_CODEC_END; ++i) {
+    mask |= (uint8_t)(1u << link_codec_registry[i].id);
+  }
+  return mask;
+}
+
+uint8_t link_codec_select(uint8_t peer_mask) {
+  uint8_t shared = peer_mask & link_codec_mask();
+  for (int i = 0; link_codec_registry[i].id != LINK_CODEC_END; ++i) {
+    if (shared & (1u << link_codec_registry[i].id)) {
+      return (uint8_t)link_codec_registry[i].id;
+    }
+  }
+  return LINK_CODEC_NONE;
+}
@@ -0,0 +1,73 @@
+/**
+ * per frame payload compression for the packet transport. the codec is
+ * negotiated with a HELLO exchange when a client connects, after which
+ * either side may send frames flagged DIST_FS_FLAG_COMPRESSED
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* @brief link codec identifiers, carried in the first byte of a compressed
+ * payload and in the HELLO exchange */
+typedef enum {
+  LINK_CODEC_NONE = 0, // raw frames only
+  LINK_CODEC_LZ,       // LZ4 style byte oriented LZ77
+  LINK_CODEC_END,
+} link_codec_e;
+
+/* payloads shorter than this are always sent raw */
+#define LINK_CODEC_MIN_SIZE 64
+
+typedef struct {
+  link_codec_e id;
+  const char *name;
+  /**
+   * @brief compress a buffer
+   *
+   * @param[in]  src      input bytes
+   * @param[in]  src_sz   number of input bytes
+   * @param[out] dst      output buffer
+   * @param[in]  dst_cap  output buffer size
+   *
+   * @return compressed size, 0 if the output didn't fit in dst_cap
+   */
+  uint32_t (*compress)(const uint8_t *src,
+                       uint32_t src_sz,
+                       uint8_t *dst,
+                       uint32_t dst_cap);
+  /**
+   * @brief decompress a buffer
+   *
+   * @param[in]  src      compressed bytes
+   * @param[in]  src_sz   number of compressed bytes
+   * @param[out] dst      output buffer
+   * @param[in]  dst_cap  output buffer size
+   *
+   * @return decompressed size, < 0 on corrupt input or overflow
+   */
+  int (*decompress)(const uint8_t *src,
+                    uint32_t src_sz,
+                    uint8_t *dst,
+                    uint32_t dst_cap);
+} link_codec_t;
+
+/**
+ * @brief codec registry lookup
+ *
+ * @return codec, or NULL for LINK_CODEC_NONE and unknown ids
+ */
+const link_codec_t *link_codec_find(uint8_t id);
+
+/**
+ * @brief bitmask of the codecs this build supports, bit n set for codec id n.
+ * sent by the client in its HELLO request
+ */
+uint8_t link_codec_mask(void);
+
+/**
+ * @brief pick the codec to use given the peer's HELLO mask
+ *
+ * @return preferred codec both ends support, LINK_CODEC_NONE if there's none
+ */
+uint8_t link_codec_select(uint8_t peer_mask);
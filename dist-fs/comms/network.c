@@ -34,6 +34,7 @@ comm_driver_t network_ops = {
   .read      = network_read,
   .write_one = NULL,
   .write     = network_write,
+  .writev    = network_writev,
   .ioctl     = network_ioctl,
   */
 };
@@ -2,9 +2,13 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "packet.h"
 #include "comms.h"
+#include "link_codec.h"
 #include "../utils.hpp"
 
 
@@ -31,98 +35,448 @@ int test_packet(comm_context_t *comm_ctx,
 
 /* packetize operation commands */
 
-int list_files_command(comm_context_t *comm_ctx) {
-  // no payload, just send the header
-  uint8_t buffer[DIST_FS_HEADER_SIZE];
-  const uint16_t buffer_size = sizeof(buffer);
-  const uint16_t timeout_ms  = 1000; // 1-second timeout
+/* @brief state shared by a client command and its response handler */
+typedef struct {
+  dist_fs_ops_e command; // operation the response belongs to
+  bool done;             // END frame seen
+  int status;            // 0, or the error code sent by the host
+  FILE *file;            // DOWNLOAD: local file, SYNC: listing being written
+  uint64_t expected;     // DOWNLOAD: size announced by the host
+  uint64_t received;     // DOWNLOAD: bytes written so far
+  uint8_t codec;         // HELLO: codec picked by the host
+} response_ctx_t;
+
+/* @brief frame callback for responses to a client command */
+static void handle_response(const dist_fs_packet_t *packet, void *arg) {
+  response_ctx_t *rsp = (response_ctx_t *)arg;
+
+  if (!(packet->flags & DIST_FS_FLAG_RESPONSE) ||
+      packet->command != rsp->command) {
+    LOG(WARN,
+        "Ignoring unexpected frame, command {%d} flags {0x%X}",
+        packet->command,
+        packet->flags);
+    return;
+  }
+
+  if (packet->flags & DIST_FS_FLAG_ERROR) {
+    rsp->status = -1;
+    if (packet->payload_size >= 4) {
+      rsp->status = (int32_t)((packet->payload[0] << 24) |
+                              (packet->payload[1] << 16) |
+                              (packet->payload[2] << 8) | packet->payload[3]);
+    }
+    LOG(ERR, "Host returned error {%d}", rsp->status);
+    rsp->done = true;
+    return;
+  }
+
+  switch (packet->command) {
+    case DIST_FS_LIST:
+      fwrite(packet->payload, 1, packet->payload_size, stdout);
+      break;
+
+    case DIST_FS_DOWNLOAD:
+      if (packet->flags & DIST_FS_FLAG_START) {
+        rsp->expected = 0;
+        for (uint32_t i = 0; i < 8 && i < packet->payload_size; i++) {
+          rsp->expected = (rsp->expected << 8) | packet->payload[i];
+        }
+        LOG(INFO, "Receiving {%lu} bytes", rsp->expected);
+      } else if (packet->payload_size > 0) {
+        if (fwrite(packet->payload, 1, packet->payload_size, rsp->file) !=
+            packet->payload_size) {
+          LOG(ERR, "Failed to write downloaded data");
+          rsp->status = -1;
+        }
+        rsp->received += packet->payload_size;
+      }
+      break;
 
-  int ret = encode_packet(DIST_FS_LIST, nullptr, 0, buffer);
+    case DIST_FS_HELLO:
+      if (packet->payload_size >= 1) {
+        rsp->codec = packet->payload[0];
+      }
+      break;
+
+    case DIST_FS_SYNC:
+      if (fwrite(packet->payload, 1, packet->payload_size, rsp->file) !=
+          packet->payload_size) {
+        LOG(ERR, "Failed to write binary listing");
+        rsp->status = -1;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  if (packet->flags & DIST_FS_FLAG_END) {
+    rsp->done = true;
+  }
+}
+
+/* @brief read and parse frames until the response to a command is done */
+static int await_response(comm_context_t *comm_ctx, response_ctx_t *rsp) {
+  // the parser carries a full sized payload buffer, keep it off the stack
+  packet_parser_t *parser = (packet_parser_t *)malloc(sizeof(*parser));
+  if (!parser) {
+    LOG(ERR, "Memory allocation failed for packet parser");
+    return -1;
+  }
+  packet_parser_init(parser, handle_response, rsp, true);
+
+  // decode_packet() waits up to a second per read, give up once the host
+  // has been quiet for the whole response timeout
+  int idle_ms = 0;
+  while (!rsp->done && idle_ms < DIST_FS_RESPONSE_TIMEOUT_MS) {
+    if (decode_packet(comm_ctx, parser) < 0) {
+      idle_ms += 1000;
+    } else {
+      idle_ms = 0;
+    }
+  }
+  free(parser);
+
+  if (!rsp->done) {
+    LOG(ERR, "Timed out waiting for response to command {%d}", rsp->command);
+    return -ETIMEDOUT;
+  }
+  return rsp->status;
+}
+
+/* @brief send a request that is just a file name and wait for the answer */
+static int name_request(comm_context_t *comm_ctx,
+                        dist_fs_ops_e command,
+                        const char *filename,
+                        response_ctx_t *rsp) {
+  size_t name_len = strlen(filename);
+  if (name_len == 0 || name_len > DIST_FS_MAX_PAYLOAD_SIZE) {
+    LOG(ERR, "Invalid file name {%s}", filename);
+    return -EINVAL;
+  }
+
+  int ret = send_packet(comm_ctx,
+                        command,
+                        DIST_FS_FLAG_START | DIST_FS_FLAG_END,
+                        (const uint8_t *)filename,
+                        (uint32_t)name_len);
   if (ret < 0) {
-    LOG(ERR, "Failed to form packet\n");
+    LOG(ERR, "Failed to send command {%d}: %d", command, ret);
     return ret;
   }
 
-  // send packet
+  rsp->command = command;
+  return await_response(comm_ctx, rsp);
+}
+
+int list_files_command(comm_context_t *comm_ctx) {
+  // no payload, just send the header
   LOG(INFO, "Writing packet");
-  ret = comm_ctx->driver->write(comm_ctx, buffer, buffer_size, timeout_ms);
+  int ret = send_packet(
+    comm_ctx, DIST_FS_LIST, DIST_FS_FLAG_START | DIST_FS_FLAG_END, nullptr, 0);
   if (ret == 0) {
     LOG(INFO, "LIST command sent");
   } else {
     LOG(ERR, "Failed to send LIST command: %d", ret);
+    return ret;
+  }
+
+  response_ctx_t rsp = {};
+  rsp.command        = DIST_FS_LIST;
+  return await_response(comm_ctx, &rsp);
+}
+
+int list_page_command(comm_context_t *comm_ctx,
+                      const dist_fs_list_query_t *query) {
+  uint8_t payload[DIST_FS_LIST_QUERY_SIZE + sizeof(query->prefix)];
+  uint32_t payload_size = encode_list_query(query, payload);
+
+  int ret = send_packet(comm_ctx,
+                        DIST_FS_LIST,
+                        DIST_FS_FLAG_START | DIST_FS_FLAG_END,
+                        payload,
+                        payload_size);
+  if (ret != 0) {
+    LOG(ERR, "Failed to send LIST command: %d", ret);
+    return ret;
+  }
+
+  response_ctx_t rsp = {};
+  rsp.command        = DIST_FS_LIST;
+  return await_response(comm_ctx, &rsp);
+}
+
+int sync_command(comm_context_t *comm_ctx,
+                 uint32_t epoch,
+                 uint64_t generation,
+                 FILE *out) {
+  uint8_t payload[DIST_FS_SYNC_QUERY_SIZE];
+  for (int i = 0; i < 4; i++) {
+    payload[i] = (uint8_t)(epoch >> (24 - 8 * i));
+  }
+  for (int i = 0; i < 8; i++) {
+    payload[4 + i] = (uint8_t)(generation >> (56 - 8 * i));
   }
-  return ret;
+
+  // without a copy there is nothing to bring up to date
+  int ret = send_packet(comm_ctx,
+                        DIST_FS_SYNC,
+                        DIST_FS_FLAG_START | DIST_FS_FLAG_END,
+                        payload,
+                        epoch ? sizeof(payload) : 0);
+  if (ret != 0) {
+    LOG(ERR, "Failed to send SYNC command: %d", ret);
+    return ret;
+  }
+
+  response_ctx_t rsp = {};
+  rsp.command        = DIST_FS_SYNC;
+  rsp.file           = out;
+  return await_response(comm_ctx, &rsp);
+}
+
+uint32_t encode_list_query(const dist_fs_list_query_t *query,
+                           uint8_t *buffer) {
+  size_t prefix_len = strnlen(query->prefix, sizeof(query->prefix) - 1);
+
+  buffer[0] = query->key;
+  buffer[1] = query->flags;
+  buffer[2] = query->type;
+  for (int i = 0; i < 4; i++) {
+    buffer[3 + i] = (uint8_t)(query->offset >> (24 - 8 * i));
+    buffer[7 + i] = (uint8_t)(query->limit >> (24 - 8 * i));
+  }
+  memcpy(buffer + DIST_FS_LIST_QUERY_SIZE, query->prefix, prefix_len);
+  return (uint32_t)(DIST_FS_LIST_QUERY_SIZE + prefix_len);
+}
+
+int decode_list_query(const uint8_t *payload,
+                      uint32_t payload_size,
+                      dist_fs_list_query_t *query) {
+  if (payload_size < DIST_FS_LIST_QUERY_SIZE ||
+      payload_size - DIST_FS_LIST_QUERY_SIZE >= sizeof(query->prefix)) {
+    return -1;
+  }
+
+  query->key    = payload[0];
+  query->flags  = payload[1];
+  query->type   = payload[2];
+  query->offset = 0;
+  query->limit  = 0;
+  for (int i = 0; i < 4; i++) {
+    query->offset = (query->offset << 8) | payload[3 + i];
+    query->limit  = (query->limit << 8) | payload[7 + i];
+  }
+  uint32_t prefix_len = payload_size - DIST_FS_LIST_QUERY_SIZE;
+  memcpy(query->prefix, payload + DIST_FS_LIST_QUERY_SIZE, prefix_len);
+  query->prefix[prefix_len] = '\0';
+  return 0;
 }
 
 int upload_files_command(comm_context_t *comm_ctx, const char *filename) {
   LOG(INFO, "Uploading file {%s}", filename);
-  const uint16_t timeout_ms = 1000; // 1-second timeout
-  int fd                    = open(filename, O_RDONLY);
+  int fd = open(filename, O_RDONLY);
   if (fd == -1) {
     LOG(ERR, "Error opening file {%s}", filename);
     return fd;
   }
-  uint32_t payload_size = lseek(fd, 0, SEEK_END);
-  if (payload_size == -1) {
-    LOG(ERR, "Error seeking to end of file");
-    return -1;
-  } else {
-    LOG(INFO, "Payload size {%d}", payload_size);
-  }
 
-  // allocate a buffer based on the size of the filename. this will be the
-  // payload
-  size_t packet_size     = DIST_FS_HEADER_SIZE + payload_size;
-  uint8_t *packet_buffer = (uint8_t *)malloc(packet_size);
-  if (!packet_buffer) {
-    LOG(ERR, "Memory allocation failed for packet buffer");
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1) {
+    LOG(ERR, "Error getting size of file {%s}", filename);
     close(fd);
     return -1;
-  } else {
-    LOG(INFO, "Allocated {%zu} bytes for packet buffer", packet_size);
+  }
+  size_t file_size = (size_t)file_stat.st_size;
+  LOG(INFO, "File size {%zu}", file_size);
+
+  // map the file instead of reading it into a packet buffer. each frame is
+  // sent as a header plus a slice of the mapping, so the file contents are
+  // never copied in userspace unless the link compresses them
+  uint8_t *data = nullptr;
+  if (file_size > 0) {
+    data = (uint8_t *)mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      LOG(ERR, "Error mapping file {%s}", filename);
+      close(fd);
+      return -1;
+    }
+    madvise(data, file_size, MADV_SEQUENTIAL);
   }
 
-  // read the file directly into the payload portion of the packet buffer
-  lseek(fd, 0, SEEK_SET); // reset file pointer to the beginning
-  ssize_t bytes_read =
-    read(fd, packet_buffer + DIST_FS_HEADER_SIZE, payload_size);
-  if (bytes_read != payload_size) {
-    LOG(ERR, "Error reading file, read {%ld} bytes", bytes_read);
-    free(packet_buffer);
-    close(fd);
+  // first frame names the file. the host stores it under its base name,
+  // the client's directories mean nothing there
+  const char *name = strrchr(filename, '/');
+  name             = name ? name + 1 : filename;
+
+  int ret = send_packet(comm_ctx,
+                        DIST_FS_UPLOAD,
+                        DIST_FS_FLAG_START,
+                        (const uint8_t *)name,
+                        (uint32_t)strlen(name));
+
+  // then the contents, the last chunk carries the END flag
+  size_t sent = 0;
+  while (ret == 0) {
+    uint32_t chunk = (file_size - sent > DIST_FS_CHUNK_SIZE)
+                       ? DIST_FS_CHUNK_SIZE
+                       : (uint32_t)(file_size - sent);
+    uint8_t flags  = (sent + chunk == file_size) ? DIST_FS_FLAG_END : 0;
+
+    ret = send_packet(comm_ctx, DIST_FS_UPLOAD, flags, data + sent, chunk);
+    if (ret != 0) {
+      LOG(ERR, "Failed to send UPLOAD data: %d", ret);
+      break;
+    }
+
+    sent += chunk;
+    if (flags & DIST_FS_FLAG_END) {
+      break;
+    }
+  }
+
+  if (data)
+    munmap(data, file_size);
+  close(fd);
+
+  if (ret != 0) {
+    LOG(ERR, "Failed to send UPLOAD command: %d", ret);
+    return ret;
+  }
+  LOG(INFO, "UPLOAD command sent");
+
+  response_ctx_t rsp = {};
+  rsp.command        = DIST_FS_UPLOAD;
+  return await_response(comm_ctx, &rsp);
+}
+
+int download_files_command(comm_context_t *comm_ctx, const char *filename) {
+  LOG(INFO, "Downloading file {%s}", filename);
+
+  const char *basename = strrchr(filename, '/');
+  basename             = (basename) ? basename + 1 : filename;
+
+  FILE *local_file = fopen(basename, "wb");
+  if (!local_file) {
+    LOG(ERR, "Failed to create local file {%s}", basename);
     return -1;
   }
 
-  int ret = encode_packet(DIST_FS_UPLOAD,
-                          packet_buffer + DIST_FS_HEADER_SIZE,
-                          payload_size,
-                          packet_buffer);
-  if (ret < 0) {
-    LOG(ERR, "Failed to form packet\n");
+  response_ctx_t rsp = {};
+  rsp.file           = local_file;
+  int ret            = name_request(comm_ctx, DIST_FS_DOWNLOAD, filename, &rsp);
+  fclose(local_file);
+
+  if (ret == 0 && rsp.received != rsp.expected) {
+    LOG(ERR,
+        "Short download, got {%lu} of {%lu} bytes",
+        rsp.received,
+        rsp.expected);
+    ret = -1;
+  }
+  if (ret != 0) {
+    remove(basename);
     return ret;
   }
 
-  // send packet
-  LOG(INFO, "Writing packet");
-  ret =
-    comm_ctx->driver->write(comm_ctx, packet_buffer, packet_size, timeout_ms);
-  if (ret == 0) {
-    LOG(INFO, "UPLOAD command sent");
-  } else {
-    LOG(ERR, "Failed to send UPLOAD command: %d", ret);
+  LOG(INFO, "File {%s} downloaded, {%lu} bytes", basename, rsp.received);
+  return 0;
+}
+
+int delete_files_command(comm_context_t *comm_ctx, const char *filename) {
+  LOG(INFO, "Deleting file {%s}", filename);
+  response_ctx_t rsp = {};
+  return name_request(comm_ctx, DIST_FS_DELETE, filename, &rsp);
+}
+
+int hello_command(comm_context_t *comm_ctx) {
+  // offer every codec this build has, the host picks one of them
+  uint8_t mask = link_codec_mask();
+  int ret      = send_packet(
+    comm_ctx, DIST_FS_HELLO, DIST_FS_FLAG_START | DIST_FS_FLAG_END, &mask, 1);
+  if (ret != 0) {
+    LOG(ERR, "Failed to send HELLO command: %d", ret);
+    return ret;
   }
 
-  free(packet_buffer);
-  close(fd);
+  response_ctx_t rsp = {};
+  rsp.command        = DIST_FS_HELLO;
+  ret                = await_response(comm_ctx, &rsp);
+  if (ret != 0) {
+    return ret;
+  }
 
+  if (rsp.codec != LINK_CODEC_NONE && !link_codec_find(rsp.codec)) {
+    LOG(ERR, "Host picked unknown link codec {%d}", rsp.codec);
+    return -1;
+  }
+  comm_ctx->codec = rsp.codec;
+  LOG(INFO, "Link codec {%d} negotiated", rsp.codec);
   return 0;
 }
 
+uint32_t packet_compress(comm_context_t *comm_ctx,
+                         uint8_t *flags,
+                         const uint8_t *payload,
+                         uint32_t payload_size,
+                         uint8_t *out) {
+  comm_ctx->tx_raw_bytes += payload_size;
+
+  const link_codec_t *codec = link_codec_find(comm_ctx->codec);
+  if (codec && payload_size >= LINK_CODEC_MIN_SIZE) {
+    // only keep the result if it's smaller than the raw payload, including
+    // the codec id byte
+    uint32_t packed =
+      codec->compress(payload, payload_size, out + 1, payload_size - 2);
+    if (packed > 0) {
+      out[0] = (uint8_t)codec->id;
+      *flags |= DIST_FS_FLAG_COMPRESSED;
+      comm_ctx->tx_wire_bytes += packed + 1;
+      return packed + 1;
+    }
+  }
+
+  comm_ctx->tx_wire_bytes += payload_size;
+  return 0;
+}
+
+int send_packet(comm_context_t *comm_ctx,
+                dist_fs_ops_e command,
+                uint8_t flags,
+                const uint8_t *payload,
+                uint32_t payload_size) {
+  const uint16_t timeout_ms = 1000; // 1-second timeout
+  uint8_t header[DIST_FS_HEADER_SIZE];
+  uint8_t packed[DIST_FS_MAX_PAYLOAD_SIZE];
+
+  if (payload_size > DIST_FS_MAX_PAYLOAD_SIZE) {
+    return -EINVAL;
+  }
+
+  uint32_t packed_size =
+    packet_compress(comm_ctx, &flags, payload, payload_size, packed);
+  if (packed_size > 0) {
+    payload      = packed;
+    payload_size = packed_size;
+  }
+  encode_packet(command, flags, nullptr, payload_size, header);
+
+  struct iovec iov[2] = {
+    {.iov_base = header, .iov_len = DIST_FS_HEADER_SIZE},
+    {.iov_base = (void *)payload, .iov_len = payload_size},
+  };
+  int ret = comm_ctx->driver->writev(
+    comm_ctx, iov, payload_size > 0 ? 2 : 1, timeout_ms);
+  return (ret == (int)(DIST_FS_HEADER_SIZE + payload_size)) ? 0 : -1;
+}
+
 int encode_packet(dist_fs_ops_e command,
+                  uint8_t flags,
                   uint8_t *payload,
                   uint32_t payload_size,
                   uint8_t *buffer) {
-  LOG(INFO,
+  LOG(DBG,
       "Forming packet for command {%d} with size {%d}",
       command,
       payload_size + DIST_FS_HEADER_SIZE);
@@ -130,19 +484,27 @@ int encode_packet(dist_fs_ops_e command,
 
   switch (command) {
     case DIST_FS_LIST:
-      LOG(INFO, "Forming packet for DIST_FS_LIST");
+      LOG(DBG, "Forming packet for DIST_FS_LIST");
       break;
 
     case DIST_FS_UPLOAD:
-      LOG(INFO, "Forming packet for DIST_FS_UPLOAD");
+      LOG(DBG, "Forming packet for DIST_FS_UPLOAD");
       break;
 
     case DIST_FS_DOWNLOAD:
-      LOG(INFO, "Forming packet for DIST_FS_UPLOAD");
+      LOG(DBG, "Forming packet for DIST_FS_DOWNLOAD");
       break;
 
     case DIST_FS_DELETE:
-      LOG(INFO, "Forming packet for DIST_FS_UPLOAD");
+      LOG(DBG, "Forming packet for DIST_FS_DELETE");
+      break;
+
+    case DIST_FS_HELLO:
+      LOG(DBG, "Forming packet for DIST_FS_HELLO");
+      break;
+
+    case DIST_FS_SYNC:
+      LOG(DBG, "Forming packet for DIST_FS_SYNC");
       break;
 
     default:
@@ -153,13 +515,13 @@ int encode_packet(dist_fs_ops_e command,
   // form the header of the packet
   buffer[DIST_FS_PKT_START_1] = DIST_FS_START_BYTE_A;
   buffer[DIST_FS_PKT_START_2] = DIST_FS_START_BYTE_B;
-  // set command of the packet
-  buffer[DIST_FS_PKT_COMMAND] = command;
+  // set command of the packet, flags share the byte
+  buffer[DIST_FS_PKT_COMMAND] = (command & DIST_FS_OP_MASK) | flags;
   // set payload size
   buffer[DIST_FS_PKT_SIZE_MSB] = (payload_size >> 8) & 0xFF;
   buffer[DIST_FS_PKT_SIZE_LSB] = payload_size & 0xFF;
 
-  LOG(INFO,
+  LOG(DBG,
       "Formed packet header: 0x%X 0x%X 0x%X 0x%X 0x%X",
       buffer[DIST_FS_PKT_START_1],
       buffer[DIST_FS_PKT_START_2],
@@ -170,84 +532,234 @@ int encode_packet(dist_fs_ops_e command,
   // fill in payload data
   if (payload && payload_size > 0) {
     memcpy(buffer + DIST_FS_PKT_PAYLOAD, payload, payload_size);
-    LOG(INFO, "memcpy complete");
+    LOG(DBG, "memcpy complete");
   }
 
   return rc;
 }
 
-int decode_packet(comm_context_t *comm_ctx) {
-  uint8_t buffer[DIST_FS_HEADER_SIZE];
-  const uint16_t buffer_size = sizeof(buffer);
-  const uint16_t timeout_ms  = 1000; // 1-second timeout
-
-  // read header first
-  int ret =
-    comm_ctx->driver->read(comm_ctx, buffer, DIST_FS_HEADER_SIZE, timeout_ms);
-  if (ret == 0) {
-    for (int i = 0; i < DIST_FS_HEADER_SIZE; i++) {
-      printf("0x%X ", buffer[i]);
-    }
-    printf("\n");
+/* streaming packet parser */
+
+/** @brief true if the header's command byte names a known operation, going
+ * the way the parser reads, with flags a frame of it can carry */
+static bool packet_command_valid(const packet_parser_t *parser,
+                                 uint8_t command) {
+  const uint8_t ends = DIST_FS_FLAG_START | DIST_FS_FLAG_END;
+  uint8_t op          = command & DIST_FS_OP_MASK;
+  bool response       = (command & DIST_FS_FLAG_RESPONSE) != 0;
+  bool whole          = (command & ends) == ends;
+  if (op > DIST_FS_SYNC || response != parser->responses) {
+    return false;
+  }
 
-    // validate start bytes
-    if (buffer[DIST_FS_PKT_START_1] != DIST_FS_START_BYTE_A ||
-        buffer[DIST_FS_PKT_START_2] != DIST_FS_START_BYTE_B) {
-      LOG(ERR, "Invalid start bytes");
-      return -1;
-    }
+  // errors are single frame responses
+  if ((command & DIST_FS_FLAG_ERROR) && !(response && whole)) {
+    return false;
+  }
 
-    // get command
-    dist_fs_ops_e command =
-      static_cast<dist_fs_ops_e>(buffer[DIST_FS_PKT_COMMAND]);
+  // clients only stream uploads, the host only listings, downloads and
+  // syncs. everything else is one START|END frame
+  bool streamed = response ? (op == DIST_FS_LIST || op == DIST_FS_DOWNLOAD ||
+                              op == DIST_FS_SYNC)
+                           : op == DIST_FS_UPLOAD;
+  return streamed || whole;
+}
 
-    // get payload size
-    uint32_t payload_size =
-      (buffer[DIST_FS_PKT_SIZE_MSB] << 8) | buffer[DIST_FS_PKT_SIZE_LSB];
+/** @brief decompress a COMPRESSED payload into the parser's scratch buffer
+ * @return decompressed size, < 0 if the payload doesn't decode */
+static int packet_parser_inflate(packet_parser_t *parser,
+                                 const uint8_t *payload) {
+  if (parser->payload_size < 1) {
+    return -1;
+  }
+  const link_codec_t *codec = link_codec_find(payload[0]);
+  if (!codec) {
+    return -1;
+  }
+  return codec->decompress(payload + 1,
+                           parser->payload_size - 1,
+                           parser->scratch,
+                           sizeof(parser->scratch));
+}
 
-    // validate payload size
-    if (buffer_size != DIST_FS_HEADER_SIZE + payload_size) {
-      LOG(ERR,
-          "Payload size mismatch: expected %u but got %zu",
-          payload_size,
-          buffer_size - DIST_FS_HEADER_SIZE);
-      return -1;
+/** @brief hand a complete frame to the parser's callback
+ * @return 1 if a frame was delivered, 0 if it was dropped */
+static size_t packet_parser_emit(packet_parser_t *parser,
+                                 const uint8_t *payload) {
+  uint8_t command = parser->header[DIST_FS_PKT_COMMAND];
+
+  dist_fs_packet_t packet;
+  packet.start[0]     = parser->header[DIST_FS_PKT_START_1];
+  packet.start[1]     = parser->header[DIST_FS_PKT_START_2];
+  packet.command      = (dist_fs_ops_e)(command & DIST_FS_OP_MASK);
+  packet.flags        = command & ~DIST_FS_OP_MASK;
+  packet.payload_size = parser->payload_size;
+  packet.payload      = (uint8_t *)payload;
+  packet.checksum     = 0;
+
+  parser->state       = PACKET_PARSER_SYNC;
+  parser->header_len  = 0;
+  parser->payload_len = 0;
+  parser->wire_bytes += packet.payload_size;
+
+  // callbacks only ever see raw payloads
+  if (packet.flags & DIST_FS_FLAG_COMPRESSED) {
+    int raw = packet_parser_inflate(parser, payload);
+    if (raw < 0) {
+      LOG(WARN, "Dropping compressed frame that failed to decode");
+      parser->corrupt_frames++;
+      return 0;
     }
+    packet.flags &= ~DIST_FS_FLAG_COMPRESSED;
+    packet.payload_size = (uint32_t)raw;
+    packet.payload      = parser->scratch;
+    parser->compressed_frames++;
+  }
+  parser->raw_bytes += packet.payload_size;
+
+  parser->frames++;
+  if (parser->on_frame) {
+    parser->on_frame(&packet, parser->arg);
+  }
+  return 1;
+}
+
+void packet_parser_init(packet_parser_t *parser,
+                        packet_frame_cb_t on_frame,
+                        void *arg,
+                        bool responses) {
+  memset(parser, 0, offsetof(packet_parser_t, payload));
+  parser->state     = PACKET_PARSER_SYNC;
+  parser->on_frame  = on_frame;
+  parser->arg       = arg;
+  parser->responses = responses;
+}
 
-    // print header information
-    LOG(INFO,
-        "Start Bytes: 0x%X 0x%X",
-        buffer[DIST_FS_PKT_START_1],
-        buffer[DIST_FS_PKT_START_2]);
-    LOG(INFO, "Command: %d", command);
-    LOG(INFO, "Payload Size: %u bytes", payload_size);
-
-    // allocate memory for payload if needed
-    uint8_t *payload = nullptr;
-    if (payload_size > 0) {
-      payload = (uint8_t *)malloc(payload_size);
-      if (!payload) {
-        LOG(ERR, "Memory allocation failed for payload");
-        return -1;
+size_t packet_parser_feed(packet_parser_t *parser,
+                          const uint8_t *data,
+                          size_t size) {
+  size_t frames = 0;
+  size_t pos    = 0;
+
+  while (pos < size) {
+    switch (parser->state) {
+      case PACKET_PARSER_SYNC: {
+        // skip straight to the next candidate start byte. memchr is
+        // vectorized in libc so line noise is discarded a word at a time
+        const uint8_t *start = (const uint8_t *)memchr(
+          data + pos, DIST_FS_START_BYTE_A, size - pos);
+        if (!start) {
+          parser->dropped_bytes += size - pos;
+          return frames;
+        }
+        size_t skipped = (size_t)(start - (data + pos));
+        if (skipped > 0) {
+          parser->dropped_bytes += skipped;
+          parser->resyncs++;
+        }
+        pos                = (size_t)(start - data) + 1;
+        parser->header[0]  = DIST_FS_START_BYTE_A;
+        parser->header_len = 1;
+        parser->state      = PACKET_PARSER_HEADER;
+        break;
       }
 
-      // read payload data of the packet
-      ret = comm_ctx->driver->read(comm_ctx, payload, payload_size, timeout_ms);
-      if (ret == 0) {
-        // handle payload if needed (printing here for example)
-        for (size_t i = 0; i < payload_size; i++) {
-          LOG(INFO, "Payload Byte %zu: 0x%X", i, payload[i]);
+      case PACKET_PARSER_HEADER: {
+        // second start byte must follow immediately. if it doesn't, drop
+        // the first one and look at this byte again while syncing
+        if (parser->header_len == 1 && data[pos] != DIST_FS_START_BYTE_B) {
+          parser->dropped_bytes++;
+          parser->resyncs++;
+          parser->state = PACKET_PARSER_SYNC;
+          break;
+        }
+
+        size_t want = DIST_FS_HEADER_SIZE - parser->header_len;
+        size_t take = (size - pos < want) ? size - pos : want;
+        memcpy(parser->header + parser->header_len, data + pos, take);
+        parser->header_len += (uint32_t)take;
+        pos += take;
+        if (parser->header_len < DIST_FS_HEADER_SIZE) {
+          break;
+        }
+
+        if (!packet_command_valid(parser,
+                                  parser->header[DIST_FS_PKT_COMMAND])) {
+          // not a real frame. the start bytes were noise, so rescan
+          // everything after them for another start sequence
+          LOG(WARN,
+              "Invalid command {0x%X}, resyncing",
+              parser->header[DIST_FS_PKT_COMMAND]);
+          uint8_t rescan[DIST_FS_HEADER_SIZE - 1];
+          memcpy(rescan, parser->header + 1, sizeof(rescan));
+          parser->dropped_bytes++;
+          parser->resyncs++;
+          parser->state      = PACKET_PARSER_SYNC;
+          parser->header_len = 0;
+          frames += packet_parser_feed(parser, rescan, sizeof(rescan));
+          break;
         }
-      } else if (ret == -1) {
-      } else {
-        LOG(ERR, "Error reading payload data: %d", ret);
+
+        parser->payload_size = (parser->header[DIST_FS_PKT_SIZE_MSB] << 8) |
+                               parser->header[DIST_FS_PKT_SIZE_LSB];
+        parser->payload_len  = 0;
+
+        if (parser->payload_size == 0) {
+          frames += packet_parser_emit(parser, nullptr);
+        } else if (size - pos >= parser->payload_size) {
+          // the whole payload is already in this chunk, hand it over
+          // without copying it into the parser
+          size_t payload_size = parser->payload_size;
+          frames += packet_parser_emit(parser, data + pos);
+          pos += payload_size;
+        } else {
+          parser->state = PACKET_PARSER_PAYLOAD;
+        }
+        break;
       }
 
-      // free memory after usage
-      free(payload);
+      case PACKET_PARSER_PAYLOAD: {
+        size_t want = parser->payload_size - parser->payload_len;
+        size_t take = (size - pos < want) ? size - pos : want;
+        memcpy(parser->payload + parser->payload_len, data + pos, take);
+        parser->payload_len += (uint32_t)take;
+        pos += take;
+        if (parser->payload_len == parser->payload_size) {
+          frames += packet_parser_emit(parser, parser->payload);
+        }
+        break;
+      }
     }
+  }
 
-    return 0;
+  return frames;
+}
+
+void log_packet(const dist_fs_packet_t *packet, void *arg) {
+  (void)arg;
+
+  // print header information
+  LOG(DBG, "Start Bytes: 0x%X 0x%X", packet->start[0], packet->start[1]);
+  LOG(DBG, "Command: %d", packet->command);
+  LOG(DBG, "Flags: 0x%X", packet->flags);
+  LOG(DBG, "Payload Size: %u bytes", packet->payload_size);
+
+  // handle payload if needed (printing here for example)
+  for (size_t i = 0; i < packet->payload_size; i++) {
+    LOG(DBG, "Payload Byte %zu: 0x%X", i, packet->payload[i]);
+  }
+}
+
+int decode_packet(comm_context_t *comm_ctx, packet_parser_t *parser) {
+  uint8_t buffer[DIST_FS_READ_BATCH_SIZE];
+  const uint16_t timeout_ms = 1000; // 1-second timeout
+
+  // read whatever is available, up to a full batch, and let the parser
+  // split it into frames
+  int ret =
+    comm_ctx->driver->read(comm_ctx, buffer, sizeof(buffer), timeout_ms);
+  if (ret > 0) {
+    return (int)packet_parser_feed(parser, buffer, (size_t)ret);
   } else if (ret == -ETIMEDOUT) {
     LOG(WARN, "Read timed out. No data received");
   } else if (ret == -1) {
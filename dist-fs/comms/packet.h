@@ -11,6 +11,11 @@
 #define DIST_FS_START_BYTE_A 0xDA
 #define DIST_FS_START_BYTE_B 0xFF
 
+/* largest payload the 16 bit size field can describe */
+#define DIST_FS_MAX_PAYLOAD_SIZE 0xFFFF
+/* bytes pulled from a driver per read when decoding */
+#define DIST_FS_READ_BATCH_SIZE 4096
+
 
 typedef enum {
   DIST_FS_START_BYTE_SIZE = 2, // start bytes are 2 bytes
@@ -23,8 +28,71 @@ typedef enum {
   DIST_FS_UPLOAD,
   DIST_FS_DOWNLOAD,
   DIST_FS_DELETE,
+  DIST_FS_HELLO,
+  DIST_FS_SYNC,
 } dist_fs_ops_e;
 
+/*
+ * the command byte carries the operation in its low bits and flags in the
+ * rest. every request and response is a stream of one or more frames of the
+ * same operation, the first marked START and the last marked END:
+ *
+ *  LIST      req: START|END, no payload for every file in table order, or a
+ *                 list query for one page of a sorted listing
+ *            rsp: "<name>\t<size>\n" lines split across frames
+ *  UPLOAD    req: START with the file name, data frames, END
+ *            rsp: START|END, no payload
+ *  DOWNLOAD  req: START|END with the file name
+ *            rsp: START with the 64 bit big endian file size, data frames, END
+ *  DELETE    req: START|END with the file name
+ *            rsp: START|END, no payload
+ *  HELLO     req: START|END with a bitmask of the client's link codecs
+ *            rsp: START|END with the link codec id the host picked
+ *  SYNC      req: START|END, no payload for every file, or the 32 bit epoch
+ *                 and 64 bit generation of the client's copy, big endian
+ *            rsp: binary listing (md_sync.hpp) split across frames, the
+ *                 changes since that generation or every file
+ *
+ * a failed request gets a single START|END|ERROR response whose payload is
+ * the 32 bit big endian error code
+ *
+ * once HELLO has picked a codec either side may send COMPRESSED frames. the
+ * payload of those is the codec id followed by the compressed bytes, and a
+ * frame that doesn't shrink is just sent raw
+ */
+#define DIST_FS_OP_MASK         0x07 // operation bits of the command byte
+#define DIST_FS_FLAG_ERROR      0x08 // response carries an error code
+#define DIST_FS_FLAG_START      0x10 // first frame of a request/response
+#define DIST_FS_FLAG_END        0x20 // last frame of a request/response
+#define DIST_FS_FLAG_RESPONSE   0x40 // frame travels from host to client
+#define DIST_FS_FLAG_COMPRESSED 0x80 // payload is link codec compressed
+
+/* payload size of data frames when streaming file contents */
+#define DIST_FS_CHUNK_SIZE 32768
+/* how long a client waits for the host to answer */
+#define DIST_FS_RESPONSE_TIMEOUT_MS 5000
+
+/* fixed part of a list query: key (1), flags (1), type (1), then the 32 bit
+ * big endian offset and limit. the name prefix takes the rest */
+#define DIST_FS_LIST_QUERY_SIZE 11
+/* list query flags */
+#define DIST_FS_LIST_DESCENDING 0x01 // largest, newest or last name first
+/* list query type that matches every file */
+#define DIST_FS_LIST_ANY_TYPE 0xFF
+
+/* sync request payload: 32 bit epoch, 64 bit generation */
+#define DIST_FS_SYNC_QUERY_SIZE 12
+
+/* @brief one page of a sorted LIST, a short page is the last one */
+typedef struct {
+  uint8_t key;      // sort order, md_index_key_e of the host
+  uint8_t flags;    // DIST_FS_LIST_* flags
+  uint8_t type;     // only files of this type, or DIST_FS_LIST_ANY_TYPE
+  uint32_t offset;  // matching files skipped
+  uint32_t limit;   // most files sent, 0 for all of them
+  char prefix[256]; // only names starting with this, empty for all
+} dist_fs_list_query_t;
+
 /* @brief packet offsets within the dist-fs packet */
 typedef enum {
   DIST_FS_PKT_START_1  = 0, // First start byte
@@ -40,22 +108,103 @@ typedef enum {
 typedef struct {
   uint8_t start[DIST_FS_START_BYTE_SIZE]; // Start bytes (fixed at 0 and 1)
   dist_fs_ops_e command; // Command (e.g., DIST_FS_LIST, DIST_FS_UPLOAD)
+  uint8_t flags;         // DIST_FS_FLAG_* bits of the command byte
   uint32_t payload_size; // Size of the payload data
   uint8_t *payload;      // Pointer to the payload data
   uint8_t checksum;      // Checksum byte for error detection
 } dist_fs_packet_t;
 
+/* @brief callback invoked by the parser for every complete frame. the
+ * payload pointer is only valid for the duration of the call */
+typedef void (*packet_frame_cb_t)(const dist_fs_packet_t *packet, void *arg);
+
+/* @brief states of the streaming packet parser */
+typedef enum {
+  PACKET_PARSER_SYNC = 0, // scanning for the first start byte
+  PACKET_PARSER_HEADER,   // collecting the rest of the header
+  PACKET_PARSER_PAYLOAD,  // collecting payload bytes
+} packet_parser_state_e;
+
+/* @brief incremental packet parser. bytes can be fed in chunks of any size
+ * and complete frames are handed to the callback as soon as they're seen.
+ * garbage between frames or a corrupt header only costs the bytes up to the
+ * next valid start sequence */
+typedef struct {
+  packet_parser_state_e state;
+  uint8_t header[DIST_FS_HEADER_SIZE]; // header bytes collected so far
+  uint32_t header_len;                 // number of valid bytes in header
+  uint32_t payload_size;               // payload size of the current frame
+  uint32_t payload_len;                // payload bytes collected so far
+  packet_frame_cb_t on_frame;          // frame callback
+  void *arg;                           // user argument for on_frame
+  bool responses;                      // reads host responses, not requests
+  uint64_t frames;                     // frames emitted
+  uint64_t resyncs;                    // times framing was lost
+  uint64_t dropped_bytes;              // bytes discarded while resyncing
+  uint64_t compressed_frames;          // frames that arrived compressed
+  uint64_t corrupt_frames;             // compressed frames that didn't decode
+  uint64_t wire_bytes;                 // payload bytes as received
+  uint64_t raw_bytes;                  // payload bytes after decompression
+  uint8_t payload[DIST_FS_MAX_PAYLOAD_SIZE]; // frames split across chunks
+  uint8_t scratch[DIST_FS_MAX_PAYLOAD_SIZE]; // decompressed payloads
+} packet_parser_t;
+
 
 /* command functions */
 int list_files_command(comm_context_t *comm_ctx);
+int list_page_command(comm_context_t *comm_ctx,
+                      const dist_fs_list_query_t *query);
 int upload_files_command(comm_context_t *comm_ctx, const char *filename);
+int download_files_command(comm_context_t *comm_ctx, const char *filename);
+int delete_files_command(comm_context_t *comm_ctx, const char *filename);
+int hello_command(comm_context_t *comm_ctx);
+/* ask for the changes since generation of epoch, epoch 0 for every file.
+ * the binary listing received is written to out */
+int sync_command(comm_context_t *comm_ctx,
+                 uint32_t epoch,
+                 uint64_t generation,
+                 FILE *out);
 /* test function for echoing packets */
 int test_packet(comm_context_t *comm_ctx,
                 uint8_t *payload,
                 uint16_t payload_size);
 /* packet functions */
 int encode_packet(dist_fs_ops_e command,
+                  uint8_t flags,
                   uint8_t *payload,
                   uint32_t payload_size,
                   uint8_t *buffer);
-int decode_packet(comm_context_t *comm_ctx);
+int send_packet(comm_context_t *comm_ctx,
+                dist_fs_ops_e command,
+                uint8_t flags,
+                const uint8_t *payload,
+                uint32_t payload_size);
+int decode_packet(comm_context_t *comm_ctx, packet_parser_t *parser);
+/* compress a payload with the link's codec. returns the size written to out
+ * (which must hold payload_size bytes) and sets DIST_FS_FLAG_COMPRESSED, or
+ * 0 if the payload should go out raw */
+uint32_t packet_compress(comm_context_t *comm_ctx,
+                         uint8_t *flags,
+                         const uint8_t *payload,
+                         uint32_t payload_size,
+                         uint8_t *out);
+/* streaming parser functions */
+/* responses picks the direction the parser reads: host responses on a
+ * client, client requests on the host. frames going the other way, or
+ * with flags no frame of their operation carries, are taken for noise */
+void packet_parser_init(packet_parser_t *parser,
+                        packet_frame_cb_t on_frame,
+                        void *arg,
+                        bool responses);
+size_t packet_parser_feed(packet_parser_t *parser,
+                          const uint8_t *data,
+                          size_t size);
+/* list query payloads. encode returns the payload size, buffer must hold
+ * DIST_FS_LIST_QUERY_SIZE plus the prefix. decode returns 0, or -1 for a
+ * payload that is too short or a prefix that doesn't fit */
+uint32_t encode_list_query(const dist_fs_list_query_t *query, uint8_t *buffer);
+int decode_list_query(const uint8_t *payload,
+                      uint32_t payload_size,
+                      dist_fs_list_query_t *query);
+/* frame callback that logs the header and payload bytes */
+void log_packet(const dist_fs_packet_t *packet, void *arg);
@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ring.h"
+
+/*
+ * head and tail are free running counters, only masked when indexing into
+ * the buffer. the producer publishes head with release semantics after
+ * writing data and the consumer publishes tail after reading it, so each
+ * side only needs an acquire load of the other's counter. each side also
+ * caches the other's counter and only reloads it when the cached value says
+ * the ring is full/empty, which keeps cache line traffic down on batches
+ */
+
+int ring_init(ring_t *ring, size_t capacity) {
+  if (!ring || capacity == 0)
+    return -EINVAL;
+
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  memset(ring, 0, sizeof(*ring));
+
+  void *buffer = NULL;
+  if (posix_memalign(&buffer, RING_CACHE_LINE_SIZE, size) != 0) {
+    return -ENOMEM;
+  }
+
+  ring->buffer   = (uint8_t *)buffer;
+  ring->capacity = size;
+  ring->mask     = size - 1;
+  return 0;
+}
+
+void ring_free(ring_t *ring) {
+  if (!ring)
+    return;
+  free(ring->buffer);
+  ring->buffer   = NULL;
+  ring->capacity = 0;
+  ring->mask     = 0;
+}
+
+size_t ring_count(ring_t *ring) {
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  return head - tail;
+}
+
+/** @brief producer's view of free space, refreshing the tail if needed */
+static size_t ring_free_space(ring_t *ring, size_t want) {
+  size_t head = ring->head;
+  size_t avail = ring->capacity - (head - ring->cached_tail);
+  if (avail < want) {
+    ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    avail             = ring->capacity - (head - ring->cached_tail);
+  }
+  return avail;
+}
+
+/** @brief consumer's view of stored bytes, refreshing the head if needed */
+static size_t ring_used_space(ring_t *ring, size_t want) {
+  size_t tail = ring->tail;
+  size_t used = ring->cached_head - tail;
+  if (used < want) {
+    ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    used              = ring->cached_head - tail;
+  }
+  return used;
+}
+
+size_t ring_space(ring_t *ring) {
+  return ring_free_space(ring, ring->capacity);
+}
+
+size_t ring_push(ring_t *ring, const uint8_t *data, size_t size) {
+  size_t avail = ring_free_space(ring, size);
+  if (size > avail)
+    size = avail;
+  if (size == 0)
+    return 0;
+
+  // copy in at most two pieces, up to the end of the buffer then the rest
+  size_t index = ring->head & ring->mask;
+  size_t first = ring->capacity - index;
+  if (first > size)
+    first = size;
+  memcpy(ring->buffer + index, data, first);
+  memcpy(ring->buffer, data + first, size - first);
+
+  __atomic_store_n(&ring->head, ring->head + size, __ATOMIC_RELEASE);
+  return size;
+}
+
+size_t ring_pop(ring_t *ring, uint8_t *data, size_t size) {
+  size_t used = ring_used_space(ring, size);
+  if (size > used)
+    size = used;
+  if (size == 0)
+    return 0;
+
+  size_t index = ring->tail & ring->mask;
+  size_t first = ring->capacity - index;
+  if (first > size)
+    first = size;
+  memcpy(data, ring->buffer + index, first);
+  memcpy(data + first, ring->buffer, size - first);
+
+  __atomic_store_n(&ring->tail, ring->tail + size, __ATOMIC_RELEASE);
+  return size;
+}
+
+size_t ring_write_ptr(ring_t *ring, uint8_t **ptr) {
+  size_t avail = ring_free_space(ring, ring->capacity);
+  size_t index = ring->head & ring->mask;
+  size_t first = ring->capacity - index;
+
+  *ptr = ring->buffer + index;
+  return (avail < first) ? avail : first;
+}
+
+void ring_commit(ring_t *ring, size_t size) {
+  __atomic_store_n(&ring->head, ring->head + size, __ATOMIC_RELEASE);
+}
+
+size_t ring_read_ptr(ring_t *ring, const uint8_t **ptr) {
+  size_t used  = ring_used_space(ring, ring->capacity);
+  size_t index = ring->tail & ring->mask;
+  size_t first = ring->capacity - index;
+
+  *ptr = ring->buffer + index;
+  return (used < first) ? used : first;
+}
+
+void ring_consume(ring_t *ring, size_t size) {
+  __atomic_store_n(&ring->tail, ring->tail + size, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,93 @@
+/**
+ * single-producer/single-consumer lock-free byte ring buffer. one thread
+ * pushes, one thread pops, and neither ever takes a lock
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** @brief size used to keep producer and consumer state on separate lines */
+#define RING_CACHE_LINE_SIZE 64
+
+/** @brief lock-free SPSC byte ring. capacity is always a power of two */
+typedef struct {
+  uint8_t *buffer; // backing storage
+  size_t capacity; // size of buffer in bytes, power of two
+  size_t mask;     // capacity - 1, for cheap index wrapping
+
+  // written only by the producer
+  __attribute__((aligned(RING_CACHE_LINE_SIZE))) size_t head;
+  size_t cached_tail; // producer's last seen tail
+
+  // written only by the consumer
+  __attribute__((aligned(RING_CACHE_LINE_SIZE))) size_t tail;
+  size_t cached_head; // consumer's last seen head
+
+  // keep whatever follows the ring off the consumer's line
+  __attribute__((aligned(RING_CACHE_LINE_SIZE))) uint8_t pad;
+} ring_t;
+
+/**
+ * @brief allocate a ring. capacity is rounded up to the next power of two
+ *
+ * @param[in] ring      ring to initialize
+ * @param[in] capacity  minimum capacity in bytes
+ *
+ * @return 0 on success, < 0 on failure
+ */
+int ring_init(ring_t *ring, size_t capacity);
+
+/** @brief free a ring's backing storage */
+void ring_free(ring_t *ring);
+
+/** @brief bytes currently stored in the ring */
+size_t ring_count(ring_t *ring);
+
+/**
+ * @brief producer: free bytes in the ring. the consumer can only add to
+ * them, so that many bytes can be pushed afterwards without a short push
+ */
+size_t ring_space(ring_t *ring);
+
+/**
+ * @brief producer: copy up to size bytes into the ring
+ *
+ * @return bytes pushed, may be less than size if the ring fills up
+ */
+size_t ring_push(ring_t *ring, const uint8_t *data, size_t size);
+
+/**
+ * @brief consumer: copy up to size bytes out of the ring
+ *
+ * @return bytes popped, may be less than size if the ring runs empty
+ */
+size_t ring_pop(ring_t *ring, uint8_t *data, size_t size);
+
+/**
+ * @brief producer: get the largest contiguous free region so data can be
+ * read straight into the ring. follow with ring_commit()
+ *
+ * @param[in]  ring  ring pointer
+ * @param[out] ptr   start of the free region
+ *
+ * @return size of the free region in bytes
+ */
+size_t ring_write_ptr(ring_t *ring, uint8_t **ptr);
+
+/** @brief producer: publish size bytes written through ring_write_ptr() */
+void ring_commit(ring_t *ring, size_t size);
+
+/**
+ * @brief consumer: get the largest contiguous readable region so data can be
+ * processed in place. follow with ring_consume()
+ *
+ * @param[in]  ring  ring pointer
+ * @param[out] ptr   start of the readable region
+ *
+ * @return size of the readable region in bytes
+ */
+size_t ring_read_ptr(ring_t *ring, const uint8_t **ptr);
+
+/** @brief consumer: release size bytes obtained through ring_read_ptr() */
+void ring_consume(ring_t *ring, size_t size);
@@ -22,6 +22,10 @@ static int spi_write(comm_context_t *ctx,
                      uint8_t *tx,
                      uint32_t tx_size,
                      uint16_t timeout_ms);
+static int spi_writev(comm_context_t *ctx,
+                      const struct iovec *iov,
+                      int iovcnt,
+                      uint16_t timeout_ms);
 static int spi_ioctl(comm_context_t *ctx, uint8_t opcode, void *data);
 
 comm_driver_t spi_ops = {
@@ -30,6 +34,7 @@ comm_driver_t spi_ops = {
   .read      = spi_read,
   .write_one = spi_write_one,
   .write     = spi_write,
+  .writev    = spi_writev,
   .ioctl     = spi_ioctl,
 };
 
@@ -173,6 +178,16 @@ static int spi_write(comm_context_t *ctx,
   return bytes_written;
 }
 
+static int spi_writev(comm_context_t *ctx,
+                      const struct iovec *iov,
+                      int iovcnt,
+                      uint16_t timeout_ms) {
+  if (!ctx)
+    return -EINVAL;
+
+  return comm_fd_writev(spi_fd, iov, iovcnt, timeout_ms);
+}
+
 static int spi_ioctl(comm_context_t *ctx, uint8_t opcode, void *data) {
   if (!ctx)
     return -EINVAL;
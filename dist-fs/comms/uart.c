@@ -23,6 +23,10 @@ static int uart_write(comm_context_t *ctx,
                       uint8_t *tx,
                       uint32_t tx_size,
                       uint16_t timeout_ms);
+static int uart_writev(comm_context_t *ctx,
+                       const struct iovec *iov,
+                       int iovcnt,
+                       uint16_t timeout_ms);
 static int uart_ioctl(comm_context_t *ctx, uint8_t opcode, void *data);
 
 comm_driver_t uart_ops = {
@@ -31,6 +35,7 @@ comm_driver_t uart_ops = {
   .read      = uart_read,
   .write_one = uart_write_one,
   .write     = uart_write,
+  .writev    = uart_writev,
   .ioctl     = uart_ioctl,
 };
 
@@ -151,7 +156,9 @@ static int uart_read(comm_context_t *ctx,
   ssize_t bytes_read = 0;
 
   while (bytes_read < rx_sz) {
-    int ret = poll(&pfd, 1, timeout_ms);
+    // wait up to timeout_ms for the first bytes, after that only drain what
+    // is already pending so a large rx buffer doesn't stall the caller
+    int ret = poll(&pfd, 1, bytes_read > 0 ? 0 : timeout_ms);
     if (ret > 0 && (pfd.revents & POLLIN)) {
       ssize_t r =
         read(uart_fd, ((uint8_t *)rx) + bytes_read, rx_sz - bytes_read);
@@ -168,7 +175,7 @@ static int uart_read(comm_context_t *ctx,
   }
 
   if (bytes_read > 0) {
-    return 0;
+    return (int)bytes_read;
   } else {
     return -1;
   }
@@ -232,17 +239,18 @@ static int uart_write(comm_context_t *ctx,
     double kb_per_sec    = bytes_per_sec / 1024;
     double mb_per_sec    = kb_per_sec / 1024;
 
-    LOG(INFO,
-        "Took %.8f seconds to send %ld bytes | %.4f KB | %.4f MB",
-        elapsed_time,
-        bytes_written,
-        bytes_written / 1024.0,
-        bytes_written / (1024.0 * 1024.0));
-    LOG(INFO,
-        "Speed: %.4f bps | %.4f Kbps | %.4f Mbps",
-        bytes_per_sec * 8,
-        kb_per_sec * 8,
-        mb_per_sec * 8);
+    // link_write in the metrics has the throughput, this is for debugging
+    LOG_LIMIT(DBG,
+              1,
+              "Took %.8f seconds to send %ld bytes | %.4f KB | %.4f MB | "
+              "Speed: %.4f bps | %.4f Kbps | %.4f Mbps",
+              elapsed_time,
+              bytes_written,
+              bytes_written / 1024.0,
+              bytes_written / (1024.0 * 1024.0),
+              bytes_per_sec * 8,
+              kb_per_sec * 8,
+              mb_per_sec * 8);
 
     return 0;
   } else {
@@ -250,6 +258,16 @@ static int uart_write(comm_context_t *ctx,
   }
 }
 
+static int uart_writev(comm_context_t *ctx,
+                       const struct iovec *iov,
+                       int iovcnt,
+                       uint16_t timeout_ms) {
+  if (!ctx || !ctx->driver)
+    return -EINVAL;
+
+  return comm_fd_writev(uart_fd, iov, iovcnt, timeout_ms);
+}
+
 static int uart_ioctl(comm_context_t *ctx, uint8_t opcode, void *data) {
   if (!ctx || !ctx->driver)
     return -EINVAL;
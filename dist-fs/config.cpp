@@ -21,6 +21,12 @@ static void print_config(const config_context_t *config_ctx) {
   printf("  Log Directory:      %s\n", config_ctx->log_directory);
   printf("  Log Rotation Size:  %d MB\n", config_ctx->log_rotation_size);
   printf("  Log Retention Days: %d\n", config_ctx->log_retention_days);
+  printf("  Link Compression:   %s\n",
+         config_ctx->link_compression ? "true" : "false");
+  printf("  Enable Scrub:       %s\n",
+         config_ctx->enable_scrub ? "true" : "false");
+  printf("  Scrub Share:        %d %%\n", config_ctx->scrub_share);
+  printf("  Scrub Interval:     %d hours\n", config_ctx->scrub_interval);
 }
 
 void config_cleanup(config_context_t *config_ctx) {
@@ -84,6 +90,14 @@ int parse_config(const char *filename, config_context_t *config_ctx) {
       config_ctx->log_rotation_size = atoi(value);
     } else if (strcmp(key, "LogRetentionDays") == 0) {
       config_ctx->log_retention_days = atoi(value);
+    } else if (strcmp(key, "LinkCompression") == 0) {
+      config_ctx->link_compression = (strcmp(value, "true") == 0);
+    } else if (strcmp(key, "EnableScrub") == 0) {
+      config_ctx->enable_scrub = (strcmp(value, "true") == 0);
+    } else if (strcmp(key, "ScrubShare") == 0) {
+      config_ctx->scrub_share = atoi(value);
+    } else if (strcmp(key, "ScrubInterval") == 0) {
+      config_ctx->scrub_interval = atoi(value);
     }
   }
 
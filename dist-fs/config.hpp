@@ -14,6 +14,10 @@ typedef struct {
   char *log_directory;    // Log directory
   int log_rotation_size;  // Log rotation size in MB
   int log_retention_days; // Log retention days
+  int link_compression;   // Compress frames on the link (1 = true)
+  int enable_scrub;       // Scrub the SSD in the background (1 = true)
+  int scrub_share;        // Percent of device time the scrub may use
+  int scrub_interval;     // Hours between scrub passes
 } config_context_t;
 
 void config_cleanup(config_context_t *config_ctx);
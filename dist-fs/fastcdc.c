@@ -0,0 +1,129 @@
+#include "fastcdc.h"
+
+
+/*
+ * cut where the gear hash has zeros in its top bits. every byte shifts the
+ * hash left by one, so the top bits depend on the last 64 bytes. 18 bits
+ * before the average size and 14 after put the average within a few
+ * percent of FASTCDC_AVG_SIZE
+ */
+#define CDC_MASK_BITS(n) (((1ULL << (n)) - 1) << (64 - (n)))
+#define CDC_MASK_SMALL   CDC_MASK_BITS(18)
+#define CDC_MASK_LARGE   CDC_MASK_BITS(14)
+
+/* random values, one per byte. changing them moves every cut point, so
+ * chunks stored before wouldn't match anymore */
+static const uint64_t cdc_gear[256] = {
+  0xC336AB87C88FAB17ULL, 0x236B6BBD416F5EE1ULL, 0x3406FA88AC55A72CULL,
+  0x798AC296F5CD33BFULL, 0x0F1418C9DD484702ULL, 0xAAC5CA6493812890ULL,
+  0x2AAA1C0A54E959BDULL, 0x96550A1312B55A14ULL, 0x80DB08EDA25F93F6ULL,
+  0x5B55902D3CFBA20EULL, 0x9FC7600D329F1844ULL, 0xC31A293A63C40C2CULL,
+  0xA89F36A8622647A6ULL, 0xC8A3AD619037916FULL, 0xE97C9F9DCC6339B1ULL,
+  0xFF8F19332A5959F9ULL, 0xB0A0B096939E3DA0ULL, 0x4EBA6DF113FA6084ULL,
+  0xE8C9AA0781C88903ULL, 0x1A562CF1BDE41993ULL, 0xCD944FDF3814E40FULL,
+  0x1B5A180781823462ULL, 0x0EE6570825E67B74ULL, 0xBCC7B5A0CE0A4180ULL,
+  0x3C248882C6E3ED82ULL, 0xF4FEE35CB7DE9F57ULL, 0xE6DC36F25ED1C733ULL,
+  0xE1C33D48CD4B5919ULL, 0x058C15D678B22816ULL, 0x692E52E26D37E9E7ULL,
+  0xFC0EDF71E22F7D3BULL, 0x3F496652D5AD440AULL, 0x1F761EC0A067AAEBULL,
+  0xCC17604C9C2C60DAULL, 0x572FF2549544F15FULL, 0xD7BE8A405E9C3B91ULL,
+  0x2351E1D6378CD5A0ULL, 0x8147FB35980BDE52ULL, 0x019AFC2DD4569978ULL,
+  0x414C7283F618AB0BULL, 0x037B3B3BE0A9F3DCULL, 0xE789EF9081FA7A2FULL,
+  0xFD921EE404D5BF36ULL, 0xCD923DFC17FB7962ULL, 0x6EDB881098D985FFULL,
+  0x8516AFDE06FB8047ULL, 0x8E1615D770F156D9ULL, 0xC914A9BDFCAA83BCULL,
+  0xD33AFCAA63FA55F6ULL, 0xA7B6C12359B37FD6ULL, 0xE3F1AFB36176BFE4ULL,
+  0x1A218DC562B19AEAULL, 0x15C883B5C607153EULL, 0x769F4CB60766C3B6ULL,
+  0xF3C7A35E2ED1CA06ULL, 0x57C15D9C9FB2A3A3ULL, 0x292A31FA1668F36EULL,
+  0x7A020CA382D45E8CULL, 0x162CADCD48FB22F4ULL, 0x568E9E013F029AC0ULL,
+  0xF065B267EE947E0EULL, 0x7DACD1BBA95BAB76ULL, 0xD94761B72AB0AB2AULL,
+  0x97D78B326D0BF7C8ULL, 0xF3D0798ED96E6558ULL, 0x0DC64CBE3EADA9FFULL,
+  0xA458DCC7A5E8B62FULL, 0x64C955C2CE82CB84ULL, 0x84B4E4CD895FF3EBULL,
+  0xB242A754E4FF5594ULL, 0x82269AC0296F08D7ULL, 0x2F256479E6B2EAEEULL,
+  0x006DF52323E88D1DULL, 0xD981526654B26B63ULL, 0x06F6FC8FFD1B8F72ULL,
+  0x0A49AFC84F8475A4ULL, 0xA7D5343CF5AA8A86ULL, 0x8A56A07A6FFEB76FULL,
+  0x727F01EE2FC1E07CULL, 0x22DEE10CA0614FE7ULL, 0xDF43C62EE30889C6ULL,
+  0xE4EECA728B5694D5ULL, 0xBC344E7954116835ULL, 0x1BB22AF876B706A7ULL,
+  0x7215A7DBB16407E5ULL, 0xF11C06F2B93F20A7ULL, 0x807CC4257F7B9C93ULL,
+  0x1BE1266EED4F6881ULL, 0xDBC6B1848C44F574ULL, 0x9C9D4EC5125630AFULL,
+  0x8C7C4D2E0E610B8EULL, 0xC83730790C46D47EULL, 0xE142F7135693BC85ULL,
+  0xCF2DBFDEE7A27843ULL, 0x314D5CD1E9868139ULL, 0xBDCBF4C498A5A3E2ULL,
+  0x954C7EDBEFE6681FULL, 0xCF1172DC91E584F3ULL, 0xB2F53BC815DE0C3BULL,
+  0x23F7CAA4E73EDFC1ULL, 0xA64381720DF20AB6ULL, 0xCFEF7CA08462D74EULL,
+  0xE7D7E698157B181FULL, 0x7F3B2428BF091332ULL, 0x5D57177E1D798D53ULL,
+  0x418A96C197BA09D3ULL, 0x965A9AF48C936DC1ULL, 0xFBA8E186AA7EBBDFULL,
+  0xA3D9FC140609E4EFULL, 0x058C74D8F323212CULL, 0x6D96AE5893313FD9ULL,
+  0x3C5C5F80D332721FULL, 0x057BF849A5684297ULL, 0x0C2692FB5A8CCF6FULL,
+  0xB76E0C18C45C1D51ULL, 0x08A019BC41304A58ULL, 0x7D415883EFDDF740ULL,
+  0x4A506D0E4AE3B82AULL, 0x03A7D7D8D5E53643ULL, 0x984EEC844DE13F8BULL,
+  0x415613F47C9F0F84ULL, 0x86242D533E2E6962ULL, 0x5D26A295C977ACE5ULL,
+  0x139E0817B2FA6410ULL, 0x6021E5EC67C5FA4CULL, 0xA6FFAB38622F94B5ULL,
+  0xC39C7880E4FCD5CBULL, 0xFE4CC3D7C0D1E6BCULL, 0x3141A0F8917DBB5FULL,
+  0xE3A08C36B6D1831CULL, 0xD63E53959889A8AAULL, 0xECD0DBDD87F76A6EULL,
+  0x49940051D6C9883BULL, 0xA3FC268C7F88AC81ULL, 0x694147BC2D1221C3ULL,
+  0x53B4950EB88A1A9AULL, 0xB83D8961C13DE9A1ULL, 0x1EEB0A28672B8DE8ULL,
+  0xF21F3EAFDD9696FAULL, 0x3BF819D5D0315F29ULL, 0x8C569807C1E56486ULL,
+  0xDBE861D61FB91020ULL, 0xA27011BD462D881AULL, 0x28D2B12685B244DBULL,
+  0xFB5480DC9A7CE1A1ULL, 0xFE2AE230028950BFULL, 0xC999D4D19430C462ULL,
+  0xE81D329DC9F209A8ULL, 0xE58E3C6E1ACA93C3ULL, 0x9C7443FFD2DBD61CULL,
+  0x4E19ADED00E60B6FULL, 0xB3A36CDA09E696C1ULL, 0xCF1517B95EE1A2A3ULL,
+  0x5078C35EA24E4BB8ULL, 0x80AC995DDE13E3CBULL, 0x28EC79BA3BEDF08AULL,
+  0xB17CF868A9F555E9ULL, 0x5B42F903AAAE8D46ULL, 0x4053CA9125265AFFULL,
+  0x77A09AAA11BCE181ULL, 0xBFE813EDA519E83AULL, 0x4AE2F39ABD8BC613ULL,
+  0xE776B96B3626499FULL, 0x4283D143AE527BE9ULL, 0x56F4938EFD760263ULL,
+  0x0785D3F5A7DEDA96ULL, 0x9824E5A7D6D638B7ULL, 0x61B542A4A1B97788ULL,
+  0xB840321377DD6798ULL, 0xE40F821B1761EF13ULL, 0x571D1F32CD6C925BULL,
+  0xB64C00EFF7869DE6ULL, 0xC804E70F838986D3ULL, 0x5AEA86AC66A9341FULL,
+  0x5B0022AEE022D197ULL, 0x5481DAD9D16ECF1DULL, 0x7BADB909C362D210ULL,
+  0xD42AD02A20FB2D6CULL, 0xEE3F8E63B4016B92ULL, 0x67DA9516CAF61D59ULL,
+  0x7FC5154D1A190D78ULL, 0x35CF0426085115CCULL, 0x0A74EEB2510BFDF7ULL,
+  0xA92CA75D74A78CD3ULL, 0x7E9D691AF5CAA563ULL, 0x221101FF4573E16DULL,
+  0x8EC1A19B634F64BDULL, 0xFED95B932EECA356ULL, 0x7E6832B3E54A20BFULL,
+  0xB3CF6517C42C1413ULL, 0x7ACC1A0C5E605129ULL, 0x6E65665C60189682ULL,
+  0x4A1AA0452CBD9B1CULL, 0xD97057F0F52A76EEULL, 0xA1DE97A4A23C8561ULL,
+  0xBEE8AE92CA0B88A0ULL, 0xDC1A08B10A731232ULL, 0x035E35EEA996B16BULL,
+  0x485A77BD2072B8EEULL, 0xCA48FE8F5ED04800ULL, 0x9243992D6E8C4625ULL,
+  0x6B7B3B50821790BEULL, 0x37E0F6FDC709C0A0ULL, 0xA8B72B0DC4954311ULL,
+  0xAC9A48C1238DD51CULL, 0xC303DF66BBA6A504ULL, 0xE3AA56B75BD2AA9BULL,
+  0x281FCC07FFA4EF83ULL, 0xDF81B34257EEF547ULL, 0xCCAD4AB274FE07F4ULL,
+  0xE1E758D65EDA2C56ULL, 0x2AC9C88DFFD54EE2ULL, 0x9D4A334D9172B310ULL,
+  0x1D0A6F617E248A2CULL, 0x70461D3882EC75B2ULL, 0x67581D85956C8AE1ULL,
+  0xB0E5F4A641816E59ULL, 0x96C5AADB3A38331AULL, 0xD85C62369A184B5FULL,
+  0xE0BAA4FB70F49721ULL, 0x292C22DAC6662146ULL, 0xEF76756042594E9AULL,
+  0x604C8ECE5CE4D522ULL, 0x185D13C492755C0FULL, 0x478EEE5D2F196DF6ULL,
+  0x62BE6595F73787CFULL, 0x224FD9B3242369ABULL, 0x6272ECC8BD4D30A6ULL,
+  0xE52D024D278BDD00ULL, 0x19F1021DB7C6A065ULL, 0xD7B55C93E9988560ULL,
+  0x9D8CD38CA24E2E1DULL, 0x21D27359186E57B6ULL, 0x18AF738A095C3CA8ULL,
+  0x64C140886495D8C9ULL, 0xCBD1637720BD220FULL, 0x2FFB46A04A7D97C1ULL,
+  0xD6F26CC0C6C48AF0ULL, 0x8BEB52AA25E728F9ULL, 0x946F15C961F9C07FULL,
+  0x1F66A321F9806288ULL, 0x221CA138EE6AFE71ULL, 0x1065CF7ECC3C879BULL,
+  0xB7F8269BE679FC1BULL, 0x8F076FD86D95C63BULL, 0x70B595FB5D00D3AAULL,
+  0x993BEF6B069CE258ULL, 0x5F55DEC9094AC14FULL, 0x2A80B210D7419C5EULL,
+  0x82BC59D2EC5C6C8AULL, 0x7AA079278ADA4345ULL, 0x550A974820714310ULL,
+  0xDD0ABB16318DCECBULL, 0xE3672C351ADBCBB0ULL, 0x6340739BA984CF4FULL,
+  0xF306A271E7012736ULL,
+};
+
+size_t fastcdc_next_chunk(const uint8_t *data, size_t size) {
+  if (size <= FASTCDC_MIN_SIZE) {
+    return size;
+  }
+
+  size_t end    = size < FASTCDC_MAX_SIZE ? size : FASTCDC_MAX_SIZE;
+  size_t normal = end < FASTCDC_AVG_SIZE ? end : FASTCDC_AVG_SIZE;
+
+  // nothing before the minimum size can be a cut point, so it isn't hashed
+  uint64_t hash = 0;
+  size_t i      = FASTCDC_MIN_SIZE;
+  for (; i < normal; i++) {
+    hash = (hash << 1) + cdc_gear[data[i]];
+    if (!(hash & CDC_MASK_SMALL)) {
+      return i + 1;
+    }
+  }
+  for (; i < end; i++) {
+    hash = (hash << 1) + cdc_gear[data[i]];
+    if (!(hash & CDC_MASK_LARGE)) {
+      return i + 1;
+    }
+  }
+  return end;
+}
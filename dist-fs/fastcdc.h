@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*
+ * content defined chunking with the FastCDC gear hash. a cut point only
+ * depends on the bytes since the previous cut, so an edit moves the
+ * boundaries around it and leaves every chunk after the next cut as it was.
+ * normalized chunking keeps the sizes close to the average, a stricter mask
+ * before it and a looser one after
+ */
+#define FASTCDC_MIN_SIZE (16 * 1024)
+#define FASTCDC_AVG_SIZE (64 * 1024)
+#define FASTCDC_MAX_SIZE (256 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief find the end of the next chunk
+ *
+ * @param[in] data  input starting at the previous cut point
+ * @param[in] size  bytes left in the input
+ *
+ * @return length of the chunk, never more than size or FASTCDC_MAX_SIZE, and
+ * only less than FASTCDC_MIN_SIZE for the tail of the input
+ */
+size_t fastcdc_next_chunk(const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
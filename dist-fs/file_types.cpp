@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "file_types.hpp"
+#include "utils.hpp"
+
+
+/** @brief a signature that has to match every byte of pattern */
+#define FILE_MAGIC(offset, pattern, priority, type)                           \
+  {offset, sizeof(pattern) - 1, priority, pattern, NULL, type}
+
+/** @brief a signature that only compares the bits set in mask */
+#define FILE_MAGIC_MASKED(offset, pattern, mask, priority, type)              \
+  {offset, sizeof(pattern) - 1, priority, pattern, mask, type}
+
+/**
+ * @brief the signature registry. to support a new format add its signatures
+ * here, the trie is rebuilt from this table. containers that share a magic
+ * number (RIFF, FORM, ftyp) are told apart by a longer masked signature with
+ * a higher priority
+ */
+static const file_magic_t file_magic_registry[] = {
+  // audio
+  FILE_MAGIC_MASKED(0,
+                    "RIFF\0\0\0\0WAVE",
+                    "\xff\xff\xff\xff\0\0\0\0\xff\xff\xff\xff",
+                    2,
+                    DIST_FS_TYPE_WAV),
+  FILE_MAGIC(0, "fLaC", 2, DIST_FS_TYPE_FLAC),
+  FILE_MAGIC_MASKED(0,
+                    "FORM\0\0\0\0AIFF",
+                    "\xff\xff\xff\xff\0\0\0\0\xff\xff\xff\xff",
+                    2,
+                    DIST_FS_TYPE_AIFF),
+  FILE_MAGIC_MASKED(0,
+                    "FORM\0\0\0\0AIFC",
+                    "\xff\xff\xff\xff\0\0\0\0\xff\xff\xff\xff",
+                    2,
+                    DIST_FS_TYPE_AIFF),
+  FILE_MAGIC(4, "ftypM4A ", 2, DIST_FS_TYPE_M4A),
+  FILE_MAGIC(4, "ftypM4B ", 2, DIST_FS_TYPE_M4A),
+  FILE_MAGIC(4, "ftypM4P ", 2, DIST_FS_TYPE_M4A),
+  FILE_MAGIC(4, "ftyp", 1, DIST_FS_TYPE_MP4),
+  // any ID3v2 version, or a bare MPEG layer III frame header
+  FILE_MAGIC(0, "ID3", 2, DIST_FS_TYPE_MP3),
+  FILE_MAGIC_MASKED(0, "\xff\xe2", "\xff\xe6", 1, DIST_FS_TYPE_MP3),
+  // ADTS frame header, layer bits zero
+  FILE_MAGIC_MASKED(0, "\xff\xf0", "\xff\xf6", 1, DIST_FS_TYPE_AAC),
+  FILE_MAGIC(0, "OggS", 2, DIST_FS_TYPE_OGG),
+  FILE_MAGIC(0, "MThd", 2, DIST_FS_TYPE_MIDI),
+
+  // images
+  FILE_MAGIC(0, "\x89PNG\r\n\x1a\n", 2, DIST_FS_TYPE_PNG),
+  FILE_MAGIC(0, "\xff\xd8\xff", 2, DIST_FS_TYPE_JPEG),
+  FILE_MAGIC(0, "GIF87a", 2, DIST_FS_TYPE_GIF),
+  FILE_MAGIC(0, "GIF89a", 2, DIST_FS_TYPE_GIF),
+  FILE_MAGIC(0, "BM", 1, DIST_FS_TYPE_BMP),
+  FILE_MAGIC(0, "II*\0", 2, DIST_FS_TYPE_TIFF),
+  FILE_MAGIC(0, "MM\0*", 2, DIST_FS_TYPE_TIFF),
+  FILE_MAGIC_MASKED(0,
+                    "RIFF\0\0\0\0WEBP",
+                    "\xff\xff\xff\xff\0\0\0\0\xff\xff\xff\xff",
+                    2,
+                    DIST_FS_TYPE_WEBP),
+
+  // archives and documents
+  FILE_MAGIC(0, "PK\x03\x04", 2, DIST_FS_TYPE_ZIP),
+  FILE_MAGIC(0, "PK\x05\x06", 2, DIST_FS_TYPE_ZIP),
+  FILE_MAGIC(0, "\x1f\x8b", 2, DIST_FS_TYPE_GZIP),
+  FILE_MAGIC(0, "BZh", 2, DIST_FS_TYPE_BZIP2),
+  FILE_MAGIC(0, "\xfd" "7zXZ\0", 2, DIST_FS_TYPE_XZ),
+  FILE_MAGIC(0, "\x28\xb5\x2f\xfd", 2, DIST_FS_TYPE_ZSTD),
+  FILE_MAGIC(0, "7z\xbc\xaf\x27\x1c", 2, DIST_FS_TYPE_7Z),
+  FILE_MAGIC(257, "ustar", 2, DIST_FS_TYPE_TAR),
+  FILE_MAGIC(0, "%PDF-", 2, DIST_FS_TYPE_PDF),
+  FILE_MAGIC(0, "\xef\xbb\xbf", 1, DIST_FS_TYPE_TEXT),
+};
+
+/** @brief names of the types, indexed by type */
+static const char *const file_type_names[DIST_FS_END] = {
+  "wav",  "flac", "aiff", "m4a", "mp3",  "data",  NULL,   // 0 - 6
+  "ogg",  "aac",  "midi", "mp4",                         // other audio
+  "png",  "jpeg", "gif",  "bmp", "tiff", "webp",         // images
+  "zip",  "gzip", "bzip2", "xz", "zstd", "7z",   "tar",  // archives
+  "pdf",  "json", "text",                                // documents
+};
+
+/******************************* decision trie ********************************/
+/*
+ * every node tests the file's byte at one offset and follows the edge for
+ * its value. signatures that don't care about that offset are copied under
+ * every edge and under the node's any child, which is taken for values
+ * without an edge and for files too short to have the byte. a node records
+ * the best signature that is complete once it's reached, and the walk keeps
+ * the best one it passed
+ */
+
+/** @brief a byte a signature still has to match */
+typedef struct {
+  uint16_t offset;
+  uint8_t value;
+  uint8_t mask;
+} file_magic_byte_t;
+
+typedef struct {
+  uint16_t offset;    // byte tested by this node
+  uint16_t first;     // index of the node's first edge
+  uint16_t num_edges; // edges, sorted by byte value
+  int16_t any;        // child for every other value, -1 for none
+  int16_t type;       // best signature complete here, -1 for none
+  uint8_t priority;   // priority of that signature
+} file_trie_node_t;
+
+typedef struct {
+  uint8_t value;
+  uint16_t child;
+} file_trie_edge_t;
+
+/** @brief a signature on its way down the trie, with the bytes left */
+typedef struct {
+  const file_magic_t *magic;
+  std::vector<file_magic_byte_t> left;
+} file_trie_item_t;
+
+/**
+ * @brief a set of signatures and how far along each one is. the signatures
+ * that don't test an offset reach the same set of states under many edges,
+ * and those share one subtree, which keeps the trie around a hundred nodes
+ */
+typedef std::vector<std::pair<const file_magic_t *, size_t>> file_trie_key_t;
+
+typedef struct {
+  std::vector<file_trie_node_t> nodes;
+  std::vector<file_trie_edge_t> edges;
+} file_trie_t;
+
+/** @brief nodes already built, by the signature states they stand for */
+typedef std::map<file_trie_key_t, uint16_t> file_trie_built_t;
+
+/** @brief builds the node of a set of signature states, -1 if the trie
+ * outgrew its 16 bit indices */
+static int file_trie_build(file_trie_t &trie,
+                           file_trie_built_t &built,
+                           std::vector<file_trie_item_t> items) {
+  // registry order, so earlier entries win ties wherever the items came from
+  std::sort(items.begin(),
+            items.end(),
+            [](const file_trie_item_t &a, const file_trie_item_t &b) {
+              return a.magic < b.magic;
+            });
+  file_trie_key_t key;
+  for (const file_trie_item_t &item : items) {
+    key.push_back({item.magic, item.left.size()});
+  }
+  auto known = built.find(key);
+  if (known != built.end()) {
+    return known->second;
+  }
+
+  // nodes are linked by 16 bit indices, and by signed ones from any
+  if (trie.nodes.size() >= INT16_MAX) {
+    return -1;
+  }
+  uint16_t index = static_cast<uint16_t>(trie.nodes.size());
+  trie.nodes.push_back({0, 0, 0, -1, -1, 0});
+  built[key] = index;
+
+  // the best complete signature
+  file_trie_node_t node = {0, 0, 0, -1, -1, 0};
+  uint16_t offset       = UINT16_MAX;
+  for (const file_trie_item_t &item : items) {
+    if (item.left.empty()) {
+      if (item.magic->priority > node.priority) {
+        node.type     = item.magic->type;
+        node.priority = item.magic->priority;
+      }
+    } else {
+      offset = std::min(offset, item.left.front().offset);
+    }
+  }
+
+  if (offset != UINT16_MAX) {
+    node.offset = offset;
+
+    // every byte value that passes a signature's test gets the signature,
+    // the ones that don't test this offset go everywhere
+    std::vector<file_trie_item_t> by_value[256];
+    std::vector<file_trie_item_t> any;
+    for (file_trie_item_t &item : items) {
+      if (item.left.empty()) {
+        continue;
+      }
+      if (item.left.front().offset != offset) {
+        any.push_back(item);
+        continue;
+      }
+      file_magic_byte_t byte = item.left.front();
+      item.left.erase(item.left.begin());
+      for (int value = 0; value < 256; value++) {
+        if ((value & byte.mask) == byte.value) {
+          by_value[value].push_back(item);
+        }
+      }
+    }
+
+    std::vector<std::pair<uint8_t, uint16_t>> children;
+    for (int value = 0; value < 256; value++) {
+      if (by_value[value].empty()) {
+        continue;
+      }
+      by_value[value].insert(by_value[value].end(), any.begin(), any.end());
+      int child = file_trie_build(trie, built, by_value[value]);
+      if (child < 0) {
+        return -1;
+      }
+      children.push_back({value, static_cast<uint16_t>(child)});
+    }
+    if (!any.empty()) {
+      int child = file_trie_build(trie, built, any);
+      if (child < 0) {
+        return -1;
+      }
+      node.any = static_cast<int16_t>(child);
+    }
+
+    // a node's edges are contiguous, so they're only appended once all of
+    // its children are built
+    if (trie.edges.size() + children.size() > UINT16_MAX) {
+      return -1;
+    }
+    node.first     = static_cast<uint16_t>(trie.edges.size());
+    node.num_edges = static_cast<uint16_t>(children.size());
+    for (const auto &child : children) {
+      trie.edges.push_back({child.first, child.second});
+    }
+  }
+
+  trie.nodes[index] = node;
+  return index;
+}
+
+static file_trie_t file_trie_compile(void) {
+  std::vector<file_trie_item_t> items;
+  for (const file_magic_t &magic : file_magic_registry) {
+    file_trie_item_t item = {&magic, {}};
+    for (uint8_t i = 0; i < magic.len; i++) {
+      uint8_t mask = magic.mask ? magic.mask[i] : 0xff;
+      if (mask) {
+        item.left.push_back({static_cast<uint16_t>(magic.offset + i),
+                             static_cast<uint8_t>(magic.pattern[i] & mask),
+                             mask});
+      }
+    }
+    items.push_back(item);
+  }
+
+  file_trie_t trie;
+  file_trie_built_t built;
+  if (file_trie_build(trie, built, items) < 0) {
+    // without a trie every file is sniffed as text or data
+    LOG(ERR, "The file signatures don't fit the type trie's 16 bit indices");
+    trie.nodes.clear();
+    trie.edges.clear();
+  }
+  return trie;
+}
+
+static bool file_edge_before(const file_trie_edge_t &edge, uint8_t value) {
+  return edge.value < value;
+}
+
+/** @brief walks the trie, -1 if no signature matches */
+static int file_trie_match(const file_trie_t &trie,
+                           const uint8_t *data,
+                           size_t size) {
+  int type         = -1;
+  uint8_t priority = 0;
+  int index        = trie.nodes.empty() ? -1 : 0;
+
+  while (index >= 0) {
+    const file_trie_node_t &node = trie.nodes[index];
+    if (node.priority > priority) {
+      type     = node.type;
+      priority = node.priority;
+    }
+    if (node.num_edges == 0 && node.any < 0) {
+      break;
+    }
+
+    index = node.any;
+    if (node.offset < size) {
+      const file_trie_edge_t *first = trie.edges.data() + node.first;
+      const file_trie_edge_t *last  = first + node.num_edges;
+      const file_trie_edge_t *edge =
+        std::lower_bound(first, last, data[node.offset], file_edge_before);
+      if (edge != last && edge->value == data[node.offset]) {
+        index = edge->child;
+      }
+    }
+  }
+
+  return type;
+}
+
+/** @brief whitespace a text file may hold among its control characters */
+static bool file_is_space(uint8_t c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+/**
+ * @brief whether the head of the file reads as text: valid UTF-8 without
+ * NULs or control characters other than whitespace. a sequence cut off by
+ * the end of the sniffed bytes is fine
+ */
+static bool file_is_text(const uint8_t *data, size_t size) {
+  size = std::min<size_t>(size, FILE_TEXT_SNIFF_SIZE);
+  for (size_t i = 0; i < size; i++) {
+    uint8_t c = data[i];
+    if (c < 0x80) {
+      if ((c < 0x20 && !file_is_space(c)) || c == 0x7f) {
+        return false;
+      }
+      continue;
+    }
+
+    // lead byte of a 2 to 4 byte sequence, overlong forms excluded
+    size_t follow = c >= 0xc2 && c <= 0xdf   ? 1
+                    : c >= 0xe0 && c <= 0xef ? 2
+                    : c >= 0xf0 && c <= 0xf4 ? 3
+                                             : 0;
+    if (follow == 0) {
+      return false;
+    }
+    for (; follow > 0 && i + 1 < size; follow--) {
+      if ((data[++i] & 0xc0) != 0x80) {
+        return false;
+      }
+    }
+  }
+  return size > 0;
+}
+
+dist_fs_file_types_e file_type_detect(const uint8_t *data, size_t size) {
+  // built on first use, function statics are initialized once even when
+  // several threads get here together
+  static const file_trie_t trie = file_trie_compile();
+
+  int type = file_trie_match(trie, data, size);
+  if (type >= 0) {
+    return static_cast<dist_fs_file_types_e>(type);
+  }
+
+  if (!file_is_text(data, size)) {
+    return DIST_FS_TYPE_DATA;
+  }
+  const uint8_t *end   = data + std::min<size_t>(size, FILE_TEXT_SNIFF_SIZE);
+  const uint8_t *first = std::find_if(
+    data, end, [](uint8_t c) { return !file_is_space(c); });
+  if (first != end && (*first == '{' || *first == '[')) {
+    return DIST_FS_TYPE_JSON;
+  }
+  return DIST_FS_TYPE_TEXT;
+}
+
+const char *file_type_name(dist_fs_file_types_e type) {
+  if (type < 0 || type >= DIST_FS_END || !file_type_names[type]) {
+    return "unknown";
+  }
+  return file_type_names[type];
+}
@@ -0,0 +1,46 @@
+/**
+ * @file file_types.hpp
+ * @brief Identifies files by their magic numbers. the signatures live in one
+ * table that is compiled into a decision trie the first time it's used, so
+ * a file is identified by one walk over its leading bytes
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "audio_files.hpp"
+
+/** @brief Bytes looked at when telling text files from binary ones */
+#define FILE_TEXT_SNIFF_SIZE 4096
+
+/**
+ * @struct file_magic_t
+ * @brief One signature of the registry. a file matches when every byte of
+ * pattern equals the file's byte at offset under mask
+ */
+typedef struct {
+  uint16_t offset;           /**< Where the pattern starts in the file */
+  uint8_t len;               /**< Bytes in pattern and mask */
+  uint8_t priority;          /**< Higher wins when several signatures match */
+  const char *pattern;       /**< Bytes to compare */
+  const char *mask;          /**< Bits compared per byte, NULL for all */
+  dist_fs_file_types_e type; /**< Type of a matching file */
+} file_magic_t;
+
+/**
+ * @brief Identifies a file from its leading bytes. files without a known
+ * signature are checked for text, and anything else is DIST_FS_TYPE_DATA
+ * @param data Head of the file, or all of it
+ * @param size Bytes in data
+ * @return Returns the file type, DIST_FS_TYPE_DATA for an unknown blob
+ */
+dist_fs_file_types_e file_type_detect(const uint8_t *data, size_t size);
+
+/**
+ * @brief Short lower case name of a file type, e.g. "wav"
+ * @param type File type
+ * @return Returns the name, or "unknown" for a value that isn't a type
+ */
+const char *file_type_name(dist_fs_file_types_e type);
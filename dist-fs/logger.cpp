@@ -0,0 +1,480 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "utils.hpp"
+#include "comms/ring.h"
+
+/** @brief fixed part of a record, the message follows it in the ring */
+typedef struct {
+  int64_t time_ns;  // wall clock time of the call
+  const char *file; // call site, string literals so they outlive the call
+  const char *func;
+  uint32_t size;    // bytes of the message
+  uint16_t line;
+  uint8_t level;
+} logger_record_t;
+
+/** @brief one thread's records. the thread is the only producer and the
+ * writer the only consumer, the writer frees it once the thread has exited
+ * and it's drained */
+typedef struct {
+  ring_t ring;
+  uint64_t queued; // records pushed
+  int closed;      // the thread exited
+} logger_ring_t;
+
+static pthread_mutex_t logger_lock = PTHREAD_MUTEX_INITIALIZER; // rings
+static std::vector<logger_ring_t *> logger_rings;
+static uint64_t logger_retired; // records queued by freed rings
+static pthread_key_t logger_key;
+static pthread_once_t logger_key_once = PTHREAD_ONCE_INIT;
+static thread_local logger_ring_t *logger_local;
+
+static pthread_t logger_thread;
+static int logger_running;       // records go to the rings
+static int logger_stopping;      // asks the writer to finish
+static int logger_pushing;       // threads that saw logger_running, pushing
+static uint64_t logger_written;  // records written by the writer
+
+// output, only touched by the writer
+static int log_fd = -1; // -1 for stdout
+static std::string log_dir;
+static std::string log_name;
+static uint64_t log_size;
+static uint64_t log_rotation_bytes;
+static int log_retention_days;
+static unsigned log_rotations;
+
+static const char *level_name(int level) {
+  switch (level) {
+    case DBG:
+      return "DBUG";
+    case INFO:
+      return "INFO";
+    case WARN:
+      return "WARN";
+    case ERR:
+      return "ERRO";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+/** @brief appends "<time> [<level>] <file>:<line> (<func>) - <msg>\n" */
+static void format_line(std::string &out,
+                        const logger_record_t *record,
+                        const char *msg) {
+  // lines come in bursts, the date only changes once a second
+  static thread_local time_t stamp_sec = -1;
+  static thread_local char stamp[32];
+
+  time_t sec = (time_t)(record->time_ns / 1000000000);
+  if (sec != stamp_sec) {
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    stamp_sec = sec;
+  }
+
+  const char *file = strrchr(record->file, '/');
+  file             = file ? file + 1 : record->file;
+
+  // appended piece by piece, the writer formats every line of the process
+  char ms[3];
+  int millis = (int)(record->time_ns / 1000000 % 1000);
+  for (int i = 2; i >= 0; --i, millis /= 10) {
+    ms[i] = (char)('0' + millis % 10);
+  }
+  char line[8];
+  auto end = std::to_chars(line, line + sizeof(line), record->line).ptr;
+
+  out.append(stamp).append(".").append(ms, 3).append(" [");
+  out.append(level_name(record->level)).append("] ");
+  size_t site = out.size();
+  out.append(file).append(":").append(line, end);
+  out.append(" (").append(record->func).append(")");
+  if (out.size() - site < 40) {
+    out.append(40 - (out.size() - site), ' ');
+  }
+  out.append(" - ").append(msg, record->size).push_back('\n');
+}
+
+static void logger_ring_release(void *arg) {
+  __atomic_store_n(&((logger_ring_t *)arg)->closed, 1, __ATOMIC_RELEASE);
+  logger_local = nullptr;
+}
+
+static void logger_key_create() {
+  pthread_key_create(&logger_key, logger_ring_release);
+}
+
+/** @brief the calling thread's ring, registered on its first line */
+static logger_ring_t *logger_ring() {
+  if (logger_local) {
+    return logger_local;
+  }
+  pthread_once(&logger_key_once, logger_key_create);
+
+  logger_ring_t *ring = new logger_ring_t();
+  if (ring_init(&ring->ring, LOGGER_RING_SIZE) != 0) {
+    delete ring;
+    return nullptr;
+  }
+  pthread_mutex_lock(&logger_lock);
+  logger_rings.push_back(ring);
+  pthread_mutex_unlock(&logger_lock);
+
+  pthread_setspecific(logger_key, ring);
+  logger_local = ring;
+  return ring;
+}
+
+/** @brief removes rotated files older than the retention */
+static void log_prune() {
+  DIR *dir = opendir(log_dir.c_str());
+  if (!dir || log_retention_days <= 0) {
+    if (dir) {
+      closedir(dir);
+    }
+    return;
+  }
+
+  time_t oldest     = time(NULL) - (time_t)log_retention_days * 24 * 3600;
+  std::string start = log_name + "-";
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    size_t len = strlen(entry->d_name);
+    if (strncmp(entry->d_name, start.c_str(), start.size()) != 0 ||
+        len < 4 || strcmp(entry->d_name + len - 4, ".log") != 0) {
+      continue;
+    }
+    std::string path = log_dir + "/" + entry->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && st.st_mtime < oldest) {
+      unlink(path.c_str());
+    }
+  }
+  closedir(dir);
+}
+
+static int log_open() {
+  std::string path = log_dir + "/" + log_name + ".log";
+  log_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (log_fd == -1) {
+    return -1;
+  }
+  struct stat st;
+  log_size = (fstat(log_fd, &st) == 0) ? (uint64_t)st.st_size : 0;
+  return 0;
+}
+
+/** @brief moves the full log aside under its rotation time and starts a
+ * new one, falling back to stdout if that can't be opened */
+static void log_rotate() {
+  char stamp[32];
+  time_t now = time(NULL);
+  struct tm tm;
+  localtime_r(&now, &tm);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+  std::string path    = log_dir + "/" + log_name + ".log";
+  std::string rotated = log_dir + "/" + log_name + "-" + stamp + "-" +
+                        std::to_string(log_rotations++) + ".log";
+  close(log_fd);
+  rename(path.c_str(), rotated.c_str());
+  if (log_open() != 0) {
+    log_fd = -1;
+  }
+  log_prune();
+}
+
+static void log_output(const std::string &batch) {
+  if (batch.empty()) {
+    return;
+  }
+  if (log_fd == -1) {
+    fwrite(batch.data(), 1, batch.size(), stdout);
+    fflush(stdout);
+    return;
+  }
+  if (log_rotation_bytes && log_size > 0 &&
+      log_size + batch.size() > log_rotation_bytes) {
+    log_rotate();
+    if (log_fd == -1) {
+      log_output(batch);
+      return;
+    }
+  }
+
+  size_t done = 0;
+  while (done < batch.size()) {
+    ssize_t n = write(log_fd, batch.data() + done, batch.size() - done);
+    if (n <= 0) {
+      break;
+    }
+    done += (size_t)n;
+  }
+  log_size += done;
+}
+
+/** @brief writes every queued record in time order, then frees the rings
+ * of threads that exited. only the writer, or logger_stop() once the
+ * writer is gone, calls this
+ * @return number of records written */
+static size_t logger_drain() {
+  static std::vector<uint8_t> records;
+  static std::vector<std::pair<int64_t, size_t>> order;
+  records.clear();
+  order.clear();
+
+  pthread_mutex_lock(&logger_lock);
+  std::vector<logger_ring_t *> rings = logger_rings;
+  pthread_mutex_unlock(&logger_lock);
+
+  for (logger_ring_t *ring : rings) {
+    // records are pushed whole, so a header means its message is there too
+    logger_record_t record;
+    while (ring_count(&ring->ring) >= sizeof(record)) {
+      ring_pop(&ring->ring, (uint8_t *)&record, sizeof(record));
+      size_t offset = records.size();
+      records.resize(offset + sizeof(record) + record.size);
+      memcpy(records.data() + offset, &record, sizeof(record));
+      ring_pop(&ring->ring,
+               records.data() + offset + sizeof(record),
+               record.size);
+      order.push_back({record.time_ns, offset});
+    }
+  }
+
+  // rings are drained one after the other, put the threads' lines back in
+  // the order they were logged
+  std::stable_sort(
+    order.begin(), order.end(), [](const auto &a, const auto &b) {
+      return a.first < b.first;
+    });
+
+  std::string batch;
+  batch.reserve(LOGGER_BATCH_SIZE);
+  for (const auto &entry : order) {
+    const uint8_t *data = records.data() + entry.second;
+    logger_record_t record;
+    memcpy(&record, data, sizeof(record));
+    format_line(batch, &record, (const char *)data + sizeof(record));
+    if (batch.size() >= LOGGER_BATCH_SIZE) {
+      log_output(batch);
+      batch.clear();
+    }
+  }
+  log_output(batch);
+  __atomic_store_n(
+    &logger_written, logger_written + order.size(), __ATOMIC_RELEASE);
+
+  // a ring closed before it was seen empty holds nothing more
+  pthread_mutex_lock(&logger_lock);
+  for (auto it = logger_rings.begin(); it != logger_rings.end();) {
+    logger_ring_t *ring = *it;
+    if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE) &&
+        ring_count(&ring->ring) == 0) {
+      logger_retired += ring->queued;
+      ring_free(&ring->ring);
+      delete ring;
+      it = logger_rings.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  pthread_mutex_unlock(&logger_lock);
+  return order.size();
+}
+
+static void *logger_main(void *arg) {
+  (void)arg;
+  while (!__atomic_load_n(&logger_stopping, __ATOMIC_ACQUIRE)) {
+    if (logger_drain() == 0) {
+      usleep(LOGGER_IDLE_MS * 1000);
+    }
+  }
+  logger_drain();
+  return NULL;
+}
+
+int logger_start(const config_context_t *cfg, const char *name) {
+  if (logger_running) {
+    return 0;
+  }
+
+  log_fd             = -1;
+  log_name           = name;
+  log_dir            = cfg->log_directory ? cfg->log_directory : "";
+  log_rotation_bytes = (uint64_t)std::max(cfg->log_rotation_size, 0) << 20;
+  log_retention_days = cfg->log_retention_days;
+  if (!log_dir.empty()) {
+    if (log_open() != 0) {
+      LOG(WARN, "Can't open a log in {%s}, logging to stdout", log_dir.c_str());
+    } else {
+      log_prune();
+    }
+  }
+
+  __atomic_store_n(&logger_stopping, 0, __ATOMIC_RELEASE);
+  if (pthread_create(&logger_thread, NULL, logger_main, NULL) != 0) {
+    LOG(ERR, "Failed to start the log writer");
+    if (log_fd != -1) {
+      close(log_fd);
+      log_fd = -1;
+    }
+    return -1;
+  }
+  __atomic_store_n(&logger_running, 1, __ATOMIC_RELEASE);
+
+  // lines still queued when main() returns early are written on the way out
+  static bool stop_at_exit = false;
+  if (!stop_at_exit) {
+    atexit(logger_stop);
+    stop_at_exit = true;
+  }
+  return 0;
+}
+
+void logger_stop() {
+  if (!logger_running) {
+    return;
+  }
+  // lines logged from here on are written by their thread. one that saw
+  // the logger running is waited for, so its record is in a ring before
+  // the last drain
+  __atomic_store_n(&logger_running, 0, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&logger_pushing, __ATOMIC_SEQ_CST) != 0) {
+    sched_yield();
+  }
+
+  __atomic_store_n(&logger_stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(logger_thread, NULL);
+  logger_drain();
+  if (log_fd != -1) {
+    close(log_fd);
+    log_fd = -1;
+  }
+}
+
+void logger_flush() {
+  if (!__atomic_load_n(&logger_running, __ATOMIC_ACQUIRE)) {
+    fflush(stdout);
+    return;
+  }
+
+  pthread_mutex_lock(&logger_lock);
+  uint64_t queued = logger_retired;
+  for (logger_ring_t *ring : logger_rings) {
+    queued += __atomic_load_n(&ring->queued, __ATOMIC_ACQUIRE);
+  }
+  pthread_mutex_unlock(&logger_lock);
+
+  while (__atomic_load_n(&logger_written, __ATOMIC_ACQUIRE) < queued) {
+    usleep(1000);
+  }
+}
+
+bool log_limit(log_limit_t *limit, uint32_t per_second, uint32_t *suppressed) {
+  // the coarse clock is a read of the vDSO page, cheap enough to ask on
+  // every call of a hot call site
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  uint64_t now_ms =
+    (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+
+  // the thread that moves the window on starts the new second's count
+  uint64_t window = __atomic_load_n(&limit->window, __ATOMIC_RELAXED);
+  if ((now_ms - window >= 1000 || window == 0) &&
+      __atomic_compare_exchange_n(&limit->window,
+                                  &window,
+                                  now_ms,
+                                  false,
+                                  __ATOMIC_RELAXED,
+                                  __ATOMIC_RELAXED)) {
+    __atomic_store_n(&limit->count, 1, __ATOMIC_RELAXED);
+    *suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  if (__atomic_add_fetch(&limit->count, 1, __ATOMIC_RELAXED) <= per_second) {
+    *suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+    return true;
+  }
+  __atomic_add_fetch(&limit->suppressed, 1, __ATOMIC_RELAXED);
+  return false;
+}
+
+void logger_vlog(int level,
+                 const char *file,
+                 uint16_t line,
+                 const char *func,
+                 const char *msg,
+                 va_list args) {
+  // the message is formatted here, arguments may not outlive the call, the
+  // rest of the line is left to the writer
+  uint8_t buf[sizeof(logger_record_t) + LOGGER_MSG_SIZE];
+  char *text = (char *)buf + sizeof(logger_record_t);
+  int len    = vsnprintf(text, LOGGER_MSG_SIZE, msg, args);
+  if (len < 0) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  logger_record_t record = {};
+
+  record.time_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  record.file    = file;
+  record.func    = func;
+  record.size    = (uint32_t)std::min(len, LOGGER_MSG_SIZE - 1);
+  record.line    = line;
+  record.level   = (uint8_t)level;
+  memcpy(buf, &record, sizeof(record));
+
+  // logger_stop() waits for a thread that's counted here and saw the logger
+  // running, anything pushed after its last drain would be lost
+  logger_ring_t *ring = nullptr;
+  __atomic_add_fetch(&logger_pushing, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&logger_running, __ATOMIC_SEQ_CST)) {
+    ring = logger_ring();
+  }
+  if (ring) {
+    // a full ring means the writer is behind, wait for it instead of losing
+    // the line. a writer that stops meanwhile leaves the line to this thread
+    size_t size = sizeof(record) + record.size;
+    while (ring->ring.capacity - ring_count(&ring->ring) < size &&
+           __atomic_load_n(&logger_running, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+    }
+    if (ring->ring.capacity - ring_count(&ring->ring) >= size) {
+      ring_push(&ring->ring, buf, size);
+      __atomic_store_n(&ring->queued, ring->queued + 1, __ATOMIC_RELEASE);
+      __atomic_sub_fetch(&logger_pushing, 1, __ATOMIC_SEQ_CST);
+      return;
+    }
+  }
+  __atomic_sub_fetch(&logger_pushing, 1, __ATOMIC_SEQ_CST);
+
+  // no writer, the line is written here
+  std::string out;
+  format_line(out, &record, text);
+  fwrite(out.data(), 1, out.size(), stdout);
+  if (level >= ERR) {
+    fflush(stdout);
+  }
+}
@@ -0,0 +1,64 @@
+/**
+ * @file logger.hpp
+ * @brief Asynchronous backend of the LOG macro. a logging thread only
+ * formats its message into a binary record on a lock free ring of its own,
+ * waiting only when the ring is full, and a writer thread adds the time,
+ * level and call site, batches the lines and writes them to stdout or to a
+ * file in LogDirectory, rotated every LogRotationSize MB and kept for
+ * LogRetentionDays. until logger_start() and after logger_stop() lines are
+ * written by the logging thread itself
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdarg>
+
+#include "config.hpp"
+
+/** @brief Bytes of each thread's ring of records */
+#define LOGGER_RING_SIZE (256 * 1024)
+/** @brief Longest message kept, longer ones are cut */
+#define LOGGER_MSG_SIZE 512
+/** @brief Bytes of formatted lines written at once */
+#define LOGGER_BATCH_SIZE (64 * 1024)
+/** @brief How long the writer sleeps when every ring is empty */
+#define LOGGER_IDLE_MS 5
+
+/**
+ * @brief Starts the writer thread
+ * @param cfg Configuration, LogDirectory, LogRotationSize and
+ * LogRetentionDays are used. without a LogDirectory lines go to stdout
+ * @param name Name of the log file, <name>.log, rotated files are
+ * <name>-<time>-<n>.log
+ * @return Returns 0 on success, or -1 if the thread couldn't be started
+ */
+int logger_start(const config_context_t *cfg, const char *name);
+
+/**
+ * @brief Writes every record still queued and stops the writer thread,
+ * also run at exit once the logger has been started
+ */
+void logger_stop();
+
+/**
+ * @brief Waits until every record logged before the call is written
+ */
+void logger_flush();
+
+/**
+ * @brief Queues one log line, called by log() behind the LOG macro
+ * @param level log_level_e of the line
+ * @param file Source file of the call site
+ * @param line Source line of the call site
+ * @param func Function of the call site
+ * @param msg printf style format of the message
+ * @param args Arguments of msg
+ */
+void logger_vlog(int level,
+                 const char *file,
+                 uint16_t line,
+                 const char *func,
+                 const char *msg,
+                 va_list args);
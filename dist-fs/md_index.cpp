@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <unistd.h>
+
+#include "md_index.hpp"
+#include "utils.hpp"
+
+/** @brief whether entry a sorts before entry b in an order */
+static bool entry_before(const md_index_entry_t &a,
+                         const md_index_entry_t &b,
+                         md_index_key_e key) {
+  switch (key) {
+    case MD_INDEX_UPLOADED:
+      if (a.md.file_time.uploaded != b.md.file_time.uploaded) {
+        return a.md.file_time.uploaded < b.md.file_time.uploaded;
+      }
+      break;
+    case MD_INDEX_SIZE:
+      if (a.md.size != b.md.size) {
+        return a.md.size < b.md.size;
+      }
+      break;
+    case MD_INDEX_TYPE:
+      if (a.md.type != b.md.type) {
+        return a.md.type < b.md.type;
+      }
+      break;
+    default:
+      break;
+  }
+
+  int name = strcmp(a.md.filename, b.md.filename);
+  if (name != 0) {
+    return name < 0;
+  }
+  return a.seq < b.seq;
+}
+
+/** @brief adds an entry to the slots and returns its slot number */
+static uint32_t slot_alloc(md_index_t *index, const storage_metadata_t &md) {
+  md_index_entry_t entry = {md, index->next_seq++};
+  if (index->free_slots.empty()) {
+    index->slots.push_back(entry);
+    return (uint32_t)(index->slots.size() - 1);
+  }
+  uint32_t slot = index->free_slots.back();
+  index->free_slots.pop_back();
+  index->slots[slot] = entry;
+  return slot;
+}
+
+/** @brief position of a slot in an order, found by binary search */
+static std::vector<uint32_t>::iterator
+order_find(md_index_t *index, md_index_key_e key, uint32_t slot) {
+  std::vector<uint32_t> &order = index->order[key];
+  const md_index_entry_t &entry = index->slots[slot];
+  return std::lower_bound(
+    order.begin(), order.end(), slot, [&](uint32_t a, uint32_t) {
+      return entry_before(index->slots[a], entry, key);
+    });
+}
+
+/** @brief ASCII lower case of a byte, what searches compare */
+static char name_fold_char(char c) {
+  return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+/** @brief ASCII lower case copy of a name */
+static std::string name_fold(const char *name) {
+  std::string folded(name);
+  for (char &c : folded) {
+    c = name_fold_char(c);
+  }
+  return folded;
+}
+
+/** @brief where folded text first appears in a name, or NULL */
+static const char *name_find(const char *name, const std::string &text) {
+  const char *end = name + strlen(name);
+  const char *it  = std::search(
+    name, end, text.begin(), text.end(), [](char a, char b) {
+      return name_fold_char(a) == b;
+    });
+  return (it == end && !text.empty()) ? nullptr : it;
+}
+
+/** @brief the distinct trigrams of a folded name, sorted */
+static std::vector<uint32_t> name_grams(const std::string &name) {
+  std::vector<uint32_t> grams;
+  for (size_t i = 0; i + MD_INDEX_GRAM_LEN <= name.size(); ++i) {
+    grams.push_back((uint32_t)(uint8_t)name[i] << 16 |
+                    (uint32_t)(uint8_t)name[i + 1] << 8 |
+                    (uint32_t)(uint8_t)name[i + 2]);
+  }
+  std::sort(grams.begin(), grams.end());
+  grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+  return grams;
+}
+
+/** @brief adds a slot to the lists of its name's trigrams */
+static void grams_add(md_index_t *index, uint32_t slot) {
+  std::string name = name_fold(index->slots[slot].md.filename);
+  for (uint32_t gram : name_grams(name)) {
+    std::vector<uint32_t> &slots = index->grams[gram];
+    slots.insert(std::lower_bound(slots.begin(), slots.end(), slot), slot);
+  }
+}
+
+/** @brief removes a slot from the lists of its name's trigrams */
+static void grams_remove(md_index_t *index, uint32_t slot) {
+  std::string name = name_fold(index->slots[slot].md.filename);
+  for (uint32_t gram : name_grams(name)) {
+    auto it = index->grams.find(gram);
+    if (it == index->grams.end()) {
+      continue;
+    }
+    std::vector<uint32_t> &slots = it->second;
+    slots.erase(std::lower_bound(slots.begin(), slots.end(), slot));
+    if (slots.empty()) {
+      index->grams.erase(it);
+    }
+  }
+}
+
+/** @brief appends a change to the log, dropping the oldest when full */
+static void log_change(md_index_t *index,
+                       md_index_change_e change,
+                       const storage_metadata_t &md) {
+  index->log.push_back({index->generation, change, md});
+  index->log.back().md.children.clear();
+  if (index->log.size() > MD_INDEX_LOG_SIZE) {
+    index->log_base = index->log.front().generation;
+    index->log.pop_front();
+  }
+}
+
+int md_index_init(md_index_t *index) {
+  index->next_seq   = 0;
+  index->generation = 0;
+  index->log_base   = 0;
+
+  // generations restart with the process, the epoch tells them apart
+  index->epoch = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+  if (pthread_rwlock_init(&index->lock, NULL) != 0) {
+    LOG(ERR, "Failed to create the metadata index lock");
+    return -1;
+  }
+  return 0;
+}
+
+void md_index_destroy(md_index_t *index) {
+  index->slots.clear();
+  index->free_slots.clear();
+  index->grams.clear();
+  index->log.clear();
+  for (auto &order : index->order) {
+    order.clear();
+  }
+  pthread_rwlock_destroy(&index->lock);
+}
+
+/** @brief replaces the entries with a table, the index is locked */
+static void index_fill(md_index_t *index,
+                       const std::vector<storage_metadata_t> &md_table) {
+  index->slots.clear();
+  index->free_slots.clear();
+  index->grams.clear();
+  for (const storage_metadata_t &md : md_table) {
+    grams_add(index, slot_alloc(index, md));
+  }
+
+  // the whole table is sorted once instead of inserted entry by entry
+  for (int key = 0; key < MD_INDEX_NUM_KEYS; ++key) {
+    std::vector<uint32_t> &order = index->order[key];
+    order.resize(index->slots.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = (uint32_t)i;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return entry_before(
+        index->slots[a], index->slots[b], (md_index_key_e)key);
+    });
+  }
+  // a client's changes can't be replayed across a rebuild
+  index->generation++;
+  index->log.clear();
+  index->log_base = index->generation;
+}
+
+/** @brief adds an entry to every order and logs it, the index is locked */
+static void entry_insert(md_index_t *index, const storage_metadata_t &entry) {
+  uint32_t slot = slot_alloc(index, entry);
+  for (int key = 0; key < MD_INDEX_NUM_KEYS; ++key) {
+    index->order[key].insert(order_find(index, (md_index_key_e)key, slot),
+                             slot);
+  }
+  grams_add(index, slot);
+  index->generation++;
+  log_change(index, MD_INDEX_ADDED, entry);
+}
+
+/** @brief the slot of the oldest entry of a name, or -1 if there is none.
+ * entries of the same name sit together in the name order, oldest first */
+static int64_t name_oldest(md_index_t *index, const char *filename) {
+  std::vector<uint32_t> &names = index->order[MD_INDEX_NAME];
+  auto it                      = std::partition_point(
+    names.begin(), names.end(), [&](uint32_t slot) {
+      return strcmp(index->slots[slot].md.filename, filename) < 0;
+    });
+  if (it == names.end() ||
+      strcmp(index->slots[*it].md.filename, filename) != 0) {
+    return -1;
+  }
+  return *it;
+}
+
+/** @brief takes a slot out of every order and logs it, the index is locked */
+static void entry_remove(md_index_t *index, uint32_t slot) {
+  for (int key = 0; key < MD_INDEX_NUM_KEYS; ++key) {
+    index->order[key].erase(order_find(index, (md_index_key_e)key, slot));
+  }
+  grams_remove(index, slot);
+  index->slots[slot].md.children.clear();
+  index->free_slots.push_back(slot);
+  index->generation++;
+  log_change(index, MD_INDEX_REMOVED, index->slots[slot].md);
+}
+
+void md_index_build(md_index_t *index,
+                    const std::vector<storage_metadata_t> &md_table) {
+  pthread_rwlock_wrlock(&index->lock);
+  index_fill(index, md_table);
+  pthread_rwlock_unlock(&index->lock);
+  LOG(INFO, "Indexed %zu metadata entries", md_table.size());
+}
+
+/** @brief orders entries by what tells stored files apart */
+static bool entry_identity_before(const storage_metadata_t &a,
+                                  const storage_metadata_t &b) {
+  int name = strcmp(a.filename, b.filename);
+  if (name != 0) {
+    return name < 0;
+  }
+  if (a.start_offset != b.start_offset) {
+    return a.start_offset < b.start_offset;
+  }
+  if (a.size != b.size) {
+    return a.size < b.size;
+  }
+  return a.file_time.uploaded < b.file_time.uploaded;
+}
+
+void md_index_update(md_index_t *index,
+                     const std::vector<storage_metadata_t> &md_table) {
+  std::vector<size_t> table(md_table.size());
+  for (size_t i = 0; i < table.size(); ++i) {
+    table[i] = i;
+  }
+  std::stable_sort(table.begin(), table.end(), [&](size_t a, size_t b) {
+    return entry_identity_before(md_table[a], md_table[b]);
+  });
+
+  pthread_rwlock_wrlock(&index->lock);
+  std::vector<uint32_t> slots = index->order[MD_INDEX_NAME];
+  std::stable_sort(slots.begin(), slots.end(), [&](uint32_t a, uint32_t b) {
+    return entry_identity_before(index->slots[a].md, index->slots[b].md);
+  });
+
+  // both sides in the same order, what only one side holds changed
+  std::vector<uint32_t> removed;
+  std::vector<size_t> added;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < slots.size() || j < table.size()) {
+    if (j == table.size()) {
+      removed.push_back(slots[i++]);
+      continue;
+    }
+    if (i == slots.size()) {
+      added.push_back(table[j++]);
+      continue;
+    }
+    const storage_metadata_t &held = index->slots[slots[i]].md;
+    const storage_metadata_t &read = md_table[table[j]];
+    if (entry_identity_before(held, read)) {
+      removed.push_back(slots[i++]);
+    } else if (entry_identity_before(read, held)) {
+      added.push_back(table[j++]);
+    } else {
+      i++;
+      j++;
+    }
+  }
+
+  // a remove in the log takes the oldest entry of its name, any other one
+  // can't be told to a client, which then gets the full listing instead
+  std::sort(removed.begin(), removed.end(), [&](uint32_t a, uint32_t b) {
+    return index->slots[a].seq < index->slots[b].seq;
+  });
+  for (uint32_t slot : removed) {
+    if (name_oldest(index, index->slots[slot].md.filename) != slot) {
+      index_fill(index, md_table);
+      pthread_rwlock_unlock(&index->lock);
+      LOG(INFO, "Indexed %zu metadata entries", md_table.size());
+      return;
+    }
+    entry_remove(index, slot);
+  }
+
+  // new entries are taken to be uploaded in table order
+  std::sort(added.begin(), added.end());
+  for (size_t entry : added) {
+    entry_insert(index, md_table[entry]);
+  }
+  pthread_rwlock_unlock(&index->lock);
+  LOG(INFO,
+      "Updated the metadata index, %zu added and %zu removed",
+      added.size(),
+      removed.size());
+}
+
+void md_index_insert(md_index_t *index, const storage_metadata_t &entry) {
+  pthread_rwlock_wrlock(&index->lock);
+  entry_insert(index, entry);
+  pthread_rwlock_unlock(&index->lock);
+}
+
+int md_index_remove(md_index_t *index, const char *filename) {
+  pthread_rwlock_wrlock(&index->lock);
+  int64_t slot = name_oldest(index, filename);
+  if (slot < 0) {
+    pthread_rwlock_unlock(&index->lock);
+    return -1;
+  }
+  entry_remove(index, (uint32_t)slot);
+  pthread_rwlock_unlock(&index->lock);
+  return 0;
+}
+
+size_t md_index_count(md_index_t *index) {
+  pthread_rwlock_rdlock(&index->lock);
+  size_t count = index->order[MD_INDEX_NAME].size();
+  pthread_rwlock_unlock(&index->lock);
+  return count;
+}
+
+/** @brief narrows [begin, end) of the name or type order to a name prefix */
+static void range_prefix(md_index_t *index,
+                         const std::vector<uint32_t> &order,
+                         const char *prefix,
+                         size_t &begin,
+                         size_t &end) {
+  size_t len = strlen(prefix);
+  auto first = std::partition_point(
+    order.begin() + begin, order.begin() + end, [&](uint32_t slot) {
+      return strcmp(index->slots[slot].md.filename, prefix) < 0;
+    });
+  auto last = std::partition_point(
+    first, order.begin() + end, [&](uint32_t slot) {
+      return strncmp(index->slots[slot].md.filename, prefix, len) <= 0;
+    });
+  begin = first - order.begin();
+  end   = last - order.begin();
+}
+
+/** @brief narrows the type order to the entries of one type */
+static void range_type(md_index_t *index,
+                       const std::vector<uint32_t> &order,
+                       int type,
+                       size_t &begin,
+                       size_t &end) {
+  auto first =
+    std::partition_point(order.begin(), order.end(), [&](uint32_t slot) {
+      return index->slots[slot].md.type < type;
+    });
+  auto last = std::partition_point(first, order.end(), [&](uint32_t slot) {
+    return index->slots[slot].md.type <= type;
+  });
+  begin = first - order.begin();
+  end   = last - order.begin();
+}
+
+size_t md_index_walk(md_index_t *index,
+                     const md_index_query_t *query,
+                     md_index_visit_t visit,
+                     void *arg) {
+  if ((int)query->key < 0 || query->key >= MD_INDEX_NUM_KEYS) {
+    return 0;
+  }
+
+  pthread_rwlock_rdlock(&index->lock);
+  const std::vector<uint32_t> &order = index->order[query->key];
+  size_t begin                       = 0;
+  size_t end                         = order.size();
+  bool check_type                    = query->type >= 0;
+  bool check_prefix                  = query->prefix && query->prefix[0];
+
+  // filters on the page's own order are a range of it
+  if (query->key == MD_INDEX_TYPE && check_type) {
+    range_type(index, order, query->type, begin, end);
+    check_type = false;
+  }
+  if ((query->key == MD_INDEX_NAME ||
+       (query->key == MD_INDEX_TYPE && query->type >= 0)) &&
+      check_prefix) {
+    range_prefix(index, order, query->prefix, begin, end);
+    check_prefix = false;
+  }
+
+  size_t span  = end - begin;
+  size_t limit = query->limit ? query->limit : span;
+  size_t sent  = 0;
+
+  // without filters left the page is a slice of the range
+  if (!check_type && !check_prefix) {
+    for (size_t i = query->offset; i < span && sent < limit; ++i, ++sent) {
+      size_t pos = query->descending ? end - 1 - i : begin + i;
+      visit(index->slots[order[pos]].md, arg);
+    }
+    pthread_rwlock_unlock(&index->lock);
+    return span;
+  }
+
+  size_t total = 0;
+  size_t len   = check_prefix ? strlen(query->prefix) : 0;
+  for (size_t i = 0; i < span; ++i) {
+    size_t pos = query->descending ? end - 1 - i : begin + i;
+    const storage_metadata_t &md = index->slots[order[pos]].md;
+    if (check_type && md.type != query->type) {
+      continue;
+    }
+    if (check_prefix && strncmp(md.filename, query->prefix, len) != 0) {
+      continue;
+    }
+    if (total++ >= query->offset && sent < limit) {
+      visit(md, arg);
+      sent++;
+    }
+  }
+  pthread_rwlock_unlock(&index->lock);
+  return total;
+}
+
+/** @brief walk visitor that copies the entries of a page */
+static void page_append(const storage_metadata_t &entry, void *arg) {
+  static_cast<std::vector<storage_metadata_t> *>(arg)->push_back(entry);
+}
+
+size_t md_index_list(md_index_t *index,
+                     const md_index_query_t *query,
+                     std::vector<storage_metadata_t> &page) {
+  page.clear();
+  return md_index_walk(index, query, page_append, &page);
+}
+
+uint64_t md_index_generation(md_index_t *index) {
+  pthread_rwlock_rdlock(&index->lock);
+  uint64_t generation = index->generation;
+  pthread_rwlock_unlock(&index->lock);
+  return generation;
+}
+
+int md_index_changes(md_index_t *index,
+                     uint32_t epoch,
+                     uint64_t since,
+                     md_index_change_visit_t visit,
+                     void *arg,
+                     uint64_t *generation) {
+  pthread_rwlock_rdlock(&index->lock);
+  *generation = index->generation;
+  if (epoch == index->epoch && since >= index->log_base &&
+      since <= index->generation) {
+    // the log is in generation order, skip what the client already has
+    auto it = std::partition_point(
+      index->log.begin(), index->log.end(), [&](const md_index_change_t &c) {
+        return c.generation <= since;
+      });
+    for (; it != index->log.end(); ++it) {
+      visit(it->change, it->md, arg);
+    }
+    pthread_rwlock_unlock(&index->lock);
+    return 0;
+  }
+
+  // upload order keeps entries of the same name oldest first, so removes
+  // applied to the listing later take the same entry the table does
+  std::vector<uint32_t> slots = index->order[MD_INDEX_UPLOADED];
+  std::sort(slots.begin(), slots.end(), [&](uint32_t a, uint32_t b) {
+    return index->slots[a].seq < index->slots[b].seq;
+  });
+  for (uint32_t slot : slots) {
+    visit(MD_INDEX_ADDED, index->slots[slot].md, arg);
+  }
+  pthread_rwlock_unlock(&index->lock);
+  return 1;
+}
+
+size_t md_index_search(md_index_t *index,
+                       const char *text,
+                       size_t limit,
+                       std::vector<storage_metadata_t> &results) {
+  results.clear();
+  std::string needle          = name_fold(text);
+  std::vector<uint32_t> grams = name_grams(needle);
+
+  pthread_rwlock_rdlock(&index->lock);
+
+  // only names holding every trigram of the text can match, the lists are
+  // intersected shortest first. text shorter than a trigram is compared
+  // against every name
+  std::vector<uint32_t> candidates;
+  if (grams.empty()) {
+    candidates = index->order[MD_INDEX_NAME];
+  } else {
+    std::vector<const std::vector<uint32_t> *> lists;
+    for (uint32_t gram : grams) {
+      auto it = index->grams.find(gram);
+      if (it == index->grams.end()) {
+        pthread_rwlock_unlock(&index->lock);
+        return 0;
+      }
+      lists.push_back(&it->second);
+    }
+    std::sort(lists.begin(),
+              lists.end(),
+              [](const std::vector<uint32_t> *a,
+                 const std::vector<uint32_t> *b) {
+                return a->size() < b->size();
+              });
+
+    // the candidates are looked up in the longer lists instead of walking
+    // them, common trigrams like "wav" have a list as long as the index
+    candidates = *lists[0];
+    for (size_t i = 1; i < lists.size() && !candidates.empty(); ++i) {
+      const std::vector<uint32_t> &list = *lists[i];
+      candidates.erase(std::remove_if(candidates.begin(),
+                                      candidates.end(),
+                                      [&list](uint32_t slot) {
+                                        return !std::binary_search(
+                                          list.begin(), list.end(), slot);
+                                      }),
+                       candidates.end());
+    }
+  }
+
+  // the trigrams may be spread over the name, so the text itself is looked
+  // for. the rank puts whole name and path component prefixes first
+  std::vector<std::pair<int, uint32_t>> matches;
+  for (uint32_t slot : candidates) {
+    const char *name = index->slots[slot].md.filename;
+    const char *pos  = name_find(name, needle);
+    if (!pos) {
+      continue;
+    }
+    int rank = pos == name ? 0 : (pos[-1] == '/' ? 1 : 2);
+    matches.push_back({rank, slot});
+  }
+
+  size_t count = limit ? std::min(limit, matches.size()) : matches.size();
+  std::partial_sort(matches.begin(),
+                    matches.begin() + count,
+                    matches.end(),
+                    [&](const std::pair<int, uint32_t> &a,
+                        const std::pair<int, uint32_t> &b) {
+                      if (a.first != b.first) {
+                        return a.first < b.first;
+                      }
+                      return entry_before(index->slots[a.second],
+                                          index->slots[b.second],
+                                          MD_INDEX_NAME);
+                    });
+  for (size_t i = 0; i < count; ++i) {
+    results.push_back(index->slots[matches[i].second].md);
+  }
+  pthread_rwlock_unlock(&index->lock);
+  return matches.size();
+}
@@ -0,0 +1,250 @@
+/**
+ * @file md_index.hpp
+ * @brief Sorted views of the metadata table, kept up to date as files are
+ * uploaded and deleted, so a listing page sorted or filtered by upload time,
+ * size, name or type is cut out of an order that already exists instead of
+ * sorting the whole table for every request. names are also indexed by
+ * their trigrams for substring search, and recent changes are logged so a
+ * client's copy of the listing can be brought up to date with a delta
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <deque>
+#include <pthread.h>
+
+#include "storage.hpp"
+
+/** @brief Bytes of a search term indexed together */
+#define MD_INDEX_GRAM_LEN 3
+
+/** @brief Changes kept in the log, older ones need a full listing */
+#define MD_INDEX_LOG_SIZE MAX_FILES
+
+/**
+ * @enum md_index_key_e
+ * @brief Orders the index keeps. equal keys are ordered by name and then by
+ * upload order, so pages are stable. values travel in LIST requests
+ */
+typedef enum {
+  MD_INDEX_UPLOADED = 0, /**< Upload time */
+  MD_INDEX_SIZE,         /**< File size in bytes */
+  MD_INDEX_NAME,         /**< Byte wise file name */
+  MD_INDEX_TYPE,         /**< File type, then name */
+  MD_INDEX_NUM_KEYS,
+} md_index_key_e;
+
+/**
+ * @struct md_index_query_t
+ * @brief One page of a listing
+ */
+typedef struct {
+  md_index_key_e key; /**< Order of the page */
+  bool descending;    /**< Largest, newest or last name first */
+  int type;           /**< Only files of this type, -1 for all */
+  const char *prefix; /**< Only names starting with this, NULL for all */
+  size_t offset;      /**< Matching entries skipped */
+  size_t limit;       /**< Most entries returned, 0 for no limit */
+} md_index_query_t;
+
+/**
+ * @brief Called for each entry of a page, in order, with the index locked
+ * @param entry Metadata entry, only valid during the call
+ * @param arg User argument passed through from the caller
+ */
+typedef void (*md_index_visit_t)(const storage_metadata_t &entry, void *arg);
+
+/**
+ * @enum md_index_change_e
+ * @brief Kinds of change in the log. values travel in binary listings
+ */
+typedef enum {
+  MD_INDEX_ADDED   = 1, /**< File uploaded */
+  MD_INDEX_REMOVED = 2, /**< Oldest file of the name deleted */
+} md_index_change_e;
+
+/**
+ * @brief Called for each change since a generation, oldest first, or for
+ * each entry of a full listing as an add, with the index locked
+ * @param change md_index_change_e of the change
+ * @param entry Metadata entry added or removed, only valid during the call
+ * @param arg User argument passed through from the caller
+ */
+typedef void (*md_index_change_visit_t)(md_index_change_e change,
+                                        const storage_metadata_t &entry,
+                                        void *arg);
+
+/**
+ * @struct md_index_change_t
+ * @brief One change in the log
+ */
+typedef struct {
+  uint64_t generation;      /**< Generation the change made */
+  md_index_change_e change; /**< What happened */
+  storage_metadata_t md;    /**< Entry added or removed, without children */
+} md_index_change_t;
+
+/**
+ * @struct md_index_entry_t
+ * @brief Metadata entry held by the index
+ */
+typedef struct {
+  storage_metadata_t md; /**< Copy of the metadata table entry */
+  uint64_t seq;          /**< Upload order, breaks ties between equal keys */
+} md_index_entry_t;
+
+/**
+ * @struct md_index_t
+ * @brief Entries live in slots, and every order is a sorted list of slot
+ * numbers, so an upload or delete is a binary search and one insert or
+ * erase per order. the trigram lists work the same way, one per trigram
+ * the names contain
+ */
+typedef struct md_index_t {
+  pthread_rwlock_t lock;                          /**< Taken by writers */
+  std::vector<md_index_entry_t> slots;            /**< Entries by slot */
+  std::vector<uint32_t> free_slots;               /**< Slots to reuse */
+  std::vector<uint32_t> order[MD_INDEX_NUM_KEYS]; /**< Slots, sorted */
+  uint64_t next_seq;                              /**< seq of the next entry */
+  uint64_t generation;                            /**< Bumped by every change */
+  uint32_t epoch;                                 /**< Differs per index */
+  uint64_t log_base;                              /**< Generation log starts */
+  std::deque<md_index_change_t> log;              /**< Changes, oldest first */
+  /** Sorted slots of the names holding each trigram, lower cased */
+  std::unordered_map<uint32_t, std::vector<uint32_t>> grams;
+} md_index_t;
+
+/**
+ * @brief Sets up an empty index
+ * @param index Index to initialize
+ * @return Returns 0 on success, or -1 if the lock couldn't be created
+ */
+int md_index_init(md_index_t *index);
+
+/**
+ * @brief Frees an index's entries and lock
+ * @param index Initialized index
+ */
+void md_index_destroy(md_index_t *index);
+
+/**
+ * @brief Replaces the contents of an index with a metadata table, entries
+ * are taken to be uploaded in table order
+ * @param index Initialized index
+ * @param md_table Metadata table read off the SSD
+ */
+void md_index_build(md_index_t *index,
+                    const std::vector<storage_metadata_t> &md_table);
+
+/**
+ * @brief Brings an index in line with a metadata table another process
+ * changed. entries are matched by name, offset, size and upload time, and
+ * what differs is logged as removes and then adds, so clients still get a
+ * delta. a table that dropped an entry other than the oldest of its name
+ * can't be told as a delta, the index is rebuilt instead
+ * @param index Initialized index
+ * @param md_table Metadata table read off the SSD
+ */
+void md_index_update(md_index_t *index,
+                     const std::vector<storage_metadata_t> &md_table);
+
+/**
+ * @brief Adds an uploaded file to every order
+ * @param index Initialized index
+ * @param entry Metadata entry written for the file
+ */
+void md_index_insert(md_index_t *index, const storage_metadata_t &entry);
+
+/**
+ * @brief Removes a deleted file from every order. with several entries of
+ * the same name the oldest goes, the same one delete_file() removes
+ * @param index Initialized index
+ * @param filename Name of the deleted file
+ * @return Returns 0 if the file was in the index, or -1 if it wasn't
+ */
+int md_index_remove(md_index_t *index, const char *filename);
+
+/**
+ * @brief Number of files in the index
+ * @param index Initialized index
+ * @return Returns the number of entries
+ */
+size_t md_index_count(md_index_t *index);
+
+/**
+ * @brief Hands the entries of one page to a visitor without copying them.
+ * see md_index_list() for how the page is found
+ * @param index Initialized index
+ * @param query Order, filters and page
+ * @param visit Called with each entry of the page, must not use the index
+ * @param arg User argument passed to visit
+ * @return Returns the number of entries matching the filters on all pages
+ */
+size_t md_index_walk(md_index_t *index,
+                     const md_index_query_t *query,
+                     md_index_visit_t visit,
+                     void *arg);
+
+/**
+ * @brief Cuts one page out of an order. a name prefix on the name order or
+ * a type on the type order narrows the order to a range by binary search,
+ * other filters are checked entry by entry
+ * @param index Initialized index
+ * @param query Order, filters and page
+ * @param page Filled in with the entries of the page, in order
+ * @return Returns the number of entries matching the filters on all pages
+ */
+size_t md_index_list(md_index_t *index,
+                     const md_index_query_t *query,
+                     std::vector<storage_metadata_t> &page);
+
+/**
+ * @brief Counter bumped by every build, insert and remove, so a listing
+ * cached by a client can be checked for changes without walking the index
+ * @param index Initialized index
+ * @return Returns the current generation
+ */
+uint64_t md_index_generation(md_index_t *index);
+
+/**
+ * @brief Hands a client the changes it's missing. a client that holds the
+ * listing at a generation of this index gets every change made since, the
+ * rest (another epoch, a generation older than the log or ahead of the
+ * index) get every entry in upload order and must drop what they hold
+ * @param index Initialized index
+ * @param epoch Epoch of the client's listing
+ * @param since Generation of the client's listing
+ * @param visit Called with each change, must not use the index
+ * @param arg User argument passed to visit
+ * @param generation Set to the generation the client is brought up to
+ * @return Returns 0 if changes were visited, or 1 if the full listing was
+ */
+int md_index_changes(md_index_t *index,
+                     uint32_t epoch,
+                     uint64_t since,
+                     md_index_change_visit_t visit,
+                     void *arg,
+                     uint64_t *generation);
+
+/**
+ * @brief Finds files whose name contains a piece of text, ignoring ASCII
+ * case. the trigram lists of the text are intersected to find the names
+ * that can match, so only those are compared. names starting with the text
+ * come first, then names with a path component starting with it, then the
+ * rest, each in name order. prefix matches in name order are what an
+ * autocomplete wants, md_index_list() by name with a prefix gives the same
+ * for a case sensitive prefix
+ * @param index Initialized index
+ * @param text Text to look for, an empty text matches every file
+ * @param limit Most entries returned, 0 for no limit
+ * @param results Filled in with the best matches, best first
+ * @return Returns the number of files that match
+ */
+size_t md_index_search(md_index_t *index,
+                       const char *text,
+                       size_t limit,
+                       std::vector<storage_metadata_t> &results);
@@ -0,0 +1,99 @@
+#include <charconv>
+#include <cstring>
+
+#include "md_json.hpp"
+#include "file_types.hpp"
+
+/** @brief appends an unsigned number */
+static void json_uint(std::string &out, uint64_t value) {
+  char digits[20];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  out.append(digits, result.ptr);
+}
+
+/** @brief appends a quoted string, escaping quotes, backslashes and control
+ * characters. runs of plain bytes are copied in one go */
+static void json_string(std::string &out, const char *text, size_t max_len) {
+  static const char hex[] = "0123456789abcdef";
+
+  size_t len = strnlen(text, max_len);
+  out.push_back('"');
+  size_t run = 0;
+  for (size_t i = 0; i < len; ++i) {
+    uint8_t c = (uint8_t)text[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    out.append(text + run, i - run);
+    run = i + 1;
+
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back((char)c);
+    } else {
+      char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+      out.append(escape, sizeof(escape));
+    }
+  }
+  out.append(text + run, len - run);
+  out.push_back('"');
+}
+
+/** @brief appends a string literal, its length known at compile time */
+template <size_t N>
+static void json_raw(std::string &out, const char (&text)[N]) {
+  out.append(text, N - 1);
+}
+
+void md_json_begin(std::string &out, size_t entries) {
+  out.reserve(out.size() + 64 + entries * MD_JSON_ENTRY_SIZE);
+  json_raw(out, "{\"files\":[");
+}
+
+void md_json_entry(std::string &out, const storage_metadata_t &entry) {
+  if (out.back() != '[') {
+    out.push_back(',');
+  }
+  json_raw(out, "{\"name\":");
+  json_string(out, entry.filename, sizeof(entry.filename));
+  json_raw(out, ",\"type\":\"");
+  out.append(file_type_name(static_cast<dist_fs_file_types_e>(entry.type)));
+  out.push_back('"');
+  json_raw(out, ",\"offset\":");
+  json_uint(out, (uint64_t)entry.start_offset);
+  json_raw(out, ",\"size_bytes\":");
+  json_uint(out, entry.size);
+  json_raw(out, ",\"size_kb\":");
+  json_uint(out, entry.size / 1024);
+  json_raw(out, ",\"size_mb\":");
+  json_uint(out, entry.size / (1024 * 1024));
+
+  // audio details come from the metadata entry, the file isn't read
+  json_raw(out, ",\"duration_ms\":");
+  json_uint(out, entry.audio.duration_ms);
+  json_raw(out, ",\"sample_rate\":");
+  json_uint(out, entry.audio.sample_rate);
+  json_raw(out, ",\"channels\":");
+  json_uint(out, entry.audio.channels);
+  json_raw(out, ",\"bits\":");
+  json_uint(out, entry.audio.bits_per_sample);
+  json_raw(out, ",\"bitrate\":");
+  json_uint(out, entry.audio.bitrate);
+  json_raw(out, ",\"bpm\":");
+  json_uint(out, entry.audio.bpm);
+  json_raw(out, ",\"title\":");
+  json_string(out, entry.audio.title, sizeof(entry.audio.title));
+  json_raw(out, ",\"artist\":");
+  json_string(out, entry.audio.artist, sizeof(entry.audio.artist));
+  json_raw(out, ",\"album\":");
+  json_string(out, entry.audio.album, sizeof(entry.audio.album));
+  out.push_back('}');
+}
+
+void md_json_end(std::string &out, size_t total, size_t offset) {
+  json_raw(out, "],\"total\":");
+  json_uint(out, total);
+  json_raw(out, ",\"offset\":");
+  json_uint(out, offset);
+  out.push_back('}');
+}
@@ -0,0 +1,38 @@
+/**
+ * @file md_json.hpp
+ * @brief Writes listings of metadata entries as JSON straight into one
+ * string, with no objects per entry, for the web listing and search
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "storage.hpp"
+
+/** @brief Bytes reserved per entry, enough for a typical name and tags */
+#define MD_JSON_ENTRY_SIZE 384
+
+/**
+ * @brief Starts a listing, {"files":[
+ * @param out String the listing is appended to
+ * @param entries Entries expected, to reserve room for all of them at once
+ */
+void md_json_begin(std::string &out, size_t entries);
+
+/**
+ * @brief Appends one entry's object to a listing begun with md_json_begin()
+ * @param out Listing being written
+ * @param entry Metadata entry
+ */
+void md_json_entry(std::string &out, const storage_metadata_t &entry);
+
+/**
+ * @brief Ends a listing, ],"total":..,"offset":..}
+ * @param out Listing being written
+ * @param total Entries matching on all pages
+ * @param offset Entries skipped before the first one written
+ */
+void md_json_end(std::string &out, size_t total, size_t offset);
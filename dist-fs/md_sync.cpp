@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <cstring>
+
+#include "md_sync.hpp"
+#include "md_index.hpp"
+#include "utils.hpp"
+
+static const uint8_t sync_magic[4] = {'D', 'F', 'S', 'L'};
+
+/** @brief appends a big endian number of the given width */
+static void put_be(std::vector<uint8_t> &out, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i) {
+    out.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+/** @brief appends a LEB128 varint, seven bits per byte, low bits first */
+static void put_varint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+/** @brief bytes of a listing being read, every read checks what's left */
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t pos;
+} sync_reader_t;
+
+static bool get_be(sync_reader_t *reader, uint64_t *value, int bytes) {
+  if (reader->size - reader->pos < (size_t)bytes) {
+    return false;
+  }
+  *value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    *value = (*value << 8) | reader->data[reader->pos++];
+  }
+  return true;
+}
+
+static bool get_varint(sync_reader_t *reader, uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (reader->pos == reader->size) {
+      return false;
+    }
+    uint8_t byte = reader->data[reader->pos++];
+    *value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** @brief visitor of md_index_changes() that appends each change */
+typedef struct {
+  std::vector<uint8_t> *out;
+  uint32_t records;
+} sync_writer_t;
+
+static void sync_change(md_index_change_e change,
+                        const storage_metadata_t &md,
+                        void *arg) {
+  sync_writer_t *writer = static_cast<sync_writer_t *>(arg);
+  md_sync_entry_t entry = {};
+
+  entry.change      = (uint8_t)change;
+  entry.type        = md.type;
+  entry.bpm         = md.audio.bpm;
+  entry.duration_ms = md.audio.duration_ms;
+  entry.sample_rate = md.audio.sample_rate;
+  entry.size        = md.size;
+  entry.uploaded    = (int64_t)md.file_time.uploaded;
+  strncpy(entry.name, md.filename, sizeof(entry.name) - 1);
+
+  md_sync_append(*writer->out, entry);
+  writer->records++;
+}
+
+size_t md_sync_encode(md_index_t *index,
+                      uint32_t epoch,
+                      uint64_t since,
+                      std::vector<uint8_t> &out) {
+  md_sync_header_t header = {MD_SYNC_VERSION, 0, index->epoch, 0, 0};
+  sync_writer_t writer    = {&out, 0};
+
+  // the header is written last, once the index has said whether the client
+  // got changes or everything
+  md_sync_begin(out);
+  if (md_index_changes(
+        index, epoch, since, sync_change, &writer, &header.generation)) {
+    header.flags = MD_SYNC_FULL;
+  }
+  header.records = writer.records;
+  md_sync_end(out, &header);
+  return writer.records;
+}
+
+void md_sync_begin(std::vector<uint8_t> &out) {
+  out.assign(MD_SYNC_HEADER_SIZE, 0);
+}
+
+void md_sync_append(std::vector<uint8_t> &out, const md_sync_entry_t &entry) {
+  size_t name_len = strnlen(entry.name, sizeof(entry.name) - 1);
+  out.push_back(entry.change);
+  out.push_back((uint8_t)name_len);
+  out.insert(out.end(), entry.name, entry.name + name_len);
+  if (entry.change != MD_INDEX_ADDED) {
+    return;
+  }
+  out.push_back(entry.type);
+  put_varint(out, entry.size);
+  put_varint(out, (uint64_t)entry.uploaded);
+  put_varint(out, entry.duration_ms);
+  put_varint(out, entry.sample_rate);
+  put_varint(out, entry.bpm);
+}
+
+void md_sync_end(std::vector<uint8_t> &out, const md_sync_header_t *header) {
+  std::vector<uint8_t> bytes(sync_magic, sync_magic + sizeof(sync_magic));
+  bytes.push_back(header->version);
+  bytes.push_back(header->flags);
+  put_be(bytes, header->epoch, 4);
+  put_be(bytes, header->generation, 8);
+  put_be(bytes, header->records, 4);
+  std::copy(bytes.begin(), bytes.end(), out.begin());
+}
+
+int md_sync_decode(const uint8_t *data,
+                   size_t size,
+                   md_sync_header_t *header,
+                   std::vector<md_sync_entry_t> &entries) {
+  entries.clear();
+  if (size < MD_SYNC_HEADER_SIZE ||
+      memcmp(data, sync_magic, sizeof(sync_magic)) != 0) {
+    LOG(ERR, "Not a binary listing");
+    return -1;
+  }
+
+  sync_reader_t reader = {data, size, sizeof(sync_magic)};
+  uint64_t value;
+
+  header->version = data[reader.pos++];
+  header->flags   = data[reader.pos++];
+  if (header->version != MD_SYNC_VERSION) {
+    LOG(ERR, "Unsupported binary listing version {%u}", header->version);
+    return -1;
+  }
+  get_be(&reader, &value, 4);
+  header->epoch = (uint32_t)value;
+  get_be(&reader, &header->generation, 8);
+  get_be(&reader, &value, 4);
+  header->records = (uint32_t)value;
+
+  // every record takes at least two bytes, so a bad count can't make the
+  // reserve run away
+  entries.reserve(std::min<size_t>(header->records, (size - reader.pos) / 2));
+  for (uint32_t i = 0; i < header->records; ++i) {
+    md_sync_entry_t entry = {};
+    uint64_t name_len;
+    if (!get_be(&reader, &value, 1) || !get_be(&reader, &name_len, 1) ||
+        size - reader.pos < name_len) {
+      LOG(ERR, "Binary listing cut short at record {%u}", i);
+      return -1;
+    }
+    entry.change = (uint8_t)value;
+    memcpy(entry.name, data + reader.pos, name_len);
+    reader.pos += name_len;
+
+    if (entry.change == MD_INDEX_ADDED) {
+      uint64_t type, uploaded, duration_ms, sample_rate, bpm;
+      if (!get_be(&reader, &type, 1) || !get_varint(&reader, &entry.size) ||
+          !get_varint(&reader, &uploaded) ||
+          !get_varint(&reader, &duration_ms) ||
+          !get_varint(&reader, &sample_rate) || !get_varint(&reader, &bpm)) {
+        LOG(ERR, "Binary listing cut short at record {%u}", i);
+        return -1;
+      }
+      entry.type        = (uint8_t)type;
+      entry.uploaded    = (int64_t)uploaded;
+      entry.duration_ms = (uint32_t)duration_ms;
+      entry.sample_rate = (uint32_t)sample_rate;
+      entry.bpm         = (uint16_t)bpm;
+    } else if (entry.change != MD_INDEX_REMOVED) {
+      LOG(ERR, "Unknown change {%u} in binary listing", entry.change);
+      return -1;
+    }
+    entries.push_back(entry);
+  }
+  return 0;
+}
+
+int md_sync_apply(md_sync_header_t *header,
+                  std::vector<md_sync_entry_t> &files,
+                  const uint8_t *data,
+                  size_t size) {
+  md_sync_header_t listing;
+  std::vector<md_sync_entry_t> entries;
+  if (md_sync_decode(data, size, &listing, entries) != 0) {
+    return -1;
+  }
+
+  if (listing.flags & MD_SYNC_FULL) {
+    files = std::move(entries);
+  } else if (listing.epoch != header->epoch) {
+    LOG(ERR, "Binary listing changes a listing of another epoch");
+    return -1;
+  } else {
+    for (const md_sync_entry_t &entry : entries) {
+      if (entry.change == MD_INDEX_ADDED) {
+        files.push_back(entry);
+        continue;
+      }
+      auto it = std::find_if(
+        files.begin(), files.end(), [&](const md_sync_entry_t &file) {
+          return strcmp(file.name, entry.name) == 0;
+        });
+      if (it != files.end()) {
+        files.erase(it);
+      }
+    }
+  }
+
+  header->version    = MD_SYNC_VERSION;
+  header->flags      = MD_SYNC_FULL;
+  header->epoch      = listing.epoch;
+  header->generation = listing.generation;
+  header->records    = (uint32_t)files.size();
+  return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file md_sync.hpp
+ * @brief Compact, versioned binary listings for clients that keep their own
+ * copy of the file list. a listing is either every file, or the changes
+ * made since the generation of the client's copy, taken from the metadata
+ * index's change log. the client applies it and keeps the result, so after
+ * the first sync only the deltas cross the link
+ *
+ * a listing starts with a header, every number big endian:
+ *
+ *   magic "DFSL" (4), version (1), flags (1), epoch (4), generation (8),
+ *   records (4)
+ *
+ * followed by the records, oldest change first:
+ *
+ *   change (1), name length (1), name, then for an added file only the
+ *   type (1) and the size, upload time, duration in ms, sample rate and
+ *   bpm as LEB128 varints
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+struct md_index_t;
+
+/** @brief Version written into listings, others are refused */
+#define MD_SYNC_VERSION 1
+/** @brief Bytes of the listing header */
+#define MD_SYNC_HEADER_SIZE 22
+/** @brief Header flag, the listing replaces the client's copy */
+#define MD_SYNC_FULL 0x01
+
+/**
+ * @struct md_sync_header_t
+ * @brief Listing header
+ */
+typedef struct {
+  uint8_t version;     /**< MD_SYNC_VERSION */
+  uint8_t flags;       /**< MD_SYNC_* flags */
+  uint32_t epoch;      /**< Epoch of the index the listing came from */
+  uint64_t generation; /**< Generation the listing brings the client to */
+  uint32_t records;    /**< Records that follow */
+} md_sync_header_t;
+
+/**
+ * @struct md_sync_entry_t
+ * @brief One record, a file the client holds or a change to apply
+ */
+typedef struct {
+  uint8_t change;       /**< md_index_change_e of the record */
+  uint8_t type;         /**< dist_fs_file_types_e of the file */
+  uint16_t bpm;         /**< Tempo tag, 0 if untagged */
+  uint32_t duration_ms; /**< Playing time of audio, 0 otherwise */
+  uint32_t sample_rate; /**< Audio sample rate, 0 otherwise */
+  uint64_t size;        /**< File size in bytes */
+  int64_t uploaded;     /**< Upload time */
+  char name[256];       /**< File name */
+} md_sync_entry_t;
+
+/**
+ * @brief Writes what a client holding the listing at epoch and since is
+ * missing, see md_index_changes()
+ * @param index Initialized index
+ * @param epoch Epoch of the client's listing, 0 if it has none
+ * @param since Generation of the client's listing
+ * @param out Filled in with the listing
+ * @return Returns the number of records written
+ */
+size_t md_sync_encode(md_index_t *index,
+                      uint32_t epoch,
+                      uint64_t since,
+                      std::vector<uint8_t> &out);
+
+/**
+ * @brief Starts a listing, leaving room for the header
+ * @param out Listing being written, cleared first
+ */
+void md_sync_begin(std::vector<uint8_t> &out);
+
+/**
+ * @brief Appends one record to a listing begun with md_sync_begin()
+ * @param out Listing being written
+ * @param entry Record, only the name is written for a removed file
+ */
+void md_sync_append(std::vector<uint8_t> &out, const md_sync_entry_t &entry);
+
+/**
+ * @brief Ends a listing by writing its header
+ * @param out Listing being written
+ * @param header Version, flags, epoch, generation and record count
+ */
+void md_sync_end(std::vector<uint8_t> &out, const md_sync_header_t *header);
+
+/**
+ * @brief Reads a listing
+ * @param data Listing bytes
+ * @param size Bytes of the listing
+ * @param header Filled in with the header
+ * @param entries Filled in with the records, in order
+ * @return Returns 0 on success, or -1 for another version or a listing that
+ * is cut short
+ */
+int md_sync_decode(const uint8_t *data,
+                   size_t size,
+                   md_sync_header_t *header,
+                   std::vector<md_sync_entry_t> &entries);
+
+/**
+ * @brief Brings a client's copy up to date. a full listing replaces it,
+ * changes are applied in order: an added file is appended and a removed one
+ * drops the oldest file of the name, as on the host
+ * @param header Header of the copy, epoch 0 for an empty copy. updated to
+ * the listing's epoch and generation
+ * @param files Files of the copy in upload order
+ * @param data Listing bytes received from the host
+ * @param size Bytes of the listing
+ * @return Returns 0 on success, or -1 if the listing doesn't decode or is
+ * changes against another epoch
+ */
+int md_sync_apply(md_sync_header_t *header,
+                  std::vector<md_sync_entry_t> &files,
+                  const uint8_t *data,
+                  size_t size);
@@ -0,0 +1,303 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "metrics.hpp"
+#include "utils.hpp"
+
+/** @brief one thread's metrics. only the thread writes them, so an update
+ * is a plain load and store, and a scrape reads them with relaxed loads */
+typedef struct {
+  uint64_t counters[METRICS_NUM_COUNTERS];
+  metrics_histogram_t ops[METRICS_NUM_OPS];
+} metrics_block_t;
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER; // blocks
+static std::vector<metrics_block_t *> metrics_blocks;
+static metrics_block_t metrics_retired; // summed blocks of exited threads
+static int64_t metrics_gauges[METRICS_NUM_GAUGES];
+static pthread_key_t metrics_key;
+static pthread_once_t metrics_key_once = PTHREAD_ONCE_INIT;
+static thread_local metrics_block_t *metrics_local;
+
+static const char *op_names[METRICS_NUM_OPS] = {
+  "upload",
+  "download",
+  "delete",
+  "md_read",
+  "md_write",
+  "md_query",
+  "device_read",
+  "device_write",
+  "link_write",
+};
+
+/** @brief name, labels and help of each counter, a family's counters are
+ * next to each other */
+static const char *counter_info[METRICS_NUM_COUNTERS][3] = {
+  {"dist_fs_cache_hits_total",
+   "{cache=\"chunk\"}",
+   "Lookups answered without going to the SSD"},
+  {"dist_fs_cache_hits_total", "{cache=\"file\"}", nullptr},
+  {"dist_fs_cache_hits_total", "{cache=\"index\"}", nullptr},
+  {"dist_fs_cache_misses_total",
+   "{cache=\"chunk\"}",
+   "Lookups that had to go to the SSD"},
+  {"dist_fs_cache_misses_total", "{cache=\"index\"}", nullptr},
+  {"dist_fs_link_rx_bytes_total", "", "Bytes received from the link"},
+  {"dist_fs_link_rx_stalls_total", "", "Times the link's rx ring was full"},
+};
+
+static const char *gauge_info[METRICS_NUM_GAUGES][2] = {
+  {"dist_fs_files", "Files in the metadata index"},
+  {"dist_fs_link_rx_queued_bytes", "Received bytes waiting to be parsed"},
+};
+
+static void metrics_fold(metrics_block_t *into, const metrics_block_t *from) {
+  const uint64_t *src = reinterpret_cast<const uint64_t *>(from);
+  uint64_t *dst       = reinterpret_cast<uint64_t *>(into);
+  for (size_t i = 0; i < sizeof(metrics_block_t) / sizeof(uint64_t); ++i) {
+    dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+  }
+}
+
+static void metrics_block_release(void *arg) {
+  metrics_block_t *block = static_cast<metrics_block_t *>(arg);
+  pthread_mutex_lock(&metrics_lock);
+  metrics_fold(&metrics_retired, block);
+  for (size_t i = 0; i < metrics_blocks.size(); ++i) {
+    if (metrics_blocks[i] == block) {
+      metrics_blocks.erase(metrics_blocks.begin() + i);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&metrics_lock);
+  delete block;
+  metrics_local = nullptr;
+}
+
+static void metrics_key_create() {
+  pthread_key_create(&metrics_key, metrics_block_release);
+}
+
+/** @brief the calling thread's block, registered on its first update */
+static metrics_block_t *metrics_block() {
+  if (metrics_local) {
+    return metrics_local;
+  }
+  pthread_once(&metrics_key_once, metrics_key_create);
+
+  metrics_block_t *block = new metrics_block_t();
+  pthread_mutex_lock(&metrics_lock);
+  metrics_blocks.push_back(block);
+  pthread_mutex_unlock(&metrics_lock);
+
+  pthread_setspecific(metrics_key, block);
+  metrics_local = block;
+  return block;
+}
+
+/** @brief adds to a value only the calling thread writes */
+static inline void metrics_bump(uint64_t *value, uint64_t by) {
+  __atomic_store_n(
+    value, __atomic_load_n(value, __ATOMIC_RELAXED) + by, __ATOMIC_RELAXED);
+}
+
+/** @brief values below 16 get a bucket each, above that every power of two
+ * is split into 16 by the bits after the leading one */
+static size_t metrics_bucket(uint64_t ns) {
+  if (ns < (1u << METRICS_SUB_BITS)) {
+    return (size_t)ns;
+  }
+  int bits = 63 - __builtin_clzll(ns);
+  if (bits >= METRICS_MAX_BITS) {
+    return METRICS_BUCKETS - 1;
+  }
+  int shift  = bits - METRICS_SUB_BITS;
+  size_t sub = (size_t)(ns >> shift) & ((1u << METRICS_SUB_BITS) - 1);
+  return ((size_t)(shift + 1) << METRICS_SUB_BITS) + sub;
+}
+
+uint64_t metrics_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void metrics_op(metrics_op_e op, uint64_t start, uint64_t bytes, bool ok) {
+  uint64_t ns                    = metrics_now_ns() - start;
+  metrics_histogram_t *histogram = &metrics_block()->ops[op];
+
+  metrics_bump(&histogram->count, 1);
+  metrics_bump(&histogram->errors, ok ? 0 : 1);
+  metrics_bump(&histogram->bytes, bytes);
+  metrics_bump(&histogram->sum_ns, ns);
+  metrics_bump(&histogram->buckets[metrics_bucket(ns)], 1);
+}
+
+void metrics_add(metrics_counter_e counter, uint64_t value) {
+  metrics_bump(&metrics_block()->counters[counter], value);
+}
+
+void metrics_set(metrics_gauge_e gauge, int64_t value) {
+  __atomic_store_n(&metrics_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+void metrics_snapshot(metrics_snapshot_t *snapshot) {
+  // a block holds every histogram, too big for the stack
+  auto total = std::make_unique<metrics_block_t>();
+
+  pthread_mutex_lock(&metrics_lock);
+  metrics_fold(total.get(), &metrics_retired);
+  for (const metrics_block_t *block : metrics_blocks) {
+    metrics_fold(total.get(), block);
+  }
+  pthread_mutex_unlock(&metrics_lock);
+
+  memcpy(snapshot->counters, total->counters, sizeof(total->counters));
+  memcpy(snapshot->ops, total->ops, sizeof(total->ops));
+  for (int i = 0; i < METRICS_NUM_GAUGES; ++i) {
+    snapshot->gauges[i] = __atomic_load_n(&metrics_gauges[i], __ATOMIC_RELAXED);
+  }
+}
+
+uint64_t metrics_percentile(const metrics_histogram_t *histogram,
+                            double quantile) {
+  // the count is read apart from the buckets, go by what the buckets hold
+  uint64_t count = 0;
+  for (size_t i = 0; i < METRICS_BUCKETS; ++i) {
+    count += histogram->buckets[i];
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(quantile * (double)count + 0.5);
+  rank          = rank < 1 ? 1 : (rank > count ? count : rank);
+  uint64_t seen = 0;
+  size_t i      = 0;
+  for (; i < METRICS_BUCKETS - 1; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      break;
+    }
+  }
+
+  if (i < (1u << METRICS_SUB_BITS)) {
+    return i;
+  }
+  // the middle of the bucket, metrics_bucket() in reverse
+  int shift      = (int)(i >> METRICS_SUB_BITS) - 1;
+  uint64_t lead  = 1u << METRICS_SUB_BITS;
+  uint64_t lower = (lead | (i & (lead - 1))) << shift;
+  return lower + ((1ull << shift) >> 1);
+}
+
+/** @brief appends "# HELP" and "# TYPE" lines of a family */
+static void expose_family(std::string &out,
+                          const char *name,
+                          const char *help,
+                          const char *type) {
+  out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+/** @brief appends one sample, labels include their braces */
+static void expose_sample(std::string &out,
+                          const char *name,
+                          const char *labels,
+                          double value) {
+  // counts are written whole, %g would round them past a billion
+  char number[32];
+  if (value == (double)(int64_t)value) {
+    snprintf(number, sizeof(number), "%.0f", value);
+  } else {
+    snprintf(number, sizeof(number), "%.9g", value);
+  }
+  out.append(name).append(labels).append(" ").append(number).append("\n");
+}
+
+void metrics_expose(std::string &out) {
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+  // a snapshot holds every histogram, kept off the stack as well
+  auto stats = std::make_unique<metrics_snapshot_t>();
+  metrics_snapshot(stats.get());
+  out.clear();
+
+  char labels[64];
+  expose_family(
+    out, "dist_fs_op_seconds", "Latency of each operation", "summary");
+  for (int op = 0; op < METRICS_NUM_OPS; ++op) {
+    const metrics_histogram_t *histogram = &stats->ops[op];
+    for (double quantile : quantiles) {
+      snprintf(labels,
+               sizeof(labels),
+               "{op=\"%s\",quantile=\"%g\"}",
+               op_names[op],
+               quantile);
+      expose_sample(out,
+                    "dist_fs_op_seconds",
+                    labels,
+                    (double)metrics_percentile(histogram, quantile) / 1e9);
+    }
+    snprintf(labels, sizeof(labels), "{op=\"%s\"}", op_names[op]);
+    expose_sample(
+      out, "dist_fs_op_seconds_sum", labels, (double)histogram->sum_ns / 1e9);
+    expose_sample(
+      out, "dist_fs_op_seconds_count", labels, (double)histogram->count);
+  }
+
+  expose_family(
+    out, "dist_fs_op_errors_total", "Operations that failed", "counter");
+  for (int op = 0; op < METRICS_NUM_OPS; ++op) {
+    snprintf(labels, sizeof(labels), "{op=\"%s\"}", op_names[op]);
+    expose_sample(
+      out, "dist_fs_op_errors_total", labels, (double)stats->ops[op].errors);
+  }
+
+  expose_family(
+    out, "dist_fs_op_bytes_total", "Bytes moved by each operation", "counter");
+  for (int op = 0; op < METRICS_NUM_OPS; ++op) {
+    snprintf(labels, sizeof(labels), "{op=\"%s\"}", op_names[op]);
+    expose_sample(
+      out, "dist_fs_op_bytes_total", labels, (double)stats->ops[op].bytes);
+  }
+
+  for (int i = 0; i < METRICS_NUM_COUNTERS; ++i) {
+    if (counter_info[i][2]) {
+      expose_family(out, counter_info[i][0], counter_info[i][2], "counter");
+    }
+    expose_sample(
+      out, counter_info[i][0], counter_info[i][1], (double)stats->counters[i]);
+  }
+
+  for (int i = 0; i < METRICS_NUM_GAUGES; ++i) {
+    expose_family(out, gauge_info[i][0], gauge_info[i][1], "gauge");
+    expose_sample(out, gauge_info[i][0], "", (double)stats->gauges[i]);
+  }
+}
+
+int metrics_write(const char *path) {
+  std::string text;
+  metrics_expose(text);
+
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *file      = fopen(tmp.c_str(), "w");
+  if (!file) {
+    LOG_LIMIT(ERR, 1, "Failed to open {%s} for the metrics", tmp.c_str());
+    return -1;
+  }
+  bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+  if (fclose(file) != 0 || !written || rename(tmp.c_str(), path) != 0) {
+    LOG_LIMIT(ERR, 1, "Failed to write the metrics to {%s}", path);
+    unlink(tmp.c_str());
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file metrics.hpp
+ * @brief Process wide counters, gauges and per operation latency histograms,
+ * written out in the Prometheus text format. every thread records into a
+ * block of its own, so the hot paths never take a lock or a shared cache
+ * line, and a scrape sums the blocks. latencies go into log-linear buckets,
+ * HDR histogram style, 16 to every power of two, so any percentile is read
+ * back within about 3% from a fixed 4.6 KB per operation and thread
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/** @brief Bits of each value kept below its leading bit */
+#define METRICS_SUB_BITS 4
+/** @brief Longest latency told apart, 2^40 ns is a bit over 18 minutes */
+#define METRICS_MAX_BITS 40
+/** @brief Buckets of one latency histogram */
+#define METRICS_BUCKETS                                                        \
+  ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS)
+
+/**
+ * @enum metrics_op_e
+ * @brief Timed operations, each with a count, errors, bytes and latencies
+ */
+typedef enum {
+  METRICS_UPLOAD = 0,   /**< upload_file_as() */
+  METRICS_DOWNLOAD,     /**< download_file_stream() */
+  METRICS_DELETE,       /**< delete_file() */
+  METRICS_MD_READ,      /**< Metadata or chunk table read off the SSD */
+  METRICS_MD_WRITE,     /**< Metadata or chunk table entry written */
+  METRICS_MD_QUERY,     /**< Listing, search or changes from the index */
+  METRICS_DEVICE_READ,  /**< File data read off the SSD */
+  METRICS_DEVICE_WRITE, /**< File data written to the SSD */
+  METRICS_LINK_WRITE,   /**< Bytes handed to the link driver */
+  METRICS_NUM_OPS,
+} metrics_op_e;
+
+/**
+ * @enum metrics_counter_e
+ * @brief Counters that only go up
+ */
+typedef enum {
+  METRICS_CHUNK_HITS = 0, /**< Uploaded chunks already on the SSD */
+  METRICS_FILE_HITS,      /**< Uploads identical to a stored file */
+  METRICS_INDEX_HITS,     /**< Searches answered by the attached index */
+  METRICS_CHUNK_MISSES,   /**< Uploaded chunks that had to be written */
+  METRICS_INDEX_MISSES,   /**< Searches that had to build an index */
+  METRICS_LINK_RX_BYTES,  /**< Bytes received from the link */
+  METRICS_LINK_RX_STALLS, /**< Times the link's rx ring was full */
+  METRICS_NUM_COUNTERS,
+} metrics_counter_e;
+
+/**
+ * @enum metrics_gauge_e
+ * @brief Values that go up and down, the last one set is reported
+ */
+typedef enum {
+  METRICS_FILES = 0,      /**< Files in the metadata index */
+  METRICS_LINK_RX_QUEUED, /**< Received bytes waiting to be parsed */
+  METRICS_NUM_GAUGES,
+} metrics_gauge_e;
+
+/**
+ * @struct metrics_histogram_t
+ * @brief Latencies of one operation, summed over every thread
+ */
+typedef struct {
+  uint64_t count;                    /**< Operations timed */
+  uint64_t errors;                   /**< Operations that failed */
+  uint64_t bytes;                    /**< Bytes moved by the operations */
+  uint64_t sum_ns;                   /**< Total time taken */
+  uint64_t buckets[METRICS_BUCKETS]; /**< Operations per latency bucket */
+} metrics_histogram_t;
+
+/**
+ * @struct metrics_snapshot_t
+ * @brief Every metric at one point in time
+ */
+typedef struct {
+  uint64_t counters[METRICS_NUM_COUNTERS];
+  int64_t gauges[METRICS_NUM_GAUGES];
+  metrics_histogram_t ops[METRICS_NUM_OPS];
+} metrics_snapshot_t;
+
+/**
+ * @brief Monotonic time to start timing an operation with
+ * @return Returns nanoseconds on the monotonic clock
+ */
+uint64_t metrics_now_ns();
+
+/**
+ * @brief Records one operation
+ * @param op Operation
+ * @param start metrics_now_ns() when it started
+ * @param bytes Bytes it moved
+ * @param ok Whether it succeeded, failures count as errors too
+ */
+void metrics_op(metrics_op_e op, uint64_t start, uint64_t bytes, bool ok);
+
+/**
+ * @brief Adds to a counter
+ * @param counter Counter
+ * @param value Amount to add
+ */
+void metrics_add(metrics_counter_e counter, uint64_t value);
+
+/**
+ * @brief Sets a gauge
+ * @param gauge Gauge
+ * @param value New value
+ */
+void metrics_set(metrics_gauge_e gauge, int64_t value);
+
+/**
+ * @brief Sums every thread's metrics, including threads that have exited
+ * @param snapshot Filled in with the totals
+ */
+void metrics_snapshot(metrics_snapshot_t *snapshot);
+
+/**
+ * @brief Reads a percentile back from a histogram
+ * @param histogram Latencies of an operation
+ * @param quantile Share of the operations at or below the result, 0 to 1
+ * @return Returns the latency in ns, the middle of its bucket, or 0 if
+ * nothing was timed
+ */
+uint64_t metrics_percentile(const metrics_histogram_t *histogram,
+                            double quantile);
+
+/**
+ * @brief Writes every metric in the Prometheus text exposition format.
+ * latencies are summaries with their p50, p90, p99 and p999
+ * @param out Filled in with the exposition
+ */
+void metrics_expose(std::string &out);
+
+/**
+ * @brief Writes the exposition to a file, replacing it in one rename so a
+ * collector never reads half of it
+ * @param path File to write, e.g. for node_exporter's textfile collector
+ * @return Returns 0 on success, or -1 if the file couldn't be written
+ */
+int metrics_write(const char *path);
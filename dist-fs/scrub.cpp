@@ -0,0 +1,273 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "utils.hpp"
+#include "blake3.h"
+#include "storage.hpp"
+#include "scrub.hpp"
+
+
+/** @brief nanoseconds on the monotonic clock */
+static uint64_t scrub_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool scrub_stopping(scrub_context_t *scrub) {
+  return __atomic_load_n(&scrub->stop, __ATOMIC_ACQUIRE);
+}
+
+/** @brief sleeps in slices so a stop doesn't have to wait out the sleep */
+static void scrub_sleep(scrub_context_t *scrub, uint64_t ns) {
+  const uint64_t slice_ns = SCRUB_SLEEP_SLICE_MS * 1000000ULL;
+  while (ns > 0 && !scrub_stopping(scrub)) {
+    uint64_t slice     = std::min(ns, slice_ns);
+    struct timespec ts = {.tv_sec  = (time_t)(slice / 1000000000ULL),
+                          .tv_nsec = (long)(slice % 1000000000ULL)};
+    nanosleep(&ts, NULL);
+    ns -= slice;
+  }
+}
+
+/**
+ * @brief idles after a read for long enough that reads only take up the
+ * scrub's share of device time. the idle time scales with how long the read
+ * took, so a device busy with foreground requests slows the scrub down with
+ * it and no device bandwidth has to be configured
+ */
+static void scrub_throttle(scrub_context_t *scrub, uint64_t busy_since) {
+  uint64_t busy = scrub_now_ns() - busy_since;
+  scrub_sleep(scrub, busy * (100 - scrub->share) / scrub->share);
+}
+
+/**
+ * @brief whether a chunk table slot still holds the chunk it held when the
+ * pass read the table. chunks freed or replaced since aren't corrupt
+ */
+static bool chunk_unchanged(int ssd_fd,
+                            uint32_t slot,
+                            const storage_chunk_t &chunk) {
+  storage_chunk_t current;
+  off_t offset = CHUNK_TABLE_OFFSET + slot * sizeof(storage_chunk_t);
+  if (pread(ssd_fd, &current, sizeof(current), offset) != sizeof(current)) {
+    return false;
+  }
+  return current.offset == chunk.offset &&
+         current.stored_size == chunk.stored_size &&
+         memcmp(current.hash, chunk.hash, BLAKE3_OUT_LEN) == 0;
+}
+
+/** @brief checks every chunk in use, collecting the slots that fail */
+static void scrub_chunks(scrub_context_t *scrub,
+                         int ssd_fd,
+                         std::vector<uint32_t> &bad) {
+  std::vector<storage_chunk_t> chunk_table = chunk_table_read(ssd_fd);
+  std::vector<uint8_t> data;
+
+  for (uint32_t slot = 0; slot < chunk_table.size(); slot++) {
+    const storage_chunk_t &chunk = chunk_table[slot];
+    if (chunk.offset == 0) {
+      continue;
+    }
+    if (scrub_stopping(scrub)) {
+      break;
+    }
+
+    uint64_t busy_since = scrub_now_ns();
+    bool ok             = chunk_read(ssd_fd, chunk, data) == 0;
+    if (ok) {
+      uint8_t hash[BLAKE3_OUT_LEN];
+      blake3_hash(data.data(), data.size(), hash);
+      ok = memcmp(hash, chunk.hash, BLAKE3_OUT_LEN) == 0;
+    }
+    scrub->stats.chunks_checked++;
+    scrub->stats.bytes_read += chunk.stored_size;
+
+    if (!ok && chunk_unchanged(ssd_fd, slot, chunk)) {
+      LOG(ERR,
+          "Scrub: chunk %u at offset 0x%08lX doesn't match its hash",
+          slot,
+          chunk.offset);
+      bad.push_back(slot);
+    }
+    scrub_throttle(scrub, busy_since);
+  }
+}
+
+/** @brief a file being read back by the scrub */
+typedef struct {
+  scrub_context_t *scrub;
+  uint64_t busy_since; // when the read of the current piece started
+} scrub_file_t;
+
+/** @brief throws the file's data away, keeping the scrub at its share */
+static int scrub_sink(const uint8_t *data, size_t size, void *arg) {
+  (void)data;
+  scrub_file_t *file = static_cast<scrub_file_t *>(arg);
+  file->scrub->stats.bytes_read += size;
+  scrub_throttle(file->scrub, file->busy_since);
+  file->busy_since = scrub_now_ns();
+  return scrub_stopping(file->scrub) ? -1 : 0;
+}
+
+/**
+ * @brief reads back the files stored as one extent, which download checks
+ * against their hash, and names the chunked files hit by bad chunks
+ * @return Returns the number of corrupt files stored as one extent
+ */
+static int scrub_files(scrub_context_t *scrub,
+                       int ssd_fd,
+                       const std::vector<uint32_t> &bad) {
+  std::vector<storage_metadata_t> md_table = md_table_read(ssd_fd);
+  std::vector<uint32_t> chunk_list;
+  int corrupt = 0;
+
+  for (const storage_metadata_t &entry : md_table) {
+    if (scrub_stopping(scrub)) {
+      break;
+    }
+
+    // chunked files were checked chunk by chunk already
+    if (entry.chunks) {
+      if (bad.empty() || chunk_list_read(ssd_fd, entry, chunk_list)) {
+        continue;
+      }
+      size_t hits = 0;
+      for (uint32_t slot : chunk_list) {
+        hits += std::binary_search(bad.begin(), bad.end(), slot);
+      }
+      if (hits) {
+        LOG(ERR, "Scrub: file %s has %zu corrupt chunks", entry.filename, hits);
+      }
+      continue;
+    }
+
+    // the sink sleeps to pace the scrub, so the reads aren't timed as
+    // downloads
+    scrub_file_t file = {scrub, scrub_now_ns()};
+    int rc = storage_stream_file(scrub->cfg, entry.filename, scrub_sink, &file);
+    scrub->stats.files_checked++;
+    if (rc == 0 || scrub_stopping(scrub)) {
+      continue;
+    }
+
+    // a file deleted or replaced while it was read isn't corrupt either
+    storage_metadata_t current;
+    if (storage_find_file(scrub->cfg, entry.filename, &current) == 0 &&
+        current.start_offset == entry.start_offset) {
+      LOG(ERR,
+          "Scrub: file %s at offset 0x%08lX doesn't match its hash",
+          entry.filename,
+          entry.start_offset);
+      corrupt++;
+    }
+  }
+
+  return corrupt;
+}
+
+void scrub_init(scrub_context_t *scrub,
+                config_context_t cfg,
+                int share,
+                int interval) {
+  memset(scrub, 0, sizeof(*scrub));
+  scrub->cfg      = cfg;
+  scrub->share    = (share > 0 && share <= 100) ? share : SCRUB_DEFAULT_SHARE;
+  scrub->interval = (interval > 0) ? interval : SCRUB_DEFAULT_INTERVAL;
+}
+
+int scrub_pass(scrub_context_t *scrub) {
+  LOG(INFO,
+      "Scrub pass starting on %s, %d%% of device time",
+      scrub->cfg.drive_full_path,
+      scrub->share);
+
+  int ssd_fd = open(scrub->cfg.drive_full_path, O_RDONLY);
+  if (ssd_fd == -1) {
+    LOG(ERR, "Scrub: error opening SSD");
+    return -1;
+  }
+
+  uint64_t start       = scrub_now_ns();
+  scrub_stats_t before = scrub->stats;
+
+  std::vector<uint32_t> bad;
+  scrub_chunks(scrub, ssd_fd, bad);
+  int corrupt = (int)bad.size() + scrub_files(scrub, ssd_fd, bad);
+  close(ssd_fd);
+
+  scrub->stats.corrupt += corrupt;
+  if (!scrub_stopping(scrub)) {
+    scrub->stats.passes++;
+  }
+
+  // LOG() needs its level at compile time, so the summary is formatted once
+  // for either level
+  char summary[160];
+  snprintf(summary,
+           sizeof(summary),
+           "Scrub pass %s in %.1f s: %lu chunks, %lu files, %lu bytes, "
+           "%d corrupt",
+           scrub_stopping(scrub) ? "stopped" : "done",
+           (double)(scrub_now_ns() - start) / 1e9,
+           scrub->stats.chunks_checked - before.chunks_checked,
+           scrub->stats.files_checked - before.files_checked,
+           scrub->stats.bytes_read - before.bytes_read,
+           corrupt);
+  if (corrupt) {
+    LOG(ERR, "%s", summary);
+  } else {
+    LOG(INFO, "%s", summary);
+  }
+  return corrupt;
+}
+
+static void *scrub_thread(void *arg) {
+  scrub_context_t *scrub = (scrub_context_t *)arg;
+  LOG(INFO, "Scrub thread started, a pass every %d hours", scrub->interval);
+
+  const uint64_t interval_ns = (uint64_t)scrub->interval * 3600 * 1000000000ULL;
+  while (!scrub_stopping(scrub)) {
+    uint64_t start = scrub_now_ns();
+    scrub_pass(scrub);
+
+    uint64_t elapsed = scrub_now_ns() - start;
+    if (elapsed < interval_ns) {
+      scrub_sleep(scrub, interval_ns - elapsed);
+    }
+  }
+
+  LOG(INFO,
+      "Scrub thread stopped after %lu passes, %lu corrupt",
+      scrub->stats.passes,
+      scrub->stats.corrupt);
+  return NULL;
+}
+
+int scrub_start(scrub_context_t *scrub) {
+  __atomic_store_n(&scrub->stop, 0, __ATOMIC_RELEASE);
+  if (pthread_create(&scrub->thread, NULL, scrub_thread, scrub) != 0) {
+    LOG(ERR, "Failed to start the scrub thread");
+    return -1;
+  }
+  scrub->running = 1;
+  return 0;
+}
+
+void scrub_stop(scrub_context_t *scrub) {
+  if (!scrub || !scrub->running) {
+    return;
+  }
+
+  __atomic_store_n(&scrub->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(scrub->thread, NULL);
+  scrub->running = 0;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file scrub.hpp
+ * @brief Background scrubber that re-reads everything stored on the SSD and
+ * checks it against the hashes recorded at upload, so silent corruption is
+ * found while the data can still be uploaded again
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <pthread.h>
+
+#include "config.hpp"
+
+/** @brief Share of device time the scrub uses unless configured otherwise */
+#define SCRUB_DEFAULT_SHARE 10
+
+/** @brief Hours between passes unless configured otherwise */
+#define SCRUB_DEFAULT_INTERVAL 24
+
+/** @brief Longest the scrub thread sleeps before checking for a stop */
+#define SCRUB_SLEEP_SLICE_MS 100
+
+/**
+ * @struct scrub_stats_t
+ * @brief Scrub counters, summed over all passes
+ */
+typedef struct {
+  uint64_t passes;         /**< Passes over the whole SSD completed */
+  uint64_t chunks_checked; /**< Chunks read back and hashed */
+  uint64_t files_checked;  /**< Files stored as one extent read back */
+  uint64_t bytes_read;     /**< Bytes read off the SSD */
+  uint64_t corrupt;        /**< Chunks and files that failed their check */
+} scrub_stats_t;
+
+/**
+ * @struct scrub_context_t
+ * @brief Scrub thread state for one SSD
+ */
+typedef struct {
+  config_context_t cfg; /**< SSD to scrub */
+  int share;            /**< Percent of device time the scrub may use */
+  int interval;         /**< Hours between the start of two passes */
+  pthread_t thread;     /**< Scrub thread handle */
+  int running;          /**< Set while the thread is running */
+  int stop;             /**< Set to end a pass early and stop the thread */
+  scrub_stats_t stats;  /**< Counters, only written by the scrubbing thread */
+} scrub_context_t;
+
+/**
+ * @brief Sets up a scrub context, out of range settings get the defaults
+ * @param scrub Context to initialize
+ * @param cfg Configuration context for the SSD
+ * @param share Percent of device time the scrub may use, 1 to 100
+ * @param interval Hours between passes
+ */
+void scrub_init(scrub_context_t *scrub,
+                config_context_t cfg,
+                int share,
+                int interval);
+
+/**
+ * @brief Starts the scrub thread, which runs a pass right away and then one
+ * every interval hours
+ * @param scrub Initialized scrub context
+ * @return Returns 0 on success, or -1 if the thread couldn't be started
+ */
+int scrub_start(scrub_context_t *scrub);
+
+/**
+ * @brief Stops the scrub thread, ending the current pass early
+ * @param scrub Scrub context
+ */
+void scrub_stop(scrub_context_t *scrub);
+
+/**
+ * @brief Runs one pass on the calling thread. every chunk is decoded and
+ * hashed, files stored as one extent are checked against their file hash,
+ * and every mismatch is logged along with the files it affects
+ * @param scrub Initialized scrub context
+ * @return Returns the number of corrupt chunks and files found, or -1 if
+ * the SSD couldn't be read
+ */
+int scrub_pass(scrub_context_t *scrub);
@@ -10,6 +10,8 @@
 #include <vector>
 
 #include "audio_files.hpp"
+#include "audio_info.hpp"
+#include "blake3.h"
 #include "config.hpp"
 
 #define DIST_FS_SSD_PATTERN_SZ                                                 \
@@ -31,6 +33,19 @@
 #define DEVICE_PATH "/dev/disk/by-id/usb-Seagate_Slim_SL_NA710NYN-0:0"
 
 
+/**
+ * @enum storage_codec_e
+ * @brief How a file's data is encoded on the SSD
+ */
+typedef enum {
+  STORAGE_CODEC_STORE = 0, /**< Raw bytes, already compressed formats */
+  STORAGE_CODEC_LZ,        /**< bytecrush LZ77 blocks */
+  STORAGE_CODEC_AUDIO,     /**< bytecrush lossless audio blocks */
+} storage_codec_e;
+
+/** @brief BLAKE3 hash of a file's or a chunk's contents */
+typedef uint8_t storage_hash_t[BLAKE3_OUT_LEN];
+
 /**
  * @struct storage_metadata_t
  * @brief Structure to hold metadata information for files on the SSD
@@ -42,11 +57,51 @@ typedef struct storage_metadata_t {
   bool is_directory;      /**< Flag indicating if the entry is a directory */
   size_t index;           /**< Index in the metadata table */
   file_times_t file_time; /**< File timestamps */
+  audio_info_t audio;     /**< Play time, format and tags of audio files */
   std::vector<storage_metadata_t> children; /**< for directories */
+  size_t stored_size;  /**< Bytes the encoded file takes on the SSD */
+  uint8_t codec;       /**< storage_codec_e the file is encoded with */
+  uint8_t type;        /**< dist_fs_file_types_e of the file */
+  uint32_t chunks;     /**< Chunk list entries, 0 for a single extent */
+  storage_hash_t hash; /**< BLAKE3 of the file's contents */
 } storage_metadata_t;
 
-/** @brief Offset where the metadata table begins on the SSD */
-constexpr const off_t METADATA_TABLE_OFFSET = 0;
+/** @brief Magic of a dist-fs drive's format block, "DISTFS" on the SSD */
+#define STORAGE_FORMAT_MAGIC 0x0000534654534944ULL
+
+/**
+ * @def STORAGE_FORMAT_VERSION
+ * @brief Version of the on-SSD layout, bumped whenever a table or an extent
+ * changes shape. a drive of another version is refused instead of misread.
+ * 1 had the larger metadata entries, 2 added the chunk table and extents
+ * holding chunk lists, which a version 1 drive would have read from its
+ * file data
+ */
+#define STORAGE_FORMAT_VERSION 2
+
+/**
+ * @struct storage_format_t
+ * @brief Format block at the start of the SSD. a drive without one counts
+ * as blank only while the block and the metadata table are all zeros
+ */
+typedef struct {
+  uint64_t magic;    /**< STORAGE_FORMAT_MAGIC */
+  uint32_t version;  /**< STORAGE_FORMAT_VERSION the drive was written with */
+  uint32_t reserved; /**< Zero */
+  /** Bumped by every upload and delete, so a process holding an index of
+   * the metadata table can tell when another one changed the table */
+  uint64_t stamp;
+} storage_format_t;
+
+/** @brief Offset of the format block */
+constexpr const off_t STORAGE_FORMAT_OFFSET = 0;
+
+/** @brief Space kept for the format block, a block so the tables align */
+constexpr const size_t STORAGE_FORMAT_SZ = 4096;
+
+/** @brief Offset where the metadata table begins, after the format block */
+constexpr const off_t METADATA_TABLE_OFFSET =
+  STORAGE_FORMAT_OFFSET + STORAGE_FORMAT_SZ;
 
 /** @brief Maximum number of files that can be tracked in the metadata table */
 constexpr const size_t MAX_FILES = 1024;
@@ -55,17 +110,87 @@ constexpr const size_t MAX_FILES = 1024;
 constexpr const size_t METADATA_TABLE_SZ =
   sizeof(storage_metadata_t) * MAX_FILES;
 
+/**
+ * @struct storage_chunk_t
+ * @brief Entry in the chunk table, one per unique chunk of file data. files
+ * split into chunks keep a list of chunk table indices in their extent
+ * instead of the data itself, so a chunk shared by several files or
+ * uploaded again is only stored once
+ */
+typedef struct {
+  storage_hash_t hash;  /**< BLAKE3 of the chunk's raw bytes */
+  off_t offset;         /**< Encoded chunk offset, 0 for free slots */
+  uint32_t size;        /**< Raw chunk size in bytes */
+  uint32_t stored_size; /**< Bytes the encoded chunk takes on the SSD */
+  uint32_t refs;        /**< Chunk list entries referencing the chunk */
+  uint8_t codec;        /**< storage_codec_e the chunk is encoded with */
+} storage_chunk_t;
+
+/** @brief Offset where the chunk table begins, after the metadata table */
+constexpr const off_t CHUNK_TABLE_OFFSET =
+  METADATA_TABLE_OFFSET + METADATA_TABLE_SZ;
+
+/** @brief Maximum number of unique chunks the chunk table can track */
+constexpr const size_t MAX_CHUNKS = 65536;
+
+/** @brief Total size of the chunk table */
+constexpr const size_t CHUNK_TABLE_SZ = sizeof(storage_chunk_t) * MAX_CHUNKS;
+
+/** @brief Offset where file extents and chunks begin */
+constexpr const off_t STORAGE_DATA_OFFSET = CHUNK_TABLE_OFFSET + CHUNK_TABLE_SZ;
+
+/** @brief Size of the chunks handed to a sink when streaming a file out */
+constexpr const size_t STORAGE_STREAM_CHUNK_SZ = 32768;
+
+/**
+ * @brief Consumer of file data streamed off the SSD
+ * @param data Chunk of file data
+ * @param size Size of the chunk in bytes
+ * @param arg User argument passed through from the caller
+ * @return Returns 0 to keep streaming, non-zero to abort
+ */
+typedef int (*storage_sink_t)(const uint8_t *data, size_t size, void *arg);
+
+/** @brief Sorted views of the metadata table, see md_index.hpp */
+struct md_index_t;
+
 /** @brief Combined size of a file header and SSD header */
 constexpr size_t PACKET_METADATA_SIZE =
   sizeof(file_info_t) + DIST_FS_SSD_HEADER_SZ;
 
 /**
- * @brief Provisions the SSD with the initial magic numbers and info
+ * @brief Picks the codec a file of the given type is stored with
+ * @param type Type of the file
+ * @return Codec for the file's data
+ */
+storage_codec_e storage_codec_for_type(dist_fs_file_types_e type);
+
+/**
+ * @brief Whether the SSD holds this build's layout
  * @param cfg_ctx Configuration context for the SSD
- * @return Returns 0 on success, or a non-zero error code on failure
+ * @return Returns true if its format block has this STORAGE_FORMAT_VERSION
+ */
+bool is_drive_provisioned(config_context_t cfg_ctx);
+
+/**
+ * @brief Provisions a blank SSD with the format block. a drive that already
+ * has one is left as it is
+ * @param cfg_ctx Configuration context for the SSD
+ * @return Returns 0 if the drive holds this build's layout afterwards, or a
+ * non-zero error code if it holds another layout or other data
  */
 int drive_provision(config_context_t cfg_ctx);
 
+/**
+ * @brief Checks the format block before the SSD is used, the tables and
+ * extents of a drive of another layout version or of a drive with other
+ * data are never read. the readers of both tables check it as well
+ * @param ssd_fd File descriptor for the SSD
+ * @return Returns 0 if the drive holds this build's layout or is blank, or
+ * -1 if it doesn't or the block couldn't be read
+ */
+int storage_format_check(int ssd_fd);
+
 /**
  * @brief Displays information about the SSD, such as capacity and current
  * usage
@@ -77,10 +202,42 @@ int drive_info(config_context_t cfg_ctx);
 /**
  * @brief Reads the metadata table from the SSD
  * @param ssd_fd File descriptor for the SSD
- * @return A vector containing the metadata table entries
+ * @return A vector containing the metadata table entries, empty if the
+ * drive doesn't hold this build's layout
  */
 std::vector<storage_metadata_t> md_table_read(int ssd_fd);
 
+/**
+ * @brief Reads the chunk table from the SSD
+ * @param ssd_fd File descriptor for the SSD
+ * @return All MAX_CHUNKS slots, indexed as on the SSD. free slots have an
+ * offset of 0, and the vector is empty if the table couldn't be read or
+ * the drive doesn't hold this build's layout
+ */
+std::vector<storage_chunk_t> chunk_table_read(int ssd_fd);
+
+/**
+ * @brief Reads and decodes one chunk's data
+ * @param ssd_fd File descriptor for the SSD
+ * @param chunk Chunk table entry of the chunk
+ * @param data Filled in with the chunk's raw bytes
+ * @return Returns 0 on success, or -1 if the chunk can't be read or decoded
+ */
+int chunk_read(int ssd_fd,
+               const storage_chunk_t &chunk,
+               std::vector<uint8_t> &data);
+
+/**
+ * @brief Reads the chunk table slots a chunked file's extent lists
+ * @param ssd_fd File descriptor for the SSD
+ * @param entry Metadata entry of a file with chunks
+ * @param chunk_list Filled in with the slots, in file order
+ * @return Returns 0 on success, or a non-zero error code on failure
+ */
+int chunk_list_read(int ssd_fd,
+                    const storage_metadata_t &entry,
+                    std::vector<uint32_t> &chunk_list);
+
 /**
  * @brief Prints the contents of the metadata table to the console
  * @param md_table Reference to the metadata table
@@ -88,6 +245,26 @@ std::vector<storage_metadata_t> md_table_read(int ssd_fd);
  */
 int md_table_print(const std::vector<storage_metadata_t> &md_table);
 
+/**
+ * @brief Hands an index to the storage driver, which adds every file it
+ * uploads to it and removes every file it deletes. the index is filled in
+ * by the first storage_refresh_index()
+ * @param index Initialized index, or NULL for none
+ */
+void storage_set_index(md_index_t *index);
+
+/**
+ * @brief Brings the attached index up to date with the metadata table when
+ * the format block's stamp shows the table changed outside this process,
+ * e.g. by the CLI. the first call builds the index, later ones log the
+ * difference with md_index_update(). call it before answering from the index
+ * @param ssd_fd File descriptor for the SSD
+ * @return Returns 1 if the index was built or updated, 0 if it was current or
+ * none is attached, or -1 if the stamp couldn't be read or the drive holds
+ * another layout
+ */
+int storage_refresh_index(int ssd_fd);
+
 /**
  * @brief Uploads a file or directory to the SSD
  * @param cfg_ctx Configuration context for the SSD
@@ -96,6 +273,58 @@ int md_table_print(const std::vector<storage_metadata_t> &md_table);
  */
 int upload_file(config_context_t cfg_ctx, const char *filename);
 
+/**
+ * @brief Uploads a local file to the SSD under a different name
+ * @param cfg_ctx Configuration context for the SSD
+ * @param filename Path to the local file to upload
+ * @param stored_name Name recorded in the metadata table
+ * @return Returns 0 on success, or a non-zero error code on failure
+ */
+int upload_file_as(config_context_t cfg_ctx,
+                   const char *filename,
+                   const char *stored_name);
+
+/**
+ * @brief Looks up a file's metadata entry
+ * @param cfg_ctx Configuration context for the SSD
+ * @param filename Name of the file to look up
+ * @param entry Filled in with the file's metadata entry when found
+ * @return Returns 0 if the file exists, or a non-zero error code otherwise
+ */
+int storage_find_file(config_context_t cfg_ctx,
+                      const char *filename,
+                      storage_metadata_t *entry);
+
+/**
+ * @brief Streams a file's contents from its extent or its chunks on the SSD
+ * to a sink, decoding it on the way so the sink always sees the original
+ * bytes
+ * @param cfg_ctx Configuration context for the SSD
+ * @param filename Name of the file to stream
+ * @param sink Called with each chunk of file data, in order
+ * @param arg User argument passed to the sink
+ * @return Returns 0 on success, or a non-zero error code on failure
+ */
+int download_file_stream(config_context_t cfg_ctx,
+                         const char *filename,
+                         storage_sink_t sink,
+                         void *arg);
+
+/**
+ * @brief Streams a file like download_file_stream() without timing it as a
+ * download, for background readers such as the scrub whose paced reads
+ * would swamp the latencies of real downloads
+ * @param cfg_ctx Configuration context for the SSD
+ * @param filename Name of the file to stream
+ * @param sink Called with each chunk of file data, in order
+ * @param arg User argument passed to the sink
+ * @return Returns 0 on success, or a non-zero error code on failure
+ */
+int storage_stream_file(config_context_t cfg_ctx,
+                        const char *filename,
+                        storage_sink_t sink,
+                        void *arg);
+
 /**
  * @brief Downloads a file from the SSD to the local filesystem
  * @param cfg_ctx Configuration context for the SSD
@@ -105,7 +334,8 @@ int upload_file(config_context_t cfg_ctx, const char *filename);
 int download_file(config_context_t cfg_ctx, const char *filename);
 
 /**
- * @brief Deletes a file or directory from the SSD
+ * @brief Deletes a file or directory from the SSD. chunks no other file
+ * references anymore are erased with it
  * @param cfg_ctx Configuration context for the SSD
  * @param filename Name of the file or directory to delete
  * @return Returns 0 on success, or a non-zero error code on failure
@@ -119,6 +349,15 @@ int delete_file(config_context_t cfg_ctx, const char *filename);
  */
 int list_files(config_context_t cfg_ctx);
 
+/**
+ * @brief Lists the files whose name contains a piece of text, ignoring case,
+ * best matches first
+ * @param cfg_ctx Configuration context for the SSD
+ * @param text Text to look for
+ * @return Returns 0 on success, or a non-zero error code on failure
+ */
+int search_files(config_context_t cfg_ctx, const char *text);
+
 /**
  * @brief Performs an echo test on the SSD by writing and reading a pattern
  * @param pattern Pointer to the pattern data
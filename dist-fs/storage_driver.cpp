@@ -4,26 +4,33 @@
 #include <string.h>
 #include <errno.h>
 #include <endian.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <vector>
 #include <cstring>
-
-#include <chrono>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
 
 #include "utils.hpp"
 #include "audio_files.hpp"
+#include "bytecrush.h"
+#include "fastcdc.h"
+#include "md_index.hpp"
+#include "metrics.hpp"
 #include "storage.hpp"
 
 
-int get_time_info(storage_metadata_t *md_table) {
+int get_time_info(storage_metadata_t *md_table, const char *path) {
   if (!md_table) {
     fprintf(stderr, "Error: md_table pointer is NULL\n");
     return -1;
   }
 
   struct stat file_stat;
-  if (stat(md_table->filename, &file_stat) == -1) {
+  if (stat(path, &file_stat) == -1) {
     perror("stat");
     return -1;
   }
@@ -36,7 +43,7 @@ int get_time_info(storage_metadata_t *md_table) {
   // if the system supports statx, attempt to retrieve creation time
   struct statx file_statx;
   if (statx(AT_FDCWD,
-            md_table->filename,
+            path,
             AT_STATX_SYNC_AS_STAT,
             STATX_BTIME,
             &file_statx) == 0) {
@@ -80,28 +87,97 @@ int get_time_info(storage_metadata_t *md_table) {
   return 0; // Success
 }
 
+// format block operations
+/*****************************************************************************/
+/**
+ * @brief reads the format block. a drive without one is blank if nothing
+ * was written where the block and the metadata table go, an older layout
+ * kept its metadata table at the start of the drive
+ * @return Returns 0 for this build's layout, 1 for a blank drive, which
+ * reads as a zeroed block, or -1 for anything else
+ */
+static int format_read(int ssd_fd, storage_format_t *format) {
+  *format            = {};
+  ssize_t bytes_read = pread(ssd_fd, format, sizeof(*format), 0);
+  if (bytes_read < 0) {
+    LOG(ERR, "Failed to read the SSD format block");
+    return -1;
+  }
+  if ((size_t)bytes_read < sizeof(*format)) {
+    *format = {};
+  }
+
+  if (format->magic == STORAGE_FORMAT_MAGIC) {
+    if (format->version != STORAGE_FORMAT_VERSION) {
+      LOG(ERR,
+          "The SSD holds layout version %u, this build reads version %u. "
+          "Copy its files off with the build that wrote them and provision "
+          "it again",
+          format->version,
+          STORAGE_FORMAT_VERSION);
+      return -1;
+    }
+    return 0;
+  }
+
+  *format = {};
+  std::vector<uint8_t> head(METADATA_TABLE_OFFSET + METADATA_TABLE_SZ);
+  bytes_read = pread(ssd_fd, head.data(), head.size(), 0);
+  if (bytes_read < 0 ||
+      std::any_of(head.begin(), head.begin() + bytes_read, [](uint8_t b) {
+        return b != 0;
+      })) {
+    LOG(ERR, "The SSD doesn't hold a dist-fs layout this build reads");
+    return -1;
+  }
+  return 1;
+}
+
+/** @brief writes the format block with a table stamp */
+static int format_write(int ssd_fd, uint64_t stamp) {
+  storage_format_t format = {};
+  format.magic            = STORAGE_FORMAT_MAGIC;
+  format.version          = STORAGE_FORMAT_VERSION;
+  format.stamp            = stamp;
+  if (pwrite(ssd_fd, &format, sizeof(format), STORAGE_FORMAT_OFFSET) !=
+      sizeof(format)) {
+    LOG(ERR, "Failed to write the SSD format block");
+    return -1;
+  }
+  return 0;
+}
+
+int storage_format_check(int ssd_fd) {
+  storage_format_t format;
+  return format_read(ssd_fd, &format) < 0 ? -1 : 0;
+}
+
+
 // metadata table operations
 /*****************************************************************************/
 std::vector<storage_metadata_t> md_table_read(int ssd_fd) {
   LOG(INFO, "Reading SSD metadata table");
   std::vector<storage_metadata_t> md_table;
+  uint64_t start = metrics_now_ns();
 
-  // seek from beginning of file
-  if (lseek(ssd_fd, 0, SEEK_SET) == -1) {
-    LOG(ERR, "Failed to seek to metadata table");
+  if (storage_format_check(ssd_fd)) {
+    metrics_op(METRICS_MD_READ, start, 0, false);
     return md_table;
   }
 
-  // read the metadata section
-  char buffer[METADATA_TABLE_SZ] = {0};
-  ssize_t bytes_read             = read(ssd_fd, buffer, METADATA_TABLE_SZ);
+  // read the metadata section, too big for the stack
+  std::vector<uint8_t> buffer(METADATA_TABLE_SZ);
+  ssize_t bytes_read =
+    pread(ssd_fd, buffer.data(), METADATA_TABLE_SZ, METADATA_TABLE_OFFSET);
   if (bytes_read <= 0) {
     LOG(INFO, "No metadata found. Initializing empty table");
+    metrics_op(METRICS_MD_READ, start, 0, bytes_read == 0);
     return md_table;
   }
 
   // parse metadata entries
-  storage_metadata_t *entries = reinterpret_cast<storage_metadata_t *>(buffer);
+  storage_metadata_t *entries =
+    reinterpret_cast<storage_metadata_t *>(buffer.data());
   size_t num_entries          = bytes_read / sizeof(storage_metadata_t);
 
   for (size_t i = 0; i < num_entries; ++i) {
@@ -110,6 +186,7 @@ std::vector<storage_metadata_t> md_table_read(int ssd_fd) {
     }
   }
 
+  metrics_op(METRICS_MD_READ, start, (uint64_t)bytes_read, true);
   return md_table;
 }
 
@@ -117,10 +194,12 @@ bool md_table_write(int ssd_fd, storage_metadata_t &entry, size_t index) {
   off_t entry_offset =
     METADATA_TABLE_OFFSET + (index * sizeof(storage_metadata_t));
   LOG(INFO, "Writing metadata entry at offset: 0x%08lX", entry_offset);
+  uint64_t start = metrics_now_ns();
 
   // seek to the metadata entry offset
   if (lseek(ssd_fd, entry_offset, SEEK_SET) == -1) {
     LOG(ERR, "Failed to seek to metadata offset: 0x%08lX", entry_offset);
+    metrics_op(METRICS_MD_WRITE, start, 0, false);
     return false;
   }
 
@@ -131,15 +210,98 @@ bool md_table_write(int ssd_fd, storage_metadata_t &entry, size_t index) {
         "Error writing metadata entry. Expected %lu bytes, wrote %ld bytes",
         sizeof(entry),
         written);
+    metrics_op(METRICS_MD_WRITE, start, 0, false);
     return false;
   }
 
   LOG(INFO,
       "Successfully wrote metadata entry at offset: 0x%08lX",
       entry_offset);
+  metrics_op(METRICS_MD_WRITE, start, sizeof(entry), true);
+  return true;
+}
+
+std::vector<storage_chunk_t> chunk_table_read(int ssd_fd) {
+  LOG(INFO, "Reading SSD chunk table");
+  std::vector<storage_chunk_t> chunk_table(MAX_CHUNKS);
+  uint64_t start = metrics_now_ns();
+
+  if (storage_format_check(ssd_fd)) {
+    metrics_op(METRICS_MD_READ, start, 0, false);
+    chunk_table.clear();
+    return chunk_table;
+  }
+
+  // a drive that was never written that far has an empty table, the slots
+  // past the end of the read stay zeroed
+  uint8_t *buffer = reinterpret_cast<uint8_t *>(chunk_table.data());
+  size_t total    = 0;
+  while (total < CHUNK_TABLE_SZ) {
+    ssize_t bytes_read = pread(ssd_fd,
+                               buffer + total,
+                               CHUNK_TABLE_SZ - total,
+                               CHUNK_TABLE_OFFSET + total);
+    if (bytes_read < 0) {
+      LOG(ERR, "Failed to read chunk table");
+      metrics_op(METRICS_MD_READ, start, total, false);
+      chunk_table.clear();
+      return chunk_table;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+    total += bytes_read;
+  }
+
+  metrics_op(METRICS_MD_READ, start, total, true);
+  return chunk_table;
+}
+
+/**
+ * @brief reads one chunk table entry, for callers that only need the slots
+ * a chunk list names rather than the whole table. a slot past the end of
+ * the drive reads as free
+ */
+static bool chunk_table_read_entry(int ssd_fd,
+                                   size_t index,
+                                   storage_chunk_t &chunk) {
+  off_t entry_offset = CHUNK_TABLE_OFFSET + (index * sizeof(storage_chunk_t));
+  uint64_t start     = metrics_now_ns();
+  ssize_t bytes_read = pread(ssd_fd, &chunk, sizeof(chunk), entry_offset);
+  metrics_op(METRICS_MD_READ, start, sizeof(chunk), bytes_read >= 0);
+  if (bytes_read < 0) {
+    LOG(ERR, "Error reading chunk table entry %zu", index);
+    return false;
+  }
+  if ((size_t)bytes_read < sizeof(chunk)) {
+    chunk = {};
+  }
   return true;
 }
 
+bool chunk_table_write(int ssd_fd, const storage_chunk_t &chunk, size_t index) {
+  off_t entry_offset = CHUNK_TABLE_OFFSET + (index * sizeof(storage_chunk_t));
+  uint64_t start     = metrics_now_ns();
+  ssize_t written    = pwrite(ssd_fd, &chunk, sizeof(chunk), entry_offset);
+  metrics_op(METRICS_MD_WRITE, start, sizeof(chunk), written == sizeof(chunk));
+  if (written != sizeof(chunk)) {
+    LOG(ERR,
+        "Error writing chunk table entry %zu. Expected %lu bytes, wrote %ld "
+        "bytes",
+        index,
+        sizeof(chunk),
+        written);
+    return false;
+  }
+  return true;
+}
+
+/** @brief whether an entry records its file's hash, older ones don't */
+static bool entry_has_hash(const storage_metadata_t &entry) {
+  static const uint8_t none[BLAKE3_OUT_LEN] = {0};
+  return memcmp(entry.hash, none, BLAKE3_OUT_LEN) != 0;
+}
+
 int md_table_print(const std::vector<storage_metadata_t> &md_table) {
   // TODO get rid of all the static definitions of line widths
   // determine maximum column widths dynamically
@@ -179,6 +341,9 @@ int md_table_print(const std::vector<storage_metadata_t> &md_table) {
             << " | " << std::setw(size_width) << "bytes"
             << " | " << std::setw(size_kb_width) << "kb"
             << " | " << std::setw(size_mb_width) << "mb"
+            << " | " << std::setw(9) << "Length"
+            << " | " << std::setw(6) << "Hz"
+            << " | " << std::setw(3) << "BPM"
             << " | " << std::setw(20) << "Modified"
             << " | " << std::setw(20) << "Accessed"
             << " | " << std::setw(20) << "Created"
@@ -186,7 +351,7 @@ int md_table_print(const std::vector<storage_metadata_t> &md_table) {
 
   // print the separator line
   std::cout << std::string(filename_width + index_width + offset_width +
-                             size_width + size_kb_width + size_mb_width + 100,
+                             size_width + size_kb_width + size_mb_width + 127,
                            '-')
             << std::endl;
 
@@ -204,6 +369,21 @@ int md_table_print(const std::vector<storage_metadata_t> &md_table) {
       return oss.str();
     };
 
+    // play time as m:ss.mmm, blank for files that aren't audio
+    auto format_length = [](uint32_t ms) -> std::string {
+      if (ms == 0) {
+        return "";
+      }
+      char text[16];
+      snprintf(text,
+               sizeof(text),
+               "%u:%02u.%03u",
+               ms / 60000,
+               ms / 1000 % 60,
+               ms % 1000);
+      return text;
+    };
+
     std::cout << std::left << std::setw(filename_width) << entry.filename
               << " | " << std::right << std::setw(index_width + 1)
               << entry.index << "|" << std::right << std::setw(offset_width + 1)
@@ -212,7 +392,10 @@ int md_table_print(const std::vector<storage_metadata_t> &md_table) {
               << std::right << std::setw(size_kb_width) << std::dec
               << entry.size / 1024 << " | " << std::right
               << std::setw(size_mb_width) << std::dec
-              << entry.size / 1024 / 1024 << " | " << std::setw(20)
+              << entry.size / 1024 / 1024 << " | " << std::setw(9)
+              << format_length(entry.audio.duration_ms) << " | "
+              << std::setw(6) << entry.audio.sample_rate << " | "
+              << std::setw(3) << entry.audio.bpm << " | " << std::setw(20)
               << format_time(entry.file_time.last_modified) << " | "
               << std::setw(20) << format_time(entry.file_time.last_accessed)
               << " | " << std::setw(20) << format_time(entry.file_time.created)
@@ -223,31 +406,37 @@ int md_table_print(const std::vector<storage_metadata_t> &md_table) {
   return 0;
 }
 
-off_t md_table_find_offset(const std::vector<storage_metadata_t> &md_table) {
+off_t md_table_find_offset(const std::vector<storage_metadata_t> &md_table,
+                           const std::vector<storage_chunk_t> &chunk_table) {
   LOG(INFO, "Finding next free offset for file storage");
-  const off_t METADATA_SIZE = MAX_FILES * sizeof(storage_metadata_t);
-  LOG(INFO, "Metadata Size          : %d", METADATA_SIZE);
+  LOG(INFO, "Metadata Size          : %d", METADATA_TABLE_SZ);
+  LOG(INFO, "Chunk table Size       : %d", CHUNK_TABLE_SZ);
   LOG(INFO, "Max files              : %d", MAX_FILES);
   LOG(INFO, "sizeof(storage_metadata_t) : %d", sizeof(storage_metadata_t));
-  if (md_table.empty()) {
-    LOG(INFO, "No files, starting right after metadata section");
-    return METADATA_SIZE;
-  }
 
-  // start searching after the metadata section
-  off_t max_end_offset = METADATA_SIZE;
-  // find the highest end offset among all files
+  // start searching after the chunk table
+  off_t max_end_offset = STORAGE_DATA_OFFSET;
+  // find the highest end offset among all files. each extent is the FS
+  // header followed by the encoded data or the chunk list
   for (const auto &entry : md_table) {
-    off_t end_offset = entry.start_offset + entry.size;
+    off_t end_offset =
+      entry.start_offset + PACKET_METADATA_SIZE + entry.stored_size;
     if (end_offset > max_end_offset)
       max_end_offset = end_offset;
   }
+  // and among the chunks, which are stored without a header
+  for (const auto &chunk : chunk_table) {
+    off_t end_offset = chunk.offset + chunk.stored_size;
+    if (chunk.offset != 0 && end_offset > max_end_offset)
+      max_end_offset = end_offset;
+  }
   return max_end_offset;
 }
 
 int update_md_table(storage_metadata_t *md_table,
                     file_info_t &file_info,
-                    int ssd_fd) {
+                    int ssd_fd,
+                    const char *path) {
 
   std::vector<storage_metadata_t> md_vector = md_table_read(ssd_fd);
   // index in the metadata table
@@ -256,7 +445,7 @@ int update_md_table(storage_metadata_t *md_table,
 
 
   // get file information
-  int rc = get_time_info(md_table);
+  int rc = get_time_info(md_table, path);
   if (rc != 0) {
     LOG(ERR, "Error getting time information : {%d}", rc);
     return rc;
@@ -319,31 +508,42 @@ int write_fs_header(int ssd_fd, off_t offset, const file_info_t &file_info) {
 // hard drive operations
 /*****************************************************************************/
 bool is_drive_provisioned(config_context_t cfg_ctx) {
-  (void)cfg_ctx;
-
-  // TODO check if a hard drive is provisioned or not
+  int ssd_fd = open(cfg_ctx.drive_full_path, O_RDONLY);
+  if (ssd_fd == -1) {
+    LOG(ERR, "Error opening SSD");
+    return false;
+  }
+  storage_format_t format;
+  bool provisioned = format_read(ssd_fd, &format) == 0;
+  close(ssd_fd);
+  return provisioned;
+}
 
-  return true;
+/** @brief gives a blank drive its format block, 0 if the layout is ours */
+static int format_provision(int ssd_fd) {
+  storage_format_t format;
+  int rc = format_read(ssd_fd, &format);
+  if (rc == 1) {
+    return format_write(ssd_fd, 0);
+  }
+  return rc;
 }
 
 int drive_provision(config_context_t cfg_ctx) {
-  (void)cfg_ctx;
-  // TODO this should provision the first N bytes of the drive with some
-  // information. there should always be a check for some magic numbers to
-  // ensure the drive we are working with is indeed the right one and produce
-  // some sort of warning/error on failure
-
-  int rc = 0;
-
-  // check if provisioned already
-  // is_provisioned = is_drive_provisioned(cfg_ctx);
-  // if (is_provisioned) {
-  //   LOG(INFO, "Drive %s is already provisioned for dist-fs",
-  //              cfg_ctx.drive_full_path);
-  //   return -1;
-  // }
-
-  return rc;
+  int ssd_fd = open(cfg_ctx.drive_full_path, O_RDWR);
+  if (ssd_fd == -1) {
+    LOG(ERR, "Error opening SSD");
+    return 1;
+  }
+  int rc = format_provision(ssd_fd);
+  close(ssd_fd);
+  if (rc == 0) {
+    LOG(INFO,
+        "Drive %s holds dist-fs layout version %u",
+        cfg_ctx.drive_full_path,
+        STORAGE_FORMAT_VERSION);
+  }
+  return rc ? 1 : 0;
 }
 
 int drive_info(config_context_t cfg_ctx) {
@@ -358,14 +558,28 @@ int drive_info(config_context_t cfg_ctx) {
   return rc;
 }
 
-int initialize_ssd(config_context_t cfg_ctx, int &ssd_fd, off_t &next_offset) {
+int initialize_ssd(config_context_t cfg_ctx,
+                   int &ssd_fd,
+                   off_t &next_offset,
+                   std::vector<storage_metadata_t> &md_table,
+                   std::vector<storage_chunk_t> &chunk_table) {
   ssd_fd = open(cfg_ctx.drive_full_path, O_RDWR);
   if (ssd_fd == -1) {
     LOG(ERR, "Error opening SSD");
     return 1;
   }
-  std::vector<storage_metadata_t> md_table = md_table_read(ssd_fd);
-  next_offset                              = md_table_find_offset(md_table);
+  // nothing is written to a drive holding another layout
+  if (format_provision(ssd_fd)) {
+    close(ssd_fd);
+    return 1;
+  }
+  chunk_table = chunk_table_read(ssd_fd);
+  if (chunk_table.empty()) {
+    close(ssd_fd);
+    return 1;
+  }
+  md_table    = md_table_read(ssd_fd);
+  next_offset = md_table_find_offset(md_table, chunk_table);
   LOG(INFO, "Next free offset: 0x%08lX/%d", next_offset, next_offset);
   return 0;
 }
@@ -373,49 +587,585 @@ int initialize_ssd(config_context_t cfg_ctx, int &ssd_fd, off_t &next_offset) {
 
 // file operations
 /*****************************************************************************/
+storage_codec_e storage_codec_for_type(dist_fs_file_types_e type) {
+  switch (type) {
+    case DIST_FS_TYPE_WAV:
+    case DIST_FS_TYPE_AIFF:
+      return STORAGE_CODEC_AUDIO;
+    // already compressed, another pass only costs CPU
+    case DIST_FS_TYPE_FLAC:
+    case DIST_FS_TYPE_MP3:
+    case DIST_FS_TYPE_M4A:
+    case DIST_FS_TYPE_OGG:
+    case DIST_FS_TYPE_AAC:
+    case DIST_FS_TYPE_MP4:
+    case DIST_FS_TYPE_PNG:
+    case DIST_FS_TYPE_JPEG:
+    case DIST_FS_TYPE_GIF:
+    case DIST_FS_TYPE_WEBP:
+    case DIST_FS_TYPE_ZIP:
+    case DIST_FS_TYPE_GZIP:
+    case DIST_FS_TYPE_BZIP2:
+    case DIST_FS_TYPE_XZ:
+    case DIST_FS_TYPE_ZSTD:
+    case DIST_FS_TYPE_7Z:
+      return STORAGE_CODEC_STORE;
+    default:
+      return STORAGE_CODEC_LZ;
+  }
+}
+
+/**
+ * @brief maps a local file read only. the pages come from the page cache
+ * as they're read, so a file of any size costs no memory of its own
+ * @param data Set to the mapping, nullptr for an empty file. release it
+ * with munmap()
+ */
+static int map_local_file(const char *filename,
+                          const uint8_t **data,
+                          struct stat &file_stat) {
+  int file_fd = open(filename, O_RDONLY);
+  if (file_fd == -1) {
+    LOG(ERR, "Error opening file: %s", filename);
+    return -1;
+  }
+
+  if (fstat(file_fd, &file_stat) == -1) {
+    close(file_fd);
+    return -1;
+  }
+
+  *data       = nullptr;
+  size_t size = (size_t)file_stat.st_size;
+  if (size > 0) {
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_fd, 0);
+    if (map == MAP_FAILED) {
+      LOG(ERR, "Error mapping file: %s", filename);
+      close(file_fd);
+      return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    *data = static_cast<const uint8_t *>(map);
+  }
+
+  close(file_fd);
+  return 0;
+}
+
+/**
+ * @brief the sample layout of the part of a PCM WAV file that starts at
+ * offset, trimmed to whole frames
+ * @return Returns the layout relative to the start of the part, nullptr if
+ * the part holds no complete frame
+ */
+static const bytecrush_audio_format_t *
+file_audio_layout(const file_info_t &file_info,
+                  uint64_t offset,
+                  size_t size,
+                  bytecrush_audio_format_t *audio) {
+  const wav_format_t &wav = file_info.wav;
+  if (file_info.type != DIST_FS_TYPE_WAV ||
+      wav.audio_format != DIST_FS_WAV_PCM || wav.block_align == 0) {
+    return nullptr;
+  }
+
+  // frames are counted from the start of the samples, not of the part
+  uint64_t start = std::max<uint64_t>(wav.data_offset, offset);
+  uint64_t skew  = (start - wav.data_offset) % wav.block_align;
+  if (skew) {
+    start += wav.block_align - skew;
+  }
+  uint64_t end = std::min<uint64_t>(wav.data_offset + wav.data_size,
+                                    offset + size);
+  if (end <= start || end - start < wav.block_align) {
+    return nullptr;
+  }
+
+  audio->channels        = wav.num_channels;
+  audio->bits_per_sample = wav.bits_per_sample;
+  audio->data_offset     = start - offset;
+  audio->data_size       = (end - start) - (end - start) % wav.block_align;
+  return audio;
+}
+
+/**
+ * @brief encodes part of a file with the codec picked for its type
+ * @param offset Where the part starts in the file
+ * @return Returns the codec actually used, STORAGE_CODEC_STORE when encoding
+ * doesn't make the part smaller
+ */
+static storage_codec_e encode_file_data(const file_info_t &file_info,
+                                        storage_codec_e codec,
+                                        const uint8_t *data,
+                                        size_t size,
+                                        uint64_t offset,
+                                        std::vector<uint8_t> &encoded) {
+  if (codec == STORAGE_CODEC_STORE || size == 0) {
+    return STORAGE_CODEC_STORE;
+  }
+
+  // the audio coder needs the sample layout, which is only known for PCM
+  // WAV files. anything else still gets the LZ77 blocks of the same stream
+  bytecrush_audio_format_t audio         = {};
+  const bytecrush_audio_format_t *layout = nullptr;
+  if (codec == STORAGE_CODEC_AUDIO) {
+    layout = file_audio_layout(file_info, offset, size, &audio);
+  }
+
+  encoded.resize(bytecrush_compress_bound(size));
+  size_t encoded_size = encoded.size();
+  if (bytecrush_compress_parallel(data,
+                                  size,
+                                  layout,
+                                  encoded.data(),
+                                  &encoded_size,
+                                  BYTECRUSH_LEVEL_DEFAULT,
+                                  BYTECRUSH_THREADS_AUTO) != 0 ||
+      encoded_size >= size) {
+    return STORAGE_CODEC_STORE;
+  }
+  encoded.resize(encoded_size);
+  return codec;
+}
+
+/** @brief writes a buffer to the SSD at the given offset */
+static int write_file_data(int ssd_fd,
+                           off_t offset,
+                           const uint8_t *data,
+                           size_t size) {
+  LOG(DBG, "Writing %zu bytes to SSD at offset: 0x%08lX", size, offset);
+  uint64_t start = metrics_now_ns();
+  size_t total   = 0;
+  while (total < size) {
+    ssize_t written =
+      pwrite(ssd_fd, data + total, size - total, offset + total);
+    if (written <= 0) {
+      LOG(ERR, "Failed to write file data");
+      metrics_op(METRICS_DEVICE_WRITE, start, total, false);
+      return 1;
+    }
+    total += written;
+  }
+  metrics_op(METRICS_DEVICE_WRITE, start, total, true);
+  return 0;
+}
+
+/** @brief reads a buffer from the SSD at the given offset */
+static int read_file_data(int ssd_fd,
+                          off_t offset,
+                          uint8_t *data,
+                          size_t size) {
+  uint64_t start = metrics_now_ns();
+  size_t total   = 0;
+  while (total < size) {
+    ssize_t bytes_read =
+      pread(ssd_fd, data + total, size - total, offset + total);
+    if (bytes_read <= 0) {
+      LOG(ERR, "Failed to read from SSD at offset %ld", offset + total);
+      metrics_op(METRICS_DEVICE_READ, start, total, false);
+      return 1;
+    }
+    total += bytes_read;
+  }
+  metrics_op(METRICS_DEVICE_READ, start, total, true);
+  return 0;
+}
+
+int chunk_list_read(int ssd_fd,
+                    const storage_metadata_t &entry,
+                    std::vector<uint32_t> &chunk_list) {
+  if (entry.stored_size != entry.chunks * sizeof(uint32_t)) {
+    LOG(ERR, "Chunk list of file '%s' has the wrong size", entry.filename);
+    return 1;
+  }
+  chunk_list.resize(entry.chunks);
+  return read_file_data(ssd_fd,
+                        entry.start_offset + PACKET_METADATA_SIZE,
+                        reinterpret_cast<uint8_t *>(chunk_list.data()),
+                        entry.stored_size);
+}
+
+/**
+ * @brief writes back the chunk table entries of a chunk list after their
+ * references changed. this happens before the file's metadata entry is
+ * written, so an upload that fails from here on leaks references instead
+ * of leaving a file pointing at chunks that may be erased
+ */
+static int write_chunk_refs(int ssd_fd,
+                            const std::vector<storage_chunk_t> &chunk_table,
+                            const std::vector<uint32_t> &chunk_list) {
+  std::vector<uint32_t> touched(chunk_list);
+  std::sort(touched.begin(), touched.end());
+  touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+  for (uint32_t slot : touched) {
+    if (!chunk_table_write(ssd_fd, chunk_table[slot], slot)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/** @brief a file on the SSD with the given contents, nullptr if none */
+static const storage_metadata_t *
+find_identical_file(const std::vector<storage_metadata_t> &md_table,
+                    const uint8_t *hash,
+                    size_t size) {
+  for (const storage_metadata_t &entry : md_table) {
+    // only chunked files can be shared, their data is reference counted
+    if (entry.chunks && entry.size == size &&
+        memcmp(entry.hash, hash, BLAKE3_OUT_LEN) == 0) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+/** @brief a chunk of the file being uploaded */
+typedef struct {
+  uint64_t offset;  // where the chunk starts in the file
+  size_t size;      // chunk size in bytes
+  std::string hash; // BLAKE3 of the chunk
+} upload_chunk_t;
+
+/** @brief marks a fingerprint of a chunk that isn't on the SSD yet */
+#define CHUNK_SLOT_NEW UINT32_MAX
+
+/**
+ * @brief splits a file into content defined chunks and writes the ones the
+ * SSD doesn't hold yet from next_offset on. chunks already on the SSD only
+ * gain a reference
+ * @param chunk_list Filled in with the chunk table slot of every chunk, in
+ * file order
+ * @return Returns 0 on success, 1 if the chunk table has no room for the
+ * file's new chunks, -1 on write errors
+ */
+static int store_file_chunks(int ssd_fd,
+                             const file_info_t &file_info,
+                             storage_codec_e codec,
+                             const uint8_t *data,
+                             size_t size,
+                             std::vector<storage_chunk_t> &chunk_table,
+                             off_t &next_offset,
+                             std::vector<uint32_t> &chunk_list) {
+  // fingerprint index of the chunks on the SSD, and the free slots with the
+  // lowest one last
+  std::unordered_map<std::string, uint32_t> fingerprints;
+  std::vector<uint32_t> free_slots;
+  for (uint32_t i = (uint32_t)chunk_table.size(); i-- > 0;) {
+    const storage_chunk_t &chunk = chunk_table[i];
+    if (chunk.offset != 0) {
+      fingerprints.emplace(
+        std::string(reinterpret_cast<const char *>(chunk.hash), BLAKE3_OUT_LEN),
+        i);
+    } else {
+      free_slots.push_back(i);
+    }
+  }
+
+  // cut and fingerprint the whole file before writing anything, so a file
+  // that doesn't fit leaves the SSD as it was
+  std::vector<upload_chunk_t> chunks;
+  size_t new_chunks = 0;
+  size_t new_bytes  = 0;
+  for (size_t pos = 0; pos < size;) {
+    upload_chunk_t chunk;
+    chunk.offset = pos;
+    chunk.size   = fastcdc_next_chunk(data + pos, size - pos);
+
+    uint8_t hash[BLAKE3_OUT_LEN];
+    blake3_hash(data + pos, chunk.size, hash);
+    chunk.hash.assign(reinterpret_cast<const char *>(hash), BLAKE3_OUT_LEN);
+
+    // repeats within the file are only counted once
+    if (fingerprints.emplace(chunk.hash, CHUNK_SLOT_NEW).second) {
+      new_chunks++;
+      new_bytes += chunk.size;
+    }
+    pos += chunk.size;
+    chunks.push_back(chunk);
+  }
+
+  LOG(INFO,
+      "%zu chunks, %zu new (%zu of %zu bytes)",
+      chunks.size(),
+      new_chunks,
+      new_bytes,
+      size);
+  metrics_add(METRICS_CHUNK_HITS, chunks.size() - new_chunks);
+  metrics_add(METRICS_CHUNK_MISSES, new_chunks);
+  if (new_chunks > free_slots.size()) {
+    LOG(WARN,
+        "Chunk table is full: %zu new chunks, %zu free slots",
+        new_chunks,
+        free_slots.size());
+    return 1;
+  }
+
+  std::vector<uint8_t> encoded;
+  chunk_list.clear();
+  for (const upload_chunk_t &chunk : chunks) {
+    uint32_t &slot = fingerprints[chunk.hash];
+    if (slot == CHUNK_SLOT_NEW) {
+      const uint8_t *raw = data + chunk.offset;
+      storage_codec_e chunk_codec =
+        encode_file_data(file_info,
+                         codec,
+                         raw,
+                         chunk.size,
+                         chunk.offset,
+                         encoded);
+
+      bool stored_raw    = chunk_codec == STORAGE_CODEC_STORE;
+      size_t stored_size = stored_raw ? chunk.size : encoded.size();
+      if (write_file_data(ssd_fd,
+                          next_offset,
+                          stored_raw ? raw : encoded.data(),
+                          stored_size)) {
+        return -1;
+      }
+
+      slot = free_slots.back();
+      free_slots.pop_back();
+      storage_chunk_t &entry = chunk_table[slot];
+      memcpy(entry.hash, chunk.hash.data(), BLAKE3_OUT_LEN);
+      entry.offset      = next_offset;
+      entry.size        = (uint32_t)chunk.size;
+      entry.stored_size = (uint32_t)stored_size;
+      entry.refs        = 0;
+      entry.codec       = chunk_codec;
+      next_offset += stored_size;
+    }
+    chunk_table[slot].refs++;
+    chunk_list.push_back(slot);
+  }
+
+  return write_chunk_refs(ssd_fd, chunk_table, chunk_list);
+}
+
+/**
+ * @brief references the chunks of a file with the same contents that's
+ * already on the SSD, so nothing but the chunk list has to be written
+ * @return Returns 0 on success, -1 on errors
+ */
+static int reference_file_chunks(int ssd_fd,
+                                 const storage_metadata_t &original,
+                                 std::vector<storage_chunk_t> &chunk_table,
+                                 std::vector<uint32_t> &chunk_list) {
+  if (chunk_list_read(ssd_fd, original, chunk_list)) {
+    return -1;
+  }
+  for (uint32_t slot : chunk_list) {
+    if (slot >= chunk_table.size() || chunk_table[slot].offset == 0) {
+      LOG(ERR, "File '%s' references a bad chunk %u", original.filename, slot);
+      return -1;
+    }
+    chunk_table[slot].refs++;
+  }
+  return write_chunk_refs(ssd_fd, chunk_table, chunk_list);
+}
+
+/** @brief input encoded at a time when a whole file goes in one extent */
+#define EXTENT_ENCODE_WINDOW (64 * BYTECRUSH_BLOCK_SIZE)
+
+/**
+ * @brief writes a whole file to one extent at offset, encoded with the codec
+ * picked for its type. the file is encoded a window at a time and each
+ * window's blocks are written behind a single stream header, which decodes
+ * like one stream since blocks never reference each other. only one
+ * window's output is held in memory
+ * @param codec The codec to try, set to STORAGE_CODEC_STORE if encoding
+ * doesn't make the file smaller and the raw file was written instead
+ * @param stored_size Set to the bytes written
+ * @return Returns 0 on success, 1 on write errors
+ */
+static int write_file_extent(int ssd_fd,
+                             off_t offset,
+                             const file_info_t &file_info,
+                             storage_codec_e *codec,
+                             const uint8_t *data,
+                             size_t size,
+                             size_t *stored_size) {
+  uint8_t header[BYTECRUSH_STREAM_HEADER_SZ];
+  std::vector<uint8_t> encoded;
+  size_t total = sizeof(header);
+  bool packed  = *codec != STORAGE_CODEC_STORE && size > 0;
+
+  // stops as soon as the stream is no smaller than the file
+  for (size_t pos = 0; packed && pos < size; pos += EXTENT_ENCODE_WINDOW) {
+    size_t window = std::min<size_t>(size - pos, EXTENT_ENCODE_WINDOW);
+    bytecrush_audio_format_t audio         = {};
+    const bytecrush_audio_format_t *layout = nullptr;
+    if (*codec == STORAGE_CODEC_AUDIO) {
+      layout = file_audio_layout(file_info, pos, window, &audio);
+    }
+
+    encoded.resize(bytecrush_compress_bound(window));
+    size_t encoded_size = encoded.size();
+    if (bytecrush_compress_parallel(data + pos,
+                                    window,
+                                    layout,
+                                    encoded.data(),
+                                    &encoded_size,
+                                    BYTECRUSH_LEVEL_DEFAULT,
+                                    BYTECRUSH_THREADS_AUTO) != 0) {
+      packed = false;
+      break;
+    }
+    if (pos == 0) {
+      memcpy(header, encoded.data(), sizeof(header));
+    }
+
+    size_t blocks = encoded_size - sizeof(header);
+    if (total + blocks >= size) {
+      packed = false;
+      break;
+    }
+    if (write_file_data(
+          ssd_fd, offset + total, encoded.data() + sizeof(header), blocks)) {
+      return 1;
+    }
+    total += blocks;
+  }
+
+  if (!packed) {
+    *codec       = STORAGE_CODEC_STORE;
+    *stored_size = size;
+    return write_file_data(ssd_fd, offset, data, size);
+  }
+
+  // the header is the first window's, with the size of the whole file
+  uint64_t raw_size = htole64(size);
+  memcpy(header + 4, &raw_size, sizeof(raw_size));
+  *stored_size = total;
+  return write_file_data(ssd_fd, offset, header, sizeof(header));
+}
+
 int transfer_file_data(int file_fd, int ssd_fd, off_t offset) {
   LOG(INFO, "Writing file data to SSD at offset: 0x%08lX", offset);
 
   // 4kb buffer
   char buffer[4096];
-  ssize_t bytes_read, bytes_written, total_bytes_written;
+  ssize_t bytes_read, bytes_written;
+  uint64_t total_bytes_written = 0;
 
   lseek(ssd_fd, offset, SEEK_SET);
 
-  auto start_time = std::chrono::high_resolution_clock::now();
+  // the throughput goes to the device_write metrics, not the log
+  uint64_t start = metrics_now_ns();
 
   while ((bytes_read = read(file_fd, buffer, sizeof(buffer))) > 0) {
     bytes_written = write(ssd_fd, buffer, bytes_read);
     if (bytes_written != bytes_read) {
       LOG(ERR, "Failed to write file data");
+      metrics_op(METRICS_DEVICE_WRITE, start, total_bytes_written, false);
       return 1;
     }
     total_bytes_written += bytes_written;
   }
-  auto end_time = std::chrono::high_resolution_clock::now();
-  std::chrono::duration<double> duration = end_time - start_time;
 
   if (bytes_read == -1) {
     LOG(ERR, "Error reading file");
+    metrics_op(METRICS_DEVICE_WRITE, start, total_bytes_written, false);
     return 1;
   }
 
-  // upload speed (bytes per second)
-  double upload_speed =
-    static_cast<double>(total_bytes_written) / duration.count();
-  LOG(INFO, "Total bytes written: %ld", total_bytes_written);
-  LOG(INFO, "Upload time: %.2f seconds", duration.count());
-  LOG(INFO,
-      "Upload speed: %.2f kbps | %.2f mbps",
-      upload_speed / 1024,
-      upload_speed / 1024 / 1024);
-
+  metrics_op(METRICS_DEVICE_WRITE, start, total_bytes_written, true);
   return 0;
 }
 
-/*TODO: I suspect some heavy optimizations will need to be done here */
+/* index kept in step with uploads and deletes, set before any are made */
+static md_index_t *storage_index = nullptr;
+/* table stamp the index matches, valid once the index has been built */
+static uint64_t storage_index_stamp = 0;
+static bool storage_index_built     = false;
+static pthread_mutex_t storage_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief reads the table stamp, 0 on a drive that was never written */
+static int table_stamp_read(int ssd_fd, uint64_t *stamp) {
+  storage_format_t format;
+  int rc = format_read(ssd_fd, &format);
+  *stamp = format.stamp;
+  return rc < 0 ? -1 : 0;
+}
+
+/**
+ * @brief records a change this process made to the metadata table. the
+ * stamp is bumped for other processes and the change is applied to the
+ * attached index, which stays current unless another process changed the
+ * table since it was built
+ * @param added Entry written for an upload, or nullptr
+ * @param removed Name of a deleted file, or nullptr
+ */
+static void table_changed(int ssd_fd,
+                          const storage_metadata_t *added,
+                          const char *removed) {
+  pthread_mutex_lock(&storage_index_lock);
+  uint64_t stamp = 0;
+  bool current   = table_stamp_read(ssd_fd, &stamp) == 0 &&
+                   storage_index_built && stamp == storage_index_stamp;
+  format_write(ssd_fd, ++stamp);
+
+  if (storage_index) {
+    if (added) {
+      md_index_insert(storage_index, *added);
+    } else {
+      md_index_remove(storage_index, removed);
+    }
+    metrics_set(METRICS_FILES, (int64_t)md_index_count(storage_index));
+    if (current) {
+      storage_index_stamp = stamp;
+    }
+  }
+  pthread_mutex_unlock(&storage_index_lock);
+}
+
+void storage_set_index(md_index_t *index) {
+  pthread_mutex_lock(&storage_index_lock);
+  storage_index       = index;
+  storage_index_built = false;
+  metrics_set(METRICS_FILES, 0);
+  pthread_mutex_unlock(&storage_index_lock);
+}
+
+int storage_refresh_index(int ssd_fd) {
+  // the stamp is read before the table, so a change made in between only
+  // costs another rebuild
+  uint64_t stamp = 0;
+  if (table_stamp_read(ssd_fd, &stamp)) {
+    return -1;
+  }
+
+  int rc = 0;
+  pthread_mutex_lock(&storage_index_lock);
+  if (storage_index &&
+      (!storage_index_built || stamp != storage_index_stamp)) {
+    // another process's changes are logged, so sync clients get a delta
+    if (storage_index_built) {
+      md_index_update(storage_index, md_table_read(ssd_fd));
+    } else {
+      md_index_build(storage_index, md_table_read(ssd_fd));
+    }
+    storage_index_stamp = stamp;
+    storage_index_built = true;
+    metrics_set(METRICS_FILES, (int64_t)md_index_count(storage_index));
+    rc = 1;
+  }
+  pthread_mutex_unlock(&storage_index_lock);
+  return rc;
+}
+
 int upload_file(config_context_t cfg_ctx, const char *filename) {
-  LOG(INFO, "Uploading file: %s", filename);
+  return upload_file_as(cfg_ctx, filename, filename);
+}
+
+/*TODO: I suspect some heavy optimizations will need to be done here */
+/** @brief stores the mapped contents of a local file on the SSD */
+static int store_file_data(config_context_t cfg_ctx,
+                           const char *filename,
+                           const char *stored_name,
+                           const uint8_t *data,
+                           size_t size,
+                           struct stat &file_stat) {
   int rc = 0;
 
   // create some struct for file information here
@@ -446,64 +1196,333 @@ int upload_file(config_context_t cfg_ctx, const char *filename) {
             └── steinway_piano_part2.wav    child node
   */
 
-  // get file info. for now this is only available for audio files
-  rc = get_file_info(file_info, filename);
-  if (rc != 0) {
+  // get file info from the mapped data, so identifying it costs no extra
+  // I/O. anything without a known signature is stored as a blob
+  rc = get_buffer_info(file_info, filename, file_stat, data, size);
+  if (rc != 0 && rc != DIST_FS_TYPE_UNKNOWN) {
     LOG(ERR, "Failed to retrieve file info for: %s", filename);
     return 1;
   }
 
-
-  // open SSD + read from the metadata table to get the next available
+  // play time and tags go in the metadata entry, so listings never have to
+  // read the file back
+  audio_info_t audio;
+  audio_info_parse(file_info.type, data, size, size, &audio);
+  storage_codec_e codec =
+    size == 0 ? STORAGE_CODEC_STORE : storage_codec_for_type(file_info.type);
+
+  // the hash identifies files that are already on the SSD, and lets
+  // downloads check what they hand out. it has to be known before the first
+  // chunk is written, or a duplicate would be copied before it was found,
+  // so it is a pass of its own over the mapping rather than part of the
+  // write loop. the pass reads the mapping rather than the file, so the
+  // pages it faults in are the ones the writes use, and spreads over cores
+  uint8_t hash[BLAKE3_OUT_LEN];
+  blake3_hash_parallel(data, size, hash, BLAKE3_THREADS_AUTO);
+
+  // open SSD + read the metadata and chunk tables to get the next available
   // offset in the FS
   int ssd_fd;
   off_t next_offset;
-  if (initialize_ssd(cfg_ctx, ssd_fd, next_offset)) {
+  std::vector<storage_metadata_t> md_vector;
+  std::vector<storage_chunk_t> chunk_table;
+  if (initialize_ssd(cfg_ctx, ssd_fd, next_offset, md_vector, chunk_table)) {
     return 1;
   }
-  file_info.offset = next_offset;
 
-  // read from the metadata table to get the next available offset in the FS
-  if (write_fs_header(ssd_fd, next_offset, file_info)) {
+  // only chunks the SSD doesn't have yet are written, and the file's extent
+  // holds the list of them. when the chunk table is full the extent holds
+  // the whole encoded file instead
+  std::vector<uint32_t> chunk_list;
+  size_t stored_size = 0;
+
+  const storage_metadata_t *original =
+    find_identical_file(md_vector, hash, size);
+  if (original) {
+    LOG(INFO,
+        "%s has the same contents as %s, sharing its chunks",
+        filename,
+        original->filename);
+    metrics_add(METRICS_FILE_HITS, 1);
+    codec = static_cast<storage_codec_e>(original->codec);
+    rc    = reference_file_chunks(ssd_fd, *original, chunk_table, chunk_list);
+  } else {
+    rc = store_file_chunks(ssd_fd,
+                           file_info,
+                           codec,
+                           data,
+                           size,
+                           chunk_table,
+                           next_offset,
+                           chunk_list);
+  }
+  if (rc < 0) {
     close(ssd_fd);
     return 1;
   }
 
-  // open the file for upload
-  int file_fd = open(filename, O_RDONLY);
-  if (file_fd == -1) {
-    LOG(ERR, "Error opening file: %s", filename);
+  file_info.offset = next_offset;
+  if (write_fs_header(ssd_fd, next_offset, file_info)) {
     close(ssd_fd);
     return 1;
   }
 
-  if (transfer_file_data(file_fd,
-                         ssd_fd,
-                         next_offset + sizeof(uint32_t) + sizeof(file_info))) {
-    close(file_fd);
+  off_t data_offset = next_offset + sizeof(uint32_t) + sizeof(file_info);
+  if (rc == 0) {
+    const uint8_t *list = reinterpret_cast<const uint8_t *>(chunk_list.data());
+    stored_size         = chunk_list.size() * sizeof(uint32_t);
+    rc = write_file_data(ssd_fd, data_offset, list, stored_size);
+  } else {
+    rc = write_file_extent(
+      ssd_fd, data_offset, file_info, &codec, data, size, &stored_size);
+  }
+  if (rc) {
     close(ssd_fd);
     return 1;
   }
+  LOG(INFO,
+      "Stored %s with codec %d in %zu chunks: %lu -> %zu bytes",
+      filename,
+      codec,
+      chunk_list.size(),
+      file_info.size,
+      stored_size);
 
-  storage_metadata_t md_table;
-  strncpy(md_table.filename, filename, sizeof(md_table.filename) - 1);
+  storage_metadata_t md_table = {};
+  strncpy(md_table.filename, stored_name, sizeof(md_table.filename) - 1);
+  md_table.codec       = codec;
+  md_table.type        = file_info.type;
+  md_table.stored_size = stored_size;
+  md_table.chunks      = (uint32_t)chunk_list.size();
+  md_table.audio       = audio;
+  memcpy(md_table.hash, hash, BLAKE3_OUT_LEN);
 
   // update the metadata table with a new entry
-  if (update_md_table(&md_table, file_info, ssd_fd)) {
-    close(file_fd);
+  if (update_md_table(&md_table, file_info, ssd_fd, filename)) {
     close(ssd_fd);
     return 1;
   }
+  table_changed(ssd_fd, &md_table, nullptr);
 
-  // close both file descriptors
-  close(file_fd);
   close(ssd_fd);
+  return 0;
+}
+
+/**
+ * @brief stores a local file on the SSD, upload_file_as() times it
+ * @param size Set to the file's size once it's mapped
+ */
+static int store_file(config_context_t cfg_ctx,
+                      const char *filename,
+                      const char *stored_name,
+                      size_t *size) {
+  LOG(INFO, "Uploading file: %s as %s", filename, stored_name);
+
+  // the whole file is needed to cut it into chunks. it's mapped rather than
+  // read so the upload holds no copy of it
+  const uint8_t *data = nullptr;
+  struct stat file_stat;
+  if (map_local_file(filename, &data, file_stat)) {
+    return 1;
+  }
+  *size = (size_t)file_stat.st_size;
+
+  int rc =
+    store_file_data(cfg_ctx, filename, stored_name, data, *size, file_stat);
+  if (data) {
+    munmap(const_cast<uint8_t *>(data), *size);
+  }
+  return rc;
+}
+
+int upload_file_as(config_context_t cfg_ctx,
+                   const char *filename,
+                   const char *stored_name) {
+  uint64_t start = metrics_now_ns();
+  size_t size    = 0;
+  int rc         = store_file(cfg_ctx, filename, stored_name, &size);
+  metrics_op(METRICS_UPLOAD, start, size, rc == 0);
+  return rc;
+}
+
+int storage_find_file(config_context_t cfg_ctx,
+                      const char *filename,
+                      storage_metadata_t *entry) {
+  int ssd_fd = open(cfg_ctx.drive_full_path, O_RDONLY);
+  if (ssd_fd < 0) {
+    LOG(ERR, "Failed to open SSD device: %s", cfg_ctx.drive_full_path);
+    return -1;
+  }
+
+  std::vector<storage_metadata_t> md_table = md_table_read(ssd_fd);
+  close(ssd_fd);
+
+  auto it = std::find_if(md_table.begin(),
+                         md_table.end(),
+                         [filename](const storage_metadata_t &md_entry) {
+                           return strcmp(md_entry.filename, filename) == 0;
+                         });
 
+  if (it == md_table.end()) {
+    LOG(ERR, "File '%s' not found on SSD.", filename);
+    return -1;
+  }
+
+  *entry = *it;
   return 0;
 }
 
-int download_file(config_context_t cfg_ctx, const char *filename) {
-  LOG(INFO, "Downloading file: %s", filename);
+int chunk_read(int ssd_fd,
+               const storage_chunk_t &chunk,
+               std::vector<uint8_t> &data) {
+  if (chunk.offset == 0 || chunk.size > FASTCDC_MAX_SIZE ||
+      chunk.stored_size > bytecrush_compress_bound(chunk.size)) {
+    LOG(ERR, "Bad chunk table entry at offset 0x%08lX", chunk.offset);
+    return -1;
+  }
+
+  if (chunk.codec == STORAGE_CODEC_STORE) {
+    data.resize(chunk.stored_size);
+    if (read_file_data(ssd_fd, chunk.offset, data.data(), data.size())) {
+      return -1;
+    }
+    return 0;
+  }
+
+  std::vector<uint8_t> stored(chunk.stored_size);
+  if (read_file_data(ssd_fd, chunk.offset, stored.data(), stored.size())) {
+    return -1;
+  }
+  data.resize(chunk.size);
+  size_t raw_size = data.size();
+  if (bytecrush_decompress(stored.data(),
+                           stored.size(),
+                           data.data(),
+                           &raw_size) != 0 ||
+      raw_size != chunk.size) {
+    LOG(ERR, "Chunk at offset 0x%08lX doesn't decode", chunk.offset);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief streams a file stored as a chunk list. each chunk's table entry is
+ * read as it's needed and the chunk decoded whole, so only one chunk is
+ * ever held in memory
+ */
+static int stream_file_chunks(int ssd_fd,
+                              const storage_metadata_t &entry,
+                              storage_sink_t sink,
+                              void *arg) {
+  std::vector<uint32_t> chunk_list;
+  if (chunk_list_read(ssd_fd, entry, chunk_list)) {
+    return -1;
+  }
+
+  std::vector<uint8_t> data;
+  storage_chunk_t chunk;
+  for (uint32_t slot : chunk_list) {
+    if (slot >= MAX_CHUNKS || !chunk_table_read_entry(ssd_fd, slot, chunk) ||
+        chunk_read(ssd_fd, chunk, data) != 0) {
+      LOG(ERR, "File '%s' references a bad chunk %u", entry.filename, slot);
+      return -1;
+    }
+    if (sink(data.data(), data.size(), arg) != 0) {
+      LOG(ERR, "Failed to stream data for file '%s'", entry.filename);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/** @brief streams a file stored as one extent */
+static int stream_file_extent(int ssd_fd,
+                              const storage_metadata_t &entry,
+                              storage_sink_t sink,
+                              void *arg) {
+  off_t start_offset = entry.start_offset;
+  size_t stored_size = entry.stored_size;
+
+  // encoded files go through a decoder that hands the sink each block as
+  // soon as it's decoded, so only one block is ever held in memory
+  bytecrush_decoder_t *decoder = nullptr;
+  if (entry.codec != STORAGE_CODEC_STORE) {
+    decoder = bytecrush_decoder_create(sink, arg);
+    if (!decoder) {
+      return -1;
+    }
+  }
+
+  // read straight from the file's extent and hand each chunk on before
+  // reading the next one
+  std::vector<uint8_t> buffer(STORAGE_STREAM_CHUNK_SZ);
+  ssize_t bytes_read;
+  off_t file_offset =
+    start_offset + sizeof(DIST_FS_SSD_HEADER) + sizeof(file_info_t);
+  int rc = 0;
+
+  while (rc == 0 && stored_size > 0) {
+    size_t to_read = std::min(stored_size, buffer.size());
+    uint64_t start = metrics_now_ns();
+    bytes_read     = pread(ssd_fd, buffer.data(), to_read, file_offset);
+    metrics_op(METRICS_DEVICE_READ,
+               start,
+               bytes_read > 0 ? (uint64_t)bytes_read : 0,
+               bytes_read > 0);
+    if (bytes_read <= 0) {
+      LOG(ERR, "Failed to read from SSD at offset %ld", file_offset);
+      rc = -1;
+      break;
+    }
+
+    if (decoder) {
+      rc = bytecrush_decoder_feed(decoder, buffer.data(), bytes_read);
+    } else {
+      rc = sink(buffer.data(), bytes_read, arg);
+    }
+    if (rc != 0) {
+      LOG(ERR, "Failed to stream data for file '%s'", entry.filename);
+      rc = -1;
+    }
+    stored_size -= bytes_read;
+    file_offset += bytes_read;
+  }
+
+  if (rc == 0 && decoder && bytecrush_decoder_finish(decoder) != 0) {
+    LOG(ERR, "Encoded data for file '%s' is truncated", entry.filename);
+    rc = -1;
+  }
+
+  bytecrush_decoder_free(decoder);
+  return rc;
+}
+
+/** @brief sink that hashes the data before passing it on */
+typedef struct {
+  storage_sink_t sink;
+  void *arg;
+  blake3_hasher_t hasher;
+} hashing_sink_t;
+
+static int hashing_sink(const uint8_t *data, size_t size, void *arg) {
+  hashing_sink_t *check = static_cast<hashing_sink_t *>(arg);
+  blake3_hasher_update(&check->hasher, data, size);
+  return check->sink(data, size, check->arg);
+}
+
+/**
+ * @brief streams a file off the SSD, download_file_stream() times it and
+ * storage_stream_file() doesn't
+ * @param size Set to the file's size once it's found
+ */
+static int stream_file(config_context_t cfg_ctx,
+                       const char *filename,
+                       storage_sink_t sink,
+                       void *arg,
+                       size_t *size) {
+  LOG(INFO, "Streaming file: %s", filename);
 
   int ssd_fd = open(cfg_ctx.drive_full_path, O_RDONLY);
   if (ssd_fd < 0) {
@@ -530,46 +1549,148 @@ int download_file(config_context_t cfg_ctx, const char *filename) {
     return -1;
   }
 
-  off_t start_offset   = it->start_offset;
-  size_t file_size     = it->size;
+  *size = it->size;
+
+  // the data is hashed again on the way out, which catches corruption
+  // anywhere between the upload and the sink
+  hashing_sink_t check = {};
+  bool verify          = entry_has_hash(*it);
+  if (verify) {
+    check.sink = sink;
+    check.arg  = arg;
+    blake3_hasher_init(&check.hasher);
+    sink = hashing_sink;
+    arg  = &check;
+  }
+
+  int rc = it->chunks ? stream_file_chunks(ssd_fd, *it, sink, arg)
+                      : stream_file_extent(ssd_fd, *it, sink, arg);
+  if (rc == 0 && verify) {
+    uint8_t hash[BLAKE3_OUT_LEN];
+    blake3_hasher_finalize(&check.hasher, hash);
+    if (memcmp(hash, it->hash, BLAKE3_OUT_LEN) != 0) {
+      LOG(ERR, "File '%s' doesn't match its hash", filename);
+      rc = -1;
+    }
+  }
+
+  close(ssd_fd);
+  return rc;
+}
+
+int download_file_stream(config_context_t cfg_ctx,
+                         const char *filename,
+                         storage_sink_t sink,
+                         void *arg) {
+  uint64_t start = metrics_now_ns();
+  size_t size    = 0;
+  int rc         = stream_file(cfg_ctx, filename, sink, arg, &size);
+  metrics_op(METRICS_DOWNLOAD, start, size, rc == 0);
+  return rc;
+}
+
+int storage_stream_file(config_context_t cfg_ctx,
+                        const char *filename,
+                        storage_sink_t sink,
+                        void *arg) {
+  size_t size = 0;
+  return stream_file(cfg_ctx, filename, sink, arg, &size);
+}
+
+/** @brief download sink that appends to a local file */
+static int file_sink(const uint8_t *data, size_t size, void *arg) {
+  FILE *local_file = static_cast<FILE *>(arg);
+  return fwrite(data, 1, size, local_file) == size ? 0 : -1;
+}
+
+int download_file(config_context_t cfg_ctx, const char *filename) {
+  LOG(INFO, "Downloading file: %s", filename);
+
   const char *basename = strrchr(filename, '/');
   basename             = (basename) ? basename + 1 : filename;
 
   FILE *local_file = fopen(basename, "wb");
   if (!local_file) {
     LOG(ERR, "Failed to create local file: %s", basename);
-    close(ssd_fd);
     return -1;
   }
 
-  char buffer[4096];
-  ssize_t bytes_read;
-  off_t file_offset =
-    start_offset + sizeof(DIST_FS_SSD_HEADER) + sizeof(file_info_t);
+  int rc = download_file_stream(cfg_ctx, filename, file_sink, local_file);
+  fclose(local_file);
+  if (rc != 0) {
+    remove(basename);
+    return -1;
+  }
 
-  while (file_size > 0) {
-    size_t to_read = std::min(file_size, sizeof(buffer));
-    bytes_read     = pread(ssd_fd, buffer, to_read, file_offset);
-    if (bytes_read <= 0) {
-      LOG(ERR, "Failed to read from SSD at offset %ld", file_offset);
-      fclose(local_file);
-      close(ssd_fd);
-      return -1;
-    }
+  LOG(INFO, "File '%s' downloaded successfully", basename);
+  return 0;
+}
 
-    fwrite(buffer, 1, bytes_read, local_file);
-    file_size -= bytes_read;
-    file_offset += bytes_read;
+/**
+ * @brief drops a reference for every entry of a chunk list and erases the
+ * chunks no file references anymore
+ */
+static int release_chunks(int ssd_fd, const std::vector<uint32_t> &chunk_list) {
+  if (chunk_list.empty()) {
+    return 0;
   }
 
-  fclose(local_file);
-  close(ssd_fd);
+  // a slot the list names more than once loses a reference per entry, and
+  // only the named slots of the table are read and written
+  std::vector<uint32_t> slots(chunk_list);
+  std::sort(slots.begin(), slots.end());
+
+  size_t touched = 0;
+  size_t freed   = 0;
+  for (size_t i = 0; i < slots.size();) {
+    uint32_t slot = slots[i];
+    size_t drops  = 0;
+    for (; i < slots.size() && slots[i] == slot; i++) {
+      drops++;
+    }
 
-  LOG(INFO, "File '%s' downloaded successfully", basename);
+    storage_chunk_t chunk = {};
+    if (slot < MAX_CHUNKS && !chunk_table_read_entry(ssd_fd, slot, chunk)) {
+      return -1;
+    }
+    if (chunk.refs < drops) {
+      LOG(WARN, "Chunk %u is already free", slot);
+      if (chunk.refs == 0) {
+        continue;
+      }
+      drops = chunk.refs;
+    }
+    chunk.refs -= (uint32_t)drops;
+    touched++;
+
+    if (chunk.refs == 0) {
+      // zeroed like a deleted file's extent before the slot is freed
+      std::vector<uint8_t> reset_buffer(chunk.stored_size, 0);
+      if (write_file_data(ssd_fd,
+                          chunk.offset,
+                          reset_buffer.data(),
+                          reset_buffer.size())) {
+        return -1;
+      }
+      chunk = {};
+      freed++;
+    }
+    if (!chunk_table_write(ssd_fd, chunk, slot)) {
+      return -1;
+    }
+  }
+
+  LOG(INFO, "Released %zu chunks, %zu no longer used", touched, freed);
   return 0;
 }
 
-int delete_file(config_context_t cfg_ctx, const char *filename) {
+/**
+ * @brief erases a file and its metadata entry, delete_file() times it
+ * @param size Set to the file's size once it's found
+ */
+static int erase_file(config_context_t cfg_ctx,
+                      const char *filename,
+                      size_t *size) {
   LOG(INFO, "Deleting file: %s", filename);
   // open SSD
   int ssd_fd = open(cfg_ctx.drive_full_path, O_RDWR);
@@ -599,14 +1720,24 @@ int delete_file(config_context_t cfg_ctx, const char *filename) {
   }
 
   const storage_metadata_t &file_entry = md_table[file_index];
+  *size                                = file_entry.size;
   LOG(INFO,
       "Found file %s with offset 0x%x and size %u bytes",
       file_entry.filename,
       file_entry.start_offset,
       file_entry.size);
 
-  // delete file content by writing a 0'd out buffer
-  std::vector<unsigned char> reset_buffer(file_entry.size, 0);
+  // the chunk list goes with the extent, keep it to release the chunks
+  std::vector<uint32_t> chunk_list;
+  if (file_entry.chunks && chunk_list_read(ssd_fd, file_entry, chunk_list)) {
+    close(ssd_fd);
+    return -1;
+  }
+
+  // delete file content by writing a 0'd out buffer over the whole extent,
+  // the FS header and the encoded data or chunk list
+  size_t extent_size = PACKET_METADATA_SIZE + file_entry.stored_size;
+  std::vector<unsigned char> reset_buffer(extent_size, 0);
   if (lseek(ssd_fd, file_entry.start_offset, SEEK_SET) == -1) {
     LOG(ERR, "Failed to seek to file offset 0x%x", file_entry.start_offset);
     close(ssd_fd);
@@ -616,8 +1747,8 @@ int delete_file(config_context_t cfg_ctx, const char *filename) {
   LOG(INFO,
       "Deleting file by writing zeroes at offset 0x%x",
       file_entry.start_offset);
-  ssize_t written = write(ssd_fd, reset_buffer.data(), file_entry.size);
-  if (written != static_cast<ssize_t>(file_entry.size)) {
+  ssize_t written = write(ssd_fd, reset_buffer.data(), extent_size);
+  if (written != static_cast<ssize_t>(extent_size)) {
     LOG(ERR,
         "Failed to write zeroes to file at offset 0x%x",
         file_entry.start_offset);
@@ -625,8 +1756,8 @@ int delete_file(config_context_t cfg_ctx, const char *filename) {
     return -1;
   }
   LOG(INFO,
-      "Successfully erased %u bytes for file %s",
-      file_entry.size,
+      "Successfully erased %zu bytes for file %s",
+      extent_size,
       file_entry.filename);
 
   // remove the metadata entry
@@ -654,6 +1785,15 @@ int delete_file(config_context_t cfg_ctx, const char *filename) {
     close(ssd_fd);
     return -1;
   }
+  table_changed(ssd_fd, nullptr, filename);
+
+  // references are only dropped once no entry lists them, a delete that
+  // fails before this leaks chunks instead of erasing ones still in use
+  if (release_chunks(ssd_fd, chunk_list)) {
+    LOG(ERR, "Failed to release the chunks of file %s", filename);
+    close(ssd_fd);
+    return -1;
+  }
 
   LOG(INFO,
       "Successfully deleted file %s and updated metadata table",
@@ -663,6 +1803,14 @@ int delete_file(config_context_t cfg_ctx, const char *filename) {
   return 0;
 }
 
+int delete_file(config_context_t cfg_ctx, const char *filename) {
+  uint64_t start = metrics_now_ns();
+  size_t size    = 0;
+  int rc         = erase_file(cfg_ctx, filename, &size);
+  metrics_op(METRICS_DELETE, start, size, rc == 0);
+  return rc;
+}
+
 int list_files(config_context_t cfg_ctx) {
   LOG(INFO, "Listing all files on the drive");
 
@@ -682,6 +1830,44 @@ int list_files(config_context_t cfg_ctx) {
   return 0;
 }
 
+int search_files(config_context_t cfg_ctx, const char *text) {
+  LOG(INFO, "Searching for files named like {%s}", text);
+
+  int ssd_fd = open(cfg_ctx.drive_full_path, O_RDONLY);
+  if (ssd_fd == -1) {
+    LOG(ERR, "Error opening SSD");
+    return 1;
+  }
+  std::vector<storage_metadata_t> md_table = md_table_read(ssd_fd);
+  storage_refresh_index(ssd_fd);
+  close(ssd_fd);
+
+  // an attached index is brought up to date, otherwise one is built for the
+  // search
+  md_index_t local_index;
+  md_index_t *index = storage_index;
+  metrics_add(index ? METRICS_INDEX_HITS : METRICS_INDEX_MISSES, 1);
+  if (!index) {
+    if (md_index_init(&local_index)) {
+      return 1;
+    }
+    md_index_build(&local_index, md_table);
+    index = &local_index;
+  }
+
+  std::vector<storage_metadata_t> results;
+  uint64_t start = metrics_now_ns();
+  size_t total   = md_index_search(index, text, 0, results);
+  metrics_op(METRICS_MD_QUERY, start, 0, true);
+  if (index == &local_index) {
+    md_index_destroy(&local_index);
+  }
+
+  LOG(INFO, "Number of matches : %zu", total);
+  md_table_print(results);
+  return 0;
+}
+
 // SSD I/O functions
 /*****************************************************************************/
 int ssd_read(unsigned char *buffer, size_t size, off_t offset) {
@@ -8,9 +8,8 @@
 
 #include <cstdint>
 
-#include <libgen.h>
-
 #include "utils.hpp"
+#include "logger.hpp"
 
 
 std::string hex_to_ascii(const std::array<char, 16> &header) {
@@ -46,19 +45,6 @@ std::string hex_to_ascii(uint32_t hex_value) {
   return oss.str();
 }
 
-const char *log_to_str(log_level_e level) {
-  switch (level) {
-    case INFO:
-      return "INFO";
-    case WARN:
-      return "WARN";
-    case ERR:
-      return "ERRO";
-    default:
-      return "UNKNOWN";
-  }
-}
-
 void log(log_level_e level,
          const char *file,
          uint16_t line,
@@ -67,17 +53,7 @@ void log(log_level_e level,
          ...) {
   va_list args;
   va_start(args, msg);
-
-  const char *filename = basename(const_cast<char *>(file));
-
-  std::cout << "[" << log_to_str(level) << "] " << std::setw(40) << std::left
-            << (std::string(filename) + ":" + std::to_string(line) + " (" +
-                func + ")")
-            << " - ";
-
-  vfprintf(stdout, msg, args);
-  std::cout << std::endl;
-
+  logger_vlog(level, file, line, func, msg, args);
   va_end(args);
 }
 
@@ -11,6 +11,7 @@
 #include <vector>
 
 enum log_level_e {
+  DBG,
   INFO,
   WARN,
   ERR,
@@ -23,9 +24,70 @@ void log(log_level_e level,
          const char *msg,
          ...);
 
-/** @brief log level macro */
+/** @brief state of one rate limited call site */
+typedef struct {
+  uint64_t window;     // monotonic ms the current second started at
+  uint32_t count;      // lines let through in the current second
+  uint32_t suppressed; // lines held back since the last one let through
+} log_limit_t;
+
+/**
+ * @brief whether a rate limited call site may write another line
+ *
+ * @param[in]  limit       state of the call site
+ * @param[in]  per_second  lines let through each second
+ * @param[out] suppressed  lines held back before this one, if it may
+ *
+ * @return true if the line should be written
+ */
+bool log_limit(log_limit_t *limit, uint32_t per_second, uint32_t *suppressed);
+
+/** @brief lowest level built in. lines below it compile to nothing, their
+ * arguments aren't evaluated either. -DLOG_MIN_LEVEL=DBG builds in the per
+ * frame and per chunk diagnostics, -DLOG_MIN_LEVEL=WARN drops INFO too */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL INFO
+#endif
+constexpr log_level_e log_min_level = LOG_MIN_LEVEL;
+
+/** @brief log level macro, lines are written by the logger (logger.hpp) */
 #define LOG(level, msg, ...)                                                   \
-  log(level, __FILE__, __LINE__, __func__, msg, ##__VA_ARGS__)
+  do {                                                                         \
+    if constexpr ((level) >= log_min_level)                                    \
+      log(level, __FILE__, __LINE__, __func__, msg, ##__VA_ARGS__);            \
+  } while (0)
+
+/** @brief LOG() at most per_second times a second from this call site. the
+ * next line written says how many were held back */
+#define LOG_LIMIT(level, per_second, msg, ...)                                 \
+  do {                                                                         \
+    if constexpr ((level) >= log_min_level) {                                  \
+      static log_limit_t log_site_;                                            \
+      uint32_t log_held_;                                                      \
+      if (log_limit(&log_site_, per_second, &log_held_)) {                     \
+        if (log_held_)                                                         \
+          log(level,                                                           \
+              __FILE__,                                                        \
+              __LINE__,                                                        \
+              __func__,                                                        \
+              msg " (%u more held back)",                                      \
+              ##__VA_ARGS__,                                                   \
+              log_held_);                                                      \
+        else                                                                   \
+          log(level, __FILE__, __LINE__, __func__, msg, ##__VA_ARGS__);        \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+/** @brief LOG() the first of every n calls from this call site */
+#define LOG_EVERY_N(level, n, msg, ...)                                        \
+  do {                                                                         \
+    if constexpr ((level) >= log_min_level) {                                  \
+      static uint64_t log_calls_;                                              \
+      if (__atomic_fetch_add(&log_calls_, 1, __ATOMIC_RELAXED) % (n) == 0)     \
+        log(level, __FILE__, __LINE__, __func__, msg, ##__VA_ARGS__);          \
+    }                                                                          \
+  } while (0)
 
 
 std::string hex_to_ascii(const std::array<char, 16> &header);
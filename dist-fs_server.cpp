@@ -3,17 +3,51 @@
  */
 #include <iostream>
 #include <cstring>
+#include <string>
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <csignal>
 #include <chrono>
 
 #include "utils.hpp"
+#include "dist-fs/config.hpp"
+#include "dist-fs/logger.hpp"
+#include "dist-fs/metrics.hpp"
+#include "dist-fs/scrub.hpp"
+#include "dist-fs/storage.hpp"
+#include "dist-fs/md_index.hpp"
 #include "dist-fs/comms/comms.h"
 #include "dist-fs/comms/packet.h"
+#include "dist-fs/comms/comm_io.h"
+#include "dist-fs/comms/dispatch.h"
 
+/* set by SIGINT and SIGTERM, the main loop winds the server down */
+static volatile sig_atomic_t server_stopping = 0;
+
+static void server_stop(int) {
+  server_stopping = 1;
+}
 
 int main() {
+  const char *config_file     = "../host.conf";
+  config_context_t config_ctx = {};
+
+  int rc = parse_config(config_file, &config_ctx);
+  if (rc != 0) {
+    LOG(ERR,
+        "Error while parsing config file : {%s} errno : {%d}",
+        config_file,
+        rc);
+    return -1;
+  }
+
+  // from here on lines are queued and written by the logger's own thread,
+  // to the log in LogDirectory when one is configured
+  if (logger_start(&config_ctx, "dist-fs_server") != 0) {
+    LOG(WARN, "Continuing with synchronous logging");
+  }
+
   comm_context_t *comm_ctx = comm_init(COMMS_UART, "/dev/ttyTHS0", 4000000);
   if (!comm_ctx) {
     LOG(ERR, "Failed to initialize UART communication\n");
@@ -25,22 +59,120 @@ int main() {
   }
 
 
+  // the I/O thread owns the UART from here on and keeps draining it into the
+  // rx ring while this thread parses and handles frames
+  static comm_io_t comm_io;
+  if (comm_io_start(
+        &comm_io, comm_ctx, COMM_IO_RX_RING_SIZE, COMM_IO_TX_RING_SIZE) < 0) {
+    LOG(ERR, "Failed to start I/O thread\n");
+    return -1;
+  }
+
+  // each decoded request is handed straight to the dispatcher, which
+  // queues its responses back on the I/O thread
+  static dispatch_context_t dispatch;
+  dispatch_init(&dispatch, &comm_io, config_ctx);
+
+  // listings are cut from sorted views of the metadata table, which the
+  // storage driver keeps in step with every upload and delete, and rebuilds
+  // when the CLI changed the table
+  static md_index_t md_index;
+  int ssd_fd = open(config_ctx.drive_full_path, O_RDONLY);
+  if (ssd_fd != -1 && storage_format_check(ssd_fd)) {
+    // a drive of another layout is refused, not served as garbage entries
+    close(ssd_fd);
+    return -1;
+  }
+  if (ssd_fd != -1 && md_index_init(&md_index) == 0) {
+    storage_set_index(&md_index);
+    storage_refresh_index(ssd_fd);
+    dispatch.index = &md_index;
+  } else {
+    LOG(WARN, "Continuing without a metadata index, listings are unsorted");
+  }
+  if (ssd_fd != -1) {
+    close(ssd_fd);
+  }
+
+  // the scrubber re-reads the SSD in the background, throttled so requests
+  // still get most of the device
+  // passes are hours apart, so a scrubbing server stays up until it's
+  // signalled instead of exiting when idle
+  static scrub_context_t scrub;
+  bool scrubbing = false;
+  if (config_ctx.enable_scrub) {
+    scrub_init(
+      &scrub, config_ctx, config_ctx.scrub_share, config_ctx.scrub_interval);
+    if (scrub_start(&scrub) < 0) {
+      LOG(WARN, "Continuing without background scrub");
+    } else {
+      scrubbing = true;
+    }
+  }
+  signal(SIGINT, server_stop);
+  signal(SIGTERM, server_stop);
+
+  // frames are reassembled across reads, so the parser outlives the loop
+  static packet_parser_t parser;
+  packet_parser_init(&parser, dispatch_packet, &dispatch, false);
+
+  // the metrics are written next to the log once a second, in the format of
+  // node_exporter's textfile collector
+  std::string metrics_path;
+  if (config_ctx.log_directory) {
+    metrics_path =
+      std::string(config_ctx.log_directory) + "/dist-fs_server.prom";
+  }
+  auto metrics_time = std::chrono::steady_clock::now();
+
   // start the timer
   auto start_time = std::chrono::steady_clock::now();
 
-  while (true) {
-    decode_packet(comm_ctx);
+  while (!server_stopping) {
+    // restart the idle timer whenever a request comes in
+    if (comm_io_decode(&comm_io, &parser, 1000) > 0) {
+      start_time = std::chrono::steady_clock::now();
+    }
 
     auto current_time = std::chrono::steady_clock::now();
+    if (!metrics_path.empty() &&
+        current_time - metrics_time >= std::chrono::seconds(1)) {
+      metrics_write(metrics_path.c_str());
+      metrics_time = current_time;
+    }
+
     auto elapsed_time = std::chrono::duration_cast<std::chrono::seconds>(
                           current_time - start_time)
                           .count();
-    if (elapsed_time >= 10) {
-      LOG(INFO, "Timeout reached after 10 seconds");
+    if (!scrubbing && elapsed_time >= 10) {
+      LOG(INFO, "Timeout reached after 10 seconds idle");
       break; // Exit the loop
     }
   }
 
+  LOG(INFO,
+      "Parsed %lu frames, %lu resyncs, %lu bytes dropped",
+      parser.frames,
+      parser.resyncs,
+      parser.dropped_bytes);
+  LOG(INFO,
+      "Link rx %lu bytes on the wire for %lu raw, tx %lu for %lu raw",
+      parser.wire_bytes,
+      parser.raw_bytes,
+      comm_ctx->tx_wire_bytes,
+      comm_ctx->tx_raw_bytes);
+
+  scrub_stop(&scrub);
+  if (!metrics_path.empty()) {
+    metrics_write(metrics_path.c_str());
+  }
+  if (dispatch.index) {
+    storage_set_index(nullptr);
+    md_index_destroy(&md_index);
+  }
+  comm_io_stop(&comm_io);
+  logger_stop();
+  config_cleanup(&config_ctx);
 
   return 0;
 }
@@ -6,6 +6,11 @@
 #include <utility>
 
 #include "../dist-fs/storage.hpp"
+#include "../dist-fs/md_index.hpp"
+#include "../dist-fs/file_types.hpp"
+#include "../dist-fs/md_json.hpp"
+#include "../dist-fs/md_sync.hpp"
+#include "../dist-fs/metrics.hpp"
 
 // Simulated SSD operations
 std::mutex ssd_mutex;
@@ -28,32 +33,176 @@ bool delete_file(const std::string &filename) {
   return false;
 }
 
-crow::json::wvalue metadata_to_json() {
-  int ssd_fd = open(DEVICE_PATH, O_RDWR);
+// sorted views of the metadata table, built by the first listing or search
+static md_index_t md_index;
+static std::once_flag md_index_once;
+
+static void md_index_attach() {
+  md_index_init(&md_index);
+
+  // uploads and deletes made through the storage driver keep it current
+  storage_set_index(&md_index);
+}
+
+// the server and the CLI write the SSD too, so every request checks the
+// table stamp first and the index is rebuilt when the table changed
+static int md_index_refresh() {
+  std::call_once(md_index_once, md_index_attach);
+  int ssd_fd = open(DEVICE_PATH, O_RDONLY);
   if (ssd_fd == -1) {
     throw std::runtime_error("Error opening SSD");
   }
+  int rc = storage_refresh_index(ssd_fd);
+  close(ssd_fd);
+  return rc;
+}
 
-  // Read the metadata table
-  std::vector<storage_metadata_t> metadata_table = metadata_table_read(ssd_fd);
+// a limit parameter, capped at what the metadata table can hold. 0 asks for
+// every match
+static size_t page_limit(const char *limit, size_t fallback) {
+  if (!limit) {
+    return fallback;
+  }
+  return std::min<size_t>(strtoul(limit, nullptr, 10), MAX_FILES);
+}
 
-  // Prepare the JSON response
-  crow::json::wvalue response;
-  std::vector<crow::json::wvalue> files; // Create an array of JSON objects
+// turns the sort, order, type, prefix, offset and limit parameters of a
+// listing into an index query
+static md_index_query_t list_query(const crow::request &req) {
+  static const char *keys[] = {"time", "size", "name", "type"};
+  md_index_query_t query    = {};
+  query.type                = -1;
 
-  for (const auto &entry : metadata_table) {
-    crow::json::wvalue file;
-    file["name"]       = entry.filename;
-    file["offset"]     = static_cast<int64_t>(entry.start_offset);
-    file["size_bytes"] = static_cast<int64_t>(entry.size);
-    file["size_kb"]    = entry.size / 1024;
-    file["size_mb"]    = entry.size / (1024 * 1024);
+  const char *sort = req.url_params.get("sort");
+  for (int key = 0; sort && key < MD_INDEX_NUM_KEYS; ++key) {
+    if (strcmp(sort, keys[key]) == 0) {
+      query.key = (md_index_key_e)key;
+    }
+  }
+  const char *order = req.url_params.get("order");
+  query.descending  = order && strcmp(order, "desc") == 0;
 
-    files.push_back(std::move(file)); // Add the file object to the list
+  const char *type = req.url_params.get("type");
+  for (int t = 0; type && t < DIST_FS_END; ++t) {
+    if (strcmp(type, file_type_name((dist_fs_file_types_e)t)) == 0) {
+      query.type = t;
+    }
   }
+  query.prefix = req.url_params.get("prefix");
 
-  response["files"] = std::move(files); // Assign the list to the "files" key
-  return response;
+  const char *offset = req.url_params.get("offset");
+  const char *limit  = req.url_params.get("limit");
+  query.offset       = offset ? strtoul(offset, nullptr, 10) : 0;
+  query.limit        = page_limit(limit, 100);
+  return query;
+}
+
+// an index refreshed against the table stamp changes with every upload and
+// delete, whoever made it, so its generation is the listings' etag. the
+// epoch keeps the generations of an earlier run from matching. an index that
+// couldn't be checked may be stale and gets no etag
+static std::string listing_etag(bool current) {
+  if (!current) {
+    return "";
+  }
+  return "\"" + std::to_string(md_index.epoch) + "-" +
+         std::to_string(md_index_generation(&md_index)) + "\"";
+}
+
+// writes each entry of a page straight into the response body
+static void listing_entry(const storage_metadata_t &entry, void *arg) {
+  md_json_entry(*static_cast<std::string *>(arg), entry);
+}
+
+static crow::response json_response(std::string body,
+                                    const std::string &etag) {
+  crow::response res(200, std::move(body));
+  res.set_header("Content-Type", "application/json");
+  if (!etag.empty()) {
+    res.set_header("ETag", etag);
+  }
+  res.set_header("Cache-Control", "no-cache"); // always revalidate
+  return res;
+}
+
+crow::response list_response(const crow::request &req) {
+  // the etag is taken before the walk, a change in between only costs the
+  // client a refetch
+  std::string etag = listing_etag(md_index_refresh() >= 0);
+  if (!etag.empty() && req.get_header_value("If-None-Match") == etag) {
+    return crow::response(304);
+  }
+
+  md_index_query_t query = list_query(req);
+  std::string body;
+  uint64_t start = metrics_now_ns();
+  size_t count   = md_index_count(&md_index);
+  md_json_begin(body, query.limit ? std::min(query.limit, count) : count);
+  size_t total = md_index_walk(&md_index, &query, listing_entry, &body);
+  md_json_end(body, total, query.offset);
+  metrics_op(METRICS_MD_QUERY, start, body.size(), true);
+  return json_response(std::move(body), etag);
+}
+
+// the best matches for the q parameter, up to limit of them
+crow::response search_response(const crow::request &req) {
+  std::string etag = listing_etag(md_index_refresh() >= 0);
+  if (!etag.empty() && req.get_header_value("If-None-Match") == etag) {
+    return crow::response(304);
+  }
+
+  const char *text  = req.url_params.get("q");
+  const char *limit = req.url_params.get("limit");
+  std::vector<storage_metadata_t> matches;
+  uint64_t start = metrics_now_ns();
+  size_t total   = md_index_search(&md_index,
+                                   text ? text : "",
+                                   page_limit(limit, 50),
+                                   matches);
+  metrics_op(METRICS_MD_QUERY, start, 0, true);
+
+  std::string body;
+  md_json_begin(body, matches.size());
+  for (const auto &entry : matches) {
+    md_json_entry(body, entry);
+  }
+  md_json_end(body, total, 0);
+  return json_response(std::move(body), etag);
+}
+
+// binary listing of what changed since the epoch and since parameters of
+// the client's copy, or of every file without them
+crow::response sync_response(const crow::request &req) {
+  // a delta from an index that couldn't be checked would leave the client's
+  // copy stale under a generation it then trusts
+  if (md_index_refresh() < 0) {
+    return crow::response(503);
+  }
+
+  const char *epoch = req.url_params.get("epoch");
+  const char *since = req.url_params.get("since");
+  std::vector<uint8_t> listing;
+  uint64_t start = metrics_now_ns();
+  md_sync_encode(&md_index,
+                 epoch ? (uint32_t)strtoul(epoch, nullptr, 10) : 0,
+                 since ? strtoull(since, nullptr, 10) : 0,
+                 listing);
+  metrics_op(METRICS_MD_QUERY, start, listing.size(), true);
+
+  crow::response res(200, std::string(listing.begin(), listing.end()));
+  res.set_header("Content-Type", "application/octet-stream");
+  res.set_header("Cache-Control", "no-store");
+  return res;
+}
+
+// every metric of this process in the Prometheus text format
+crow::response metrics_response() {
+  std::string body;
+  metrics_expose(body);
+  crow::response res(200, std::move(body));
+  res.set_header("Content-Type", "text/plain; version=0.0.4");
+  res.set_header("Cache-Control", "no-store");
+  return res;
 }
 
 int main() {
@@ -95,12 +244,38 @@ int main() {
     });
 
   // List files API
-  CROW_ROUTE(app, "/api/list").methods("GET"_method)([](const crow::request &) {
-    try {
-      return crow::response(metadata_to_json());
-    } catch (const std::exception &ex) {
-      return crow::response(500, std::string("Error: ") + ex.what());
-    }
+  CROW_ROUTE(app, "/api/list")
+    .methods("GET"_method)([](const crow::request &req) {
+      try {
+        return list_response(req);
+      } catch (const std::exception &ex) {
+        return crow::response(500, std::string("Error: ") + ex.what());
+      }
+    });
+
+  // Search file names API
+  CROW_ROUTE(app, "/api/search")
+    .methods("GET"_method)([](const crow::request &req) {
+      try {
+        return search_response(req);
+      } catch (const std::exception &ex) {
+        return crow::response(500, std::string("Error: ") + ex.what());
+      }
+    });
+
+  // Binary listing and deltas API
+  CROW_ROUTE(app, "/api/sync")
+    .methods("GET"_method)([](const crow::request &req) {
+      try {
+        return sync_response(req);
+      } catch (const std::exception &ex) {
+        return crow::response(500, std::string("Error: ") + ex.what());
+      }
+    });
+
+  // Prometheus scrape endpoint
+  CROW_ROUTE(app, "/metrics").methods("GET"_method)([] {
+    return metrics_response();
   });
 
 
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstring>
+
+#include "bytecrush_simd.h"
+
+// every kernel table has to match the scalar one bit for bit, or streams
+// would depend on the CPU that wrote them
+class BytecrushSimdTest : public ::testing::Test {
+protected:
+  const bytecrush_kernels_t *scalar = nullptr;
+  std::vector<const bytecrush_kernels_t *> kernels;
+
+  void SetUp() override {
+    const bytecrush_kernels_t *list[8];
+    size_t count = bytecrush_kernels_available(list, 8);
+    ASSERT_GE(count, 1u);
+    scalar = bytecrush_kernels_scalar();
+    EXPECT_EQ(list[0], scalar);
+    kernels.assign(list, list + count);
+  }
+
+  // a smooth signal with noise, clamped to the given bit depth
+  static std::vector<int32_t> make_signal(uint32_t n, uint32_t bits) {
+    std::mt19937 rng(n * 31 + bits);
+    std::uniform_int_distribution<int32_t> noise(-64, 64);
+    int32_t max = (1 << (bits - 1)) - 1;
+    int32_t min = -max - 1;
+    std::vector<int32_t> x(n);
+    double phase = 0.0;
+    for (uint32_t i = 0; i < n; i++) {
+      phase += 0.013;
+      double v = std::sin(phase) * max + noise(rng);
+      x[i]     = static_cast<int32_t>(v > max ? max : (v < min ? min : v));
+    }
+    // full scale steps as well, the worst case for the residuals
+    for (uint32_t i = 0; i + 1 < n; i += 97) {
+      x[i]     = max;
+      x[i + 1] = min;
+    }
+    return x;
+  }
+};
+
+TEST_F(BytecrushSimdTest, BestIsAvailable) {
+  const bytecrush_kernels_t *best = bytecrush_kernels();
+  EXPECT_EQ(best, kernels.back()) << best->name;
+}
+
+TEST_F(BytecrushSimdTest, FixedResidualMatchesScalar) {
+  // lengths around the vector widths to cover the scalar tails
+  for (uint32_t n : {0u, 1u, 3u, 5u, 8u, 13u, 31u, 100u, 4096u}) {
+    for (uint32_t bits : {8u, 17u, 25u}) {
+      std::vector<int32_t> x = make_signal(n, bits);
+      for (uint32_t order = 0; order < BYTECRUSH_FIXED_ORDERS; order++) {
+        std::vector<int32_t> expect(n, 0x55);
+        scalar->fixed_residual(x.data(), n, order, expect.data());
+        for (const bytecrush_kernels_t *k : kernels) {
+          std::vector<int32_t> res(n, 0x55);
+          k->fixed_residual(x.data(), n, order, res.data());
+          EXPECT_EQ(res, expect)
+            << k->name << " n " << n << " bits " << bits << " order " << order;
+        }
+      }
+    }
+  }
+}
+
+TEST_F(BytecrushSimdTest, FixedSadMatchesScalar) {
+  for (uint32_t n : {0u, 4u, 5u, 11u, 12u, 13u, 257u, 4096u}) {
+    for (uint32_t bits : {8u, 17u, 25u}) {
+      std::vector<int32_t> x = make_signal(n, bits);
+      uint64_t expect[BYTECRUSH_FIXED_ORDERS];
+      scalar->fixed_sad(x.data(), n, expect);
+      for (const bytecrush_kernels_t *k : kernels) {
+        uint64_t sad[BYTECRUSH_FIXED_ORDERS];
+        k->fixed_sad(x.data(), n, sad);
+        for (uint32_t o = 0; o < BYTECRUSH_FIXED_ORDERS; o++) {
+          EXPECT_EQ(sad[o], expect[o])
+            << k->name << " n " << n << " bits " << bits << " order " << o;
+        }
+      }
+    }
+  }
+}
+
+TEST_F(BytecrushSimdTest, RiceMapMatchesScalar) {
+  for (uint32_t n : {0u, 1u, 7u, 9u, 33u, 4096u}) {
+    std::vector<int32_t> res = make_signal(n, 31);
+    std::vector<uint32_t> expect(n);
+    uint64_t expect_sum = scalar->rice_map(res.data(), n, expect.data());
+    for (const bytecrush_kernels_t *k : kernels) {
+      std::vector<uint32_t> u(n);
+      EXPECT_EQ(k->rice_map(res.data(), n, u.data()), expect_sum) << k->name;
+      EXPECT_EQ(k->rice_map(res.data(), n, nullptr), expect_sum) << k->name;
+      EXPECT_EQ(u, expect) << k->name << " n " << n;
+    }
+  }
+
+  // zigzag puts small magnitudes of either sign next to each other
+  int32_t res[4] = {0, -1, 1, -2};
+  uint32_t u[4]  = {};
+  uint64_t sum   = scalar->rice_map(res, 4, u);
+  uint32_t zz[4] = {0, 1, 2, 3};
+  EXPECT_EQ(sum, 6u);
+  EXPECT_EQ(std::memcmp(u, zz, sizeof(zz)), 0);
+}
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <random>
+#include <set>
+#include <string>
+
+#include "blake3.h"
+#include "fastcdc.h"
+
+static std::string to_hex(const uint8_t *hash) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  for (int i = 0; i < BLAKE3_OUT_LEN; i++) {
+    hex += digits[hash[i] >> 4];
+    hex += digits[hash[i] & 15];
+  }
+  return hex;
+}
+
+// the input of the official test vectors, bytes counting up mod 251
+static std::vector<uint8_t> vector_input(size_t n) {
+  std::vector<uint8_t> input(n);
+  for (size_t i = 0; i < n; i++) {
+    input[i] = static_cast<uint8_t>(i % 251);
+  }
+  return input;
+}
+
+static std::vector<std::string> cut_chunks(const std::vector<uint8_t> &data) {
+  std::vector<std::string> chunks;
+  for (size_t pos = 0; pos < data.size();) {
+    size_t len = fastcdc_next_chunk(data.data() + pos, data.size() - pos);
+    chunks.emplace_back(reinterpret_cast<const char *>(data.data()) + pos, len);
+    pos += len;
+  }
+  return chunks;
+}
+
+TEST(Blake3Test, KnownVectors) {
+  uint8_t hash[BLAKE3_OUT_LEN];
+
+  blake3_hash("", 0, hash);
+  EXPECT_EQ(to_hex(hash),
+            "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262");
+
+  blake3_hash("abc", 3, hash);
+  EXPECT_EQ(to_hex(hash),
+            "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85");
+
+  std::vector<uint8_t> input = vector_input(1);
+  blake3_hash(input.data(), input.size(), hash);
+  EXPECT_EQ(to_hex(hash),
+            "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213");
+
+  // exactly one chunk, the root is the chunk itself
+  input = vector_input(BLAKE3_CHUNK_LEN);
+  blake3_hash(input.data(), input.size(), hash);
+  EXPECT_EQ(to_hex(hash),
+            "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7");
+}
+
+TEST(Blake3Test, IncrementalMatchesOneShot) {
+  // sizes around the chunk and tree boundaries
+  for (size_t n : {63u, 64u, 65u, 1025u, 2048u, 3073u, 8192u, 100001u}) {
+    std::vector<uint8_t> input = vector_input(n);
+    uint8_t expect[BLAKE3_OUT_LEN];
+    blake3_hash(input.data(), n, expect);
+
+    for (size_t step : {1u, 7u, 64u, 1000u}) {
+      blake3_hasher_t hasher;
+      blake3_hasher_init(&hasher);
+      for (size_t pos = 0; pos < n; pos += step) {
+        blake3_hasher_update(&hasher,
+                             input.data() + pos,
+                             std::min(step, n - pos));
+      }
+      uint8_t hash[BLAKE3_OUT_LEN];
+      blake3_hasher_finalize(&hasher, hash);
+      EXPECT_EQ(to_hex(hash), to_hex(expect)) << "n " << n << " step " << step;
+    }
+  }
+}
+
+TEST(Blake3Test, ParallelMatchesOneShot) {
+  // sizes around the piece boundaries, and one large enough for many pieces
+  for (size_t n : {0u, 65536u, 65537u, 262145u, 1048576u, 5000000u}) {
+    std::vector<uint8_t> input = vector_input(n);
+    uint8_t expect[BLAKE3_OUT_LEN];
+    blake3_hash(input.data(), n, expect);
+
+    for (int threads : {BLAKE3_THREADS_AUTO, 1, 2, 3, 8}) {
+      uint8_t hash[BLAKE3_OUT_LEN];
+      blake3_hash_parallel(input.data(), n, hash, threads);
+      EXPECT_EQ(to_hex(hash), to_hex(expect))
+        << "n " << n << " threads " << threads;
+    }
+  }
+}
+
+TEST(FastCdcTest, ChunkSizes) {
+  std::mt19937 rng(7);
+  std::vector<uint8_t> data(8 * 1024 * 1024);
+  for (auto &byte : data) {
+    byte = static_cast<uint8_t>(rng());
+  }
+
+  std::vector<std::string> chunks = cut_chunks(data);
+  for (size_t i = 0; i < chunks.size(); i++) {
+    EXPECT_LE(chunks[i].size(), FASTCDC_MAX_SIZE);
+    if (i + 1 < chunks.size()) {
+      EXPECT_GT(chunks[i].size(), FASTCDC_MIN_SIZE);
+    }
+  }
+  // normalized chunking keeps the average near the target
+  size_t average = data.size() / chunks.size();
+  EXPECT_GT(average, FASTCDC_AVG_SIZE / 2);
+  EXPECT_LT(average, FASTCDC_AVG_SIZE * 2);
+
+  // short inputs are a single chunk
+  EXPECT_EQ(fastcdc_next_chunk(data.data(), 100), 100u);
+  EXPECT_EQ(fastcdc_next_chunk(data.data(), 0), 0u);
+}
+
+TEST(FastCdcTest, EditOnlyMovesNearbyCuts) {
+  std::mt19937 rng(11);
+  std::vector<uint8_t> data(4 * 1024 * 1024);
+  for (auto &byte : data) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  std::vector<std::string> before = cut_chunks(data);
+
+  // a few bytes inserted in the middle shift everything after them
+  data.insert(data.begin() + data.size() / 2, {'e', 'd', 'i', 't'});
+  std::vector<std::string> after = cut_chunks(data);
+
+  std::set<std::string> known(before.begin(), before.end());
+  size_t changed = 0;
+  for (const std::string &chunk : after) {
+    changed += known.count(chunk) == 0;
+  }
+  EXPECT_GE(changed, 1u);
+  EXPECT_LE(changed, 2u);
+}
@@ -1,7 +1,13 @@
 #include <gtest/gtest.h>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
 
+#include "audio_files.hpp"
 #include "bytecrush.h"
 
 extern "C" {
@@ -110,3 +116,372 @@ TEST(ByteCrushTest, CompressAlreadyCompressedData) {
   ASSERT_EQ(decompressed_size, input_size);
   ASSERT_TRUE(compare_bytes(input, decompressed, input_size));
 }
+
+static std::vector<unsigned char> make_listing(size_t min_size) {
+  std::string json = "[";
+  for (int i = 0; json.size() < min_size; i++) {
+    json += "{\"name\":\"take_" + std::to_string(i) +
+            ".wav\",\"size\":" + std::to_string(48000 + i * 17) +
+            ",\"is_directory\":false},";
+  }
+  json += "]";
+  return std::vector<unsigned char>(json.begin(), json.end());
+}
+
+TEST(ByteCrushTest, MultiBlockAllLevels) {
+  // spans several blocks, with a partial one at the end
+  std::vector<unsigned char> input = make_listing(3 * BYTECRUSH_BLOCK_SIZE);
+
+  for (int level = BYTECRUSH_LEVEL_MIN; level <= BYTECRUSH_LEVEL_MAX;
+       level++) {
+    std::vector<unsigned char> compressed(
+      bytecrush_compress_bound(input.size()));
+    size_t compressed_size = compressed.size();
+    ASSERT_EQ(bytecrush_compress_level(input.data(),
+                                       input.size(),
+                                       compressed.data(),
+                                       &compressed_size,
+                                       level),
+              0);
+    // repetitive JSON should shrink a lot at any level
+    EXPECT_LT(compressed_size, input.size() / 3) << "level " << level;
+
+    std::vector<unsigned char> decompressed(input.size());
+    size_t decompressed_size = decompressed.size();
+    ASSERT_EQ(bytecrush_decompress(compressed.data(),
+                                   compressed_size,
+                                   decompressed.data(),
+                                   &decompressed_size),
+              0);
+    ASSERT_EQ(decompressed_size, input.size());
+    EXPECT_EQ(decompressed, input) << "level " << level;
+  }
+}
+
+TEST(ByteCrushTest, OutputTooSmall) {
+  std::vector<unsigned char> input = make_listing(4096);
+  unsigned char compressed[32];
+  size_t compressed_size = sizeof(compressed);
+  EXPECT_EQ(bytecrush_compress(
+              input.data(), input.size(), compressed, &compressed_size),
+            -1);
+
+  std::vector<unsigned char> full(bytecrush_compress_bound(input.size()));
+  compressed_size = full.size();
+  ASSERT_EQ(bytecrush_compress(
+              input.data(), input.size(), full.data(), &compressed_size),
+            0);
+  std::vector<unsigned char> decompressed(input.size() - 1);
+  size_t decompressed_size = decompressed.size();
+  EXPECT_EQ(bytecrush_decompress(full.data(),
+                                 compressed_size,
+                                 decompressed.data(),
+                                 &decompressed_size),
+            -1);
+}
+
+TEST(ByteCrushTest, RejectsCorruptStream) {
+  std::vector<unsigned char> input = make_listing(8192);
+  std::vector<unsigned char> compressed(bytecrush_compress_bound(input.size()));
+  size_t compressed_size = compressed.size();
+  ASSERT_EQ(bytecrush_compress(
+              input.data(), input.size(), compressed.data(), &compressed_size),
+            0);
+
+  std::vector<unsigned char> decompressed(input.size());
+  size_t decompressed_size = decompressed.size();
+
+  // truncated stream
+  EXPECT_EQ(bytecrush_decompress(compressed.data(),
+                                 compressed_size - 1,
+                                 decompressed.data(),
+                                 &decompressed_size),
+            -1);
+
+  // unknown block method
+  compressed[BYTECRUSH_STREAM_HEADER_SZ] = 0x7F;
+  decompressed_size                      = decompressed.size();
+  EXPECT_EQ(bytecrush_decompress(compressed.data(),
+                                 compressed_size,
+                                 decompressed.data(),
+                                 &decompressed_size),
+            -1);
+}
+
+// a 44 byte WAV header followed by a couple of detuned, slightly noisy tones
+static std::vector<unsigned char> make_wav(uint16_t channels,
+                                           uint16_t bits,
+                                           size_t frames,
+                                           bytecrush_audio_format_t *fmt) {
+  size_t bytes = bits / 8;
+  std::vector<unsigned char> wav(44, 0);
+  std::memcpy(wav.data(), "RIFF\0\0\0\0WAVEfmt ", 16);
+  std::memcpy(wav.data() + 36, "data", 4);
+
+  uint32_t seed = 12345;
+  double scale  = (1 << (bits - 2));
+  for (size_t i = 0; i < frames; i++) {
+    for (uint16_t ch = 0; ch < channels; ch++) {
+      seed = seed * 1103515245 + 12345;
+      int noise      = static_cast<int>((seed >> 16) & 7) - 4;
+      double phase   = static_cast<double>(i) * (0.01 + ch * 0.0003);
+      int32_t sample = static_cast<int32_t>(scale * std::sin(phase)) + noise;
+      for (size_t b = 0; b < bytes; b++) {
+        wav.push_back(static_cast<unsigned char>(sample >> (8 * b)));
+      }
+    }
+  }
+
+  fmt->channels        = channels;
+  fmt->bits_per_sample = bits;
+  fmt->data_offset     = 44;
+  fmt->data_size       = wav.size() - 44;
+  return wav;
+}
+
+static size_t audio_round_trip(const std::vector<unsigned char> &input,
+                               const bytecrush_audio_format_t *fmt) {
+  std::vector<unsigned char> compressed(bytecrush_compress_bound(input.size()));
+  size_t compressed_size = compressed.size();
+  EXPECT_EQ(bytecrush_compress_audio(input.data(),
+                                     input.size(),
+                                     fmt,
+                                     compressed.data(),
+                                     &compressed_size,
+                                     BYTECRUSH_LEVEL_DEFAULT),
+            0);
+
+  std::vector<unsigned char> decompressed(input.size());
+  size_t decompressed_size = decompressed.size();
+  EXPECT_EQ(bytecrush_decompress(compressed.data(),
+                                 compressed_size,
+                                 decompressed.data(),
+                                 &decompressed_size),
+            0);
+  EXPECT_EQ(decompressed_size, input.size());
+  EXPECT_EQ(decompressed, input);
+  return compressed_size;
+}
+
+TEST(ByteCrushTest, AudioRoundTrip) {
+  for (uint16_t bits : {uint16_t{8}, uint16_t{16}, uint16_t{24}}) {
+    for (uint16_t channels : {uint16_t{1}, uint16_t{2}, uint16_t{6}}) {
+      bytecrush_audio_format_t fmt;
+      // odd frame count so the last block holds a partial frame
+      std::vector<unsigned char> wav =
+        make_wav(channels, bits, 3 * BYTECRUSH_BLOCK_SIZE / 7 + 3, &fmt);
+      SCOPED_TRACE(std::to_string(bits) + " bit, " + std::to_string(channels) +
+                   " channels");
+      audio_round_trip(wav, &fmt);
+    }
+  }
+}
+
+TEST(ByteCrushTest, AudioBeatsLZ77) {
+  bytecrush_audio_format_t fmt;
+  std::vector<unsigned char> wav = make_wav(2, 16, 200000, &fmt);
+
+  size_t audio_size = audio_round_trip(wav, &fmt);
+  size_t lz_size    = audio_round_trip(wav, nullptr);
+  EXPECT_LT(audio_size, wav.size() / 2);
+  EXPECT_LT(audio_size, lz_size);
+}
+
+TEST(ByteCrushTest, AudioFromWavFile) {
+  const char *path = "../test_files/wavs/CantinaBand3.wav";
+  char name[64];
+  std::strcpy(name, path);
+  file_info_t file_info;
+  ASSERT_EQ(get_file_info(file_info, name), 0);
+  ASSERT_EQ(file_info.type, DIST_FS_TYPE_WAV);
+  EXPECT_EQ(file_info.wav.audio_format, DIST_FS_WAV_PCM);
+  EXPECT_EQ(file_info.wav.num_channels, 1);
+  EXPECT_EQ(file_info.wav.bits_per_sample, 16);
+  EXPECT_EQ(file_info.wav.data_offset, 44u);
+  EXPECT_EQ(file_info.wav.data_size, 132300u);
+
+  std::ifstream file(path, std::ios::binary);
+  std::vector<unsigned char> input((std::istreambuf_iterator<char>(file)),
+                                   std::istreambuf_iterator<char>());
+  bytecrush_audio_format_t fmt = {file_info.wav.num_channels,
+                                  file_info.wav.bits_per_sample,
+                                  file_info.wav.data_offset,
+                                  file_info.wav.data_size};
+  EXPECT_LT(audio_round_trip(input, &fmt), input.size());
+}
+
+static int collect_sink(const unsigned char *data, size_t size, void *arg) {
+  auto *out = static_cast<std::vector<unsigned char> *>(arg);
+  out->insert(out->end(), data, data + size);
+  return 0;
+}
+
+TEST(ByteCrushTest, StreamingDecoder) {
+  bytecrush_audio_format_t fmt;
+  std::vector<unsigned char> input = make_wav(2, 16, 100000, &fmt);
+  std::vector<unsigned char> compressed(bytecrush_compress_bound(input.size()));
+  size_t compressed_size = compressed.size();
+  ASSERT_EQ(bytecrush_compress_audio(input.data(),
+                                     input.size(),
+                                     &fmt,
+                                     compressed.data(),
+                                     &compressed_size,
+                                     BYTECRUSH_LEVEL_DEFAULT),
+            0);
+
+  // chunk sizes that split headers and blocks at odd places
+  for (size_t chunk : {1, 7, 4096, 100000}) {
+    std::vector<unsigned char> output;
+    bytecrush_decoder_t *dec = bytecrush_decoder_create(collect_sink, &output);
+    ASSERT_NE(dec, nullptr);
+    for (size_t in = 0; in < compressed_size; in += chunk) {
+      size_t n = std::min(chunk, compressed_size - in);
+      ASSERT_EQ(bytecrush_decoder_feed(dec, compressed.data() + in, n), 0);
+    }
+    EXPECT_EQ(bytecrush_decoder_finish(dec), 0);
+    bytecrush_decoder_free(dec);
+    EXPECT_EQ(output, input) << "chunk " << chunk;
+  }
+
+  // a truncated stream decodes what it can but doesn't finish
+  std::vector<unsigned char> output;
+  bytecrush_decoder_t *dec = bytecrush_decoder_create(collect_sink, &output);
+  ASSERT_EQ(bytecrush_decoder_feed(dec, compressed.data(), compressed_size - 1),
+            0);
+  EXPECT_EQ(bytecrush_decoder_finish(dec), -1);
+  EXPECT_LT(output.size(), input.size());
+  bytecrush_decoder_free(dec);
+}
+
+TEST(ByteCrushTest, ParallelMatchesSingleThread) {
+  // an LZ77 prefix, audio blocks and a trailer, with more blocks than slots
+  bytecrush_audio_format_t fmt;
+  std::vector<unsigned char> input = make_wav(2, 16, 600000, &fmt);
+  std::vector<unsigned char> listing = make_listing(3 * BYTECRUSH_BLOCK_SIZE);
+  input.insert(input.end(), listing.begin(), listing.end());
+
+  std::vector<unsigned char> expect(bytecrush_compress_bound(input.size()));
+  size_t expect_size = expect.size();
+  ASSERT_EQ(bytecrush_compress_audio(input.data(),
+                                     input.size(),
+                                     &fmt,
+                                     expect.data(),
+                                     &expect_size,
+                                     BYTECRUSH_LEVEL_DEFAULT),
+            0);
+  expect.resize(expect_size);
+
+  for (int threads : {BYTECRUSH_THREADS_AUTO, 2, 3, 8}) {
+    std::vector<unsigned char> compressed(
+      bytecrush_compress_bound(input.size()));
+    size_t compressed_size = compressed.size();
+    ASSERT_EQ(bytecrush_compress_parallel(input.data(),
+                                          input.size(),
+                                          &fmt,
+                                          compressed.data(),
+                                          &compressed_size,
+                                          BYTECRUSH_LEVEL_DEFAULT,
+                                          threads),
+              0);
+    compressed.resize(compressed_size);
+    EXPECT_EQ(compressed, expect) << threads << " threads";
+
+    std::vector<unsigned char> decompressed(input.size());
+    size_t decompressed_size = decompressed.size();
+    ASSERT_EQ(bytecrush_decompress_parallel(expect.data(),
+                                            expect_size,
+                                            decompressed.data(),
+                                            &decompressed_size,
+                                            threads),
+              0);
+    EXPECT_EQ(decompressed, input) << threads << " threads";
+  }
+
+  // a short output fails on every thread count instead of truncating
+  for (int threads : {1, 4}) {
+    std::vector<unsigned char> compressed(expect_size - 1);
+    size_t compressed_size = compressed.size();
+    EXPECT_EQ(bytecrush_compress_parallel(input.data(),
+                                          input.size(),
+                                          &fmt,
+                                          compressed.data(),
+                                          &compressed_size,
+                                          BYTECRUSH_LEVEL_DEFAULT,
+                                          threads),
+              -1);
+  }
+
+  // a bad block is caught by whichever worker decodes it
+  expect[BYTECRUSH_STREAM_HEADER_SZ] = 0x7f;
+  std::vector<unsigned char> decompressed(input.size());
+  size_t decompressed_size = decompressed.size();
+  EXPECT_NE(bytecrush_decompress_parallel(expect.data(),
+                                          expect_size,
+                                          decompressed.data(),
+                                          &decompressed_size,
+                                          4),
+            0);
+}
+
+TEST(ByteCrushTest, HuffmanStage) {
+  // LZ77 only finds short matches in a random 4 letter alphabet, the
+  // literals code at 2 bits a byte
+  std::vector<unsigned char> dna(2 * BYTECRUSH_BLOCK_SIZE + 123);
+  uint32_t seed = 99;
+  for (unsigned char &c : dna) {
+    seed = seed * 1103515245 + 12345;
+    c    = "ACGT"[(seed >> 16) & 3];
+  }
+  std::vector<unsigned char> listing = make_listing(2 * BYTECRUSH_BLOCK_SIZE);
+
+  for (const std::vector<unsigned char> *input : {&dna, &listing}) {
+    std::vector<unsigned char> fast(bytecrush_compress_bound(input->size()));
+    size_t fast_size = fast.size();
+    ASSERT_EQ(bytecrush_compress_level(input->data(),
+                                       input->size(),
+                                       fast.data(),
+                                       &fast_size,
+                                       BYTECRUSH_LEVEL_MIN),
+              0);
+
+    std::vector<unsigned char> compressed(
+      bytecrush_compress_bound(input->size()));
+    size_t compressed_size = compressed.size();
+    ASSERT_EQ(bytecrush_compress_level(input->data(),
+                                       input->size(),
+                                       compressed.data(),
+                                       &compressed_size,
+                                       BYTECRUSH_LEVEL_MIN + 1),
+              0);
+    EXPECT_EQ(compressed[BYTECRUSH_STREAM_HEADER_SZ],
+              BYTECRUSH_METHOD_LZ77_HUFF);
+    EXPECT_LT(compressed_size, fast_size);
+
+    std::vector<unsigned char> decompressed(input->size());
+    size_t decompressed_size = decompressed.size();
+    ASSERT_EQ(bytecrush_decompress(compressed.data(),
+                                   compressed_size,
+                                   decompressed.data(),
+                                   &decompressed_size),
+              0);
+    EXPECT_EQ(decompressed, *input);
+  }
+
+  std::vector<unsigned char> compressed(bytecrush_compress_bound(dna.size()));
+  size_t compressed_size = compressed.size();
+  ASSERT_EQ(bytecrush_compress(
+              dna.data(), dna.size(), compressed.data(), &compressed_size),
+            0);
+  EXPECT_LT(compressed_size, dna.size() / 2);
+
+  // code lengths that oversubscribe the code space are rejected
+  size_t lengths = BYTECRUSH_STREAM_HEADER_SZ + BYTECRUSH_BLOCK_HEADER_SZ + 4;
+  std::memset(compressed.data() + lengths, 0x11, 128);
+  std::vector<unsigned char> decompressed(dna.size());
+  size_t decompressed_size = decompressed.size();
+  EXPECT_EQ(bytecrush_decompress(compressed.data(),
+                                 compressed_size,
+                                 decompressed.data(),
+                                 &decompressed_size),
+            -1);
+}
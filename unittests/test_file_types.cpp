@@ -0,0 +1,274 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "audio_files.hpp"
+#include "file_types.hpp"
+#include "audio_info.hpp"
+
+static std::vector<uint8_t> read_all(const char *path, struct stat &st) {
+  std::vector<uint8_t> data;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    return data;
+  }
+  data.resize(st.st_size);
+  EXPECT_EQ(pread(fd, data.data(), data.size(), 0), (ssize_t)data.size());
+  close(fd);
+  return data;
+}
+
+TEST(FileTypeTest, BufferMatchesFile) {
+  char path[] = "../test_files/wavs/CantinaBand3.wav";
+  struct stat st;
+  std::vector<uint8_t> data = read_all(path, st);
+  ASSERT_FALSE(data.empty());
+
+  file_info_t from_file = {};
+  ASSERT_EQ(get_file_info(from_file, path), 0);
+
+  // only the chunk headers in front of the samples are needed, the data
+  // chunk is sized from the stat
+  for (size_t size : {data.size(), (size_t)64}) {
+    file_info_t from_buffer = {};
+    ASSERT_EQ(get_buffer_info(from_buffer, path, st, data.data(), size), 0);
+    EXPECT_EQ(from_buffer.type, DIST_FS_TYPE_WAV);
+    EXPECT_EQ(from_buffer.size, from_file.size);
+    EXPECT_EQ(from_buffer.timestamp, from_file.timestamp);
+    EXPECT_EQ(memcmp(&from_buffer.wav, &from_file.wav, sizeof(wav_format_t)),
+              0);
+  }
+}
+
+TEST(FileTypeTest, WavHeaderCutShort) {
+  // RIFF/WAVE with a fmt chunk that runs past the end of the buffer
+  const uint8_t header[] = {'R', 'I', 'F', 'F', 36, 0, 0, 0, 'W', 'A', 'V',
+                            'E', 'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0};
+  wav_format_t fmt;
+  EXPECT_EQ(get_wav_format(header, sizeof(header), 1000, fmt), 0);
+  EXPECT_EQ(fmt.num_channels, 0);
+  EXPECT_EQ(fmt.data_size, 0u);
+
+  EXPECT_EQ(get_wav_format(header, 8, 1000, fmt), -1);
+}
+
+static dist_fs_file_types_e detect(const std::string &head) {
+  return file_type_detect(reinterpret_cast<const uint8_t *>(head.data()),
+                          head.size());
+}
+
+TEST(FileTypeTest, TestFiles) {
+  const std::pair<const char *, dist_fs_file_types_e> files[] = {
+    {"../test_files/wavs/CantinaBand3.wav", DIST_FS_TYPE_WAV},
+    {"../test_files/wavs/file_example_WAV_2_9MG.flac", DIST_FS_TYPE_FLAC},
+    {"../test_files/aiff/M1F1-AlawC-AFsp.aif", DIST_FS_TYPE_AIFF},
+    {"../test_files/aiff/aiff-16.snd", DIST_FS_TYPE_AIFF},
+    {"../test_files/mp3/sample-3s.mp3", DIST_FS_TYPE_MP3},
+    {"../test_files/imgs/wav_format1.png", DIST_FS_TYPE_PNG},
+    {"../test_files/json/ex1.json", DIST_FS_TYPE_JSON},
+    {"../test_files/json/64KB.json", DIST_FS_TYPE_JSON},
+  };
+  for (const auto &file : files) {
+    struct stat st;
+    std::vector<uint8_t> data = read_all(file.first, st);
+    ASSERT_FALSE(data.empty()) << file.first;
+    EXPECT_EQ(file_type_detect(data.data(), data.size()), file.second)
+      << file.first;
+  }
+}
+
+TEST(FileTypeTest, Signatures) {
+  // any ID3v2 version, and bare frames
+  EXPECT_EQ(detect(std::string("ID3\x03\0\0\0\0", 8)), DIST_FS_TYPE_MP3);
+  EXPECT_EQ(detect("\xff\xfb\x90\x64"), DIST_FS_TYPE_MP3);
+  EXPECT_EQ(detect("\xff\xf1\x50\x80"), DIST_FS_TYPE_AAC);
+  EXPECT_EQ(detect("\xff\xd8\xff\xe0"), DIST_FS_TYPE_JPEG);
+
+  // containers told apart by the bytes after their magic number
+  EXPECT_EQ(detect(std::string("RIFF\0\0\0\0WEBPVP8 ", 16)),
+            DIST_FS_TYPE_WEBP);
+  EXPECT_EQ(detect(std::string("\0\0\0\x20" "ftypM4A \0\0\0\0", 16)),
+            DIST_FS_TYPE_M4A);
+  EXPECT_EQ(detect(std::string("\0\0\0\x18" "ftypisom\0\0\0\0", 16)),
+            DIST_FS_TYPE_MP4);
+  EXPECT_EQ(detect(std::string("FORM\0\0\0\0AIFC", 12)), DIST_FS_TYPE_AIFF);
+
+  EXPECT_EQ(detect(std::string("PK\x03\x04\x14\0", 6)), DIST_FS_TYPE_ZIP);
+  EXPECT_EQ(detect("\x1f\x8b\x08"), DIST_FS_TYPE_GZIP);
+  EXPECT_EQ(detect("%PDF-1.7\n"), DIST_FS_TYPE_PDF);
+
+  std::string tar(512, '\0');
+  tar.replace(0, 8, "file.txt");
+  tar.replace(257, 5, "ustar");
+  EXPECT_EQ(detect(tar), DIST_FS_TYPE_TAR);
+}
+
+TEST(FileTypeTest, TextAndBlobs) {
+  EXPECT_EQ(detect("  \n{\"key\": 1}"), DIST_FS_TYPE_JSON);
+  EXPECT_EQ(detect("[1, 2, 3]"), DIST_FS_TYPE_JSON);
+  EXPECT_EQ(detect("hello world\n"), DIST_FS_TYPE_TEXT);
+
+  // a signature cut short doesn't match
+  EXPECT_EQ(detect(std::string("\x89PN", 3)), DIST_FS_TYPE_DATA);
+  EXPECT_EQ(detect(std::string("\x01\x02\0\x03", 4)), DIST_FS_TYPE_DATA);
+  EXPECT_EQ(detect(std::string("h\0e\0l\0l\0o\0", 10)), DIST_FS_TYPE_DATA);
+  EXPECT_EQ(detect(std::string(4096, '\0')), DIST_FS_TYPE_DATA);
+  EXPECT_EQ(detect(std::string(" \0[1]", 5)), DIST_FS_TYPE_DATA);
+  EXPECT_EQ(detect(""), DIST_FS_TYPE_DATA);
+
+  EXPECT_STREQ(file_type_name(DIST_FS_TYPE_WAV), "wav");
+  EXPECT_STREQ(file_type_name(DIST_FS_TYPE_TEXT), "text");
+  EXPECT_STREQ(file_type_name(static_cast<dist_fs_file_types_e>(6)),
+               "unknown");
+}
+
+static audio_info_t parse(const std::string &file) {
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(file.data());
+  audio_info_t info;
+  EXPECT_EQ(audio_info_parse(file_type_detect(data, file.size()),
+                             data,
+                             file.size(),
+                             file.size(),
+                             &info),
+            0);
+  return info;
+}
+
+static std::string be32_bytes(size_t v) {
+  return {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+}
+
+static std::string le32_bytes(size_t v) {
+  return {char(v), char(v >> 8), char(v >> 16), char(v >> 24)};
+}
+
+// an MP4 box, size and type in front of the body
+static std::string box(const char *type, const std::string &body) {
+  return be32_bytes(8 + body.size()) + type + body;
+}
+
+TEST(AudioInfoTest, TestFiles) {
+  struct {
+    const char *path;
+    uint32_t duration_ms, sample_rate;
+    uint16_t channels, bits;
+  } files[] = {
+    {"../test_files/wavs/CantinaBand3.wav", 3000, 22050, 1, 16},
+    {"../test_files/flac/sample-file-4.flac", 19714, 44100, 2, 16},
+    {"../test_files/aiff/aiff-16.snd", 746, 44100, 2, 16},
+    {"../test_files/mp3/sample-6s.mp3", 6426, 44100, 2, 0},
+  };
+  for (const auto &file : files) {
+    struct stat st;
+    std::vector<uint8_t> data = read_all(file.path, st);
+    ASSERT_FALSE(data.empty()) << file.path;
+    audio_info_t info =
+      parse(std::string(data.begin(), data.end()));
+    EXPECT_EQ(info.duration_ms, file.duration_ms) << file.path;
+    EXPECT_EQ(info.sample_rate, file.sample_rate) << file.path;
+    EXPECT_EQ(info.channels, file.channels) << file.path;
+    EXPECT_EQ(info.bits_per_sample, file.bits) << file.path;
+    EXPECT_GT(info.bitrate, 0u) << file.path;
+  }
+
+  struct stat st;
+  std::vector<uint8_t> flac =
+    read_all("../test_files/flac/sample-file-4.flac", st);
+  audio_info_t info = parse(std::string(flac.begin(), flac.end()));
+  EXPECT_STREQ(info.title, "The Happy Meeting");
+  EXPECT_STREQ(info.artist, "Samples Files");
+}
+
+TEST(AudioInfoTest, WavTags) {
+  // 48 kHz stereo 16 bit, one second of silence, INFO tags and a loop tempo
+  std::string fmt = le32_bytes(0x00020001) + le32_bytes(48000) +
+                    le32_bytes(192000) + le32_bytes(0x00100004);
+  std::string info = std::string("INFO") + "INAM" + le32_bytes(5) +
+                     std::string("Loop\0", 6) + "IART" + le32_bytes(4) +
+                     "Band";
+  float tempo      = 127.9f;
+  std::string acid(24, '\0');
+  memcpy(&acid[20], &tempo, sizeof(tempo));
+
+  std::string body = std::string("WAVE") + "fmt " + le32_bytes(16) + fmt +
+                     "LIST" + le32_bytes(info.size()) + info + "acid" +
+                     le32_bytes(acid.size()) + acid + "data" +
+                     le32_bytes(192000) + std::string(192000, '\0');
+  audio_info_t wav = parse("RIFF" + le32_bytes(body.size()) + body);
+  EXPECT_EQ(wav.duration_ms, 1000u);
+  EXPECT_EQ(wav.sample_rate, 48000u);
+  EXPECT_EQ(wav.channels, 2);
+  EXPECT_EQ(wav.bpm, 128);
+  EXPECT_STREQ(wav.title, "Loop");
+  EXPECT_STREQ(wav.artist, "Band");
+}
+
+TEST(AudioInfoTest, Id3AndMp4Tags) {
+  // ID3v2.3 with a UTF-16 title and a tempo, ahead of one CBR frame
+  std::string title = std::string("\x01\xff\xfe" "D\0r\0u\0m\0s\0", 13);
+  std::string bpm   = std::string("\0" "90", 3);
+  std::string frames = "TIT2" + be32_bytes(title.size()) +
+                       std::string(2, '\0') + title + "TBPM" +
+                       be32_bytes(bpm.size()) + std::string(2, '\0') + bpm;
+  std::string tag = std::string("ID3\x03\0\0\0\0\0", 9) +
+                    char(frames.size());
+  std::string frame = std::string("\xff\xfb\x90\x64", 4) +
+                      std::string(413, '\0');
+  audio_info_t mp3  = parse(tag + frames + frame);
+  EXPECT_STREQ(mp3.title, "Drums");
+  EXPECT_EQ(mp3.bpm, 90);
+  EXPECT_EQ(mp3.sample_rate, 44100u);
+  EXPECT_EQ(mp3.channels, 2);
+
+  // mvhd with a 1 kHz timescale, an mp4a sample entry and ilst tags
+  std::string mvhd = std::string(12, '\0') + be32_bytes(1000) +
+                     be32_bytes(4500) + std::string(80, '\0');
+  std::string mp4a = std::string(16, '\0') + std::string("\0\x02\0\x10", 4) +
+                     std::string(4, '\0') + be32_bytes(44100u << 16);
+  std::string stsd = std::string(4, '\0') + be32_bytes(1) + box("mp4a", mp4a);
+  std::string trak =
+    box("mdia", box("minf", box("stbl", box("stsd", stsd))));
+  std::string name = box("data", std::string(8, '\0') + "Keys");
+  std::string tmpo =
+    box("data", std::string(8, '\0') + std::string("\0\x78", 2));
+  std::string ilst = box("\xa9nam", name) + box("tmpo", tmpo);
+  std::string udta =
+    box("meta", std::string(4, '\0') + box("ilst", ilst));
+  std::string m4a = box("ftyp", "M4A " + std::string(4, '\0')) +
+                    box("moov", box("mvhd", mvhd) + box("trak", trak) +
+                                  box("udta", udta));
+  audio_info_t info = parse(m4a);
+  EXPECT_EQ(info.duration_ms, 4500u);
+  EXPECT_EQ(info.sample_rate, 44100u);
+  EXPECT_EQ(info.channels, 2);
+  EXPECT_EQ(info.bpm, 120);
+  EXPECT_STREQ(info.title, "Keys");
+}
+
+TEST(AudioInfoTest, Mp4BoxSizesEndTheWalk) {
+  std::string ftyp = box("ftyp", "M4A " + std::string(4, '\0'));
+  audio_info_t info;
+
+  // a 64 bit size that would wrap the walk back to the free box
+  std::string wrap = ftyp + box("free", std::string(8, '\0')) +
+                     be32_bytes(1) + "mdat" +
+                     std::string("\xff\xff\xff\xff\xff\xff\xff\xf0", 8) +
+                     std::string(8, '\0');
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(wrap.data());
+  ASSERT_EQ(file_type_detect(data, wrap.size()), DIST_FS_TYPE_M4A);
+  EXPECT_EQ(
+    audio_info_parse(DIST_FS_TYPE_M4A, data, wrap.size(), wrap.size(), &info),
+    -1);
+
+  // a zero size runs to the end of the file
+  std::string mvhd = std::string(12, '\0') + be32_bytes(1000) +
+                     be32_bytes(2000) + std::string(80, '\0');
+  std::string tail = ftyp + box("moov", box("mvhd", mvhd)) + be32_bytes(0) +
+                     "mdat" + std::string(64, '\0');
+  info = parse(tail);
+  EXPECT_EQ(info.duration_ms, 2000u);
+}
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <string>
+#include <cstring>
+
+#include "comms/link_codec.h"
+#include "comms/packet.h"
+
+static const link_codec_t *lz() {
+  const link_codec_t *codec = link_codec_find(LINK_CODEC_LZ);
+  EXPECT_NE(codec, nullptr);
+  return codec;
+}
+
+static std::vector<uint8_t> round_trip(const std::vector<uint8_t> &input,
+                                       uint32_t *packed_size) {
+  std::vector<uint8_t> packed(input.size() + input.size() / 255 + 16);
+  *packed_size = lz()->compress(input.data(),
+                                (uint32_t)input.size(),
+                                packed.data(),
+                                (uint32_t)packed.size());
+
+  std::vector<uint8_t> output(input.size());
+  int n = lz()->decompress(
+    packed.data(), *packed_size, output.data(), (uint32_t)output.size());
+  EXPECT_EQ(n, (int)input.size());
+  return output;
+}
+
+TEST(LinkCodecTest, RoundTripListing) {
+  std::string listing;
+  for (int i = 0; i < 200; i++) {
+    listing += "track_" + std::to_string(i) + ".wav\t" +
+               std::to_string(1000000 + i * 37) + "\n";
+  }
+  std::vector<uint8_t> input(listing.begin(), listing.end());
+
+  uint32_t packed_size = 0;
+  EXPECT_EQ(round_trip(input, &packed_size), input);
+  EXPECT_LT(packed_size, input.size() / 2);
+}
+
+TEST(LinkCodecTest, RoundTripShortAndOverlapping) {
+  for (size_t len : {0, 1, 5, 12, 13, 64, 1000}) {
+    std::vector<uint8_t> input(len, 0x5A);
+    uint32_t packed_size = 0;
+    EXPECT_EQ(round_trip(input, &packed_size), input) << "len " << len;
+  }
+}
+
+TEST(LinkCodecTest, IncompressibleDoesNotFit) {
+  std::vector<uint8_t> input(4096);
+  uint32_t state = 12345;
+  for (auto &b : input) {
+    state = state * 1103515245u + 12345u;
+    b     = (uint8_t)(state >> 24);
+  }
+  std::vector<uint8_t> packed(input.size() - 1);
+  EXPECT_EQ(lz()->compress(input.data(),
+                           (uint32_t)input.size(),
+                           packed.data(),
+                           (uint32_t)packed.size()),
+            0u);
+}
+
+TEST(LinkCodecTest, RejectsCorruptInput) {
+  std::vector<uint8_t> out(64);
+  // match offset reaching before the start of the output
+  const uint8_t bad_offset[] = {0x10, 'a', 0x05, 0x00};
+  EXPECT_LT(lz()->decompress(
+              bad_offset, sizeof(bad_offset), out.data(), (uint32_t)out.size()),
+            0);
+  // literal run longer than the input
+  const uint8_t truncated[] = {0xF0, 0x20, 'a'};
+  EXPECT_LT(lz()->decompress(
+              truncated, sizeof(truncated), out.data(), (uint32_t)out.size()),
+            0);
+}
+
+TEST(LinkCodecTest, Select) {
+  EXPECT_EQ(link_codec_select(link_codec_mask()), LINK_CODEC_LZ);
+  EXPECT_EQ(link_codec_select(0), LINK_CODEC_NONE);
+  EXPECT_EQ(link_codec_find(LINK_CODEC_NONE), nullptr);
+}
+
+static void capture_payload(const dist_fs_packet_t *packet, void *arg) {
+  auto *payloads = static_cast<std::vector<std::vector<uint8_t>> *>(arg);
+  EXPECT_FALSE(packet->flags & DIST_FS_FLAG_COMPRESSED);
+  payloads->emplace_back(packet->payload,
+                         packet->payload + packet->payload_size);
+}
+
+TEST(LinkCodecTest, ParserInflatesCompressedFrames) {
+  comm_context_t ctx = {};
+  ctx.codec          = LINK_CODEC_LZ;
+
+  std::vector<uint8_t> payload(4000);
+  for (size_t i = 0; i < payload.size(); i++) {
+    payload[i] = (uint8_t)("RIFF....WAVEfmt "[i % 16]);
+  }
+
+  uint8_t flags = DIST_FS_FLAG_START;
+  std::vector<uint8_t> packed(payload.size());
+  uint32_t packed_size = packet_compress(
+    &ctx, &flags, payload.data(), (uint32_t)payload.size(), packed.data());
+  ASSERT_GT(packed_size, 0u);
+  EXPECT_TRUE(flags & DIST_FS_FLAG_COMPRESSED);
+  EXPECT_EQ(ctx.tx_raw_bytes, payload.size());
+  EXPECT_EQ(ctx.tx_wire_bytes, packed_size);
+
+  std::vector<uint8_t> stream(DIST_FS_HEADER_SIZE + packed_size);
+  encode_packet(
+    DIST_FS_UPLOAD, flags, packed.data(), packed_size, stream.data());
+
+  static packet_parser_t parser;
+  std::vector<std::vector<uint8_t>> payloads;
+  packet_parser_init(&parser, capture_payload, &payloads, false);
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 1u);
+  ASSERT_EQ(payloads.size(), 1u);
+  EXPECT_EQ(payloads[0], payload);
+  EXPECT_EQ(parser.compressed_frames, 1u);
+  EXPECT_EQ(parser.raw_bytes, payload.size());
+
+  // a corrupt compressed frame is dropped instead of delivered
+  stream[DIST_FS_HEADER_SIZE] = 0x7F;
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 0u);
+  EXPECT_EQ(parser.corrupt_frames, 1u);
+  EXPECT_EQ(payloads.size(), 1u);
+}
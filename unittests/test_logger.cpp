@@ -0,0 +1,213 @@
+#include <gtest/gtest.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils.hpp"
+#include "logger.hpp"
+
+class LoggerTest : public ::testing::Test {
+protected:
+  char dir[32]                = "/tmp/dist_fs_log_XXXXXX";
+  config_context_t config_ctx = {};
+
+  std::vector<std::string> files() {
+    std::vector<std::string> names;
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    while (d && (entry = readdir(d)) != NULL) {
+      if (entry->d_name[0] != '.') {
+        names.push_back(entry->d_name);
+      }
+    }
+    if (d) {
+      closedir(d);
+    }
+    return names;
+  }
+
+  std::vector<std::string> lines(const std::string &name) {
+    std::ifstream in(std::string(dir) + "/" + name);
+    std::vector<std::string> found;
+    std::string line;
+    while (std::getline(in, line)) {
+      found.push_back(line);
+    }
+    return found;
+  }
+
+  void SetUp() override {
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    config_ctx.log_directory      = dir;
+    config_ctx.log_rotation_size  = 1;
+    config_ctx.log_retention_days = 7;
+  }
+
+  void TearDown() override {
+    logger_stop();
+    for (const auto &name : files()) {
+      unlink((std::string(dir) + "/" + name).c_str());
+    }
+    rmdir(dir);
+  }
+};
+
+TEST_F(LoggerTest, LinesFromThreadsInOrder) {
+  ASSERT_EQ(logger_start(&config_ctx, "test"), 0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < 200; ++i) {
+        LOG(INFO, "thread %d line %d", t, i);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  LOG(WARN, "%s", std::string(2 * LOGGER_MSG_SIZE, 'x').c_str());
+  logger_flush();
+
+  // each thread's lines keep their order, and a long message is cut
+  std::vector<int> next(4, 0);
+  size_t longest = 0;
+  for (const auto &line : lines("test.log")) {
+    int t, i;
+    const char *msg = strstr(line.c_str(), " - ");
+    ASSERT_NE(msg, nullptr) << line;
+    if (sscanf(msg, " - thread %d line %d", &t, &i) == 2) {
+      EXPECT_EQ(i, next[t]++);
+    } else {
+      EXPECT_NE(line.find("[WARN] test_logger.cpp:"), std::string::npos);
+      longest = strlen(msg + 3);
+    }
+  }
+  EXPECT_EQ(next, (std::vector<int>{200, 200, 200, 200}));
+  EXPECT_EQ(longest, (size_t)LOGGER_MSG_SIZE - 1);
+}
+
+TEST_F(LoggerTest, RotatesAndPrunes) {
+  // a rotated log past the retention, and one still within it
+  std::string old_log = std::string(dir) + "/test-20000101-000000-0.log";
+  std::string new_log = std::string(dir) + "/test-20000102-000000-1.log";
+  std::ofstream(old_log) << "old\n";
+  std::ofstream(new_log) << "new\n";
+  struct utimbuf times;
+  times.actime  = time(NULL) - 30 * 24 * 3600;
+  times.modtime = times.actime;
+  ASSERT_EQ(utime(old_log.c_str(), &times), 0);
+
+  ASSERT_EQ(logger_start(&config_ctx, "test"), 0);
+  EXPECT_EQ(access(old_log.c_str(), F_OK), -1);
+  EXPECT_EQ(access(new_log.c_str(), F_OK), 0);
+
+  // a bit over a MB of lines, more than the ring holds, so the logging
+  // thread has to wait for the writer too
+  std::string text(400, 'y');
+  for (int i = 0; i < 3000; ++i) {
+    LOG(INFO, "%d %s", i, text.c_str());
+  }
+  logger_stop();
+
+  size_t total = 0;
+  size_t rotated = 0;
+  for (const auto &name : files()) {
+    total += lines(name).size();
+    if (name != "test.log" && name != "test-20000102-000000-1.log") {
+      rotated++;
+      struct stat st;
+      ASSERT_EQ(stat((std::string(dir) + "/" + name).c_str(), &st), 0);
+      EXPECT_LE((size_t)st.st_size, (size_t)1 << 20);
+    }
+  }
+  EXPECT_EQ(rotated, 1u);
+  EXPECT_EQ(total, 3000u + 1);
+}
+
+TEST_F(LoggerTest, StopKeepsLinesLoggedMeanwhile) {
+  ASSERT_EQ(logger_start(&config_ctx, "test"), 0);
+
+  // threads still logging while the logger stops, each line lands in the
+  // log or, once it's stopped, on stdout
+  testing::internal::CaptureStdout();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < 2000; ++i) {
+        LOG(INFO, "thread %d line %d", t, i);
+      }
+    });
+  }
+  logger_stop();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  std::string out = testing::internal::GetCapturedStdout();
+
+  size_t total = lines("test.log").size();
+  for (size_t pos = 0; (pos = out.find(" - thread ", pos)) != out.npos;) {
+    total++;
+    pos++;
+  }
+  EXPECT_EQ(total, 4u * 2000);
+}
+
+TEST_F(LoggerTest, LimitsRepeatedLines) {
+  log_limit_t limit = {};
+  uint32_t held     = 0;
+  int allowed       = 0;
+  for (int i = 0; i < 10; ++i) {
+    allowed += log_limit(&limit, 3, &held);
+  }
+  EXPECT_EQ(allowed, 3);
+
+  // once the second is over the next line goes out and counts the rest
+  limit.window -= 1000;
+  EXPECT_TRUE(log_limit(&limit, 3, &held));
+  EXPECT_EQ(held, 7u);
+  EXPECT_TRUE(log_limit(&limit, 3, &held));
+  EXPECT_EQ(held, 0u);
+
+  ASSERT_EQ(logger_start(&config_ctx, "test"), 0);
+  for (int i = 0; i < 100; ++i) {
+    LOG_LIMIT(INFO, 2, "limited %d", i);
+    LOG_EVERY_N(INFO, 25, "sampled %d", i);
+  }
+  logger_flush();
+
+  size_t limited = 0;
+  std::vector<int> sampled;
+  for (const auto &line : lines("test.log")) {
+    int i;
+    const char *msg = strstr(line.c_str(), " - ");
+    ASSERT_NE(msg, nullptr) << line;
+    if (sscanf(msg, " - sampled %d", &i) == 1) {
+      sampled.push_back(i);
+    } else if (strstr(msg, "limited")) {
+      limited++;
+    }
+  }
+  EXPECT_GE(limited, 2u);
+  EXPECT_LT(limited, 10u);
+  EXPECT_EQ(sampled, (std::vector<int>{0, 25, 50, 75}));
+}
+
+TEST_F(LoggerTest, LevelsBelowMinimumCompileOut) {
+  // with the default LOG_MIN_LEVEL a DBG line doesn't even evaluate its
+  // arguments
+  int calls = 0;
+  LOG(DBG, "%d", ++calls);
+  LOG_LIMIT(DBG, 1, "%d", ++calls);
+  LOG_EVERY_N(DBG, 1, "%d", ++calls);
+  EXPECT_EQ(calls, 0);
+  LOG(INFO, "%d", ++calls);
+  EXPECT_EQ(calls, 1);
+}
@@ -0,0 +1,227 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "md_index.hpp"
+
+class MdIndexTest : public ::testing::Test {
+protected:
+  md_index_t index;
+
+  static storage_metadata_t entry(const char *name,
+                                  size_t size,
+                                  dist_fs_file_types_e type,
+                                  std::time_t uploaded) {
+    storage_metadata_t md = {};
+    strncpy(md.filename, name, sizeof(md.filename) - 1);
+    md.size               = size;
+    md.type               = type;
+    md.file_time.uploaded = uploaded;
+    return md;
+  }
+
+  // names of a page, in order
+  std::vector<std::string> list(md_index_query_t query, size_t *total) {
+    std::vector<storage_metadata_t> page;
+    *total = md_index_list(&index, &query, page);
+
+    std::vector<std::string> names;
+    for (const auto &md : page) {
+      names.push_back(md.filename);
+    }
+    return names;
+  }
+
+  void SetUp() override {
+    ASSERT_EQ(md_index_init(&index), 0);
+    md_index_build(&index,
+                   {
+                     entry("drums/kick.wav", 300, DIST_FS_TYPE_WAV, 40),
+                     entry("drums/snare.wav", 100, DIST_FS_TYPE_WAV, 10),
+                     entry("notes.txt", 50, DIST_FS_TYPE_TEXT, 30),
+                     entry("keys/pad.flac", 200, DIST_FS_TYPE_FLAC, 20),
+                     entry("drums/hats.flac", 400, DIST_FS_TYPE_FLAC, 50),
+                   });
+  }
+
+  void TearDown() override {
+    md_index_destroy(&index);
+  }
+};
+
+TEST_F(MdIndexTest, SortsAndPages) {
+  size_t total;
+  md_index_query_t query = {MD_INDEX_SIZE, false, -1, NULL, 0, 0};
+  EXPECT_EQ(list(query, &total),
+            (std::vector<std::string>{"notes.txt",
+                                      "drums/snare.wav",
+                                      "keys/pad.flac",
+                                      "drums/kick.wav",
+                                      "drums/hats.flac"}));
+  EXPECT_EQ(total, 5u);
+
+  // second page of two, newest first
+  query = {MD_INDEX_UPLOADED, true, -1, NULL, 2, 2};
+  EXPECT_EQ(list(query, &total),
+            (std::vector<std::string>{"notes.txt", "keys/pad.flac"}));
+  EXPECT_EQ(total, 5u);
+
+  // a page past the end is empty
+  query = {MD_INDEX_NAME, false, -1, NULL, 5, 2};
+  EXPECT_TRUE(list(query, &total).empty());
+  EXPECT_EQ(total, 5u);
+}
+
+TEST_F(MdIndexTest, Filters) {
+  size_t total;
+  md_index_query_t query = {MD_INDEX_NAME, false, -1, "drums/", 1, 0};
+  EXPECT_EQ(list(query, &total),
+            (std::vector<std::string>{"drums/kick.wav", "drums/snare.wav"}));
+  EXPECT_EQ(total, 3u);
+
+  query = {MD_INDEX_TYPE, false, DIST_FS_TYPE_FLAC, NULL, 0, 0};
+  EXPECT_EQ(list(query, &total),
+            (std::vector<std::string>{"drums/hats.flac", "keys/pad.flac"}));
+
+  // filters on another order are checked entry by entry
+  query = {MD_INDEX_SIZE, true, DIST_FS_TYPE_WAV, "drums/", 0, 1};
+  EXPECT_EQ(list(query, &total),
+            (std::vector<std::string>{"drums/kick.wav"}));
+  EXPECT_EQ(total, 2u);
+
+  query = {MD_INDEX_TYPE, false, DIST_FS_TYPE_FLAC, "keys/", 0, 0};
+  EXPECT_EQ(list(query, &total),
+            (std::vector<std::string>{"keys/pad.flac"}));
+  EXPECT_EQ(total, 1u);
+}
+
+TEST_F(MdIndexTest, InsertAndRemove) {
+  md_index_insert(&index, entry("drums/clap.wav", 250, DIST_FS_TYPE_WAV, 60));
+  md_index_insert(&index, entry("notes.txt", 75, DIST_FS_TYPE_TEXT, 70));
+  EXPECT_EQ(md_index_count(&index), 7u);
+
+  size_t total;
+  md_index_query_t query = {MD_INDEX_SIZE, false, -1, NULL, 0, 4};
+  EXPECT_EQ(list(query, &total),
+            (std::vector<std::string>{"notes.txt",
+                                      "notes.txt",
+                                      "drums/snare.wav",
+                                      "keys/pad.flac"}));
+
+  // the older of two files with the same name goes first
+  EXPECT_EQ(md_index_remove(&index, "notes.txt"), 0);
+  EXPECT_EQ(md_index_remove(&index, "drums/kick.wav"), 0);
+  EXPECT_EQ(md_index_remove(&index, "missing.wav"), -1);
+  EXPECT_EQ(md_index_count(&index), 5u);
+
+  std::vector<storage_metadata_t> page;
+  query = {MD_INDEX_NAME, false, -1, "notes", 0, 0};
+  ASSERT_EQ(md_index_list(&index, &query, page), 1u);
+  EXPECT_EQ(page[0].size, 75u);
+
+  // freed slots are reused and every order stays sorted
+  md_index_insert(&index, entry("bass.wav", 500, DIST_FS_TYPE_WAV, 5));
+  query = {MD_INDEX_UPLOADED, false, -1, NULL, 0, 0};
+  EXPECT_EQ(list(query, &total),
+            (std::vector<std::string>{"bass.wav",
+                                      "drums/snare.wav",
+                                      "keys/pad.flac",
+                                      "drums/hats.flac",
+                                      "drums/clap.wav",
+                                      "notes.txt"}));
+}
+
+TEST_F(MdIndexTest, UpdateLogsTheTableDifference) {
+  uint64_t generation = md_index_generation(&index);
+
+  // another process deleted the kick and uploaded a clap
+  md_index_update(&index,
+                  {
+                    entry("drums/snare.wav", 100, DIST_FS_TYPE_WAV, 10),
+                    entry("notes.txt", 50, DIST_FS_TYPE_TEXT, 30),
+                    entry("keys/pad.flac", 200, DIST_FS_TYPE_FLAC, 20),
+                    entry("drums/hats.flac", 400, DIST_FS_TYPE_FLAC, 50),
+                    entry("drums/clap.wav", 250, DIST_FS_TYPE_WAV, 60),
+                  });
+  EXPECT_EQ(md_index_count(&index), 5u);
+  EXPECT_EQ(md_index_generation(&index), generation + 2);
+
+  std::vector<std::pair<md_index_change_e, std::string>> changes;
+  uint64_t now = 0;
+  auto visit   = [](md_index_change_e change,
+                  const storage_metadata_t &entry,
+                  void *arg) {
+    static_cast<std::vector<std::pair<md_index_change_e, std::string>> *>(arg)
+      ->push_back({change, entry.filename});
+  };
+  EXPECT_EQ(
+    md_index_changes(&index, index.epoch, generation, visit, &changes, &now),
+    0);
+  EXPECT_EQ(changes,
+            (std::vector<std::pair<md_index_change_e, std::string>>{
+              {MD_INDEX_REMOVED, "drums/kick.wav"},
+              {MD_INDEX_ADDED, "drums/clap.wav"}}));
+
+  // the same table again changes nothing
+  md_index_update(&index,
+                  {
+                    entry("drums/snare.wav", 100, DIST_FS_TYPE_WAV, 10),
+                    entry("notes.txt", 50, DIST_FS_TYPE_TEXT, 30),
+                    entry("keys/pad.flac", 200, DIST_FS_TYPE_FLAC, 20),
+                    entry("drums/hats.flac", 400, DIST_FS_TYPE_FLAC, 50),
+                    entry("drums/clap.wav", 250, DIST_FS_TYPE_WAV, 60),
+                  });
+  EXPECT_EQ(md_index_generation(&index), now);
+
+  // dropping the newer of two files of a name can't be a delta
+  md_index_insert(&index, entry("notes.txt", 75, DIST_FS_TYPE_TEXT, 70));
+  md_index_update(&index,
+                  {
+                    entry("notes.txt", 50, DIST_FS_TYPE_TEXT, 30),
+                  });
+  changes.clear();
+  EXPECT_EQ(md_index_changes(&index, index.epoch, now, visit, &changes, &now),
+            1);
+  EXPECT_EQ(changes,
+            (std::vector<std::pair<md_index_change_e, std::string>>{
+              {MD_INDEX_ADDED, "notes.txt"}}));
+}
+
+TEST_F(MdIndexTest, Search) {
+  std::vector<storage_metadata_t> results;
+  auto names = [&results]() {
+    std::vector<std::string> found;
+    for (const auto &md : results) {
+      found.push_back(md.filename);
+    }
+    return found;
+  };
+
+  // name prefixes first, then path component prefixes, then the rest
+  md_index_insert(&index, entry("Snare Roll.WAV", 10, DIST_FS_TYPE_WAV, 60));
+  md_index_insert(&index, entry("keys/rimsnare.wav", 10, DIST_FS_TYPE_WAV, 70));
+  EXPECT_EQ(md_index_search(&index, "SNARE", 0, results), 3u);
+  EXPECT_EQ(names(),
+            (std::vector<std::string>{
+              "Snare Roll.WAV", "drums/snare.wav", "keys/rimsnare.wav"}));
+
+  EXPECT_EQ(md_index_search(&index, ".flac", 1, results), 2u);
+  EXPECT_EQ(names(), (std::vector<std::string>{"drums/hats.flac"}));
+
+  // text with a trigram no name holds is answered from the lists alone
+  EXPECT_EQ(md_index_search(&index, "drumsnare", 0, results), 0u);
+  EXPECT_EQ(md_index_search(&index, "zzz", 0, results), 0u);
+
+  // text shorter than a trigram is compared against every name
+  EXPECT_EQ(md_index_search(&index, "k", 0, results), 3u);
+  EXPECT_EQ(md_index_search(&index, "", 0, results), 7u);
+
+  // deleted names drop out of the trigram lists
+  ASSERT_EQ(md_index_remove(&index, "drums/snare.wav"), 0);
+  EXPECT_EQ(md_index_search(&index, "snare", 0, results), 2u);
+  ASSERT_EQ(md_index_remove(&index, "Snare Roll.WAV"), 0);
+  ASSERT_EQ(md_index_remove(&index, "keys/rimsnare.wav"), 0);
+  EXPECT_EQ(md_index_search(&index, "snare", 0, results), 0u);
+  EXPECT_EQ(index.grams.count(('n' << 16) | ('a' << 8) | 'r'), 0u);
+}
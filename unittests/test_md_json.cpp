@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+
+#include "md_json.hpp"
+#include "md_index.hpp"
+
+static storage_metadata_t json_entry(const char *name, size_t size) {
+  storage_metadata_t md = {};
+  strncpy(md.filename, name, sizeof(md.filename) - 1);
+  md.size = size;
+  return md;
+}
+
+TEST(MdJsonTest, Listing) {
+  storage_metadata_t wav = json_entry("drums/kick.wav", 3 * 1024 * 1024 + 5);
+  wav.type               = DIST_FS_TYPE_WAV;
+  wav.start_offset       = 4096;
+  wav.audio.duration_ms  = 3000;
+  wav.audio.sample_rate  = 44100;
+  wav.audio.channels     = 2;
+  wav.audio.bpm          = 120;
+  strcpy(wav.audio.title, "Kick");
+
+  std::string out;
+  md_json_begin(out, 2);
+  md_json_entry(out, wav);
+  md_json_entry(out, json_entry("a\"b\\c\td\x01.txt", 0));
+  md_json_end(out, 7, 2);
+
+  EXPECT_EQ(out,
+            "{\"files\":[{\"name\":\"drums/kick.wav\",\"type\":\"wav\","
+            "\"offset\":4096,\"size_bytes\":3145733,\"size_kb\":3072,"
+            "\"size_mb\":3,\"duration_ms\":3000,\"sample_rate\":44100,"
+            "\"channels\":2,\"bits\":0,\"bitrate\":0,\"bpm\":120,"
+            "\"title\":\"Kick\",\"artist\":\"\",\"album\":\"\"},"
+            "{\"name\":\"a\\\"b\\\\c\\u0009d\\u0001.txt\",\"type\":\"wav\","
+            "\"offset\":0,\"size_bytes\":0,\"size_kb\":0,\"size_mb\":0,"
+            "\"duration_ms\":0,\"sample_rate\":0,\"channels\":0,\"bits\":0,"
+            "\"bitrate\":0,\"bpm\":0,\"title\":\"\",\"artist\":\"\","
+            "\"album\":\"\"}],\"total\":7,\"offset\":2}");
+  EXPECT_GE(out.capacity(), 2u * MD_JSON_ENTRY_SIZE);
+}
+
+TEST(MdJsonTest, EmptyListing) {
+  std::string out;
+  md_json_begin(out, 0);
+  md_json_end(out, 0, 0);
+  EXPECT_EQ(out, "{\"files\":[],\"total\":0,\"offset\":0}");
+}
+
+static void json_visit(const storage_metadata_t &entry, void *arg) {
+  md_json_entry(*static_cast<std::string *>(arg), entry);
+}
+
+TEST(MdJsonTest, WalkedPageAndGeneration) {
+  md_index_t index;
+  ASSERT_EQ(md_index_init(&index), 0);
+  md_index_build(&index, {json_entry("b.wav", 2), json_entry("a.wav", 1)});
+  uint64_t generation = md_index_generation(&index);
+
+  md_index_query_t query = {MD_INDEX_NAME, false, -1, NULL, 1, 1};
+  std::string out;
+  md_json_begin(out, 1);
+  EXPECT_EQ(md_index_walk(&index, &query, json_visit, &out), 2u);
+  md_json_end(out, 2, 1);
+  EXPECT_NE(out.find("\"name\":\"b.wav\""), std::string::npos);
+  EXPECT_EQ(out.find("a.wav"), std::string::npos);
+
+  // every change moves the generation, reads don't
+  EXPECT_EQ(md_index_generation(&index), generation);
+  md_index_insert(&index, json_entry("c.wav", 3));
+  EXPECT_GT(md_index_generation(&index), generation);
+  generation = md_index_generation(&index);
+  ASSERT_EQ(md_index_remove(&index, "c.wav"), 0);
+  EXPECT_GT(md_index_generation(&index), generation);
+  md_index_destroy(&index);
+}
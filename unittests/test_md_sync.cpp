@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "md_sync.hpp"
+#include "md_index.hpp"
+
+class MdSyncTest : public ::testing::Test {
+protected:
+  md_index_t index;
+  md_sync_header_t header = {};
+  std::vector<md_sync_entry_t> files;
+
+  static storage_metadata_t entry(const char *name, size_t size) {
+    storage_metadata_t md = {};
+    strncpy(md.filename, name, sizeof(md.filename) - 1);
+    md.size               = size;
+    md.type               = DIST_FS_TYPE_WAV;
+    md.file_time.uploaded = 1700000000;
+    return md;
+  }
+
+  // brings the copy up to date, returns the bytes that crossed
+  size_t sync() {
+    std::vector<uint8_t> listing;
+    md_sync_encode(&index, header.epoch, header.generation, listing);
+    EXPECT_EQ(md_sync_apply(&header, files, listing.data(), listing.size()),
+              0);
+    return listing.size();
+  }
+
+  std::vector<std::string> names() {
+    std::vector<std::string> found;
+    for (const auto &file : files) {
+      found.push_back(file.name);
+    }
+    return found;
+  }
+
+  void SetUp() override {
+    ASSERT_EQ(md_index_init(&index), 0);
+    md_index_build(&index, {entry("kick.wav", 300), entry("snare.wav", 100)});
+  }
+
+  void TearDown() override {
+    md_index_destroy(&index);
+  }
+};
+
+TEST_F(MdSyncTest, FullListingThenDeltas) {
+  storage_metadata_t tagged = entry("pad.wav", 5000000);
+  tagged.audio.duration_ms  = 61000;
+  tagged.audio.sample_rate  = 48000;
+  tagged.audio.bpm          = 128;
+  md_index_insert(&index, tagged);
+
+  sync();
+  EXPECT_EQ(header.epoch, index.epoch);
+  EXPECT_EQ(header.generation, md_index_generation(&index));
+  EXPECT_EQ(names(),
+            (std::vector<std::string>{"kick.wav", "snare.wav", "pad.wav"}));
+  EXPECT_EQ(files[2].size, 5000000u);
+  EXPECT_EQ(files[2].duration_ms, 61000u);
+  EXPECT_EQ(files[2].sample_rate, 48000u);
+  EXPECT_EQ(files[2].bpm, 128);
+  EXPECT_EQ(files[2].uploaded, 1700000000);
+
+  // nothing changed, only the header crosses
+  EXPECT_EQ(sync(), (size_t)MD_SYNC_HEADER_SIZE);
+
+  // a delete is the name alone, and takes the older of two files
+  md_index_insert(&index, entry("kick.wav", 400));
+  ASSERT_EQ(md_index_remove(&index, "kick.wav"), 0);
+  EXPECT_EQ(sync(),
+            MD_SYNC_HEADER_SIZE + (2 + 8 + 1 + 2 + 5 + 3) + (2 + 8));
+  EXPECT_EQ(names(),
+            (std::vector<std::string>{"snare.wav", "pad.wav", "kick.wav"}));
+  EXPECT_EQ(files[2].size, 400u);
+}
+
+TEST_F(MdSyncTest, StaleCopiesGetEverything) {
+  sync();
+  std::vector<uint8_t> listing;
+  md_sync_header_t got;
+  std::vector<md_sync_entry_t> entries;
+
+  // a copy from another run of the server
+  md_sync_encode(&index, index.epoch + 1, header.generation, listing);
+  ASSERT_EQ(md_sync_decode(listing.data(), listing.size(), &got, entries), 0);
+  EXPECT_EQ(got.flags, MD_SYNC_FULL);
+  EXPECT_EQ(entries.size(), 2u);
+
+  // a copy older than the log
+  for (size_t i = 0; i < MD_INDEX_LOG_SIZE; ++i) {
+    md_index_insert(&index, entry("loop.wav", i));
+  }
+  md_index_remove(&index, "loop.wav");
+  md_sync_encode(&index, header.epoch, header.generation, listing);
+  ASSERT_EQ(md_sync_decode(listing.data(), listing.size(), &got, entries), 0);
+  EXPECT_EQ(got.flags, MD_SYNC_FULL);
+  EXPECT_EQ(entries.size(), MD_INDEX_LOG_SIZE + 1);
+
+  // a copy still covered by the log
+  md_sync_encode(&index, index.epoch, got.generation - 1, listing);
+  ASSERT_EQ(md_sync_decode(listing.data(), listing.size(), &got, entries), 0);
+  EXPECT_EQ(got.flags, 0);
+  ASSERT_EQ(entries.size(), 1u);
+  EXPECT_EQ(entries[0].change, MD_INDEX_REMOVED);
+
+  // a rebuild can't be replayed
+  md_index_build(&index, {entry("kick.wav", 300)});
+  sync();
+  EXPECT_EQ(names(), (std::vector<std::string>{"kick.wav"}));
+}
+
+TEST_F(MdSyncTest, RejectsBadListings) {
+  std::vector<uint8_t> listing;
+  md_sync_encode(&index, 0, 0, listing);
+
+  // deltas against a copy of another epoch
+  md_sync_header_t copy = {MD_SYNC_VERSION, MD_SYNC_FULL, 1, 0, 0};
+  std::vector<uint8_t> delta;
+  md_sync_header_t changes = {MD_SYNC_VERSION, 0, 2, 5, 0};
+  md_sync_begin(delta);
+  md_sync_end(delta, &changes);
+  EXPECT_EQ(md_sync_apply(&copy, files, delta.data(), delta.size()), -1);
+
+  // cut short, and another version
+  EXPECT_EQ(md_sync_apply(&header, files, listing.data(), listing.size() - 1),
+            -1);
+  listing[4] = MD_SYNC_VERSION + 1;
+  EXPECT_EQ(md_sync_apply(&header, files, listing.data(), listing.size()), -1);
+  EXPECT_TRUE(files.empty());
+}
@@ -5,12 +5,24 @@
 
 #include "storage.hpp"
 
+static storage_metadata_t mock_entry(const char *name,
+                                     off_t start_offset,
+                                     size_t size,
+                                     bool is_directory) {
+  storage_metadata_t md = {};
+  strncpy(md.filename, name, sizeof(md.filename) - 1);
+  md.start_offset = start_offset;
+  md.size         = size;
+  md.is_directory = is_directory;
+  return md;
+}
+
 // Mock data for metadata table
 const size_t MOCK_METADATA_ENTRIES                      = 3;
 storage_metadata_t mock_md_table[MOCK_METADATA_ENTRIES] = {
-  {"file1.txt", 1024, 512, false},
-  {"file2.txt", 2048, 1024, false},
-  {"dir1", 3072, 0, true}};
+  mock_entry("file1.txt", 1024, 512, false),
+  mock_entry("file2.txt", 2048, 1024, false),
+  mock_entry("dir1", 3072, 0, true)};
 
 class StorageDriverTest : public ::testing::Test {
 protected:
@@ -24,11 +36,16 @@ protected:
     mock_fd = open("/tmp/mock_ssd", O_RDWR | O_CREAT | O_TRUNC, 0666);
     ASSERT_NE(mock_fd, -1) << "Failed to create mock SSD file";
 
-    ssize_t bytes_written = write(mock_fd, mock_ssd, METADATA_TABLE_SZ);
+    storage_format_t format = {};
+    format.magic            = STORAGE_FORMAT_MAGIC;
+    format.version          = STORAGE_FORMAT_VERSION;
+    ASSERT_EQ(pwrite(mock_fd, &format, sizeof(format), STORAGE_FORMAT_OFFSET),
+              (ssize_t)sizeof(format));
+
+    ssize_t bytes_written =
+      pwrite(mock_fd, mock_ssd, METADATA_TABLE_SZ, METADATA_TABLE_OFFSET);
     ASSERT_EQ(bytes_written, METADATA_TABLE_SZ)
       << "Failed to write mock SSD data";
-
-    lseek(mock_fd, 0, SEEK_SET);
   }
 
   void TearDown() override {
@@ -54,9 +71,7 @@ TEST_F(StorageDriverTest, ReadValidMetadataTable) {
 // reading empty metadata table
 TEST_F(StorageDriverTest, ReadEmptyMetadataTable) {
   memset(mock_ssd, 0, METADATA_TABLE_SZ);
-  lseek(mock_fd, 0, SEEK_SET);
-  write(mock_fd, mock_ssd, METADATA_TABLE_SZ);
-  lseek(mock_fd, 0, SEEK_SET);
+  pwrite(mock_fd, mock_ssd, METADATA_TABLE_SZ, METADATA_TABLE_OFFSET);
 
   std::vector<storage_metadata_t> metadata = md_table_read(mock_fd);
 
@@ -76,9 +91,7 @@ TEST_F(StorageDriverTest, SeekFailure) {
 TEST_F(StorageDriverTest, PartialRead) {
   ssize_t partial_size =
     sizeof(storage_metadata_t) * (MOCK_METADATA_ENTRIES - 1);
-  lseek(mock_fd, 0, SEEK_SET);
-  write(mock_fd, mock_md_table, partial_size);
-  lseek(mock_fd, 0, SEEK_SET);
+  pwrite(mock_fd, mock_md_table, partial_size, METADATA_TABLE_OFFSET);
 
   std::vector<storage_metadata_t> metadata = md_table_read(mock_fd);
 
@@ -90,3 +103,32 @@ TEST_F(StorageDriverTest, PartialRead) {
     EXPECT_EQ(metadata[i].is_directory, mock_md_table[i].is_directory);
   }
 }
+
+// a drive of another layout reads as no files and is refused
+TEST_F(StorageDriverTest, OtherLayoutsAreRefused) {
+  storage_format_t format = {};
+  format.magic            = STORAGE_FORMAT_MAGIC;
+  format.version          = STORAGE_FORMAT_VERSION + 1;
+  pwrite(mock_fd, &format, sizeof(format), STORAGE_FORMAT_OFFSET);
+  EXPECT_EQ(storage_format_check(mock_fd), -1);
+  EXPECT_TRUE(md_table_read(mock_fd).empty());
+  EXPECT_TRUE(chunk_table_read(mock_fd).empty());
+
+  // a version 1 drive has file data where the chunk table is
+  format.version = 1;
+  pwrite(mock_fd, &format, sizeof(format), STORAGE_FORMAT_OFFSET);
+  EXPECT_EQ(storage_format_check(mock_fd), -1);
+  EXPECT_TRUE(chunk_table_read(mock_fd).empty());
+
+  // the metadata table of a drive from before the format block
+  format = {};
+  pwrite(mock_fd, &format, sizeof(format), STORAGE_FORMAT_OFFSET);
+  pwrite(mock_fd, mock_md_table, sizeof(mock_md_table), 0);
+  EXPECT_EQ(storage_format_check(mock_fd), -1);
+  EXPECT_TRUE(md_table_read(mock_fd).empty());
+
+  // a blank drive is fine
+  ASSERT_EQ(ftruncate(mock_fd, 0), 0);
+  EXPECT_EQ(storage_format_check(mock_fd), 0);
+  EXPECT_TRUE(md_table_read(mock_fd).empty());
+}
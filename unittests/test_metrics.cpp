@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.hpp"
+
+// other tests record too, so every check is on what changed since a
+// snapshot taken at the start
+class MetricsTest : public ::testing::Test {
+protected:
+  std::unique_ptr<metrics_snapshot_t> before =
+    std::make_unique<metrics_snapshot_t>();
+  std::unique_ptr<metrics_snapshot_t> after =
+    std::make_unique<metrics_snapshot_t>();
+
+  void SetUp() override {
+    metrics_snapshot(before.get());
+  }
+
+  metrics_histogram_t delta(metrics_op_e op) {
+    metrics_snapshot(after.get());
+    metrics_histogram_t histogram = after->ops[op];
+    histogram.count -= before->ops[op].count;
+    histogram.errors -= before->ops[op].errors;
+    histogram.bytes -= before->ops[op].bytes;
+    histogram.sum_ns -= before->ops[op].sum_ns;
+    for (size_t i = 0; i < METRICS_BUCKETS; ++i) {
+      histogram.buckets[i] -= before->ops[op].buckets[i];
+    }
+    return histogram;
+  }
+};
+
+TEST_F(MetricsTest, PercentilesWithinBucketError) {
+  metrics_histogram_t empty = {};
+  EXPECT_EQ(metrics_percentile(&empty, 0.5), 0u);
+
+  // 1 ms to 1 s, backdating the start stands in for the wait. the thread
+  // registers first, so what reading the clock adds is lost in the bucket
+  // error even in a sanitizer build
+  metrics_add(METRICS_LINK_RX_BYTES, 0);
+  for (uint64_t i = 1; i <= 1000; ++i) {
+    metrics_op(METRICS_LINK_WRITE, metrics_now_ns() - i * 1000000, 10, i != 7);
+  }
+
+  metrics_histogram_t histogram = delta(METRICS_LINK_WRITE);
+  EXPECT_EQ(histogram.count, 1000u);
+  EXPECT_EQ(histogram.errors, 1u);
+  EXPECT_EQ(histogram.bytes, 10000u);
+  EXPECT_GE(histogram.sum_ns, 500500ull * 1000000);
+
+  EXPECT_NEAR(static_cast<double>(metrics_percentile(&histogram, 0.5)),
+              500e6,
+              500e6 * 0.04);
+  EXPECT_NEAR(static_cast<double>(metrics_percentile(&histogram, 0.99)),
+              990e6,
+              990e6 * 0.04);
+  EXPECT_NEAR(static_cast<double>(metrics_percentile(&histogram, 1.0)),
+              1000e6,
+              1000e6 * 0.04);
+  EXPECT_NEAR(static_cast<double>(metrics_percentile(&histogram, 0.0)),
+              1e6,
+              1e6 * 0.04);
+}
+
+TEST_F(MetricsTest, ThreadsThatExitedStillCount) {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([]() {
+      for (int i = 0; i < 1000; ++i) {
+        metrics_add(METRICS_LINK_RX_BYTES, 3);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  metrics_snapshot(after.get());
+  EXPECT_EQ(after->counters[METRICS_LINK_RX_BYTES] -
+              before->counters[METRICS_LINK_RX_BYTES],
+            12000u);
+}
+
+TEST_F(MetricsTest, ExposesPrometheusText) {
+  metrics_set(METRICS_LINK_RX_QUEUED, 42);
+  metrics_op(METRICS_UPLOAD, metrics_now_ns() - 2000000, 1 << 20, true);
+
+  std::string text;
+  metrics_expose(text);
+
+  // one HELP and TYPE per family, a sample per line
+  std::istringstream lines(text);
+  std::string line;
+  int cache_help = 0;
+  while (std::getline(lines, line)) {
+    if (line.rfind("# HELP dist_fs_cache_hits_total ", 0) == 0) {
+      cache_help++;
+    }
+    if (line[0] != '#') {
+      EXPECT_NE(line.find(' '), std::string::npos) << line;
+    }
+  }
+  EXPECT_EQ(cache_help, 1);
+  EXPECT_NE(text.find("# TYPE dist_fs_op_seconds summary\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("dist_fs_op_seconds{op=\"upload\",quantile=\"0.99\"} "),
+            std::string::npos);
+  EXPECT_NE(text.find("dist_fs_cache_hits_total{cache=\"chunk\"} "),
+            std::string::npos);
+  EXPECT_NE(text.find("dist_fs_link_rx_queued_bytes 42\n"), std::string::npos);
+
+  char path[] = "/tmp/dist_fs_metrics_XXXXXX";
+  int fd      = mkstemp(path);
+  ASSERT_NE(fd, -1);
+  close(fd);
+  ASSERT_EQ(metrics_write(path), 0);
+  std::stringstream written;
+  written << std::ifstream(path).rdbuf();
+  EXPECT_NE(written.str().find("dist_fs_link_rx_queued_bytes 42\n"),
+            std::string::npos);
+  unlink(path);
+}
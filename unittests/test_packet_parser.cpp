@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <cstring>
+
+#include "comms/packet.h"
+
+// frames collected by the parser callback
+struct captured_frame_t {
+  dist_fs_ops_e command;
+  uint8_t flags;
+  std::vector<uint8_t> payload;
+};
+
+static void capture_frame(const dist_fs_packet_t *packet, void *arg) {
+  auto *frames = static_cast<std::vector<captured_frame_t> *>(arg);
+  captured_frame_t frame;
+  frame.command = packet->command;
+  frame.flags   = packet->flags;
+  frame.payload.assign(packet->payload,
+                       packet->payload + packet->payload_size);
+  frames->push_back(frame);
+}
+
+// requests other than upload data are a single START|END frame
+static const uint8_t WHOLE = DIST_FS_FLAG_START | DIST_FS_FLAG_END;
+
+static std::vector<uint8_t> make_frame(dist_fs_ops_e command,
+                                       const std::vector<uint8_t> &payload,
+                                       uint8_t flags = WHOLE) {
+  std::vector<uint8_t> frame(DIST_FS_HEADER_SIZE + payload.size());
+  encode_packet(command,
+                flags,
+                const_cast<uint8_t *>(payload.data()),
+                static_cast<uint32_t>(payload.size()),
+                frame.data());
+  return frame;
+}
+
+class PacketParserTest : public ::testing::Test {
+protected:
+  static packet_parser_t parser;
+  std::vector<captured_frame_t> frames;
+
+  void SetUp() override {
+    packet_parser_init(&parser, capture_frame, &frames, false);
+  }
+};
+
+packet_parser_t PacketParserTest::parser;
+
+TEST_F(PacketParserTest, SingleFrame) {
+  std::vector<uint8_t> payload = {0xDE, 0xAD, 0xBE, 0xEF};
+  std::vector<uint8_t> stream  = make_frame(DIST_FS_UPLOAD, payload);
+
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 1u);
+  ASSERT_EQ(frames.size(), 1u);
+  EXPECT_EQ(frames[0].command, DIST_FS_UPLOAD);
+  EXPECT_EQ(frames[0].payload, payload);
+  EXPECT_EQ(parser.dropped_bytes, 0u);
+}
+
+TEST_F(PacketParserTest, ManyFramesOneChunk) {
+  std::vector<uint8_t> stream;
+  for (int i = 0; i < 16; i++) {
+    std::vector<uint8_t> frame =
+      make_frame(DIST_FS_LIST, std::vector<uint8_t>(i, (uint8_t)i));
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 16u);
+  ASSERT_EQ(frames.size(), 16u);
+  for (size_t i = 0; i < frames.size(); i++) {
+    EXPECT_EQ(frames[i].payload, std::vector<uint8_t>(i, (uint8_t)i));
+  }
+}
+
+TEST_F(PacketParserTest, ByteAtATime) {
+  std::vector<uint8_t> payload(300);
+  for (size_t i = 0; i < payload.size(); i++) {
+    payload[i] = (uint8_t)(i * 7);
+  }
+  std::vector<uint8_t> stream = make_frame(DIST_FS_DOWNLOAD, payload);
+
+  for (uint8_t byte : stream) {
+    packet_parser_feed(&parser, &byte, 1);
+  }
+  ASSERT_EQ(frames.size(), 1u);
+  EXPECT_EQ(frames[0].command, DIST_FS_DOWNLOAD);
+  EXPECT_EQ(frames[0].payload, payload);
+}
+
+TEST_F(PacketParserTest, ResyncAfterNoise) {
+  std::vector<uint8_t> stream = {0x00, 0xDA, 0x13, 0xDA, 0xDA, 0x55, 0xFF};
+  std::vector<uint8_t> frame  = make_frame(DIST_FS_DELETE, {0x01, 0x02});
+  stream.insert(stream.end(), frame.begin(), frame.end());
+
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 1u);
+  ASSERT_EQ(frames.size(), 1u);
+  EXPECT_EQ(frames[0].command, DIST_FS_DELETE);
+  EXPECT_EQ(frames[0].payload, std::vector<uint8_t>({0x01, 0x02}));
+  EXPECT_EQ(parser.dropped_bytes, 7u);
+}
+
+TEST_F(PacketParserTest, ResyncAfterInvalidCommand) {
+  // valid start bytes followed by a command that doesn't exist. the real
+  // frame starts inside the bogus header
+  std::vector<uint8_t> stream = {
+    0xDA, 0xFF, 0x7F, 0xDA, 0xFF, 0x30, 0x00, 0x00};
+
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 1u);
+  ASSERT_EQ(frames.size(), 1u);
+  EXPECT_EQ(frames[0].command, DIST_FS_LIST);
+  EXPECT_TRUE(frames[0].payload.empty());
+}
+
+TEST_F(PacketParserTest, StartByteSplitAcrossChunks) {
+  std::vector<uint8_t> stream = make_frame(DIST_FS_UPLOAD, {0xAA, 0xBB});
+
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), 1), 0u);
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data() + 1, stream.size() - 1),
+            1u);
+  ASSERT_EQ(frames.size(), 1u);
+  EXPECT_EQ(frames[0].payload, std::vector<uint8_t>({0xAA, 0xBB}));
+}
+
+TEST_F(PacketParserTest, FlagsSplitFromCommand) {
+  uint8_t flags = DIST_FS_FLAG_RESPONSE | DIST_FS_FLAG_START | DIST_FS_FLAG_END;
+  packet_parser_init(&parser, capture_frame, &frames, true);
+
+  std::vector<uint8_t> stream = make_frame(DIST_FS_DOWNLOAD, {0x42}, flags);
+
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 1u);
+  ASSERT_EQ(frames.size(), 1u);
+  EXPECT_EQ(frames[0].command, DIST_FS_DOWNLOAD);
+  EXPECT_EQ(frames[0].flags, flags);
+  EXPECT_EQ(frames[0].payload, std::vector<uint8_t>({0x42}));
+}
+
+TEST_F(PacketParserTest, RejectsImpossibleFlags) {
+  const uint8_t rsp = DIST_FS_FLAG_RESPONSE;
+  const std::pair<uint8_t, uint8_t> requests[] = {
+    {DIST_FS_DOWNLOAD, rsp | DIST_FS_FLAG_START}, // a response
+    {DIST_FS_DELETE, WHOLE | DIST_FS_FLAG_ERROR}, // errors are responses
+    {DIST_FS_LIST, DIST_FS_FLAG_START},           // only uploads stream
+    {6, WHOLE},                                   // no such operation
+  };
+  for (const auto &request : requests) {
+    std::vector<uint8_t> stream =
+      make_frame((dist_fs_ops_e)request.first, {0x01}, request.second);
+    EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 0u)
+      << (int)request.first << " " << (int)request.second;
+  }
+  EXPECT_EQ(parser.resyncs, 4u);
+
+  // upload data frames carry no flags
+  std::vector<uint8_t> stream = make_frame(DIST_FS_UPLOAD, {0x02}, 0);
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 1u);
+
+  // a client reads the host's streams, and single frame answers whole
+  packet_parser_init(&parser, capture_frame, &frames, true);
+  stream = make_frame(DIST_FS_DOWNLOAD, {0x03}, rsp);
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 1u);
+  stream = make_frame(DIST_FS_DELETE, {}, rsp | DIST_FS_FLAG_START);
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 0u);
+  stream = make_frame(DIST_FS_DELETE, {}, WHOLE);
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 0u);
+  stream =
+    make_frame(DIST_FS_DELETE, {0, 0, 0, 2}, rsp | WHOLE | DIST_FS_FLAG_ERROR);
+  EXPECT_EQ(packet_parser_feed(&parser, stream.data(), stream.size()), 1u);
+}
+
+TEST(ListQueryTest, RoundTrip) {
+  dist_fs_list_query_t query = {2, DIST_FS_LIST_DESCENDING, 4, 70000, 50, {}};
+  strcpy(query.prefix, "drums/");
+
+  uint8_t payload[DIST_FS_LIST_QUERY_SIZE + sizeof(query.prefix)];
+  uint32_t size = encode_list_query(&query, payload);
+  ASSERT_EQ(size, DIST_FS_LIST_QUERY_SIZE + 6u);
+
+  dist_fs_list_query_t decoded;
+  ASSERT_EQ(decode_list_query(payload, size, &decoded), 0);
+  EXPECT_EQ(decoded.key, 2);
+  EXPECT_EQ(decoded.flags, DIST_FS_LIST_DESCENDING);
+  EXPECT_EQ(decoded.type, 4);
+  EXPECT_EQ(decoded.offset, 70000u);
+  EXPECT_EQ(decoded.limit, 50u);
+  EXPECT_STREQ(decoded.prefix, "drums/");
+
+  EXPECT_EQ(decode_list_query(payload, DIST_FS_LIST_QUERY_SIZE - 1, &decoded),
+            -1);
+}
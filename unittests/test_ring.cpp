@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include <thread>
+#include <cstring>
+
+#include "comms/ring.h"
+
+class RingTest : public ::testing::Test {
+protected:
+  ring_t ring;
+
+  void SetUp() override { ASSERT_EQ(ring_init(&ring, 100), 0); }
+
+  void TearDown() override { ring_free(&ring); }
+};
+
+// capacity is rounded up to a power of two
+TEST_F(RingTest, CapacityPowerOfTwo) {
+  EXPECT_EQ(ring.capacity, 128u);
+  EXPECT_EQ(ring.mask, 127u);
+  EXPECT_EQ(ring_count(&ring), 0u);
+}
+
+// producer and consumer state live on separate cache lines
+TEST_F(RingTest, CacheLinePadding) {
+  uintptr_t head = reinterpret_cast<uintptr_t>(&ring.head);
+  uintptr_t tail = reinterpret_cast<uintptr_t>(&ring.tail);
+  EXPECT_GE(tail - head, static_cast<uintptr_t>(RING_CACHE_LINE_SIZE));
+  EXPECT_EQ(head % RING_CACHE_LINE_SIZE, 0u);
+  EXPECT_EQ(tail % RING_CACHE_LINE_SIZE, 0u);
+}
+
+// batches that wrap around the end of the buffer come back in order
+TEST_F(RingTest, PushPopWrapAround) {
+  uint8_t in[100];
+  uint8_t out[100];
+  for (int round = 0; round < 10; round++) {
+    for (size_t i = 0; i < sizeof(in); i++) {
+      in[i] = static_cast<uint8_t>(round * 100 + i);
+    }
+    ASSERT_EQ(ring_push(&ring, in, sizeof(in)), sizeof(in));
+    ASSERT_EQ(ring_count(&ring), sizeof(in));
+    ASSERT_EQ(ring_pop(&ring, out, sizeof(out)), sizeof(out));
+    ASSERT_EQ(std::memcmp(in, out, sizeof(in)), 0);
+  }
+}
+
+// pushes are truncated when the ring is full
+TEST_F(RingTest, PushWhenFull) {
+  std::vector<uint8_t> in(200, 0xAB);
+  EXPECT_EQ(ring_push(&ring, in.data(), in.size()), 128u);
+  EXPECT_EQ(ring_push(&ring, in.data(), in.size()), 0u);
+
+  uint8_t out[8];
+  EXPECT_EQ(ring_pop(&ring, out, sizeof(out)), sizeof(out));
+  EXPECT_EQ(ring_push(&ring, in.data(), in.size()), sizeof(out));
+}
+
+// the free space a producer sees only grows until it pushes
+TEST_F(RingTest, SpaceForWholeWrites) {
+  std::vector<uint8_t> in(100, 0xCD);
+  EXPECT_EQ(ring_space(&ring), 128u);
+  ASSERT_EQ(ring_push(&ring, in.data(), in.size()), in.size());
+  EXPECT_EQ(ring_space(&ring), 28u);
+
+  uint8_t out[50];
+  ASSERT_EQ(ring_pop(&ring, out, sizeof(out)), sizeof(out));
+  EXPECT_EQ(ring_space(&ring), 78u);
+}
+
+// zero copy access never hands out a region that crosses the wrap point
+TEST_F(RingTest, ContiguousRegions) {
+  uint8_t *wptr = nullptr;
+  ASSERT_EQ(ring_write_ptr(&ring, &wptr), 128u);
+  ring_commit(&ring, 120);
+
+  const uint8_t *rptr = nullptr;
+  ASSERT_EQ(ring_read_ptr(&ring, &rptr), 120u);
+  ring_consume(&ring, 120);
+
+  // only the 8 bytes up to the end of the buffer are contiguous
+  EXPECT_EQ(ring_write_ptr(&ring, &wptr), 8u);
+  EXPECT_EQ(wptr, ring.buffer + 120);
+}
+
+// one producer thread and one consumer thread moving a counting sequence
+TEST_F(RingTest, ProducerConsumerThreads) {
+  const size_t total = 1 << 20;
+
+  std::thread producer([this, total] {
+    uint8_t chunk[37];
+    size_t sent = 0;
+    while (sent < total) {
+      size_t n = std::min(sizeof(chunk), total - sent);
+      for (size_t i = 0; i < n; i++) {
+        chunk[i] = static_cast<uint8_t>(sent + i);
+      }
+      size_t pushed = 0;
+      while (pushed < n) {
+        size_t p = ring_push(&ring, chunk + pushed, n - pushed);
+        if (p == 0) {
+          std::this_thread::yield();
+        }
+        pushed += p;
+      }
+      sent += n;
+    }
+  });
+
+  size_t received = 0;
+  bool in_order   = true;
+  uint8_t chunk[53];
+  while (received < total) {
+    size_t n = ring_pop(&ring, chunk, sizeof(chunk));
+    if (n == 0) {
+      std::this_thread::yield();
+    }
+    for (size_t i = 0; i < n; i++) {
+      in_order &= chunk[i] == static_cast<uint8_t>(received + i);
+    }
+    received += n;
+  }
+  producer.join();
+
+  EXPECT_TRUE(in_order);
+  EXPECT_EQ(ring_count(&ring), 0u);
+}
@@ -4,12 +4,18 @@
 #include <cstring>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
 
 #include "utils.hpp"
 #include "storage.hpp"
+#include "scrub.hpp"
+#include "md_index.hpp"
 
 class UploadFileTest : public ::testing::Test {
 protected:
@@ -98,3 +104,407 @@ TEST_F(UploadFileTest, DownloadValidFile) {
 
   std::remove(basename);
 }
+
+/** @brief download sink that collects the file in memory */
+static int vector_sink(const uint8_t *data, size_t size, void *arg) {
+  std::vector<uint8_t> *out = static_cast<std::vector<uint8_t> *>(arg);
+  out->insert(out->end(), data, data + size);
+  return 0;
+}
+
+TEST_F(UploadFileTest, WavIsStoredEncoded) {
+  ASSERT_EQ(upload_file(config_ctx, test_filename), 0) << "File upload failed";
+
+  storage_metadata_t entry;
+  ASSERT_EQ(storage_find_file(config_ctx, test_filename, &entry), 0);
+  EXPECT_EQ(entry.codec, STORAGE_CODEC_AUDIO);
+  EXPECT_LT(entry.stored_size, entry.size);
+
+  // the extent only lists the chunks, the samples are coded in them
+  ASSERT_GT(entry.chunks, 0u);
+  std::vector<storage_chunk_t> chunk_table = chunk_table_read(ssd_fd);
+  size_t chunk_bytes                       = 0;
+  for (const storage_chunk_t &chunk : chunk_table) {
+    if (chunk.offset != 0) {
+      EXPECT_EQ(chunk.codec, STORAGE_CODEC_AUDIO);
+      chunk_bytes += chunk.stored_size;
+    }
+  }
+  EXPECT_LT(chunk_bytes, entry.size);
+
+  std::ifstream original(test_filename, std::ios::binary);
+  std::vector<uint8_t> expected((std::istreambuf_iterator<char>(original)),
+                                std::istreambuf_iterator<char>());
+  std::vector<uint8_t> downloaded;
+  ASSERT_EQ(
+    download_file_stream(config_ctx, test_filename, vector_sink, &downloaded),
+    0);
+  EXPECT_EQ(downloaded, expected);
+}
+
+TEST_F(UploadFileTest, TextIsStoredWithLZ) {
+  char text_path[] = "/tmp/dist_fs_listing_XXXXXX";
+  int text_fd      = mkstemp(text_path);
+  ASSERT_NE(text_fd, -1);
+  std::string json = "[";
+  for (int i = 0; i < 2000; i++) {
+    json += "{\"name\":\"track_" + std::to_string(i) + ".wav\",\"size\":" +
+            std::to_string(48000 + i * 17) + "},";
+  }
+  json += "]";
+  ASSERT_EQ(write(text_fd, json.data(), json.size()),
+            static_cast<ssize_t>(json.size()));
+  close(text_fd);
+
+  ASSERT_EQ(upload_file_as(config_ctx, text_path, "listing.json"), 0);
+
+  storage_metadata_t entry;
+  ASSERT_EQ(storage_find_file(config_ctx, "listing.json", &entry), 0);
+  EXPECT_EQ(entry.codec, STORAGE_CODEC_LZ);
+  EXPECT_EQ(entry.size, json.size());
+  EXPECT_LT(entry.stored_size, json.size() / 3);
+
+  std::vector<uint8_t> downloaded;
+  ASSERT_EQ(
+    download_file_stream(config_ctx, "listing.json", vector_sink, &downloaded),
+    0);
+  EXPECT_EQ(std::string(downloaded.begin(), downloaded.end()), json);
+
+  std::remove(text_path);
+}
+
+/** @brief chunks in use on the SSD and the references to them */
+static size_t chunks_in_use(int ssd_fd, size_t *refs) {
+  std::vector<storage_chunk_t> chunk_table = chunk_table_read(ssd_fd);
+  size_t in_use                            = 0;
+  *refs                                    = 0;
+  for (const storage_chunk_t &chunk : chunk_table) {
+    if (chunk.offset != 0) {
+      in_use++;
+      *refs += chunk.refs;
+    }
+  }
+  return in_use;
+}
+
+/** @brief writes a buffer to a local file */
+static void write_local(const char *path, const std::vector<uint8_t> &data) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+TEST_F(UploadFileTest, FullChunkTableEncodesWholeFileInWindows) {
+  char path[] = "/tmp/dist_fs_stem_XXXXXX";
+  int fd      = mkstemp(path);
+  ASSERT_NE(fd, -1);
+  close(fd);
+  ASSERT_EQ(upload_file_as(config_ctx, test_filename, "first.wav"), 0);
+
+  // taking every free slot leaves no room for new chunks
+  std::vector<storage_chunk_t> chunk_table = chunk_table_read(ssd_fd);
+  for (size_t i = 0; i < chunk_table.size(); i++) {
+    if (chunk_table[i].offset == 0) {
+      memcpy(chunk_table[i].hash, &i, sizeof(i));
+      chunk_table[i].offset = 1;
+    }
+  }
+  ASSERT_EQ(
+    pwrite(ssd_fd, chunk_table.data(), CHUNK_TABLE_SZ, CHUNK_TABLE_OFFSET),
+    static_cast<ssize_t>(CHUNK_TABLE_SZ));
+
+  // more than one window of text, each window's blocks behind one header
+  std::string text;
+  for (int i = 0; text.size() < 20 * 1024 * 1024; i++) {
+    text += "stem_" + std::to_string(i) + ".wav\t" +
+            std::to_string(48000 + i * 17) + "\n";
+  }
+  std::vector<uint8_t> data(text.begin(), text.end());
+  write_local(path, data);
+  ASSERT_EQ(upload_file_as(config_ctx, path, "listing.txt"), 0);
+
+  storage_metadata_t entry;
+  ASSERT_EQ(storage_find_file(config_ctx, "listing.txt", &entry), 0);
+  EXPECT_EQ(entry.chunks, 0u);
+  EXPECT_EQ(entry.codec, STORAGE_CODEC_LZ);
+  EXPECT_LT(entry.stored_size, data.size() / 3);
+
+  std::vector<uint8_t> downloaded;
+  ASSERT_EQ(
+    download_file_stream(config_ctx, "listing.txt", vector_sink, &downloaded),
+    0);
+  EXPECT_EQ(downloaded, data);
+
+  // noise gets nothing out of encoding and is written as it is
+  std::mt19937 rng(7);
+  std::vector<uint8_t> noise(1024 * 1024);
+  for (auto &byte : noise) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  write_local(path, noise);
+  ASSERT_EQ(upload_file_as(config_ctx, path, "noise.txt"), 0);
+  ASSERT_EQ(storage_find_file(config_ctx, "noise.txt", &entry), 0);
+  EXPECT_EQ(entry.codec, STORAGE_CODEC_STORE);
+  EXPECT_EQ(entry.stored_size, noise.size());
+
+  downloaded.clear();
+  ASSERT_EQ(
+    download_file_stream(config_ctx, "noise.txt", vector_sink, &downloaded),
+    0);
+  EXPECT_EQ(downloaded, noise);
+
+  std::remove(path);
+}
+
+TEST_F(UploadFileTest, ReuploadOnlyStoresChangedChunks) {
+  char path[] = "/tmp/dist_fs_stem_XXXXXX";
+  int fd      = mkstemp(path);
+  ASSERT_NE(fd, -1);
+  close(fd);
+
+  // noise doesn't compress, so the SSD grows by what's actually written
+  std::mt19937 rng(3);
+  std::vector<uint8_t> take1(2 * 1024 * 1024);
+  for (auto &byte : take1) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  write_local(path, take1);
+  ASSERT_EQ(upload_file_as(config_ctx, path, "take1.bin"), 0);
+
+  size_t refs;
+  size_t chunks1 = chunks_in_use(ssd_fd, &refs);
+  off_t end1     = lseek(ssd_fd, 0, SEEK_END);
+  EXPECT_GT(chunks1, 8u);
+  EXPECT_EQ(refs, chunks1);
+
+  // the same stem with a small edit in the middle
+  std::vector<uint8_t> take2 = take1;
+  take2.insert(take2.begin() + take2.size() / 2, 16, 0x7F);
+  write_local(path, take2);
+  ASSERT_EQ(upload_file_as(config_ctx, path, "take2.bin"), 0);
+
+  size_t chunks2 = chunks_in_use(ssd_fd, &refs);
+  off_t end2     = lseek(ssd_fd, 0, SEEK_END);
+  EXPECT_LE(chunks2 - chunks1, 2u);
+  EXPECT_LT(static_cast<size_t>(end2 - end1), take2.size() / 4);
+
+  storage_metadata_t entry;
+  ASSERT_EQ(storage_find_file(config_ctx, "take2.bin", &entry), 0);
+  EXPECT_EQ(entry.size, take2.size());
+  EXPECT_EQ(refs, chunks1 + entry.chunks);
+
+  std::vector<uint8_t> downloaded;
+  ASSERT_EQ(
+    download_file_stream(config_ctx, "take1.bin", vector_sink, &downloaded),
+    0);
+  EXPECT_EQ(downloaded, take1);
+
+  // the shared chunks stay with the second take
+  ASSERT_EQ(delete_file(config_ctx, "take1.bin"), 0);
+  EXPECT_EQ(chunks_in_use(ssd_fd, &refs), entry.chunks);
+  EXPECT_EQ(refs, entry.chunks);
+
+  downloaded.clear();
+  ASSERT_EQ(
+    download_file_stream(config_ctx, "take2.bin", vector_sink, &downloaded),
+    0);
+  EXPECT_EQ(downloaded, take2);
+
+  ASSERT_EQ(delete_file(config_ctx, "take2.bin"), 0);
+  EXPECT_EQ(chunks_in_use(ssd_fd, &refs), 0u);
+
+  std::remove(path);
+}
+
+TEST_F(UploadFileTest, IdenticalUploadSharesChunks) {
+  ASSERT_EQ(upload_file_as(config_ctx, test_filename, "take1.wav"), 0);
+  size_t refs;
+  size_t chunks = chunks_in_use(ssd_fd, &refs);
+  off_t end1    = lseek(ssd_fd, 0, SEEK_END);
+
+  ASSERT_EQ(upload_file_as(config_ctx, test_filename, "take2.wav"), 0);
+  EXPECT_EQ(chunks_in_use(ssd_fd, &refs), chunks);
+  EXPECT_EQ(refs, chunks * 2);
+
+  // only the FS header and chunk list were written
+  storage_metadata_t take1, take2;
+  ASSERT_EQ(storage_find_file(config_ctx, "take1.wav", &take1), 0);
+  ASSERT_EQ(storage_find_file(config_ctx, "take2.wav", &take2), 0);
+  EXPECT_EQ(lseek(ssd_fd, 0, SEEK_END) - end1,
+            static_cast<off_t>(PACKET_METADATA_SIZE + take2.stored_size));
+  EXPECT_EQ(take2.codec, take1.codec);
+
+  std::ifstream original(test_filename, std::ios::binary);
+  std::vector<uint8_t> expected((std::istreambuf_iterator<char>(original)),
+                                std::istreambuf_iterator<char>());
+  uint8_t hash[BLAKE3_OUT_LEN];
+  blake3_hash(expected.data(), expected.size(), hash);
+  EXPECT_EQ(memcmp(take2.hash, hash, BLAKE3_OUT_LEN), 0);
+  EXPECT_EQ(memcmp(take1.hash, hash, BLAKE3_OUT_LEN), 0);
+
+  std::vector<uint8_t> downloaded;
+  ASSERT_EQ(
+    download_file_stream(config_ctx, "take2.wav", vector_sink, &downloaded),
+    0);
+  EXPECT_EQ(downloaded, expected);
+}
+
+TEST_F(UploadFileTest, DownloadChecksHash) {
+  char path[] = "/tmp/dist_fs_stem_XXXXXX";
+  int fd      = mkstemp(path);
+  ASSERT_NE(fd, -1);
+  close(fd);
+
+  // stored as is, so a flipped byte decodes fine and only the hash can
+  // catch it
+  std::mt19937 rng(5);
+  std::vector<uint8_t> data(256 * 1024);
+  for (auto &byte : data) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  write_local(path, data);
+  ASSERT_EQ(upload_file_as(config_ctx, path, "noise.bin"), 0);
+
+  std::vector<uint8_t> downloaded;
+  ASSERT_EQ(
+    download_file_stream(config_ctx, "noise.bin", vector_sink, &downloaded),
+    0);
+  EXPECT_EQ(downloaded, data);
+
+  std::vector<storage_chunk_t> chunk_table = chunk_table_read(ssd_fd);
+  ASSERT_NE(chunk_table[0].offset, 0);
+  ASSERT_EQ(chunk_table[0].codec, STORAGE_CODEC_STORE);
+  uint8_t byte;
+  ASSERT_EQ(pread(ssd_fd, &byte, 1, chunk_table[0].offset + 100), 1);
+  byte ^= 0x20;
+  ASSERT_EQ(pwrite(ssd_fd, &byte, 1, chunk_table[0].offset + 100), 1);
+
+  downloaded.clear();
+  EXPECT_NE(
+    download_file_stream(config_ctx, "noise.bin", vector_sink, &downloaded),
+    0);
+
+  std::remove(path);
+}
+
+TEST_F(UploadFileTest, ScrubFindsFlippedByte) {
+  char path[] = "/tmp/dist_fs_stem_XXXXXX";
+  int fd      = mkstemp(path);
+  ASSERT_NE(fd, -1);
+  close(fd);
+
+  std::mt19937 rng(9);
+  std::vector<uint8_t> data(256 * 1024);
+  for (auto &byte : data) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  write_local(path, data);
+  ASSERT_EQ(upload_file_as(config_ctx, path, "noise.bin"), 0);
+
+  // the whole device share, so the pass never sleeps
+  scrub_context_t scrub;
+  scrub_init(&scrub, config_ctx, 100, SCRUB_DEFAULT_INTERVAL);
+  EXPECT_EQ(scrub_pass(&scrub), 0);
+  EXPECT_GT(scrub.stats.chunks_checked, 0u);
+  EXPECT_EQ(scrub.stats.passes, 1u);
+
+  std::vector<storage_chunk_t> chunk_table = chunk_table_read(ssd_fd);
+  ASSERT_EQ(chunk_table[0].codec, STORAGE_CODEC_STORE);
+  uint8_t byte;
+  ASSERT_EQ(pread(ssd_fd, &byte, 1, chunk_table[0].offset + 100), 1);
+  byte ^= 0x20;
+  ASSERT_EQ(pwrite(ssd_fd, &byte, 1, chunk_table[0].offset + 100), 1);
+
+  EXPECT_EQ(scrub_pass(&scrub), 1);
+  EXPECT_EQ(scrub.stats.corrupt, 1u);
+  EXPECT_EQ(scrub.stats.passes, 2u);
+
+  std::remove(path);
+}
+
+TEST_F(UploadFileTest, IndexFollowsUploadsAndDeletes) {
+  md_index_t index;
+  ASSERT_EQ(md_index_init(&index), 0);
+  storage_set_index(&index);
+  ASSERT_EQ(storage_refresh_index(ssd_fd), 1);
+
+  ASSERT_EQ(upload_file_as(config_ctx, test_filename, "b.wav"), 0);
+  ASSERT_EQ(
+    upload_file_as(config_ctx, "../test_files/json/ex1.json", "a.json"), 0);
+  // this process's own changes keep the index current
+  EXPECT_EQ(storage_refresh_index(ssd_fd), 0);
+
+  std::vector<storage_metadata_t> page;
+  md_index_query_t query = {MD_INDEX_TYPE, false, -1, NULL, 0, 0};
+  ASSERT_EQ(md_index_list(&index, &query, page), 2u);
+  EXPECT_STREQ(page[0].filename, "b.wav");
+  EXPECT_EQ(page[0].type, DIST_FS_TYPE_WAV);
+  EXPECT_STREQ(page[1].filename, "a.json");
+
+  ASSERT_EQ(delete_file(config_ctx, "b.wav"), 0);
+  storage_set_index(nullptr);
+  query.key = MD_INDEX_NAME;
+  ASSERT_EQ(md_index_list(&index, &query, page), 1u);
+  EXPECT_STREQ(page[0].filename, "a.json");
+  md_index_destroy(&index);
+}
+
+TEST_F(UploadFileTest, IndexPicksUpOtherProcessesChanges) {
+  md_index_t index;
+  ASSERT_EQ(md_index_init(&index), 0);
+  storage_set_index(&index);
+  ASSERT_EQ(storage_refresh_index(ssd_fd), 1);
+  uint64_t generation = md_index_generation(&index);
+
+  // another process, like the CLI next to the server, uploads a file
+  pid_t pid = fork();
+  ASSERT_NE(pid, -1);
+  if (pid == 0) {
+    storage_set_index(nullptr);
+    _exit(upload_file_as(config_ctx, test_filename, "cli.wav") == 0 ? 0 : 1);
+  }
+  int status = 0;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  EXPECT_EQ(md_index_count(&index), 0u);
+  EXPECT_EQ(storage_refresh_index(ssd_fd), 1);
+  EXPECT_EQ(md_index_count(&index), 1u);
+  EXPECT_GT(md_index_generation(&index), generation);
+  EXPECT_EQ(storage_refresh_index(ssd_fd), 0);
+
+  // a sync client holding the listing from before gets the upload as a delta
+  std::vector<std::string> added;
+  uint64_t now = 0;
+  EXPECT_EQ(md_index_changes(
+              &index,
+              index.epoch,
+              generation,
+              [](md_index_change_e change,
+                 const storage_metadata_t &entry,
+                 void *arg) {
+                if (change == MD_INDEX_ADDED) {
+                  static_cast<std::vector<std::string> *>(arg)->push_back(
+                    entry.filename);
+                }
+              },
+              &added,
+              &now),
+            0);
+  EXPECT_EQ(added, (std::vector<std::string>{"cli.wav"}));
+  EXPECT_EQ(now, md_index_generation(&index));
+
+  storage_set_index(nullptr);
+  md_index_destroy(&index);
+}
+
+TEST(StorageCodecTest, CodecForType) {
+  EXPECT_EQ(storage_codec_for_type(DIST_FS_TYPE_WAV), STORAGE_CODEC_AUDIO);
+  EXPECT_EQ(storage_codec_for_type(DIST_FS_TYPE_AIFF), STORAGE_CODEC_AUDIO);
+  EXPECT_EQ(storage_codec_for_type(DIST_FS_TYPE_FLAC), STORAGE_CODEC_STORE);
+  EXPECT_EQ(storage_codec_for_type(DIST_FS_TYPE_MP3), STORAGE_CODEC_STORE);
+  EXPECT_EQ(storage_codec_for_type(DIST_FS_TYPE_M4A), STORAGE_CODEC_STORE);
+  EXPECT_EQ(storage_codec_for_type(DIST_FS_TYPE_DATA), STORAGE_CODEC_LZ);
+  EXPECT_EQ(storage_codec_for_type(DIST_FS_TYPE_JPEG), STORAGE_CODEC_STORE);
+  EXPECT_EQ(storage_codec_for_type(DIST_FS_TYPE_ZSTD), STORAGE_CODEC_STORE);
+  EXPECT_EQ(storage_codec_for_type(DIST_FS_TYPE_JSON), STORAGE_CODEC_LZ);
+}